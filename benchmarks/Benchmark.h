@@ -0,0 +1,192 @@
+// -*- lsst-c++ -*-
+#ifndef MULTISHAPELET_BENCHMARKS_Benchmark_h_INCLUDED
+#define MULTISHAPELET_BENCHMARKS_Benchmark_h_INCLUDED
+
+//
+// Shared harness for the programs in this directory.
+//
+// Each benchmark is a functor that is called repeatedly; the reported time is the best (minimum)
+// per-call time over several repeats of a calibrated number of calls, which is much less sensitive
+// to other activity on the machine than the mean.  All random numbers come from fixed seeds, so
+// every run sees exactly the same inputs.
+//
+
+#include <cmath>
+#include <cstdio>
+#include <limits>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include "boost/format.hpp"
+#include "boost/make_shared.hpp"
+#include "boost/random/mersenne_twister.hpp"
+#include "boost/random/normal_distribution.hpp"
+#include "boost/random/variate_generator.hpp"
+
+#include "lsst/base.h"
+#include "lsst/afw/geom/ellipses.h"
+#include "lsst/afw/image/MaskedImage.h"
+#include "lsst/meas/extensions/multiShapelet.h"
+
+namespace lsst { namespace meas { namespace extensions { namespace multiShapelet { namespace benchmarks {
+
+namespace el = afw::geom::ellipses;
+
+/// Side lengths (in pixels) of the square footprints every benchmark is run on.
+int const FOOTPRINT_SIZES[] = { 8, 16, 32, 64, 128 };
+int const N_FOOTPRINT_SIZES = sizeof(FOOTPRINT_SIZES) / sizeof(int);
+
+/// Number of Gaussian components in the synthetic profiles registered by registerProfiles().
+int const PROFILE_SIZES[] = { 2, 4, 6, 8 };
+int const N_PROFILE_SIZES = sizeof(PROFILE_SIZES) / sizeof(int);
+
+/**
+ *  @brief Return the best per-call wall-clock time (in seconds) of a functor.
+ *
+ *  The functor is called once to warm up and calibrate, then nRepeats times in a loop of enough
+ *  calls to take at least minTime seconds.
+ */
+template <typename F>
+double timePerCall(F & f, double minTime=0.1, int nRepeats=5) {
+    StageTimer timer;
+    f();
+    double single = std::max(timer.lap(), 1E-7);
+    int nCalls = std::max(1, int(minTime / single));
+    double best = std::numeric_limits<double>::infinity();
+    for (int r = 0; r < nRepeats; ++r) {
+        timer.lap();
+        for (int i = 0; i < nCalls; ++i) {
+            f();
+        }
+        best = std::min(best, timer.lap() / nCalls);
+    }
+    return best;
+}
+
+inline void printHeader(std::string const & title) {
+    std::printf("\n%s\n", title.c_str());
+    std::printf("%-44s %6s %8s %14s %14s\n", "case", "size", "pixels", "pixels/s", "sources/s");
+}
+
+/// @brief Print one result line; each call of the timed functor is one source of nPixels pixels.
+inline void report(std::string const & name, int size, int nPixels, double seconds) {
+    std::printf("%-44s %6d %8d %14.4g %14.4g\n", name.c_str(), size, nPixels,
+                nPixels / seconds, 1.0 / seconds);
+    std::fflush(stdout);
+}
+
+/// @brief Return the registry name of the synthetic profile with n components.
+inline std::string getProfileName(int n) {
+    return (boost::format("benchmark-%d") % n).str();
+}
+
+/**
+ *  @brief Register synthetic multi-Gaussian profiles with PROFILE_SIZES components.
+ *
+ *  The radii are log-spaced over the range used by the tractor exponential and de Vaucouleur
+ *  approximations, with fluxes falling toward the outer components; the profiles are normalized.
+ *  The built-in tractor profiles themselves are benchmarked by benchTractor.py.
+ */
+inline void registerProfiles() {
+    for (int i = 0; i < N_PROFILE_SIZES; ++i) {
+        int n = PROFILE_SIZES[i];
+        ndarray::Array<double,1,1> fluxes = ndarray::allocate(n);
+        ndarray::Array<double,1,1> radii = ndarray::allocate(n);
+        for (int k = 0; k < n; ++k) {
+            double t = (n > 1) ? double(k) / (n - 1) : 0.5;
+            radii[k] = 0.05 * std::pow(60.0, t);
+            fluxes[k] = std::exp(-1.5 * t);
+        }
+        MultiGaussianRegistry::insert(getProfileName(n), fluxes, radii, true);
+    }
+}
+
+/// @brief Return the double-Gaussian used as the true PSF of the synthetic stamps.
+inline FitPsfModel makePsfModel() {
+    ndarray::Array<double,1,1> parameters = ndarray::allocate(3);
+    parameters[0] = 0.05;
+    parameters[1] = -0.02;
+    parameters[2] = 0.5; // log radius: ~1.6 pixel inner sigma
+    return FitPsfModel(FitPsfControl(), 1.0, parameters);
+}
+
+/// @brief Return the (deliberately not pixel-centered) position of the source in a stamp.
+inline afw::geom::Point2D getStampCenter(int size) {
+    return afw::geom::Point2D(0.5 * size - 0.3, 0.5 * size + 0.2);
+}
+
+/**
+ *  @brief Return a square stamp of the given size containing a PSF-convolved multi-Gaussian source.
+ *
+ *  The source is placed at getStampCenter(size), and each component's flux is multiplied by the
+ *  given flux.  If noiseSigma is nonzero, Gaussian noise drawn from a generator seeded with seed
+ *  is added and the variance plane is set to match.  An empty psfMultiGaussian leaves the source
+ *  unconvolved.
+ */
+inline PTR(afw::image::MaskedImage<float>) makeStamp(
+    int size,
+    MultiGaussian const & multiGaussian,
+    el::Quadrupole const & ellipse,
+    MultiGaussian const & psfMultiGaussian,
+    el::Quadrupole const & psfEllipse,
+    double flux,
+    double noiseSigma,
+    unsigned int seed
+) {
+    PTR(afw::image::MaskedImage<float>) stamp = boost::make_shared< afw::image::MaskedImage<float> >(
+        afw::geom::Extent2I(size, size)
+    );
+    afw::geom::Point2D center = getStampCenter(size);
+    std::vector<double> amplitudes;
+    std::vector<EllipseSquaredNorm> norms;
+    MultiGaussian psf(psfMultiGaussian);
+    if (psf.size() == 0u) {
+        psf.add(GaussianComponent(1.0, 0.0));
+    }
+    for (MultiGaussian::const_iterator i = multiGaussian.begin(); i != multiGaussian.end(); ++i) {
+        for (MultiGaussian::const_iterator j = psf.begin(); j != psf.end(); ++j) {
+            el::Quadrupole q(
+                ellipse.getIxx() * i->radius * i->radius + psfEllipse.getIxx() * j->radius * j->radius,
+                ellipse.getIyy() * i->radius * i->radius + psfEllipse.getIyy() * j->radius * j->radius,
+                ellipse.getIxy() * i->radius * i->radius + psfEllipse.getIxy() * j->radius * j->radius
+            );
+            norms.push_back(EllipseSquaredNorm());
+            norms.back().update(q, false);
+            amplitudes.push_back(
+                flux * i->flux * j->flux / (2.0 * M_PI * std::sqrt(q.getDeterminant()))
+            );
+        }
+    }
+    boost::mt19937 engine(seed);
+    boost::variate_generator< boost::mt19937 &, boost::normal_distribution<double> > noise(
+        engine, boost::normal_distribution<double>(0.0, 1.0)
+    );
+    for (int y = 0; y < size; ++y) {
+        for (int x = 0; x < size; ++x) {
+            double value = 0.0;
+            double rx, ry, z;
+            for (std::size_t n = 0; n < norms.size(); ++n) {
+                norms[n](x - center.getX(), y - center.getY(), rx, ry, z);
+                value += amplitudes[n] * std::exp(-0.5 * z);
+            }
+            if (noiseSigma > 0.0) {
+                value += noiseSigma * noise();
+            }
+            (*stamp->getImage())(x, y) = value;
+            (*stamp->getVariance())(x, y) = (noiseSigma > 0.0) ? noiseSigma * noiseSigma : 1.0;
+            (*stamp->getMask())(x, y) = 0;
+        }
+    }
+    return stamp;
+}
+
+/// @brief Return the true ellipse of the synthetic sources for a given footprint size.
+inline el::Quadrupole makeSourceEllipse(int size) {
+    double r = 0.1 * size;
+    return el::Quadrupole(el::Axes(r, 0.7 * r, 0.4));
+}
+
+}}}}} // namespace lsst::meas::extensions::multiShapelet::benchmarks
+
+#endif // !MULTISHAPELET_BENCHMARKS_Benchmark_h_INCLUDED
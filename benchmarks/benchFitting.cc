@@ -0,0 +1,164 @@
+//
+// Benchmarks for complete fits: HybridOptimizer::run on PSF-convolved multi-Gaussian objectives,
+// and end-to-end FitPsfAlgorithm and FitProfileAlgorithm fits (including input flattening and the
+// final linear shapelet fit) on synthetic stamps.
+//
+// Each source is one fit to a square stamp of FOOTPRINT_SIZES pixels on a side; the profile fits
+// use noisy stamps with a signal-to-noise ratio that does not depend on the stamp size, and start
+// from a deliberately wrong ellipse so the optimizer does a realistic amount of work.  The profile
+// fits are also run in coarse-to-fine mode (FitProfileControl::pyramidLevels), which skips levels
+// with fewer than pyramidMinPixels pixels and so only differs on the larger stamps.
+//
+#include "Benchmark.h"
+
+namespace ms = lsst::meas::extensions::multiShapelet;
+namespace bm = lsst::meas::extensions::multiShapelet::benchmarks;
+namespace el = lsst::afw::geom::ellipses;
+namespace afwDet = lsst::afw::detection;
+namespace afwImage = lsst::afw::image;
+
+namespace {
+
+PTR(afwImage::MaskedImage<float>) makeSourceStamp(int size, std::string const & profile) {
+    ms::FitPsfModel psfModel = bm::makePsfModel();
+    return bm::makeStamp(
+        size, ms::MultiGaussianRegistry::lookup(profile), bm::makeSourceEllipse(size),
+        psfModel.getMultiGaussian(), psfModel.ellipse, 50.0 * size, 1.0, 5
+    );
+}
+
+el::Quadrupole makeInitialShape(int size) {
+    double r = 0.13 * size;
+    return el::Quadrupole(el::Axes(r, 0.9 * r, -0.2));
+}
+
+class OptimizerCase {
+public:
+
+    void operator()() {
+        ms::HybridOptimizer opt = ms::FitProfileAlgorithm::makeOptimizer(ctrl, psfModel, ellipse, inputs);
+        opt.run();
+        evaluations += opt.getEvaluationCount();
+        ++calls;
+    }
+
+    OptimizerCase(ms::FitProfileControl const & ctrl_, ms::ModelInputHandler const & inputs_, int size) :
+        ctrl(ctrl_), psfModel(bm::makePsfModel()), ellipse(makeInitialShape(size)), inputs(inputs_),
+        evaluations(0), calls(0)
+    {}
+
+    ms::FitProfileControl ctrl;
+    ms::FitPsfModel psfModel;
+    ms::MultiGaussianObjective::EllipseCore ellipse;
+    ms::ModelInputHandler inputs;
+    long evaluations;
+    long calls;
+};
+
+class PsfCase {
+public:
+
+    void operator()() { ms::FitPsfAlgorithm::apply(ctrl, inputs); }
+
+    explicit PsfCase(ms::ModelInputHandler const & inputs_) : ctrl(), inputs(inputs_) {}
+
+    ms::FitPsfControl ctrl;
+    ms::ModelInputHandler inputs;
+};
+
+class ProfileCase {
+public:
+
+    void operator()() {
+        el::Quadrupole shape(makeInitialShape(size));
+        ms::ModelInputHandler inputs = ms::FitProfileAlgorithm::adjustInputs(
+            ctrl, psfModel, shape, footprint, *stamp, bm::getStampCenter(size)
+        );
+        nPixels = inputs.getSize();
+        ms::FitProfileAlgorithm::apply(ctrl, psfModel, ms::MultiGaussianObjective::EllipseCore(shape), inputs);
+    }
+
+    ProfileCase(ms::FitProfileControl const & ctrl_, int size_) :
+        size(size_), nPixels(0), ctrl(ctrl_), psfModel(bm::makePsfModel()),
+        stamp(makeSourceStamp(size_, ctrl_.profile)),
+        footprint(stamp->getBBox(afwImage::PARENT))
+    {}
+
+    int size;
+    int nPixels;
+    ms::FitProfileControl ctrl;
+    ms::FitPsfModel psfModel;
+    PTR(afwImage::MaskedImage<float>) stamp;
+    afwDet::Footprint footprint;
+};
+
+void runOptimizer() {
+    bm::printHeader("HybridOptimizer::run, PSF-convolved synthetic profiles");
+    for (int p = 0; p < bm::N_PROFILE_SIZES; ++p) {
+        ms::FitProfileControl ctrl;
+        ctrl.profile = bm::getProfileName(bm::PROFILE_SIZES[p]);
+        for (int i = 0; i < bm::N_FOOTPRINT_SIZES; ++i) {
+            int size = bm::FOOTPRINT_SIZES[i];
+            PTR(afwImage::MaskedImage<float>) stamp = makeSourceStamp(size, ctrl.profile);
+            ms::ModelInputHandler inputs(
+                *stamp, bm::getStampCenter(size), stamp->getBBox(afwImage::PARENT)
+            );
+            OptimizerCase c(ctrl, inputs, size);
+            double t = bm::timePerCall(c);
+            std::string name = (boost::format("%d components (%.1f evaluations)")
+                                % (2 * bm::PROFILE_SIZES[p])
+                                % (double(c.evaluations) / c.calls)).str();
+            bm::report(name, size, inputs.getSize(), t);
+        }
+    }
+}
+
+void runPsf() {
+    bm::printHeader("FitPsfAlgorithm::apply, noiseless double-Gaussian PSF images");
+    ms::FitPsfModel psfModel = bm::makePsfModel();
+    for (int i = 0; i < bm::N_FOOTPRINT_SIZES; ++i) {
+        int size = bm::FOOTPRINT_SIZES[i];
+        PTR(afwImage::MaskedImage<float>) stamp = bm::makeStamp(
+            size, psfModel.getMultiGaussian(), psfModel.ellipse, ms::MultiGaussian(), el::Quadrupole(),
+            1.0, 0.0, 0
+        );
+        ms::ModelInputHandler inputs(
+            *stamp->getImage(), bm::getStampCenter(size), stamp->getBBox(afwImage::PARENT)
+        );
+        PsfCase c(inputs);
+        bm::report("double-Gaussian + shapelets", size, inputs.getSize(), bm::timePerCall(c));
+    }
+}
+
+void runProfile() {
+    bm::printHeader("FitProfileAlgorithm::adjustInputs + apply, noisy synthetic stamps");
+    for (int p = 0; p < bm::N_PROFILE_SIZES; ++p) {
+        ms::FitProfileControl ctrl;
+        ctrl.profile = bm::getProfileName(bm::PROFILE_SIZES[p]);
+        // Fit exactly the stamp, so the pixel count is the same as in the other benchmarks.
+        ctrl.growFootprint = 0;
+        ctrl.radiusInputFactor = 0.0;
+        for (int levels = 0; levels <= 2; levels += 2) {
+            ctrl.pyramidLevels = levels;
+            std::string name = levels
+                ? (boost::format("%d components, %d coarse levels") % (2 * bm::PROFILE_SIZES[p]) % levels).str()
+                : (boost::format("%d components") % (2 * bm::PROFILE_SIZES[p])).str();
+            for (int i = 0; i < bm::N_FOOTPRINT_SIZES; ++i) {
+                int size = bm::FOOTPRINT_SIZES[i];
+                ProfileCase c(ctrl, size);
+                double t = bm::timePerCall(c);
+                bm::report(name, size, c.nPixels, t);
+            }
+        }
+    }
+}
+
+} // anonymous
+
+int main() {
+    bm::registerProfiles();
+    runOptimizer();
+    runPsf();
+    runProfile();
+    return 0;
+}
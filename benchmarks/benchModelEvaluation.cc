@@ -0,0 +1,181 @@
+//
+// Microbenchmarks for the innermost model-evaluation code: the vectorized EllipseSquaredNorm
+// operations, GaussianModelBuilder model and derivative evaluation (with and without the
+// approximate exponential, and with coordinate arrays vs. spans), and MultiGaussianObjective
+// function and derivative evaluation for PSF-convolved profiles of typical sizes.
+//
+// Each source is one evaluation over a square footprint of FOOTPRINT_SIZES pixels on a side.
+//
+#include "Eigen/Core"
+
+#include "Benchmark.h"
+
+namespace ms = lsst::meas::extensions::multiShapelet;
+namespace bm = lsst::meas::extensions::multiShapelet::benchmarks;
+
+namespace {
+
+ms::ModelInputHandler makeInputs(int size) {
+    ms::FitPsfModel psfModel = bm::makePsfModel();
+    PTR(lsst::afw::image::MaskedImage<float>) stamp = bm::makeStamp(
+        size, ms::MultiGaussianRegistry::lookup(bm::getProfileName(4)), bm::makeSourceEllipse(size),
+        psfModel.getMultiGaussian(), psfModel.ellipse, 100.0, 1.0, 5
+    );
+    return ms::ModelInputHandler(
+        *stamp->getImage(), bm::getStampCenter(size), stamp->getBBox(lsst::afw::image::PARENT)
+    );
+}
+
+ms::MultiGaussianObjective::EllipseCore makeEllipse(int size) {
+    return ms::MultiGaussianObjective::EllipseCore(bm::makeSourceEllipse(size));
+}
+
+class EllipseSquaredNormCase {
+public:
+
+    void operator()() {
+        esn(x, y, rx, ry, z);
+        if (withDerivative) {
+            dz.setZero();
+            esn.dEllipse(x, y, rx, ry, jacobian, dz);
+        }
+    }
+
+    EllipseSquaredNormCase(ms::ModelInputHandler const & inputs, int size, bool withDerivative_) :
+        withDerivative(withDerivative_),
+        x(inputs.getX().asEigen()), y(inputs.getY().asEigen()),
+        rx(inputs.getSize()), ry(inputs.getSize()), z(inputs.getSize()),
+        dz(inputs.getSize(), 3)
+    {
+        jacobian = esn.update(makeEllipse(size));
+    }
+
+    bool withDerivative;
+    ms::EllipseSquaredNorm esn;
+    Eigen::Matrix3d jacobian;
+    Eigen::VectorXd x;
+    Eigen::VectorXd y;
+    Eigen::VectorXd rx;
+    Eigen::VectorXd ry;
+    Eigen::VectorXd z;
+    Eigen::MatrixXd dz;
+};
+
+class BuilderCase {
+public:
+
+    void operator()() {
+        builder.update(ellipse);
+        if (withDerivative) {
+            builder.computeDerivative(derivative);
+        }
+    }
+
+    BuilderCase(ms::GaussianModelBuilder const & builder_, int size, bool withDerivative_) :
+        withDerivative(withDerivative_), builder(builder_), ellipse(makeEllipse(size)),
+        derivative(ndarray::allocate(builder_.getSize(), 3))
+    {}
+
+    bool withDerivative;
+    ms::GaussianModelBuilder builder;
+    ms::MultiGaussianObjective::EllipseCore ellipse;
+    ndarray::Array<double,2,-1> derivative;
+};
+
+class ObjectiveCase {
+public:
+
+    void operator()() {
+        if (fused) {
+            objective->computeFunctionAndDerivative(parameters, function, derivative);
+        } else {
+            objective->computeFunction(parameters, function);
+            objective->computeDerivative(parameters, function, derivative);
+        }
+    }
+
+    ObjectiveCase(PTR(ms::MultiGaussianObjective) const & objective_, int size, bool fused_) :
+        fused(fused_), objective(objective_),
+        parameters(ndarray::allocate(3)),
+        function(ndarray::allocate(objective_->getInputs().getSize())),
+        derivative(ndarray::allocate(objective_->getInputs().getSize(), 3))
+    {
+        ms::MultiGaussianObjective::writeParameters(makeEllipse(size), parameters);
+    }
+
+    bool fused;
+    PTR(ms::MultiGaussianObjective) objective;
+    ndarray::Array<double,1,1> parameters;
+    ndarray::Array<double,1,1> function;
+    ndarray::Array<double,2,-2> derivative;
+};
+
+void runEllipseSquaredNorm() {
+    bm::printHeader("EllipseSquaredNorm, vectorized");
+    for (int d = 0; d < 2; ++d) {
+        for (int i = 0; i < bm::N_FOOTPRINT_SIZES; ++i) {
+            int size = bm::FOOTPRINT_SIZES[i];
+            ms::ModelInputHandler inputs = makeInputs(size);
+            EllipseSquaredNormCase c(inputs, size, d);
+            bm::report(d ? "norm + dEllipse" : "norm", size, inputs.getSize(), bm::timePerCall(c));
+        }
+    }
+}
+
+void runBuilder() {
+    bm::printHeader("GaussianModelBuilder, single PSF-convolved component");
+    ms::FitPsfModel psfModel = bm::makePsfModel();
+    for (int d = 0; d < 2; ++d) {
+        for (int spans = 0; spans < 2; ++spans) {
+            for (int approx = 0; approx < 2; ++approx) {
+                std::string name = (boost::format("%s, %s, %s exp")
+                                    % (d ? "update + derivative" : "update")
+                                    % (spans ? "spans" : "x/y arrays")
+                                    % (approx ? "approx" : "exact")).str();
+                for (int i = 0; i < bm::N_FOOTPRINT_SIZES; ++i) {
+                    int size = bm::FOOTPRINT_SIZES[i];
+                    ms::ModelInputHandler inputs = makeInputs(size);
+                    ms::GaussianModelBuilder builder = spans
+                        ? ms::GaussianModelBuilder(
+                            inputs.getSpans(), 1.0, 1.0, psfModel.ellipse, 1.0, approx
+                        )
+                        : ms::GaussianModelBuilder(
+                            inputs.getX(), inputs.getY(), 1.0, 1.0, psfModel.ellipse, 1.0, approx
+                        );
+                    BuilderCase c(builder, size, d);
+                    bm::report(name, size, inputs.getSize(), bm::timePerCall(c));
+                }
+            }
+        }
+    }
+}
+
+void runObjective() {
+    bm::printHeader("MultiGaussianObjective f+J, convolved with a double-Gaussian PSF");
+    ms::FitPsfModel psfModel = bm::makePsfModel();
+    for (int p = 0; p < bm::N_PROFILE_SIZES; ++p) {
+        ms::FitProfileControl ctrl;
+        ctrl.profile = bm::getProfileName(bm::PROFILE_SIZES[p]);
+        for (int fused = 0; fused < 2; ++fused) {
+            std::string name = (boost::format("%d components, %s")
+                                % (2 * bm::PROFILE_SIZES[p])
+                                % (fused ? "fused" : "separate")).str();
+            for (int i = 0; i < bm::N_FOOTPRINT_SIZES; ++i) {
+                int size = bm::FOOTPRINT_SIZES[i];
+                ms::ModelInputHandler inputs = makeInputs(size);
+                ObjectiveCase c(ms::FitProfileAlgorithm::makeObjective(ctrl, psfModel, inputs), size, fused);
+                bm::report(name, size, inputs.getSize(), bm::timePerCall(c));
+            }
+        }
+    }
+}
+
+} // anonymous
+
+int main() {
+    bm::registerProfiles();
+    runEllipseSquaredNorm();
+    runBuilder();
+    runObjective();
+    return 0;
+}
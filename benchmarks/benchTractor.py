@@ -0,0 +1,147 @@
+#!/usr/bin/env python
+
+# 
+# LSST Data Management System
+# Copyright 2008, 2009, 2010 LSST Corporation.
+# 
+# This product includes software developed by the
+# LSST Project (http://www.lsst.org/).
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+# 
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+# 
+# You should have received a copy of the LSST License Statement and 
+# the GNU General Public License along with this program.  If not, 
+# see <http://www.lsstcorp.org/LegalNotices/>.
+#
+
+
+"""
+Benchmarks for fits with the built-in tractor exponential and de Vaucouleur profiles (the C++
+benchmarks in this directory use synthetic profiles with a range of component counts instead).
+
+These are the same cases as the "HybridOptimizer::run" and "FitProfileAlgorithm" sections of
+benchFitting, and report results in the same format.
+
+Run with:
+   python benchTractor.py
+"""
+
+import time
+import numpy
+
+import lsst.afw.geom as geom
+import lsst.afw.geom.ellipses
+import lsst.afw.image
+import lsst.afw.detection
+import lsst.meas.extensions.multiShapelet as ms
+
+FOOTPRINT_SIZES = (8, 16, 32, 64, 128)
+PROFILES = ("tractor-exponential", "tractor-devaucouleur")
+
+def timePerCall(func, minTime=0.1, nRepeats=5):
+    """Return the best per-call time of func over nRepeats calibrated loops (see Benchmark.h)."""
+    t0 = time.time()
+    func()
+    nCalls = max(1, int(minTime / max(time.time() - t0, 1E-7)))
+    best = float("inf")
+    for r in range(nRepeats):
+        t0 = time.time()
+        for i in range(nCalls):
+            func()
+        best = min(best, (time.time() - t0) / nCalls)
+    return best
+
+def printHeader(title):
+    print
+    print title
+    print "%-44s %6s %8s %14s %14s" % ("case", "size", "pixels", "pixels/s", "sources/s")
+
+def report(name, size, nPixels, seconds):
+    print "%-44s %6d %8d %14.4g %14.4g" % (name, size, nPixels, nPixels / seconds, 1.0 / seconds)
+
+def makePsfModel():
+    return ms.FitPsfModel(ms.FitPsfControl(), 1.0, numpy.array([0.05, -0.02, 0.5]))
+
+def getStampCenter(size):
+    return geom.Point2D(0.5 * size - 0.3, 0.5 * size + 0.2)
+
+def makeStamp(size, profile, seed=5):
+    """Make a noisy PSF-convolved source stamp, as in makeStamp() in Benchmark.h."""
+    psfModel = makePsfModel()
+    r = 0.1 * size
+    ellipse = geom.ellipses.Quadrupole(geom.ellipses.Axes(r, 0.7 * r, 0.4))
+    center = getStampCenter(size)
+    x, y = numpy.meshgrid(numpy.arange(size) - center.getX(), numpy.arange(size) - center.getY())
+    image = numpy.zeros((size, size), dtype=float)
+    for c in ms.MultiGaussianRegistry.lookup(profile):
+        for p in psfModel.getMultiGaussian():
+            ixx = ellipse.getIxx() * c.radius**2 + psfModel.ellipse.getIxx() * p.radius**2
+            iyy = ellipse.getIyy() * c.radius**2 + psfModel.ellipse.getIyy() * p.radius**2
+            ixy = ellipse.getIxy() * c.radius**2 + psfModel.ellipse.getIxy() * p.radius**2
+            det = ixx * iyy - ixy**2
+            z = (iyy * x**2 - 2.0 * ixy * x * y + ixx * y**2) / det
+            image += 50.0 * size * c.flux * p.flux * numpy.exp(-0.5 * z) / (2.0 * numpy.pi * det**0.5)
+    numpy.random.seed(seed)
+    mi = lsst.afw.image.MaskedImageF(geom.Extent2I(size, size))
+    mi.getImage().getArray()[:,:] = image + numpy.random.randn(size, size)
+    mi.getVariance().getArray()[:,:] = 1.0
+    return mi
+
+def makeInitialShape(size):
+    r = 0.13 * size
+    return geom.ellipses.Quadrupole(geom.ellipses.Axes(r, 0.9 * r, -0.2))
+
+def runOptimizer():
+    printHeader("HybridOptimizer::run, PSF-convolved tractor profiles")
+    psfModel = makePsfModel()
+    for profile in PROFILES:
+        ctrl = ms.FitProfileConfig().makeControl()
+        ctrl.profile = profile
+        for size in FOOTPRINT_SIZES:
+            mi = makeStamp(size, profile)
+            footprint = lsst.afw.detection.Footprint(mi.getBBox(lsst.afw.image.PARENT))
+            inputs = ms.ModelInputHandler(mi, getStampCenter(size), footprint, 0, 0, False)
+            ellipse = ms.MultiGaussianObjective.EllipseCore(makeInitialShape(size))
+            evaluations = []
+            def func():
+                opt = ms.FitProfileAlgorithm.makeOptimizer(ctrl, psfModel, ellipse, inputs)
+                opt.run()
+                evaluations.append(opt.getEvaluationCount())
+            t = timePerCall(func)
+            name = "%s (%.1f evaluations)" % (profile, float(sum(evaluations)) / len(evaluations))
+            report(name, size, inputs.getSize(), t)
+
+def runProfile():
+    printHeader("FitProfileAlgorithm::adjustInputs + apply, tractor profiles")
+    psfModel = makePsfModel()
+    for profile in PROFILES:
+        config = ms.FitProfileConfig()
+        config.profile = profile
+        config.growFootprint = 0
+        config.radiusInputFactor = 0.0
+        ctrl = config.makeControl()
+        for size in FOOTPRINT_SIZES:
+            mi = makeStamp(size, profile)
+            footprint = lsst.afw.detection.Footprint(mi.getBBox(lsst.afw.image.PARENT))
+            center = getStampCenter(size)
+            nPixels = []
+            def func():
+                shape = makeInitialShape(size)
+                inputs = ms.FitProfileAlgorithm.adjustInputs(ctrl, psfModel, shape, footprint, mi, center)
+                nPixels.append(inputs.getSize())
+                ms.FitProfileAlgorithm.apply(ctrl, psfModel, ms.MultiGaussianObjective.EllipseCore(shape),
+                                             inputs)
+            t = timePerCall(func)
+            report(profile, size, nPixels[-1], t)
+
+if __name__ == "__main__":
+    runOptimizer()
+    runProfile()
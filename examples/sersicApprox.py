@@ -118,13 +118,23 @@ def plotFull(exact, sdss, tractor, yMaxLog, yMaxLinear):
     pyplot.ylim(0, yMaxLinear)
 
 def saveTractorProfiles(filename):
+    """Write the tractor profiles in the format read by MultiGaussianRegistry.loadFile.
+
+    These are also compiled into the registry (with fluxes normalized to one), so this is only
+    needed as a template for saving other profiles without the C++ library.
+    """
     d = {
         "tractor-devaucouleur": (tractorDeVaucouleur.flux,  tractorDeVaucouleur.sigma),
         "tractor-exponential": (tractorExponential.flux, tractorExponential.sigma),
         }
-    import cPickle
-    with open(filename, 'w') as f:
-        cPickle.dump(d, f, protocol=2)
+    import struct
+    with open(filename, 'wb') as f:
+        f.write(struct.pack("<8sII", "MGPROFIL", 1, len(d)))
+        for name, (flux, sigma) in sorted(d.iteritems()):
+            f.write(struct.pack("<I", len(name)) + name)
+            f.write(struct.pack("<I", len(flux)))
+            for component in zip(flux, sigma):
+                f.write(struct.pack("<dd", *component))
 
 def main():
     plotFull(exactExponential, sdssExponential, tractorExponential, yMaxLog=1E2, yMaxLinear=6)
@@ -23,8 +23,10 @@
 #ifndef MULTISHAPELET_multiShapelet_h_INCLUDED
 #define MULTISHAPELET_multiShapelet_h_INCLUDED
 
+#include "lsst/meas/extensions/multiShapelet/ConvolvedProfileTemplate.h"
 #include "lsst/meas/extensions/multiShapelet/GaussianModelBuilder.h"
 #include "lsst/meas/extensions/multiShapelet/HybridOptimizer.h"
+#include "lsst/meas/extensions/multiShapelet/Instrumentation.h"
 #include "lsst/meas/extensions/multiShapelet/ModelInputHandler.h"
 #include "lsst/meas/extensions/multiShapelet/MultiGaussian.h"
 #include "lsst/meas/extensions/multiShapelet/MultiGaussianRegistry.h"
@@ -33,5 +35,7 @@
 #include "lsst/meas/extensions/multiShapelet/FitPsf.h"
 #include "lsst/meas/extensions/multiShapelet/FitProfile.h"
 #include "lsst/meas/extensions/multiShapelet/FitCombo.h"
+#include "lsst/meas/extensions/multiShapelet/FitExpDev.h"
+#include "lsst/meas/extensions/multiShapelet/ArrayBatch.h"
 
 #endif // !MULTISHAPELET_multiShapelet_h_INCLUDED
@@ -0,0 +1,126 @@
+// -*- lsst-c++ -*-
+/* 
+ * LSST Data Management System
+ * Copyright 2012 LSST Corporation.
+ * 
+ * This product includes software developed by the
+ * LSST Project (http://www.lsst.org/).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the LSST License Statement and 
+ * the GNU General Public License along with this program.  If not, 
+ * see <http://www.lsstcorp.org/LegalNotices/>.
+ */
+#ifndef MULTISHAPELET_ArrayBatch_h_INCLUDED
+#define MULTISHAPELET_ArrayBatch_h_INCLUDED
+
+#include "ndarray.h"
+
+#include "lsst/meas/extensions/multiShapelet/FitPsf.h"
+#include "lsst/meas/extensions/multiShapelet/FitProfile.h"
+
+namespace lsst { namespace meas { namespace extensions { namespace multiShapelet {
+
+/**
+ *  @brief Namespace/hidden class for batch fits whose inputs and outputs are plain arrays.
+ *
+ *  These wrap FitPsfAlgorithm::applyBatch and FitProfileAlgorithm::applyBatch for callers that keep
+ *  their per-source quantities in NumPy arrays: each source is a row of the input arrays, and the
+ *  results for each source are written to a row of a caller-provided output array, with columns
+ *  given by the enums below.  In Python, the arrays are passed without copying and the GIL is
+ *  released while fitting.  The sources are distributed over nThreads threads only when the library
+ *  was built with OpenMP; otherwise they are fit serially.  The makePsfBatchArray and
+ *  makeProfileBatchArray functions create structured arrays with named fields for the outputs,
+ *  which fitPsfArrays and fitProfileArrays accept in place of plain 2-d arrays.
+ *
+ *  Sources whose fits fail have their flag column set to 1 and all other columns set to NaN.
+ */
+class ArrayBatch {
+public:
+
+    /// @brief Columns of the PSF fit output array; the inner and outer coefficients follow.
+    enum PsfColumn {
+        PSF_FLAG = 0,     ///< 1 if the fit failed, 0 otherwise
+        PSF_IXX,          ///< inner ellipse moments
+        PSF_IYY,
+        PSF_IXY,
+        PSF_CHISQ,        ///< reduced chi^2
+        PSF_COEFFICIENTS  ///< first of the inner coefficients, which are followed by the outer ones
+    };
+
+    /// @brief Columns of the profile fit output array.
+    enum ProfileColumn {
+        PROFILE_FLAG = 0,    ///< 1 if FitProfileModel::fluxFlag was set, 0 otherwise
+        PROFILE_FLUX,
+        PROFILE_FLUX_ERR,
+        PROFILE_IXX,         ///< half-light ellipse moments
+        PROFILE_IYY,
+        PROFILE_IXY,
+        PROFILE_CHISQ,       ///< reduced chi^2
+        PROFILE_COLUMN_COUNT
+    };
+
+    /// @brief Return the number of columns in a PSF fit output array for the given control.
+    static int getPsfColumnCount(FitPsfControl const & ctrl);
+
+    /**
+     *  @brief Fit the PSF at many points.
+     *
+     *  @param[in]  ctrl      Details of the model to fit.
+     *  @param[in]  psf       PSF to evaluate and fit.
+     *  @param[in]  centers   (N x 2) array of (x, y) positions.
+     *  @param[out] output    (N x getPsfColumnCount(ctrl)) array of results.
+     *  @param[in]  nThreads  Number of threads to use (ignored without OpenMP).
+     */
+    static void fitPsf(
+        FitPsfControl const & ctrl,
+        afw::detection::Psf const & psf,
+        ndarray::Array<double const,2,2> const & centers,
+        ndarray::Array<double,2,2> const & output,
+        int nThreads=1
+    );
+
+    /**
+     *  @brief Fit a profile to many sources on the same image.
+     *
+     *  Each source's footprint is the box given by a row of stamps; its PSF model is read from the
+     *  corresponding row of a fitPsf() output array computed with psfCtrl, and its initial ellipse
+     *  is the moments ellipse in a row of shapes (adjusted as in FitProfileAlgorithm::adjustInputs).
+     *
+     *  @param[in]  ctrl      Details of the model to fit.
+     *  @param[in]  psfCtrl   Control object the PSF models were fit with.
+     *  @param[in]  image     Image containing all the sources.
+     *  @param[in]  centers   (N x 2) array of (x, y) positions, in PARENT coordinates.
+     *  @param[in]  shapes    (N x 3) array of (Ixx, Iyy, Ixy) moments.
+     *  @param[in]  stamps    (N x 4) array of (x0, y0, width, height) boxes, in PARENT coordinates.
+     *  @param[in]  psfModels (N x getPsfColumnCount(psfCtrl)) array from fitPsf().
+     *  @param[out] output    (N x PROFILE_COLUMN_COUNT) array of results.
+     *  @param[in]  nThreads  Number of threads to use (ignored without OpenMP).
+     */
+    template <typename PixelT>
+    static void fitProfile(
+        FitProfileControl const & ctrl,
+        FitPsfControl const & psfCtrl,
+        afw::image::MaskedImage<PixelT> const & image,
+        ndarray::Array<double const,2,2> const & centers,
+        ndarray::Array<double const,2,2> const & shapes,
+        ndarray::Array<int const,2,2> const & stamps,
+        ndarray::Array<double const,2,2> const & psfModels,
+        ndarray::Array<double,2,2> const & output,
+        int nThreads=1
+    );
+
+};
+
+}}}} // namespace lsst::meas::extensions::multiShapelet
+
+#endif // !MULTISHAPELET_ArrayBatch_h_INCLUDED
@@ -0,0 +1,91 @@
+// -*- lsst-c++ -*-
+/* 
+ * LSST Data Management System
+ * Copyright 2012 LSST Corporation.
+ * 
+ * This product includes software developed by the
+ * LSST Project (http://www.lsst.org/).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the LSST License Statement and 
+ * the GNU General Public License along with this program.  If not, 
+ * see <http://www.lsstcorp.org/LegalNotices/>.
+ */
+#ifndef MULTISHAPELET_ConvolvedProfileTemplate_h_INCLUDED
+#define MULTISHAPELET_ConvolvedProfileTemplate_h_INCLUDED
+
+#include <vector>
+
+#include "lsst/shapelet/HermiteConvolution.h"
+#include "lsst/shapelet/ModelBuilder.h"
+#include "lsst/meas/extensions/multiShapelet/MultiGaussian.h"
+#include "lsst/meas/extensions/multiShapelet/FitPsf.h"
+
+namespace lsst { namespace meas { namespace extensions { namespace multiShapelet {
+
+/**
+ *  @brief A multi-Gaussian profile convolved with a shapelet PSF model, for evaluating unit-flux
+ *         model images of the profile with many different ellipses.
+ *
+ *  This produces the same model as normalizing
+ *  @code
+ *  profileModel.asMultiShapelet().convolve(psfModel.asMultiShapelet())
+ *  @endcode
+ *  but the profile components, the PSF shapelet expansion, its normalization, and the
+ *  ellipse-independent part of the convolution for each PSF element are computed once at
+ *  construction, so each evaluation costs only a small convolution matrix and one ModelBuilder
+ *  pass per (component, PSF element) pair.
+ *
+ *  A template is immutable after construction, and may be shared between threads as long as each
+ *  uses its own ModelBuilder.
+ */
+class ConvolvedProfileTemplate {
+public:
+
+    /**
+     *  @brief Add the convolved, unit-flux model with the given ellipse to an array.
+     *
+     *  @param[in]     ellipse    Half-light ellipse of the unconvolved profile, centered on the
+     *                            builder's coordinate origin.
+     *  @param[in,out] builder    ModelBuilder initialized with the coordinates to evaluate on.
+     *  @param[in,out] output     Array to add the model to, with the same size as the builder.
+     *  @param[in]     weight     Factor to multiply the model by before adding it.
+     */
+    void addModelVector(
+        afw::geom::ellipses::BaseCore const & ellipse,
+        shapelet::ModelBuilder<double> & builder,
+        ndarray::Array<double,1,1> const & output,
+        double weight=1.0
+    ) const;
+
+    /// @brief Return the number of shapelet elements in the convolved model.
+    int getElementCount() const { return _components.size() * _convolutions.size(); }
+
+    ConvolvedProfileTemplate(MultiGaussian const & profile, FitPsfModel const & psfModel);
+
+private:
+
+    struct Component {
+        double radius;
+        double amplitude; // zeroth-order shapelet coefficient that normalizes the convolved model
+    };
+
+    typedef std::vector<Component> ComponentList;
+    typedef std::vector< PTR(shapelet::HermiteConvolution) > ConvolutionList;
+
+    ComponentList _components;
+    ConvolutionList _convolutions;
+};
+
+}}}} // namespace lsst::meas::extensions::multiShapelet
+
+#endif // !MULTISHAPELET_ConvolvedProfileTemplate_h_INCLUDED
@@ -23,6 +23,8 @@
 #ifndef MULTISHAPELET_EllipseSquaredNorm_h_INCLUDED
 #define MULTISHAPELET_EllipseSquaredNorm_h_INCLUDED
 
+#include <cmath>
+
 #include "lsst/afw/geom/ellipses.h"
 
 namespace lsst { namespace meas { namespace extensions { namespace multiShapelet {
@@ -66,6 +68,15 @@ public:
         ry = x * _r12 + y * _r22;
         z = rx * rx + ry * ry;
     }
+    void operator()(
+        float const x, float const y,
+        float & rx, float & ry,
+        float & z
+    ) const {
+        rx = x * float(_r11);
+        ry = x * float(_r12) + y * float(_r22);
+        z = rx * rx + ry * ry;
+    }
     template <typename D1, typename D2, typename D3>
     void operator()(
         Eigen::MatrixBase<D1> const & x, Eigen::MatrixBase<D1> const & y,
@@ -78,6 +89,73 @@ public:
     }
     //@}
 
+    /// @brief Return the coefficient of x^2 in the squared norm (half its second difference along a row).
+    double getXXCoefficient() const { return _r11 * _r11 + _r12 * _r12; }
+
+    /**
+     *  @brief Compute the range [xMin, xMax] of x for which the squared norm at (x, y) is at most z.
+     *
+     *  Returns false (leaving xMin and xMax unchanged) if the row does not intersect the ellipse.
+     */
+    bool getRowInterval(double const y, double const z, double & xMin, double & xMax) const {
+        double const a = getXXCoefficient();
+        double const b = _r12 * _r22 * y;
+        double const disc = b * b - a * (_r22 * _r22 * y * y - z);
+        if (!(disc >= 0.0)) return false;
+        double const s = std::sqrt(disc);
+        xMin = (-b - s) / a;
+        xMax = (-b + s) / a;
+        return true;
+    }
+
+    /**
+     *  @brief Compute the squared ellipse norm along a row of n pixels starting at (x0, y).
+     *
+     *  Equivalent to calling the scalar operator() on (x0 + k, y) for k in [0, n), and filling
+     *  x with x0 + k, but the intermediates rx and ry are advanced by a constant step per pixel
+     *  rather than recomputed from the coordinates.
+     */
+    void evaluateSpan(
+        double const x0, double const y, int const n,
+        double * x, double * rx, double * ry, double * z
+    ) const {
+        double a = x0 * _r11;
+        double b = x0 * _r12 + y * _r22;
+        for (int k = 0; k < n; ++k) {
+            x[k] = x0 + k;
+            rx[k] = a;
+            ry[k] = b;
+            z[k] = a * a + b * b;
+            a += _r11;
+            b += _r12;
+        }
+    }
+
+    /**
+     *  @brief Single-precision version of evaluateSpan().
+     *
+     *  Here rx and ry are recomputed from the pixel index at every pixel: advancing them by a
+     *  constant float step would accumulate round-off along the row.  The loop has no dependency
+     *  between pixels, so it vectorizes.
+     */
+    void evaluateSpan(
+        double const x0, double const y, int const n,
+        float * x, float * rx, float * ry, float * z
+    ) const {
+        float const r11 = _r11;
+        float const r12 = _r12;
+        float const fx0 = x0;
+        float const a0 = x0 * _r11;
+        float const b0 = x0 * _r12 + y * _r22;
+        for (int k = 0; k < n; ++k) {
+            float const dx = k;
+            x[k] = fx0 + dx;
+            rx[k] = a0 + dx * r11;
+            ry[k] = b0 + dx * r12;
+            z[k] = rx[k] * rx[k] + ry[k] * ry[k];
+        }
+    }
+
     //@{
     /**
      *  @brief Compute the derivative of the squared ellipse norm wrt the input coordinates.
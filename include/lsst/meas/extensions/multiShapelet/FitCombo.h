@@ -43,6 +43,8 @@ public:
     LSST_CONTROL_FIELD(radiusInputFactor, double,
                        "Number of half-light radii used to determine the pixels to fit");
     LSST_CONTROL_FIELD(useApproximateExp, bool, "Use fast approximate exponential (good to ~1E-4)");
+    LSST_CONTROL_FIELD(instrument, bool,
+                       "If true, add fields for per-stage timings, and save per-process totals to the metadata");
 
     PTR(FitComboControl) clone() const {
         return boost::static_pointer_cast<FitComboControl>(_clone());
@@ -59,7 +61,7 @@ public:
         algorithms::AlgorithmControl("multishapelet.combo", 2.6),
         expName("multishapelet.exp"), devName("multishapelet.dev"), psfName("multishapelet.psf"),
         usePixelWeights(false), badMaskPlanes(), growFootprint(5), radiusInputFactor(4.0),
-        useApproximateExp(false)
+        useApproximateExp(false), instrument(false)
     {
         badMaskPlanes.push_back("EDGE");
         badMaskPlanes.push_back("SAT");
@@ -83,7 +85,10 @@ struct FitComboModel {
     double devFrac; ///< fraction of total flux in the de Vaucouleur component
     double flux; ///< total flux of model, integrated to infinity (includes PSF factor, if enabled)
     double fluxErr; ///< uncertainty on flux
+    bool fluxFlag; ///< set to true if the flux should not be trusted
+    FitStatistics stats; ///< work done by the fit (there is no nonlinear fit, so only timings are set)
 
+    /// @brief Construct a placeholder model with NaN flux and fluxFlag set.
     explicit FitComboModel(FitComboControl const & ctrl);
 
     /// @brief Deep copy constructor.
@@ -104,7 +109,8 @@ public:
     FitComboAlgorithm(
         FitComboControl const & ctrl,
         afw::table::Schema & schema,
-        algorithms::AlgorithmMap const & others
+        algorithms::AlgorithmMap const & others,
+        PTR(daf::base::PropertyList) const & metadata = PTR(daf::base::PropertyList)()
     );
 
     /// @brief Return the control object
@@ -112,6 +118,14 @@ public:
         return static_cast<FitComboControl const &>(algorithms::Algorithm::getControl());
     }
 
+    /**
+     *  @brief Write the summary of the sources measured so far to the metadata passed at construction.
+     *
+     *  This is done automatically when the algorithm is destroyed; nothing is written unless the
+     *  control's 'instrument' field is set.
+     */
+    void flushStatistics() const;
+
     template <typename PixelT>
     static ModelInputHandler adjustInputs(
         FitComboControl const & ctrl,
@@ -123,14 +137,65 @@ public:
         afw::geom::Point2D const & center
     );
 
+    /**
+     *  @brief Fit the fluxes of a non-negative linear combination of the exponential and de Vaucouleur
+     *         components, holding their ellipses fixed.
+     *
+     *  The two-parameter constrained problem is solved exactly; the flux uncertainty is computed
+     *  from the covariance matrix of the component fluxes (or, when one component's flux is zero,
+     *  from the one-component fit).
+     */
+    static FitComboModel apply(
+        FitComboControl const & ctrl,
+        FitPsfModel const & psfModel,
+        FitProfileModel const & expComponent,
+        FitProfileModel const & devComponent,
+        ModelInputHandler const & inputs
+    );
+
+    /**
+     *  @brief Fit the combination using already-evaluated component models.
+     *
+     *  The rows of componentModels are the exponential and de Vaucouleur models, convolved with
+     *  the PSF, normalized to unit flux, and weighted as the inputs are; these are the model
+     *  vectors FitProfileAlgorithm::apply can return when the components were fit to the same
+     *  inputs, so they need not be rebuilt.
+     */
     static FitComboModel apply(
+        FitComboControl const & ctrl,
+        FitProfileModel const & expComponent,
+        FitProfileModel const & devComponent,
+        ModelInputHandler const & inputs,
+        ndarray::Array<double const,2,2> const & componentModels
+    );
+
+    /**
+     *  @brief Fit only the total flux of the combination, holding the de Vaucouleur fraction fixed.
+     *
+     *  This is the linear fit used in forced mode, with devFrac taken from the reference source.
+     */
+    static FitComboModel applyForced(
         FitComboControl const & ctrl,
         FitPsfModel const & psfModel,
         FitProfileModel const & expComponent,
         FitProfileModel const & devComponent,
+        double devFrac,
         ModelInputHandler const & inputs
     );
 
+    /// @brief Forced-mode fit using already-evaluated component models (see the apply() overload).
+    static FitComboModel applyForced(
+        FitComboControl const & ctrl,
+        FitProfileModel const & expComponent,
+        FitProfileModel const & devComponent,
+        double devFrac,
+        ModelInputHandler const & inputs,
+        ndarray::Array<double const,2,2> const & componentModels
+    );
+
+    /// @brief Save a model to the fields registered by this algorithm.
+    void fillRecord(afw::table::SourceRecord & source, FitComboModel const & model) const;
+
 private:
 
     template <typename PixelT>
@@ -156,6 +221,8 @@ private:
     CONST_PTR(FitProfileControl) _expComponentCtrl;
     CONST_PTR(FitProfileControl) _devComponentCtrl;
     CONST_PTR(FitPsfControl) _psfCtrl;
+    PTR(FitStatisticsKeys) _statsKeys;
+    PTR(FitStatisticsSummary) _statsSummary;
 };
 
 inline PTR(FitComboAlgorithm) FitComboControl::makeAlgorithm(
@@ -0,0 +1,229 @@
+// -*- lsst-c++ -*-
+/* 
+ * LSST Data Management System
+ * Copyright 2012 LSST Corporation.
+ * 
+ * This product includes software developed by the
+ * LSST Project (http://www.lsst.org/).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the LSST License Statement and 
+ * the GNU General Public License along with this program.  If not, 
+ * see <http://www.lsstcorp.org/LegalNotices/>.
+ */
+#ifndef MULTISHAPELET_FitExpDev_h_INCLUDED
+#define MULTISHAPELET_FitExpDev_h_INCLUDED
+
+#include "lsst/meas/extensions/multiShapelet/FitCombo.h"
+
+namespace lsst { namespace meas { namespace extensions { namespace multiShapelet {
+
+class FitExpDevAlgorithm;
+
+/**
+ *  @brief Control object for FitExpDevAlgorithm.
+ *
+ *  The pixel-selection fields of the nested exp and dev controls (usePixelWeights, badMaskPlanes,
+ *  maxBadPixelFraction, growFootprint, radiusInputFactor) are ignored; the fields of the same name
+ *  here define the single set of pixels shared by all three fits.
+ */
+class FitExpDevControl : public algorithms::AlgorithmControl {
+public:
+
+    LSST_CONTROL_FIELD(psfName, std::string, "Root name of the FitPsfAlgorithm fields.");
+    LSST_CONTROL_FIELD(expName, std::string, "Root name of the exponential component fields.");
+    LSST_CONTROL_FIELD(devName, std::string, "Root name of the de Vaucouleur component fields.");
+    LSST_CONTROL_FIELD(comboName, std::string, "Root name of the linear combination fields.");
+    LSST_NESTED_CONTROL_FIELD(exp, lsst.meas.extensions.multiShapelet.multiShapeletLib,
+                              FitProfileControl, "Configuration for the exponential component fit");
+    LSST_NESTED_CONTROL_FIELD(dev, lsst.meas.extensions.multiShapelet.multiShapeletLib,
+                              FitProfileControl, "Configuration for the de Vaucouleur component fit");
+    LSST_CONTROL_FIELD(usePixelWeights, bool,
+                       "If true, individually weigh pixels using the variance image.");
+    LSST_CONTROL_FIELD(badMaskPlanes, std::vector<std::string>,
+                       "Mask planes that indicate pixels that should be ignored in the fit.");
+    LSST_CONTROL_FIELD(maxBadPixelFraction, double,
+                       "Maximum fraction of pixels that may be ignored due to masks; "
+                       "more than this and we don't even try.");
+    LSST_CONTROL_FIELD(growFootprint, int, "Number of pixels to grow the footprint by.");
+    LSST_CONTROL_FIELD(radiusInputFactor, double,
+                       "Number of half-light radii (of both initial ellipses) used to determine "
+                       "the pixels to fit");
+    LSST_CONTROL_FIELD(instrument, bool,
+                       "If true, add fields for optimizer counts and per-stage timings, and save"
+                       " per-process totals to the metadata (the shared inputs time is charged to exp)");
+
+    PTR(FitExpDevControl) clone() const {
+        return boost::static_pointer_cast<FitExpDevControl>(_clone());
+    }
+
+    PTR(FitExpDevAlgorithm) makeAlgorithm(
+        afw::table::Schema & schema,
+        PTR(daf::base::PropertyList) const & metadata = PTR(daf::base::PropertyList)(),
+        algorithms::AlgorithmMap const & others = algorithms::AlgorithmMap(),
+        bool isForced = false
+    ) const;
+
+    FitExpDevControl() :
+        algorithms::AlgorithmControl("multishapelet.expdev", 2.5),
+        psfName("multishapelet.psf"), expName("multishapelet.exp"), devName("multishapelet.dev"),
+        comboName("multishapelet.combo"), exp(), dev(),
+        usePixelWeights(false), badMaskPlanes(), maxBadPixelFraction(0.1),
+        growFootprint(5), radiusInputFactor(4.0), instrument(false)
+    {
+        exp.profile = "tractor-exponential";
+        dev.profile = "tractor-devaucouleur";
+        badMaskPlanes.push_back("EDGE");
+        badMaskPlanes.push_back("SAT");
+    }
+
+private:
+    virtual PTR(algorithms::AlgorithmControl) _clone() const;
+    virtual PTR(algorithms::Algorithm) _makeAlgorithm(
+        afw::table::Schema & schema,
+        PTR(daf::base::PropertyList) const & metadata,
+        algorithms::AlgorithmMap const & other,
+        bool isForced
+    ) const;
+};
+
+/**
+ *  @brief The results of a joint exponential, de Vaucouleur and linear combination fit.
+ */
+struct FitExpDevModel {
+
+    FitProfileModel exp; ///< exponential component fit
+    FitProfileModel dev; ///< de Vaucouleur component fit
+    FitComboModel combo; ///< linear combination of the two components
+
+    /// @brief Construct placeholder models, with all flux flags set.
+    explicit FitExpDevModel(FitExpDevControl const & ctrl);
+
+};
+
+/**
+ *  @brief Fit exponential and de Vaucouleur models and their linear combination in one pass.
+ *
+ *  This produces exactly the same fields as running FitProfileAlgorithm twice (with expName and
+ *  devName) followed by FitComboAlgorithm (with comboName), and should be used instead of those
+ *  three, not in addition to them.  The difference is that the image is flattened into a single
+ *  ModelInputHandler covering the union of the regions the separate algorithms would use, and all
+ *  three fits are done on those same pixels, rather than growing, merging and flattening the
+ *  footprint once per algorithm.
+ */
+class FitExpDevAlgorithm : public algorithms::Algorithm {
+public:
+
+    typedef FitExpDevControl Control;
+    typedef FitExpDevModel Model;
+
+    /// @brief Construct an algorithm instance and register its fields with a Schema.
+    FitExpDevAlgorithm(
+        FitExpDevControl const & ctrl,
+        afw::table::Schema & schema,
+        algorithms::AlgorithmMap const & others,
+        bool isForced,
+        PTR(daf::base::PropertyList) const & metadata = PTR(daf::base::PropertyList)()
+    );
+
+    /// @brief Return the control object
+    FitExpDevControl const & getControl() const {
+        return static_cast<FitExpDevControl const &>(algorithms::Algorithm::getControl());
+    }
+
+    /**
+     *  @brief Write the summary of the sources measured so far to the metadata passed at construction.
+     *
+     *  This is done automatically when the algorithm is destroyed; nothing is written unless the
+     *  control's 'instrument' field is set.
+     */
+    void flushStatistics() const;
+
+    /**
+     *  @brief Compute both initial ellipses (unless fixShape) and flatten the pixels shared by both fits.
+     *
+     *  expShape and devShape should be set to the moments ellipse (or, with fixShape, to the ellipses
+     *  to use as-is); on return they hold the initial ellipses for the exp and dev fits.
+     */
+    template <typename PixelT>
+    static ModelInputHandler adjustInputs(
+        FitExpDevControl const & ctrl,
+        FitPsfModel const & psfModel,
+        afw::geom::ellipses::Quadrupole & expShape,
+        afw::geom::ellipses::Quadrupole & devShape,
+        afw::detection::Footprint const & footprint,
+        afw::image::MaskedImage<PixelT> const & image,
+        afw::geom::Point2D const & center,
+        bool fixShape=false
+    );
+
+    /**
+     *  @brief Fit both profiles and their linear combination to the same inputs.
+     *
+     *  A component fit that throws is returned as a placeholder with fluxFlag set, as is the
+     *  combination if either component failed or the combination fit throws.
+     */
+    static FitExpDevModel apply(
+        FitExpDevControl const & ctrl,
+        FitPsfModel const & psfModel,
+        MultiGaussianObjective::EllipseCore const & expEllipse,
+        MultiGaussianObjective::EllipseCore const & devEllipse,
+        ModelInputHandler const & inputs
+    );
+
+private:
+
+    template <typename PixelT>
+    void _apply(
+        afw::table::SourceRecord & source,
+        afw::image::Exposure<PixelT> const & exposure,
+        afw::geom::Point2D const & center
+    ) const;
+
+    template <typename PixelT>
+    void _applyForced(
+        afw::table::SourceRecord & source,
+        afw::image::Exposure<PixelT> const & exposure,
+        afw::geom::Point2D const & center,
+        afw::table::SourceRecord const & reference,
+        afw::geom::AffineTransform const & refToMeas
+    ) const;
+
+    void _fillRecord(afw::table::SourceRecord & source, FitExpDevModel const & model) const;
+
+    void _addStatistics(FitExpDevModel const & model) const;
+
+    LSST_MEAS_ALGORITHM_PRIVATE_INTERFACE(FitExpDevAlgorithm);
+
+    CONST_PTR(FitProfileAlgorithm) _expAlgorithm;
+    CONST_PTR(FitProfileAlgorithm) _devAlgorithm;
+    CONST_PTR(FitComboAlgorithm) _comboAlgorithm;
+    CONST_PTR(FitPsfControl) _psfCtrl;
+    PTR(FitStatisticsSummary) _expStatsSummary;
+    PTR(FitStatisticsSummary) _devStatsSummary;
+    PTR(FitStatisticsSummary) _comboStatsSummary;
+};
+
+inline PTR(FitExpDevAlgorithm) FitExpDevControl::makeAlgorithm(
+    afw::table::Schema & schema,
+    PTR(daf::base::PropertyList) const & metadata,
+    algorithms::AlgorithmMap const & others,
+    bool isForced
+) const {
+    return boost::static_pointer_cast<FitExpDevAlgorithm>(
+        _makeAlgorithm(schema, metadata, others, isForced)
+    );
+}
+
+}}}} // namespace lsst::meas::extensions::multiShapelet
+
+#endif // !MULTISHAPELET_FitExpDev_h_INCLUDED
@@ -25,6 +25,7 @@
 
 #include "lsst/meas/algorithms/Algorithm.h"
 #include "lsst/meas/extensions/multiShapelet/FitPsf.h"
+#include "lsst/meas/extensions/multiShapelet/ConvolvedProfileTemplate.h"
 #include "lsst/meas/extensions/multiShapelet/MultiGaussianRegistry.h"
 #include "lsst/meas/extensions/multiShapelet/MultiGaussianObjective.h"
 
@@ -42,6 +43,10 @@ public:
     LSST_CONTROL_FIELD(deconvolveShape, bool,
                        "Attempt to approximately deconvolve the canonical shape before "
                        "using it to set the initial parameters.");
+    LSST_CONTROL_FIELD(matchWeightedMoments, bool,
+                       "If deconvolveShape, treat the canonical shape as adaptive moments and match the"
+                       " Gaussian-weighted moments of the convolved profile with a Newton solve, instead"
+                       " of its unweighted moments; falls back to the unweighted solution on failure.");
     LSST_CONTROL_FIELD(minInitialRadius, double,
                        "Minimum half-light radius in units of PSF inner radius for initial parameters.");
     LSST_CONTROL_FIELD(usePixelWeights, bool,
@@ -55,6 +60,42 @@ public:
     LSST_CONTROL_FIELD(radiusInputFactor, double,
                        "Number of half-light radii used to determine the pixels to fit");
     LSST_CONTROL_FIELD(useApproximateExp, bool, "Use fast approximate exponential (good to ~1E-4)");
+    LSST_CONTROL_FIELD(streamingMinPixels, int,
+                       "Footprints with at least this many pixels are fit by accumulating the normal"
+                       " equations tile by tile, without full-size model or derivative arrays; <= 0"
+                       " disables this");
+    LSST_CONTROL_FIELD(useSinglePrecision, bool,
+                       "Evaluate the model and derivative of streamed fits in single precision; the"
+                       " normal equations are still accumulated in double precision");
+    LSST_CONTROL_FIELD(cullSigma, double,
+                       "Only evaluate each convolved Gaussian component on pixels within this many"
+                       " sigma of its center (the neglected flux is at most exp(-cullSigma^2/2) per"
+                       " component); <= 0 evaluates every pixel");
+    LSST_CONTROL_FIELD(pruneTolerance, double,
+                       "Drop convolved Gaussian components whose flux is less than this fraction of"
+                       " the total; <= 0 keeps them all");
+    LSST_CONTROL_FIELD(parallelMinPixels, int,
+                       "Footprints with at least this many pixels are evaluated with several threads"
+                       " within the fit: parallelThreads by apply(), and all of its threads by"
+                       " applyBatch()");
+    LSST_CONTROL_FIELD(parallelThreads, int,
+                       "Number of threads used within a single large fit; 1 disables intra-source"
+                       " parallelism (ignored without OpenMP)");
+    LSST_CONTROL_FIELD(pyramidLevels, int,
+                       "Number of coarse levels, binned by 2^level x 2^level pixels, that are fit"
+                       " (coarsest first, each starting from the last) before the full-resolution"
+                       " fit; 0 fits only at full resolution");
+    LSST_CONTROL_FIELD(pyramidMinPixels, int,
+                       "Coarse levels with fewer than this many binned pixels are skipped");
+    LSST_NESTED_CONTROL_FIELD(optimizer, lsst.meas.extensions.multiShapelet.multiShapeletLib,
+                              HybridOptimizerControl, "Configuration for the nonlinear optimizer");
+    LSST_CONTROL_FIELD(warmStartName, std::string,
+                       "Root name of another FitProfile algorithm (e.g. 'multishapelet.dev') whose "
+                       "best-fit ellipse, if already measured and unflagged, is used as the initial "
+                       "ellipse instead of the deconvolved moments; empty to disable.");
+    LSST_CONTROL_FIELD(instrument, bool,
+                       "If true, add fields for optimizer counts and per-stage timings, and save"
+                       " per-process totals to the metadata");
 
     PTR(FitProfileControl) clone() const {
         return boost::static_pointer_cast<FitProfileControl>(_clone());
@@ -73,12 +114,16 @@ public:
         algorithms::AlgorithmControl("multishapelet.profile", 2.5),
         profile("tractor-exponential"), psfName("multishapelet.psf"),
         minRadius(0.0001), minAxisRatio(0.0001),
-        deconvolveShape(true), minInitialRadius(0.5),
+        deconvolveShape(true), matchWeightedMoments(false), minInitialRadius(0.5),
         usePixelWeights(false), badMaskPlanes(), maxBadPixelFraction(0.1),
-        growFootprint(5), radiusInputFactor(4.0), useApproximateExp(false)
+        growFootprint(5), radiusInputFactor(4.0), useApproximateExp(false), streamingMinPixels(100000),
+        useSinglePrecision(false), cullSigma(0.0), pruneTolerance(0.0), parallelMinPixels(20000), parallelThreads(1),
+        pyramidLevels(0), pyramidMinPixels(400), optimizer(), warmStartName(), instrument(false)
     {
         badMaskPlanes.push_back("EDGE");
         badMaskPlanes.push_back("SAT");
+        optimizer.tau = 1E-2;
+        optimizer.gTol = 1E-4;
     }
 
 private:
@@ -101,7 +146,7 @@ private:
  */
 struct FitProfileModel {
 
-    std::string profile; ///< name of profile to look up in MultiGaussianRegistry
+    MultiGaussianHandle profile; ///< registered profile (use profile.getName() for its name)
     double flux; ///< total flux of model, integrated to infinity (includes PSF factor, if enabled)
     double fluxErr; ///< uncertainty on flux
     afw::geom::ellipses::Quadrupole ellipse; ///< half-light radius ellipse
@@ -113,6 +158,9 @@ struct FitProfileModel {
     bool flagMinAxisRatio; ///< set to true if the best-fit axis ratio was at the minimum constraint
     bool flagLargeArea; ///< set to true if the area inside the best-fit half-light ellipse was larger
                         ///< than the number of pixels used
+    double approximationError; ///< upper bound on the fraction of model flux neglected by
+                               ///< ctrl.cullSigma and ctrl.pruneTolerance
+    FitStatistics stats; ///< work done by the fit
 
     FitProfileModel(
         FitProfileControl const & ctrl,
@@ -124,13 +172,16 @@ struct FitProfileModel {
     FitProfileModel(FitProfileControl const & ctrl, afw::table::SourceRecord const & source,
                     bool loadPsfFactorModel=false);
 
+    /// @brief Construct a placeholder model with NaN flux and fluxFlag set, for fits that failed.
+    explicit FitProfileModel(FitProfileControl const & ctrl);
+
     /// @brief Deep copy constructor.
     FitProfileModel(FitProfileModel const & other);
 
     /// @brief Deep assignment operator.
     FitProfileModel & operator=(FitProfileModel const & other);
 
-    MultiGaussian const & getMultiGaussian() const { return MultiGaussianRegistry::lookup(profile); }
+    MultiGaussian const & getMultiGaussian() const { return *profile; }
 
     /**
      *  @brief Return a MultiShapeletFunction representation of the model (unconvolved).
@@ -141,6 +192,52 @@ struct FitProfileModel {
 
 };
 
+/**
+ *  @brief Per-source inputs for FitProfileAlgorithm::applyBatch.
+ */
+struct FitProfileBatchInput {
+
+    PTR(afw::detection::Footprint) footprint; ///< detection footprint (grown/merged as in adjustInputs)
+    afw::geom::Point2D center; ///< center of the source in the image's PARENT coordinates
+    afw::geom::ellipses::Quadrupole shape; ///< initial moments ellipse, adjusted as in adjustInputs
+    FitPsfModel psfModel; ///< localized double-shapelet PSF model
+
+    FitProfileBatchInput(
+        PTR(afw::detection::Footprint) const & footprint_,
+        afw::geom::Point2D const & center_,
+        afw::geom::ellipses::Quadrupole const & shape_,
+        FitPsfModel const & psfModel_
+    ) : footprint(footprint_), center(center_), shape(shape_), psfModel(psfModel_) {}
+
+};
+
+/**
+ *  @brief Per-source inputs for FitProfileAlgorithm::applyForcedBatch.
+ *
+ *  Each input refers to a reference model by its index, so a single list of reference models can
+ *  be shared by the inputs for every epoch.
+ */
+struct FitProfileForcedBatchInput {
+
+    int reference; ///< index of the source's model in the list of reference models
+    PTR(afw::detection::Footprint) footprint; ///< detection footprint on this image
+    afw::geom::Point2D center; ///< center of the source in the image's PARENT coordinates
+    afw::geom::LinearTransform refToMeas; ///< local transform from reference to image coordinates
+    FitPsfModel psfModel; ///< localized double-shapelet PSF model
+    bool psfFluxFlag; ///< PSF flux flag of the source on this image; flagged sources are not fit
+
+    FitProfileForcedBatchInput(
+        int reference_,
+        PTR(afw::detection::Footprint) const & footprint_,
+        afw::geom::Point2D const & center_,
+        afw::geom::LinearTransform const & refToMeas_,
+        FitPsfModel const & psfModel_,
+        bool psfFluxFlag_=false
+    ) : reference(reference_), footprint(footprint_), center(center_), refToMeas(refToMeas_),
+        psfModel(psfModel_), psfFluxFlag(psfFluxFlag_) {}
+
+};
+
 class FitProfileAlgorithm : public algorithms::Algorithm {
 public:
 
@@ -152,7 +249,8 @@ public:
         FitProfileControl const & ctrl,
         afw::table::Schema & schema,
         algorithms::AlgorithmMap const & others,
-        bool isForced
+        bool isForced,
+        PTR(daf::base::PropertyList) const & metadata = PTR(daf::base::PropertyList)()
     );
 
     /// @brief Return the control object
@@ -160,10 +258,24 @@ public:
         return static_cast<FitProfileControl const &>(algorithms::Algorithm::getControl());
     }
 
+    /**
+     *  @brief Write the summary of the sources measured so far to the metadata passed at construction.
+     *
+     *  This is done automatically when the algorithm is destroyed; nothing is written unless the
+     *  control's 'instrument' field is set.
+     */
+    void flushStatistics() const;
+
     /**
      *  @brief Return an Objective that can be used to fit the convolved model to an image.
      *
      *  The objective function will use only the Gaussian terms in the PSF for the convolution.
+     *  It is put in streaming mode (see MultiGaussianObjective::setStreaming) if the inputs have
+     *  at least ctrl.streamingMinPixels pixels (evaluated in single precision if
+     *  ctrl.useSinglePrecision is set), and uses ctrl.parallelThreads threads (see
+     *  MultiGaussianObjective::setThreads) if they have at least ctrl.parallelMinPixels.  Culling
+     *  and pruning are enabled according to ctrl.cullSigma and ctrl.pruneTolerance (see
+     *  MultiGaussianObjective::setCulling).
      *
      *  This is provided primarily for testing and debugging purposes.
      */
@@ -186,7 +298,22 @@ public:
         FitProfileControl const & ctrl,
         FitPsfModel const & psfModel,
         MultiGaussianObjective::EllipseCore const & ellipse,
-        ModelInputHandler const & inputs
+        ModelInputHandler const & inputs,
+        HybridOptimizerWarmStart const & warmStart = HybridOptimizerWarmStart()
+    );
+
+    /**
+     *  @brief Turn a moments ellipse into the initial ellipse for the nonlinear fit.
+     *
+     *  The shape is approximately deconvolved (if ctrl.deconvolveShape, using
+     *  MultiGaussian::deconvolveWeighted if ctrl.matchWeightedMoments), and replaced by a
+     *  scaled PSF ellipse if it is too small, too elliptical, or undefined.  This is the
+     *  first part of adjustInputs(), when fixShape is false.
+     */
+    static void adjustShape(
+        FitProfileControl const & ctrl,
+        FitPsfModel const & psfModel,
+        afw::geom::ellipses::Quadrupole & shape
     );
 
     template <typename PixelT>
@@ -197,39 +324,132 @@ public:
         afw::detection::Footprint const & footprint,
         afw::image::MaskedImage<PixelT> const & image,
         afw::geom::Point2D const & center,
-        bool fixShape=false
+        bool fixShape=false,
+        ModelInputWorkspace * workspace=0
     );
 
     /**
      *  @brief Given a model computed using only the double-Gaussian PSF approximation,
      *         do a linear fit with additional shapelet terms in the PSF.
      *
-     *  This is provided primarily for testing and debugging purposes; it is the second
-     *  part of apply(), after the nonlinear double-Gaussian fit.
+     *  This is the second part of apply(), after the nonlinear double-Gaussian fit.  If modelVector
+     *  is not empty, it is set to the (weighted, if the inputs have weights) unit-flux model the
+     *  flux was fit with; it must have the same size as the inputs.
      */
     static void fitShapeletTerms(
         FitProfileControl const & ctrl,
         FitPsfModel const & psfModel,
         ModelInputHandler const & inputs,
-        FitProfileModel & model
+        FitProfileModel & model,
+        ndarray::Array<double,1,1> const & modelVector = ndarray::Array<double,1,1>()
+    );
+
+    /**
+     *  @brief Like the other fitShapeletTerms overload, but with a precomputed convolved profile.
+     *
+     *  The template must have been constructed from the model's profile and the PSF model
+     *  the nonlinear fit used; reusing it avoids redoing the PSF convolution setup.
+     */
+    static void fitShapeletTerms(
+        FitProfileControl const & ctrl,
+        ConvolvedProfileTemplate const & convolvedProfile,
+        ModelInputHandler const & inputs,
+        FitProfileModel & model,
+        ndarray::Array<double,1,1> const & modelVector = ndarray::Array<double,1,1>()
     );
 
     /**
      *  @brief Fit the model, using an existing ModelInputHandler as the data.
      *
+     *  If ctrl.pyramidLevels is positive, the ellipse is first fit to binned versions of the inputs
+     *  (see the binning ModelInputHandler constructor), from the coarsest level to the finest, so
+     *  the full-resolution fit starts close to the optimum and needs only a few iterations (which
+     *  can be capped with ctrl.optimizer.maxEvaluations).  The warm start is used and set only by
+     *  the full-resolution fit, and the optimizer counts in the model's statistics include all levels.
+     *
      *  @param[in]     ctrl           Details of the model to fit.
      *  @param[in]     psfModel       Localized double-shapelet PSF model.
      *  @param[in]     ellipse        Initial ellipse parameters
      *                                (possibly modified as defined by ctrl data members).
      *  @param[in]     inputs         Inputs that determine the data to be fit.
+     *  @param[in,out] warmStart      If non-null and non-empty, optimizer state from a previous fit
+     *                                of a similar model (see HybridOptimizerWarmStart); if non-null,
+     *                                set to the final optimizer state on return.
+     *  @param[out]    modelVector    If not empty, set to the unit-flux model vector from
+     *                                fitShapeletTerms(), for reuse in later linear fits.
      */
     static FitProfileModel apply(
         FitProfileControl const & ctrl,
         FitPsfModel const & psfModel,
         MultiGaussianObjective::EllipseCore const & ellipse,
-        ModelInputHandler const & inputs
+        ModelInputHandler const & inputs,
+        HybridOptimizerWarmStart * warmStart=0,
+        ndarray::Array<double,1,1> const & modelVector = ndarray::Array<double,1,1>()
     );
 
+    /**
+     *  @brief Fit many sources on the same image.
+     *
+     *  Each source is processed exactly as adjustInputs() followed by apply() would; the fits are
+     *  distributed over nThreads threads when the library is built with OpenMP.  Sources whose
+     *  detection footprints have at least ctrl.parallelMinPixels pixels are instead fit one at a
+     *  time after all the others, each using all nThreads threads within the fit (see
+     *  MultiGaussianObjective::setThreads), so a few huge sources do not leave the other threads
+     *  idle at the end.  Sources with a
+     *  failed PSF model, or whose fit throws, are returned as placeholder models with fluxFlag set
+     *  (see FitProfileModel(FitProfileControl const &)).
+     *
+     *  Profiles must not be inserted into MultiGaussianRegistry while this runs (see
+     *  MultiGaussianRegistry::ScopedFreeze to enforce that).
+     *
+     *  @param[in]     ctrl           Details of the model to fit.
+     *  @param[in]     sources        Footprints, centers, initial ellipses and PSF models.
+     *  @param[in]     image          Image containing all the sources.
+     *  @param[in]     nThreads       Number of threads to use (ignored without OpenMP).
+     */
+    template <typename PixelT>
+    static std::vector<FitProfileModel> applyBatch(
+        FitProfileControl const & ctrl,
+        std::vector<FitProfileBatchInput> const & sources,
+        afw::image::MaskedImage<PixelT> const & image,
+        int nThreads=1
+    );
+
+    /**
+     *  @brief Do forced (linear-only) fits of many sources on the same image.
+     *
+     *  Each source is fit as in forced mode: the ellipse of its reference model is transformed to
+     *  the image and held fixed, and only the flux is fit, with fitShapeletTerms().  The reference
+     *  models are only read, so the same list (built once, e.g. with the FitProfileModel
+     *  constructor that takes a SourceRecord) can be passed for every epoch; each call then does
+     *  no per-source registry lookups or record unpacking, and all the flattened inputs and model
+     *  vectors for a thread reuse the same memory.  The fits are distributed over nThreads threads
+     *  when the library is built with OpenMP.
+     *
+     *  Sources whose reference model, PSF model or PSF flux failed, or whose fit throws, are
+     *  returned as placeholder models with fluxFlag set (the single-source forced mode throws for
+     *  the same sources).  Throws InvalidParameterException if any reference
+     *  index is out of range.  As with applyBatch(), profiles must not be inserted into
+     *  MultiGaussianRegistry while this runs.
+     *
+     *  @param[in]     ctrl           Details of the model to fit.
+     *  @param[in]     references     Reference models, indexed by FitProfileForcedBatchInput::reference.
+     *  @param[in]     sources        Footprints, centers, transforms and PSF models on this image.
+     *  @param[in]     image          Image containing all the sources.
+     *  @param[in]     nThreads       Number of threads to use (ignored without OpenMP).
+     */
+    template <typename PixelT>
+    static std::vector<FitProfileModel> applyForcedBatch(
+        FitProfileControl const & ctrl,
+        std::vector<FitProfileModel> const & references,
+        std::vector<FitProfileForcedBatchInput> const & sources,
+        afw::image::MaskedImage<PixelT> const & image,
+        int nThreads=1
+    );
+
+    /// @brief Save a model to the fields registered by this algorithm (only some are set in forced mode).
+    void fillRecord(afw::table::SourceRecord & source, FitProfileModel const & model) const;
+
 private:
 
     template <typename PixelT>
@@ -260,6 +480,9 @@ private:
     afw::table::Key< afw::table::Flag > _flagMinAxisRatioKey;
     afw::table::Key< afw::table::Flag > _flagLargeAreaKey;
     CONST_PTR(FitPsfControl) _psfCtrl;
+    bool _isForced;
+    PTR(FitStatisticsKeys) _statsKeys;
+    PTR(FitStatisticsSummary) _statsSummary;
 };
 
 inline PTR(FitProfileAlgorithm) FitProfileControl::makeAlgorithm(
@@ -23,6 +23,8 @@
 #ifndef MULTISHAPELET_FitPsf_h_INCLUDED
 #define MULTISHAPELET_FitPsf_h_INCLUDED
 
+#include <map>
+
 #include "ndarray.h"
 
 #include "lsst/shapelet.h"
@@ -31,6 +33,7 @@
 #include "lsst/meas/extensions/multiShapelet/MultiGaussian.h"
 #include "lsst/meas/extensions/multiShapelet/ModelInputHandler.h"
 #include "lsst/meas/extensions/multiShapelet/HybridOptimizer.h"
+#include "lsst/meas/extensions/multiShapelet/Instrumentation.h"
 
 namespace lsst { namespace meas { namespace extensions { namespace multiShapelet {
 
@@ -52,7 +55,22 @@ public:
                        " when shapelets coefficients are fit and ellipses are held fixed."
     );
     LSST_CONTROL_FIELD(initialRadius, double, "Initial radius of inner component in pixels");
+    LSST_CONTROL_FIELD(initialMoments, bool,
+                       "If true, start from the ellipse whose Gaussian-weighted moments match the"
+                       " adaptive moments of the image, instead of a circle with initialRadius"
+                       " (which is still used to start the moments iteration, and as a fallback)");
     LSST_CONTROL_FIELD(useApproximateExp, bool, "Use fast approximate exponential (good to ~1E-4)");
+    LSST_CONTROL_FIELD(cacheSpacing, double,
+                       "Spacing (in pixels) of a grid of positions at which the PSF model is fit once"
+                       " and reused for nearby sources; <= 0 fits the PSF at every source position");
+    LSST_CONTROL_FIELD(cacheInterpolate, bool,
+                       "If true, bilinearly interpolate cached models from the four surrounding grid"
+                       " points instead of using the nearest one (ignored if cacheSpacing <= 0)");
+    LSST_NESTED_CONTROL_FIELD(optimizer, lsst.meas.extensions.multiShapelet.multiShapeletLib,
+                              HybridOptimizerControl, "Configuration for the nonlinear optimizer");
+    LSST_CONTROL_FIELD(instrument, bool,
+                       "If true, add fields for optimizer counts and per-stage timings, and save"
+                       " per-process totals to the metadata");
 
     PTR(FitPsfControl) clone() const { return boost::static_pointer_cast<FitPsfControl>(_clone()); }
 
@@ -68,8 +86,12 @@ public:
     FitPsfControl() :
         algorithms::AlgorithmControl("multishapelet.psf", 2.0),
         innerOrder(2), outerOrder(1), minRadius(0.1), minAxisRatio(0.1),
-        radiusRatio(2.0), peakRatio(0.1), initialRadius(1.5), useApproximateExp(false)
-    {}
+        radiusRatio(2.0), peakRatio(0.1), initialRadius(1.5), initialMoments(false), useApproximateExp(false),
+        cacheSpacing(0.0), cacheInterpolate(false), optimizer(), instrument(false)
+    {
+        optimizer.tau = 1E-6;
+        optimizer.gTol = 1E-6;
+    }
 
 private:
 
@@ -102,6 +124,7 @@ struct FitPsfModel {
     bool failedTinyStep; ///< set to true if the optimizer step size got too small to make progress
     bool failedMinRadius; ///< set to true if the best-fit radius was at the minimum constraint
     bool failedMinAxisRatio; ///< set to true if the best-fit axis ratio was at the minimum constraint
+    FitStatistics stats; ///< work done by the fit (zero for models taken from the cache)
 
     bool hasFailed() const { return failedMaxIter || failedTinyStep || failedMinRadius || failedMinAxisRatio; }
 
@@ -123,6 +146,15 @@ struct FitPsfModel {
     /// @brief Construct by extracting saved values from a Record.
     FitPsfModel(FitPsfControl const & ctrl, afw::table::BaseRecord const & source);
 
+    /**
+     *  @brief Construct a placeholder model with zero coefficients and a zero-area ellipse.
+     *
+     *  This is used to represent sources whose fit could not be completed (see
+     *  FitPsfAlgorithm::applyBatch); FitProfileAlgorithm and FitComboAlgorithm treat a PSF
+     *  model with a zero-area ellipse as a failed PSF fit.
+     */
+    explicit FitPsfModel(FitPsfControl const & ctrl);
+
     /// @brief Deep copy constructor.
     FitPsfModel(FitPsfModel const & other);
 
@@ -149,13 +181,25 @@ public:
     typedef FitPsfModel Model;
 
     /// @brief Construct an algorithm instance and register its fields with a Schema.
-    FitPsfAlgorithm(FitPsfControl const & ctrl, afw::table::Schema & schema);
+    FitPsfAlgorithm(
+        FitPsfControl const & ctrl,
+        afw::table::Schema & schema,
+        PTR(daf::base::PropertyList) const & metadata = PTR(daf::base::PropertyList)()
+    );
 
     /// @brief Return the control object
     FitPsfControl const & getControl() const {
         return static_cast<FitPsfControl const &>(algorithms::Algorithm::getControl());
     }
 
+    /**
+     *  @brief Write the summary of the sources measured so far to the metadata passed at construction.
+     *
+     *  This is done automatically when the algorithm is destroyed; nothing is written unless the
+     *  control's 'instrument' field is set.
+     */
+    void flushStatistics() const;
+
     /**
      *  @brief Return an Objective that can be used to fit an elliptical double-Gaussian to the image.
      *
@@ -172,6 +216,9 @@ public:
      *  This is provided primarily for testing and debugging purposes; the user can create an optimizer,
      *  step through it, and use the FitPsfModel constructor that takes a parameter vector to
      *  visualize its progress.
+     *
+     *  The initial ellipse is a circle with radius ctrl.initialRadius, or if ctrl.initialMoments,
+     *  the result of MultiGaussian::deconvolveWeighted applied to the adaptive moments of the image.
      */
     static HybridOptimizer makeOptimizer(
         FitPsfControl const & ctrl,
@@ -214,6 +261,27 @@ public:
         afw::geom::Point2D const & center
     );
 
+    /**
+     *  @brief Fit a PSF object evaluated at many points.
+     *
+     *  The PSF images are computed serially (Psf implementations need not be thread-safe), and
+     *  the fits themselves are distributed over nThreads threads when the library is built with
+     *  OpenMP.  Sources are processed in chunks, so only a few PSF images are held at once.
+     *  Sources for which the fit throws are returned as placeholder models (see
+     *  FitPsfModel(FitPsfControl const &)).
+     *
+     *  @param[in] ctrl           Details of the model to fit.
+     *  @param[in] psf            PSF object
+     *  @param[in] centers        Points at which to evaluate the PSF.
+     *  @param[in] nThreads       Number of threads to use (ignored without OpenMP).
+     */
+    static std::vector<FitPsfModel> applyBatch(
+        FitPsfControl const & ctrl,
+        afw::detection::Psf const & psf,
+        std::vector<afw::geom::Point2D> const & centers,
+        int nThreads=1
+    );
+
     /**
      *  @brief Fit a PSF object evaluated at a point, returning a FitPsfModel
      *         and saving the to the given record.
@@ -230,8 +298,34 @@ public:
         afw::geom::Point2D const & center
     ) const;
 
+    /**
+     *  @brief Like fit(), but reuse models fit on a grid of nearby positions when the
+     *         control's cacheSpacing is positive.
+     *
+     *  Grid points are fit lazily, the first time a source near them is measured, and are
+     *  discarded whenever a different Psf object is passed.  The distance to the nearest grid
+     *  point is saved to the record, along with a flag indicating the cache was used.  If
+     *  any of the grid fits needed by a source failed, the PSF is fit at the source position
+     *  instead.  This is not thread-safe, as the cache is shared by all calls.
+     *
+     *  @param[in] record         Record in which to save results
+     *  @param[in] psf            PSF object; held until a different one is passed
+     *  @param[in] center         Point at which to evaluate the PSF
+     */
+    FitPsfModel fitCached(
+        afw::table::BaseRecord & record,
+        CONST_PTR(afw::detection::Psf) const & psf,
+        afw::geom::Point2D const & center
+    ) const;
+
 private:
 
+    typedef std::map<std::pair<int,int>,FitPsfModel> CacheMap;
+
+    void _save(afw::table::BaseRecord & record, FitPsfModel const & model) const;
+
+    FitPsfModel const * _getCachedNode(int i, int j) const;
+
     template <typename PixelT>
     void _apply(
         afw::table::SourceRecord & source,
@@ -251,6 +345,12 @@ private:
     afw::table::Key< afw::table::Flag > _flagTinyStepKey;
     afw::table::Key< afw::table::Flag > _flagMinRadiusKey;
     afw::table::Key< afw::table::Flag > _flagMinAxisRatioKey;
+    afw::table::Key<float> _cacheDistanceKey;
+    afw::table::Key< afw::table::Flag > _flagCachedKey;
+    PTR(FitStatisticsKeys) _statsKeys;
+    PTR(FitStatisticsSummary) _statsSummary;
+    mutable CONST_PTR(afw::detection::Psf) _cachePsf;
+    mutable CacheMap _cache;
 };
 
 inline PTR(FitPsfAlgorithm) FitPsfControl::makeAlgorithm(
@@ -28,6 +28,7 @@
 #include "lsst/afw/detection/Footprint.h"
 
 #include "lsst/meas/extensions/multiShapelet/EllipseSquaredNorm.h"
+#include "lsst/meas/extensions/multiShapelet/ModelInputHandler.h"
 
 namespace lsst { namespace meas { namespace extensions { namespace multiShapelet {
 
@@ -42,14 +43,89 @@ public:
         double psfAmplitude=1.0, bool useApproximateExp=false
     );
     
+    /**
+     *  @brief Construct a builder that reads pixel coordinates from a list of spans.
+     *
+     *  Instead of streaming separate X and Y arrays, the ellipse squared norm is advanced
+     *  incrementally along each span (see EllipseSquaredNorm::evaluateSpan), which reduces the
+     *  memory traffic per pixel and avoids the full-size intermediate arrays.  The exponential
+     *  is also evaluated by recurrence along each span, so only a few transcendentals are needed
+     *  per row (this makes rectangular PSF-image fits O(H) in exponentials rather than O(W*H)).
+     *  In this mode useApproximateExp only affects very short spans.
+     */
+    GaussianModelBuilder(
+        CoordinateSpanList const & spans,
+        double flux=1.0, double radius=1.0,
+        afw::geom::ellipses::Quadrupole const & psfEllipse = afw::geom::ellipses::Quadrupole(0.0, 0.0, 0.0),
+        double psfAmplitude=1.0, bool useApproximateExp=false
+    );
+
     GaussianModelBuilder(GaussianModelBuilder const & other);
 
     GaussianModelBuilder & operator=(GaussianModelBuilder const & other);
 
-    int getSize() const { return _x.size(); }
+    int getSize() const { return _size; }
+
+    /// @brief Return the product of the component flux and PSF amplitude.
+    double getAmplitude() const { return _flux * _psfAmplitude; }
+
+    /**
+     *  @brief Only evaluate pixels within nSigma of the center of the (PSF-convolved) ellipse.
+     *
+     *  Pixels outside the ellipse are treated as zero for the model and derivative; each span
+     *  is intersected with the ellipse whenever the ellipse is updated, so only the pixels inside
+     *  it are visited.  The neglected fraction of the component's flux is at most
+     *  exp(-nSigma^2/2).  Culling requires a span-based builder; a nonpositive nSigma disables it.
+     */
+    void setCullRadius(double nSigma);
+
+    /// @brief Return the culling radius in sigma (see setCullRadius()); zero if disabled.
+    double getCullRadius() const { return _cullRadius; }
 
     void update(afw::geom::ellipses::BaseCore const & ellipse);
 
+    /**
+     *  @brief Update the ellipse without evaluating the model on the full coordinate arrays.
+     *
+     *  This is used with addModelAndDerivative() by callers that fold several builders into a
+     *  single pass over the pixels; getModel() and computeDerivative() are not valid until
+     *  update() is called.
+     */
+    void updateEllipse(afw::geom::ellipses::BaseCore const & ellipse);
+
+    /**
+     *  @brief Add the model and its derivative for pixels [begin, end) to the given arrays.
+     *
+     *  The model and derivative arrays must be the full size of the coordinate arrays; only
+     *  the given range of rows is touched.  Must be preceded by a call to updateEllipse()
+     *  or update().
+     */
+    void addModelAndDerivative(
+        int begin, int end,
+        ndarray::Array<double,1,1> const & model,
+        ndarray::Array<double,2,-2> const & derivative
+    ) const;
+
+    /**
+     *  @brief Add the model and its derivative for pixels [begin, end) to tile-sized arrays.
+     *
+     *  Like addModelAndDerivative(), but row zero of the output arrays corresponds to pixel
+     *  'begin', so they need only have end - begin rows; this lets callers that reduce each
+     *  tile immediately avoid full-size arrays altogether.
+     *
+     *  T may be float or double.  With float, the ellipse norms, exponentials, and the model and
+     *  derivative assembly are all evaluated in single precision, which halves the size of the
+     *  buffers and doubles the SIMD width of every per-pixel loop; the exponential is then evaluated
+     *  directly at each pixel rather than by the recurrence along each row, whose round-off would
+     *  grow too quickly in float.  Results agree with double precision to ~1E-6 relative.
+     */
+    template <typename T>
+    void addTileModelAndDerivative(
+        int begin, int end,
+        ndarray::Array<T,1,1> const & model,
+        ndarray::Array<T,2,-2> const & derivative
+    ) const;
+
     ndarray::Array<double const,1,1> getModel() const { return _model; }
 
     void computeDerivative(
@@ -60,10 +136,45 @@ public:
     void setOutput(ndarray::Array<double,1,1> const & array);
 
 private:
+
+    // A range [begin, end) of pixel indices that are evaluated (all of them, unless culling).
+    struct PixelRange {
+        int begin;
+        int end;
+    };
+
+    typedef std::vector<PixelRange> PixelRangeList;
+
+    // Return the first active range that ends after pixel 'begin'.
+    PixelRangeList::const_iterator _findRange(int begin) const;
+
+    // Recompute _ranges for the current ellipse.
+    void _updateRanges();
+
+    // Implementation for addModelAndDerivative and addTileModelAndDerivative; m and d point to the
+    // model and derivative for pixel 'begin', and s0 and s1 are the derivative strides.
+    template <typename T>
+    void _addModelAndDerivative(int begin, int end, T * m, T * d, int s0, int s1) const;
+
+    // Add the model and derivative for the pixels [begin, end) of a single active range.
+    template <typename T>
+    void _addRangeModelAndDerivative(int begin, int end, T * m, T * d, int s0, int s1) const;
+
+    // Fill the coordinates and ellipse norm intermediates for pixels [begin, begin + n); if evaluate
+    // is true, z is replaced by the normalized Gaussian itself.  T is float or double.
+    template <typename T>
+    void _computeBlock(
+        int begin, int n,
+        T * x, T * y, T * rx, T * ry, T * z,
+        bool evaluate
+    ) const;
     
     bool _useApproximateExp;
+    int _size;
+    double _cullRadius;
     double _flux;
     double _psfAmplitude;
+    double _normalization;
     afw::geom::LinearTransform _scaling;
     afw::geom::ellipses::Quadrupole _psfEllipse;
     EllipseSquaredNorm _esn;
@@ -73,6 +184,8 @@ private:
     ndarray::EigenView<double const,1,1> _y;
     Eigen::VectorXd _rx;
     Eigen::VectorXd _ry;
+    CoordinateSpanList _spans;
+    PixelRangeList _ranges;
     ndarray::Array<double,1,1> _model;
 };
 
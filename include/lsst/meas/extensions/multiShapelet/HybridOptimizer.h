@@ -55,6 +55,53 @@ public:
         ndarray::Array<double,2,-2> const & derivative
     ) = 0;
 
+    /**
+     *  @brief Compute both the function and its derivative at the given parameters.
+     *
+     *  This is what HybridOptimizer calls whenever it needs both; the default implementation
+     *  just calls computeFunction() and then computeDerivative(), but objectives that can share
+     *  work between the two (e.g. by making a single pass over the data) should override it.
+     */
+    virtual void computeFunctionAndDerivative(
+        ndarray::Array<double const,1,1> const & parameters, 
+        ndarray::Array<double,1,1> const & function,
+        ndarray::Array<double,2,-2> const & derivative
+    ) {
+        computeFunction(parameters, function);
+        computeDerivative(parameters, function, derivative);
+    }
+
+    /**
+     *  @brief Return true if HybridOptimizer should call computeNormalEquations() instead of
+     *         computeFunctionAndDerivative().
+     *
+     *  An optimizer on such an objective never allocates function- or derivative-sized arrays,
+     *  so its getFunction() and getTrialFunction() accessors return empty arrays.
+     */
+    virtual bool hasNormalEquations() const { return false; }
+
+    /**
+     *  @brief Compute the reduced least-squares quantities at the given parameters.
+     *
+     *  With f the function vector and J its derivative, the outputs are
+     *   - halfChiSq: 0.5 f^T f
+     *   - functionInfNorm: an upper bound on the inf norm of f (compared with the fTol control
+     *     value; sqrt(2 halfChiSq) is always a valid choice)
+     *   - gradient: J^T f
+     *   - normalMatrix: J^T J (only the lower triangle is used)
+     *
+     *  This lets an objective accumulate the normal equations over pieces of the data without
+     *  ever holding all of f and J in memory.  Only called when hasNormalEquations() is true;
+     *  the default implementation throws LogicErrorException.
+     */
+    virtual void computeNormalEquations(
+        ndarray::Array<double const,1,1> const & parameters,
+        double & halfChiSq,
+        double & functionInfNorm,
+        ndarray::Array<double,1,1> const & gradient,
+        ndarray::Array<double,2,2> const & normalMatrix
+    );
+
     virtual ~Objective() {}
 
     int getFunctionSize() const { return _functionSize; }
@@ -74,12 +121,46 @@ public:
     LSST_CONTROL_FIELD(gTol, double, "stopping tolerance for gradient value");
     LSST_CONTROL_FIELD(minStep, double, "minimum step size");
     LSST_CONTROL_FIELD(maxIter, int, "maximum number of iterations");
+    LSST_CONTROL_FIELD(maxEvaluations, int,
+                       "maximum number of objective function evaluations (including the initial one)"
+                       " before run() stops with FAILURE_MAXITER; <= 0 for no limit.  Each step"
+                       " evaluates the function at most once, so run() never exceeds this, but"
+                       " step() itself does not check it");
+    LSST_CONTROL_FIELD(chiSqTol, double,
+                       "if > 0, stop with SUCCESS_CHISQ once the chi^2 decrease predicted by a full"
+                       " Gauss-Newton step is less than this times the noise variance estimated from"
+                       " the reduced chi^2 (i.e. this fraction of the decrease for a 1-sigma change)");
     LSST_CONTROL_FIELD(tau, double, "LM parameter (FIXME!)");
     LSST_CONTROL_FIELD(delta0, double, "BFGS parameter (FIXME!)");
     LSST_CONTROL_FIELD(useCholesky, bool, "whether to use Cholesky or Eigensystem factorization");
+    LSST_CONTROL_FIELD(lazyDerivative, bool,
+                       "in Levenberg-Marquardt mode, evaluate the function first and the derivative only"
+                       " if the step is accepted (rejected steps then do not update the BFGS Hessian"
+                       " approximation)");
 
     HybridOptimizerControl() : 
-        fTol(1E-8), gTol(1E-8), minStep(1E-8), maxIter(200), tau(1E-3), delta0(1.0), useCholesky(true) {}
+        fTol(1E-8), gTol(1E-8), minStep(1E-8), maxIter(200), maxEvaluations(0), chiSqTol(0.0),
+        tau(1E-3), delta0(1.0), useCholesky(true), lazyDerivative(false) {}
+};
+
+/**
+ *  @brief Internal HybridOptimizer state that can be used to warm-start a new optimizer.
+ *
+ *  When a problem is re-solved from a nearby starting point (e.g. reprocessing a source that
+ *  has barely changed), carrying over the Levenberg-Marquardt damping and the BFGS Hessian
+ *  approximation lets the new optimizer skip the iterations it would otherwise spend rebuilding
+ *  them.  This holds only plain values and an array, so it can be saved and restored field by
+ *  field.  A default-constructed instance is empty and has no effect.
+ */
+struct HybridOptimizerWarmStart {
+    int method;        ///< HybridOptimizer::MethodEnum the previous optimizer finished in
+    double mu;         ///< Levenberg-Marquardt damping parameter
+    double delta;      ///< BFGS trust region size
+    ndarray::Array<double,2,2> hessian; ///< BFGS Hessian approximation (empty if not set)
+
+    bool isEmpty() const { return hessian.isEmpty(); }
+
+    HybridOptimizerWarmStart() : method(0), mu(0.0), delta(0.0), hessian() {}
 };
 
 
@@ -95,6 +176,10 @@ public:
  *
  *  The main goal of the reimplementation is to expose the main loop to the user,
  *  adding them to inspect each step in detail.
+ *
+ *  Objectives with exactly three parameters (such as MultiGaussianObjective) use fixed-size
+ *  matrices for all parameter-space quantities, so the per-step solves and BFGS updates
+ *  do no heap allocation; other objectives use dynamic-size matrices.
  */
 
 class HybridOptimizer {
@@ -111,10 +196,11 @@ public:
                                   ///  invalid; none of the trial quantities were updated.
         SUCCESS_FTOL      = 0x08, ///< Function values are below tolerance (i.e. perfect fit).
         SUCCESS_GTOL      = 0x10, ///< Gradient values are below tolerance (at minimum).
-        SUCCESS           = SUCCESS_FTOL | SUCCESS_GTOL, ///< Any success condition.
+        SUCCESS_CHISQ     = 0x100, ///< Predicted chi^2 decrease is statistically insignificant.
+        SUCCESS           = SUCCESS_FTOL | SUCCESS_GTOL | SUCCESS_CHISQ, ///< Any success condition.
         FAILURE_MINSTEP   = 0x20, ///< Calculated step became too small.
         FAILURE_MINTRUST  = 0x40, ///< Trust region became too small.
-        FAILURE_MAXITER   = 0x80, ///< Too many iterations.
+        FAILURE_MAXITER   = 0x80, ///< Too many iterations or function evaluations.
         FAILURE           = FAILURE_MINSTEP | FAILURE_MINTRUST | FAILURE_MAXITER, ///< Any failure condition.
         FINISHED          = SUCCESS | FAILURE  ///< Any success or failure condition.
     };
@@ -141,7 +227,8 @@ public:
     /**
      *  @brief Call step() in a loop until it succeeds or fails.
      *
-     *  Return value is a bitwise OR of StateFlags.
+     *  Return value is a bitwise OR of StateFlags.  FAILURE_MAXITER is set if the loop ends because
+     *  maxIter steps were taken, or because another step could exceed maxEvaluations.
      */
     int run();
 
@@ -158,6 +245,8 @@ public:
      *  @brief Return the maximum absolute value (inf norm) of the function vector.
      *
      *  The SUCCESS_FTOL condition is met when this is less than the fTol control value.
+     *  For objectives that compute the normal equations directly, this is the upper bound
+     *  reported by Objective::computeNormalEquations().
      */
     double getFunctionInfNorm() const;
 
@@ -168,28 +257,80 @@ public:
      */
     double getGradientInfNorm() const;
 
+    /**
+     *  @brief Return the chi^2 decrease predicted by a full Gauss-Newton step from the current point.
+     *
+     *  This is @f$g^T (J^T J)^{-1} g@f$, where @f$g@f$ is the gradient of half the chi^2 and @f$J@f$
+     *  the derivative of the function vector.  The SUCCESS_CHISQ condition is met when this is less
+     *  than the chiSqTol control value times getChiSq() / (getFunctionSize() - getParameterSize())
+     *  of the objective; for residuals that are weighted by their inverse noise this is about
+     *  chiSqTol, the fraction of the chi^2 change corresponding to a 1-sigma parameter change.
+     */
+    double getPredictedChiSqDecrease() const;
+
     /// @brief Return the LM 'mu' parameter that multiplies the diagonal term added to the Hessian.
     double getMu() const;
 
     /// @brief Return the BFGS trust region size.
     double getDelta() const;
 
+    /// @brief Return the number of calls to step() so far (including those made by run()).
+    int getStepCount() const;
+
+    /// @brief Return the number of times the objective function has been evaluated.
+    int getEvaluationCount() const;
+
+    /**
+     *  @brief Return the number of times the objective derivative has been evaluated.
+     *
+     *  This is the same as getEvaluationCount() unless the lazyDerivative control field is set;
+     *  the difference is the number of derivative evaluations saved on rejected steps.
+     */
+    int getDerivativeCount() const;
+
+    /// @brief Return the number of times the optimizer has switched between LM and BFGS.
+    int getMethodSwitchCount() const;
+
+    /// @brief Return the state needed to warm-start another optimizer on a similar problem.
+    HybridOptimizerWarmStart getWarmStart() const;
+
     CONST_PTR(Objective) getObjective() const;
 
     ndarray::Array<double const,1,1> getParameters() const;
 
     ndarray::Array<double const,1,1> getTrialParameters() const;
 
+    /**
+     *  @brief Return the function vector (empty if Objective::hasNormalEquations() is true).
+     *
+     *  Accepting a step swaps the current and trial function buffers, so the returned array
+     *  should be copied if it is needed after the next call to step().
+     */
     ndarray::Array<double const,1,1> getFunction() const;
 
+    /**
+     *  @brief Return the trial function vector (empty if Objective::hasNormalEquations() is true).
+     *
+     *  This is only meaningful when the last step was rejected; after an accepted step, the trial
+     *  values are those returned by getFunction(), and this returns the buffer that will be
+     *  overwritten by the next evaluation.
+     */
     ndarray::Array<double const,1,1> getTrialFunction() const;
 
     Control const & getControl() const;
 
+    /**
+     *  @brief Construct an optimizer and evaluate the objective at the initial parameters.
+     *
+     *  If a non-empty warmStart is given, its damping parameter and Hessian approximation replace
+     *  those computed from the initial derivative, and the optimizer starts in the method the
+     *  previous one finished in.  Its Hessian must match the objective's parameter size.
+     */
     explicit HybridOptimizer(
         PTR(Objective) const & objective, 
         ndarray::Array<double const,1,1> const & parameters,
-        Control const & ctrl = Control()
+        Control const & ctrl = Control(),
+        HybridOptimizerWarmStart const & warmStart = HybridOptimizerWarmStart()
     );
 
     ~HybridOptimizer();
@@ -198,6 +339,8 @@ private:
 
     class Impl;
 
+    template <int N> class SizedImpl;
+
     PTR(Impl) _impl;
 };
 
@@ -0,0 +1,158 @@
+// -*- lsst-c++ -*-
+/* 
+ * LSST Data Management System
+ * Copyright 2012 LSST Corporation.
+ * 
+ * This product includes software developed by the
+ * LSST Project (http://www.lsst.org/).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the LSST License Statement and 
+ * the GNU General Public License along with this program.  If not, 
+ * see <http://www.lsstcorp.org/LegalNotices/>.
+ */
+#ifndef MULTISHAPELET_Instrumentation_h_INCLUDED
+#define MULTISHAPELET_Instrumentation_h_INCLUDED
+
+#include <string>
+
+#include "boost/noncopyable.hpp"
+#include "boost/date_time/posix_time/posix_time_types.hpp"
+
+#include "lsst/daf/base/PropertyList.h"
+#include "lsst/afw/table/Schema.h"
+#include "lsst/afw/table/BaseRecord.h"
+#include "lsst/meas/extensions/multiShapelet/HybridOptimizer.h"
+
+namespace lsst { namespace meas { namespace extensions { namespace multiShapelet {
+
+/**
+ *  @brief A wall-clock stopwatch for timing the stages of a fit.
+ */
+class StageTimer {
+public:
+
+    StageTimer() : _start(now()) {}
+
+    /// @brief Return the seconds elapsed since construction or the last call to lap(), and restart.
+    double lap() {
+        boost::posix_time::ptime t = now();
+        double result = (t - _start).total_microseconds() * 1E-6;
+        _start = t;
+        return result;
+    }
+
+private:
+    static boost::posix_time::ptime now() { return boost::posix_time::microsec_clock::universal_time(); }
+
+    boost::posix_time::ptime _start;
+};
+
+/**
+ *  @brief How much work a single fit took.
+ *
+ *  The counts are zero for fits that do not run the optimizer.  Timings are wall-clock seconds.
+ */
+struct FitStatistics {
+    int steps;          ///< number of HybridOptimizer::step() calls
+    int evaluations;    ///< number of objective function evaluations
+    int derivatives;    ///< number of derivative evaluations (fewer with lazyDerivative optimizers)
+    int methodSwitches; ///< number of switches between Levenberg-Marquardt and BFGS
+    double inputsTime;  ///< time spent selecting and flattening the pixels to fit
+    double fitTime;     ///< time spent in the nonlinear fit
+    double linearTime;  ///< time spent in the final linear fit
+
+    /// @brief Set the counts from an optimizer that has finished running.
+    void readOptimizer(HybridOptimizer const & optimizer) {
+        steps = optimizer.getStepCount();
+        evaluations = optimizer.getEvaluationCount();
+        derivatives = optimizer.getDerivativeCount();
+        methodSwitches = optimizer.getMethodSwitchCount();
+    }
+
+    FitStatistics() :
+        steps(0), evaluations(0), derivatives(0), methodSwitches(0), inputsTime(0.0), fitTime(0.0), linearTime(0.0) {}
+};
+
+/**
+ *  @brief Optional schema fields that record a FitStatistics for each source.
+ *
+ *  Algorithms only create these when their control's 'instrument' field is set.
+ */
+class FitStatisticsKeys {
+public:
+
+    /**
+     *  @brief Add fields to a schema.
+     *
+     *  @param[in,out] schema     Schema to add fields to.
+     *  @param[in]     prefix     Root name of the fields (usually the algorithm name).
+     *  @param[in]     nonlinear  Whether to add fields for the optimizer counts and nonlinear fit time.
+     */
+    FitStatisticsKeys(afw::table::Schema & schema, std::string const & prefix, bool nonlinear);
+
+    /// @brief Save the statistics of a fit to a record.
+    void set(afw::table::BaseRecord & record, FitStatistics const & stats) const;
+
+private:
+    bool _nonlinear;
+    afw::table::Key<int> _stepsKey;
+    afw::table::Key<int> _evaluationsKey;
+    afw::table::Key<int> _derivativesKey;
+    afw::table::Key<int> _methodSwitchesKey;
+    afw::table::Key<float> _inputsTimeKey;
+    afw::table::Key<float> _fitTimeKey;
+    afw::table::Key<float> _linearTimeKey;
+};
+
+/**
+ *  @brief Per-process totals and maxima of the FitStatistics of all the sources an algorithm measured.
+ *
+ *  add() only updates the in-memory sums; flush() (which is also called on destruction) writes
+ *  the summary to the metadata PropertyList (if any) as "<prefix>.summary.nsources" and
+ *  "<prefix>.summary.<quantity>.total" and ".max", where the quantities are the field names used
+ *  by FitStatisticsKeys (nsteps, time.fit, etc.).
+ */
+class FitStatisticsSummary : private boost::noncopyable {
+public:
+
+    FitStatisticsSummary(PTR(daf::base::PropertyList) const & metadata, std::string const & prefix);
+
+    /// @brief Write the summary to the metadata, ignoring any exception.
+    ~FitStatisticsSummary();
+
+    /// @brief Include the statistics of another source in the summary.
+    void add(FitStatistics const & stats);
+
+    /// @brief Write the current summary to the metadata, replacing any previously-written values.
+    void flush() const;
+
+    /// @brief Return the number of sources included in the summary.
+    int getSourceCount() const { return _sourceCount; }
+
+    /// @brief Return the sums of all the statistics included in the summary.
+    FitStatistics const & getTotal() const { return _total; }
+
+    /// @brief Return the element-wise maximum of all the statistics included in the summary.
+    FitStatistics const & getMax() const { return _max; }
+
+private:
+    PTR(daf::base::PropertyList) _metadata;
+    std::string _prefix;
+    int _sourceCount;
+    FitStatistics _total;
+    FitStatistics _max;
+};
+
+}}}} // namespace lsst::meas::extensions::multiShapelet
+
+#endif // !MULTISHAPELET_Instrumentation_h_INCLUDED
@@ -23,6 +23,8 @@
 #ifndef MULTISHAPELET_ModelInputHandler_h_INCLUDED
 #define MULTISHAPELET_ModelInputHandler_h_INCLUDED
 
+#include <vector>
+
 #include "lsst/afw/geom.h"
 #include "lsst/afw/geom/ellipses.h"
 #include "lsst/afw/image/Image.h"
@@ -31,6 +33,56 @@
 
 namespace lsst { namespace meas { namespace extensions { namespace multiShapelet {
 
+/**
+ *  @brief A run of consecutive pixels in the same row, in center-subtracted coordinates.
+ *
+ *  This is a compressed representation of the flattened coordinate arrays: pixel
+ *  @c offset+k (for @c 0<=k<size) has coordinates @c (x0+k,y).
+ */
+struct CoordinateSpan {
+    double x0;   ///< center-subtracted X coordinate of the first pixel
+    double y;    ///< center-subtracted Y coordinate of all pixels
+    int offset;  ///< index of the first pixel in the flattened arrays
+    int size;    ///< number of pixels in the span
+};
+
+typedef std::vector<CoordinateSpan> CoordinateSpanList;
+
+/**
+ *  @brief A simple arena for the flattened arrays held by ModelInputHandler.
+ *
+ *  Fitting many sources one after another allocates and frees the same handful of small arrays
+ *  for each one; passing a workspace to the ModelInputHandler constructors carves those arrays
+ *  out of a single buffer instead.  Call reset() between sources to reuse the memory.  Arrays
+ *  returned before a reset() remain valid (they share ownership of the buffer), but will be
+ *  overwritten by later allocations, so a handler must not outlive the next reset() of the
+ *  workspace it was built from.
+ *
+ *  Workspaces are not thread-safe; use one per thread.
+ */
+class ModelInputWorkspace {
+public:
+
+    /// @brief Construct with an initial buffer capacity (in doubles); the buffer grows as needed.
+    explicit ModelInputWorkspace(int capacity=0);
+
+    /// @brief Return a new array of the given size from the buffer.
+    ndarray::Array<double,1,1> allocate(int size);
+
+    /// @brief Make the full buffer available again, invalidating previously-allocated arrays.
+    void reset() { _offset = 0; }
+
+    /// @brief Return the size of the current buffer.
+    int getCapacity() const { return _buffer.getSize<0>(); }
+
+    /// @brief Return the number of elements allocated since the last reset.
+    int getUsed() const { return _offset; }
+
+private:
+    ndarray::Array<double,1,1> _buffer;
+    int _offset;
+};
+
 class ModelInputHandler {
 public:
 
@@ -46,30 +98,38 @@ public:
     /// @brief Per-pixel weights; will be empty if initialized with an Image rather than a MaskedImage.
     ndarray::Array<double const,1,1> getWeights() const  { return _weights; }
 
+    /// @brief Span-compressed form of the X and Y coordinate arrays, in the same pixel order.
+    CoordinateSpanList const & getSpans() const { return _spans; }
+
     /// @brief The number of pixels in the model.
     int getSize() const { return _x.size(); }
     
     /// @brief Return the footprint actually used to flatten the inputs.
     PTR(afw::detection::Footprint) getFootprint() const { return _footprint; }
 
+    /// @brief Return the side length, in image pixels, of each of the model's pixels (1 unless binned).
+    int getBinSize() const { return _binSize; }
+
     template <typename PixelT>
     ModelInputHandler(afw::image::Image<PixelT> const & image, afw::geom::Point2D const & center, 
-                      afw::geom::Box2I const & region);
+                      afw::geom::Box2I const & region, ModelInputWorkspace * workspace=0);
 
     template <typename PixelT>
     ModelInputHandler(afw::image::Image<PixelT> const & image, afw::geom::Point2D const & center, 
-                      afw::detection::Footprint const & region, int growFootprint=0);
+                      afw::detection::Footprint const & region, int growFootprint=0,
+                      ModelInputWorkspace * workspace=0);
 
     template <typename PixelT>
     ModelInputHandler(afw::image::Image<PixelT> const & image, afw::geom::Point2D const & center,
                       std::vector<afw::geom::ellipses::Ellipse> const & ellipses,
-                      afw::detection::Footprint const & region, int growFootprint=0);
+                      afw::detection::Footprint const & region, int growFootprint=0,
+                      ModelInputWorkspace * workspace=0);
     
     template <typename PixelT>
     ModelInputHandler(
         afw::image::MaskedImage<PixelT> const & image, afw::geom::Point2D const & center, 
         afw::geom::Box2I const & region, afw::image::MaskPixel badPixelMask=0x0, bool usePixelWeights=false,
-        double maxBadPixelFraction=1.00
+        double maxBadPixelFraction=1.00, ModelInputWorkspace * workspace=0
     );
 
     template <typename PixelT>
@@ -77,7 +137,7 @@ public:
         afw::image::MaskedImage<PixelT> const & image, afw::geom::Point2D const & center, 
         afw::detection::Footprint const & region, int growFootprint=0,
         afw::image::MaskPixel badPixelMask=0x0, bool usePixelWeights=false,
-        double maxBadPixelFraction=1.00
+        double maxBadPixelFraction=1.00, ModelInputWorkspace * workspace=0
     );
 
     template <typename PixelT>
@@ -86,7 +146,40 @@ public:
         std::vector<afw::geom::ellipses::Ellipse> const & ellipses, 
         afw::detection::Footprint const & region, int growFootprint=0,
         afw::image::MaskPixel badPixelMask=0x0, bool usePixelWeights=false,
-        double maxBadPixelFraction=1.00
+        double maxBadPixelFraction=1.00, ModelInputWorkspace * workspace=0
+    );
+
+    /**
+     *  @brief Construct from the pixels of another handler that lie within the given region.
+     *
+     *  This reuses the coordinates, weighted data and weights already computed for another fit
+     *  (with the same center) rather than re-reading them from the image, so several fits on
+     *  overlapping footprints of the same source need only flatten the image once.  Note that
+     *  when the parent was constructed with usePixelWeights=false, its constant weight is the
+     *  mean over the parent's region, not the new one.
+     */
+    ModelInputHandler(
+        ModelInputHandler const & other, afw::detection::Footprint const & region,
+        ModelInputWorkspace * workspace=0
+    );
+
+    /**
+     *  @brief Construct a coarser version of another handler by summing its pixels in square bins.
+     *
+     *  The bins are binSize x binSize blocks of image pixels, aligned with the image's PARENT
+     *  pixel grid, and every bin containing at least one of the other handler's pixels is kept.
+     *  Coordinates are those of the bin centers in units of bins (still relative to the same
+     *  center), so the spans have a unit step; an ellipse fit to the binned inputs is 1/binSize
+     *  times the size of one fit to the originals, and the footprint is in bin indices.  The data
+     *  are the summed pixel values divided by the square root of their summed variance, and the
+     *  weights are that same inverse standard deviation times the fraction of the bin covered, so
+     *  a model evaluated per unit bin area is compared to the pixels that were actually summed.
+     *  Inputs without weights are treated as having unit variance.
+     *
+     *  The other handler must not itself be binned.
+     */
+    ModelInputHandler(
+        ModelInputHandler const & other, int binSize, ModelInputWorkspace * workspace=0
     );
 
 private:
@@ -94,7 +187,9 @@ private:
     ndarray::Array<double,1,1> _y;
     ndarray::Array<double,1,1> _data;
     ndarray::Array<double,1,1> _weights;
+    CoordinateSpanList _spans;
     PTR(afw::detection::Footprint) _footprint;
+    int _binSize;
 };
 
 }}}} // namespace lsst::meas::extensions::multiShapelet
@@ -57,6 +57,25 @@ public:
         MultiGaussian const & psfMultiGaussian
     ) const;
 
+    /**
+     *  @brief Deconvolve adaptive moments by matching the Gaussian-weighted moments of the profile.
+     *
+     *  fullMoments are treated as adaptive moments W: the second moments of the image, weighted
+     *  by a Gaussian with covariance W, are W/2 (as for a Gaussian image with covariance W).  The
+     *  ellipse of the profile is found by solving the same condition for the profile convolved
+     *  with the PSF, with a few Newton iterations on its three moments starting from deconvolve().
+     *  Unlike deconvolve(), this is exact for profiles of any number of components, but it falls
+     *  back to the deconvolve() result if the solve does not converge to a relative tolerance
+     *  within maxIter iterations.
+     */
+    afw::geom::ellipses::Quadrupole deconvolveWeighted(
+        afw::geom::ellipses::Quadrupole const & fullMoments,
+        afw::geom::ellipses::Quadrupole const & psfMoments,
+        MultiGaussian const & psfMultiGaussian,
+        int maxIter=20,
+        double tolerance=1E-8
+    ) const;
+
     iterator begin() { return _components.begin(); }
     const_iterator begin() const { return _components.begin(); }
 
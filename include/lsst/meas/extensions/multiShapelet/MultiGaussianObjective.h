@@ -23,6 +23,8 @@
 #ifndef MULTISHAPELET_MultiGaussianObjective_h_INCLUDED
 #define MULTISHAPELET_MultiGaussianObjective_h_INCLUDED
 
+#include <algorithm>
+
 #include "lsst/meas/extensions/multiShapelet/MultiGaussian.h"
 #include "lsst/meas/extensions/multiShapelet/HybridOptimizer.h"
 #include "lsst/meas/extensions/multiShapelet/ModelInputHandler.h"
@@ -52,6 +54,101 @@ public:
         ndarray::Array<double,2,-2> const & derivative
     );
 
+    /**
+     *  @brief Compute the function and derivative together in a single tiled pass over the pixels.
+     *
+     *  All Gaussian components are accumulated directly into the model and derivative arrays,
+     *  without evaluating per-component model arrays.  Because the per-component state is not
+     *  updated, computeDerivative() should not be called after this function without an
+     *  intervening call to computeFunction().
+     */
+    virtual void computeFunctionAndDerivative(
+        ndarray::Array<double const,1,1> const & parameters, 
+        ndarray::Array<double,1,1> const & function,
+        ndarray::Array<double,2,-2> const & derivative
+    );
+
+    /// @brief Return true if streaming mode is enabled (see setStreaming()).
+    virtual bool hasNormalEquations() const { return _streaming; }
+
+    /**
+     *  @brief Accumulate the normal equations tile by tile, without any full-size arrays.
+     *
+     *  Each tile's model and derivative are reduced into a few scalar and 3-element sums as soon
+     *  as they are computed, so only ~20 doubles are kept per tile of 256 pixels.  The sums are
+     *  taken relative to the amplitude from the previous evaluation, which keeps round-off in the
+     *  chi^2 small when successive amplitudes are close; the function inf norm is bounded rather
+     *  than computed exactly.  This does not update getModel().
+     */
+    virtual void computeNormalEquations(
+        ndarray::Array<double const,1,1> const & parameters,
+        double & halfChiSq,
+        double & functionInfNorm,
+        ndarray::Array<double,1,1> const & gradient,
+        ndarray::Array<double,2,2> const & normalMatrix
+    );
+
+    /**
+     *  @brief Set whether HybridOptimizer should use computeNormalEquations().
+     *
+     *  Streaming mode is intended for very large footprints, where the optimizer's full-size
+     *  function and derivative arrays would not fit in cache (or memory).
+     */
+    void setStreaming(bool streaming) { _streaming = streaming; }
+
+    /**
+     *  @brief Set whether computeNormalEquations() evaluates the model in single precision.
+     *
+     *  The per-pixel model and derivative of each tile are then evaluated entirely in float (see
+     *  GaussianModelBuilder::addTileModelAndDerivative), and widened to double as they are
+     *  weighted and compared to the data; the residuals, amplitude dot products, and normal
+     *  equations are always accumulated in double.  This only affects streaming mode.
+     */
+    void setSinglePrecision(bool singlePrecision) { _singlePrecision = singlePrecision; }
+
+    /// @brief Return true if the streaming model is evaluated in single precision.
+    bool getSinglePrecision() const { return _singlePrecision; }
+
+    /**
+     *  @brief Set the number of threads used to evaluate the model within a single call.
+     *
+     *  When greater than one (and the library is built with OpenMP), computeFunctionAndDerivative()
+     *  and computeNormalEquations() distribute fixed tiles of pixels over the threads.  Per-tile
+     *  partial sums are always combined in tile order, so results are bitwise identical for any
+     *  number of threads.  computeFunction() and computeDerivative() are always single-threaded.
+     */
+    void setThreads(int nThreads) { _nThreads = std::max(nThreads, 1); }
+
+    /// @brief Return the number of threads used within a single evaluation (see setThreads()).
+    int getThreads() const { return _nThreads; }
+
+    /**
+     *  @brief Return the number of threads that actually ran the last threaded evaluation.
+     *
+     *  This is the size of the OpenMP team for the last call to computeFunctionAndDerivative() or
+     *  computeNormalEquations(); it is always one without OpenMP, and may be less than getThreads()
+     *  if the OpenMP runtime limits the number of threads.
+     */
+    int getThreadsUsed() const { return _threadsUsed; }
+
+    /**
+     *  @brief Drop negligible components and skip pixels far from the center of the others.
+     *
+     *  Components (after convolution) whose flux times PSF amplitude is less than pruneTolerance
+     *  times the total are removed, and the rest are only evaluated within nSigma of their
+     *  ellipse (see GaussianModelBuilder::setCullRadius); a nonpositive value disables either.
+     *  Pruning cannot be undone, so this should be called once, before the first evaluation.
+     */
+    void setCulling(double nSigma, double pruneTolerance);
+
+    /**
+     *  @brief Return an upper bound on the fraction of the model flux neglected due to setCulling().
+     *
+     *  This is the flux of the pruned components plus exp(-nSigma^2/2) times the flux of the
+     *  others, relative to the total flux of all components.
+     */
+    double getApproximationError() const { return _approximationError; }
+
     double getAmplitude() const { return _amplitude; }
     
     ndarray::Array<double const,1,1> getModel() const { return _model; }
@@ -87,6 +184,15 @@ private:
 
     typedef std::vector<GaussianModelBuilder> BuilderList;
 
+    void _finishFunction(ndarray::Array<double,1,1> const & function);
+
+    void _finishDerivative(ndarray::Array<double,2,-2> const & derivative);
+
+    bool _streaming;
+    bool _singlePrecision;
+    int _nThreads;
+    int _threadsUsed;
+    double _approximationError;
     double _minRadius;
     double _minAxisRatio;
     double _amplitude;
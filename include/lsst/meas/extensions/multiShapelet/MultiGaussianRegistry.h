@@ -23,6 +23,11 @@
 #ifndef MULTISHAPELET_MultiGaussianRegistry_h_INCLUDED
 #define MULTISHAPELET_MultiGaussianRegistry_h_INCLUDED
 
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "boost/noncopyable.hpp"
 #include "ndarray.h"
 
 #include "lsst/base.h"
@@ -30,22 +35,82 @@
 
 namespace lsst { namespace meas { namespace extensions { namespace multiShapelet {
 
+/**
+ *  @brief A reference to a profile in MultiGaussianRegistry that can be stored in place of its name.
+ *
+ *  Handles are as cheap to copy as a pointer, and dereferencing one does no lookup, so code that
+ *  uses the same profile for many sources should get a handle once rather than look up the name
+ *  for each one.  A handle remains valid for the life of the process; if its name is registered
+ *  again (which is only possible while MultiGaussianRegistry is not frozen), it refers to the new
+ *  profile.
+ */
+class MultiGaussianHandle {
+public:
+
+    /// @brief Construct a null handle, which must not be dereferenced.
+    MultiGaussianHandle() : _entry(0) {}
+
+    bool isNull() const { return !_entry; }
+
+    /// @brief Return the registered profile.
+    MultiGaussian const & get() const { return _entry->second; }
+
+    MultiGaussian const & operator*() const { return _entry->second; }
+
+    MultiGaussian const * operator->() const { return &_entry->second; }
+
+    /// @brief Return the name the profile was registered with; empty for null handles.
+    std::string getName() const { return _entry ? _entry->first : std::string(); }
+
+    bool operator==(MultiGaussianHandle const & other) const { return _entry == other._entry; }
+    bool operator!=(MultiGaussianHandle const & other) const { return _entry != other._entry; }
+
+private:
+
+    friend class MultiGaussianRegistry;
+
+    typedef std::pair<std::string const, MultiGaussian> Entry;
+
+    explicit MultiGaussianHandle(Entry const * entry) : _entry(entry) {}
+
+    Entry const * _entry;
+};
+
 /**
  *  @brief Namespace/hidden singleton class for registering and retrieving multi-Gaussian
  *         profiles by name.
  *
- *  Lookups are linear in the number of elements, but the most-recently used item is always
- *  checked first.
+ *  Lookups by name are hash-table lookups that never modify the registry, so lookups and handles
+ *  are safe to use from any number of threads without locking, as long as nothing inserts profiles
+ *  at the same time.  Insertions are never synchronized; code that runs fits on several threads
+ *  (e.g. FitProfileAlgorithm::applyBatch) relies on the caller not inserting profiles until they
+ *  return.  Callers that want that enforced can freeze the registry for the duration, usually with
+ *  a ScopedFreeze; while it is frozen, insert() and loadFile() throw instead of racing with the
+ *  readers.  The library itself never freezes the registry.
+ *
+ *  The registry always contains the built-in "tractor-exponential" and "tractor-devaucouleur"
+ *  profiles (normalized to unit flux), which are compiled into the library; other profiles can be
+ *  inserted directly or loaded from a profile file written by saveFile().
  *
- *  This is populated at import time in the Python module.
+ *  Profile files are a compact little-endian binary format: the 8 characters "MGPROFIL", then
+ *  unsigned 32-bit integers for the format version (1) and number of profiles, and for each profile
+ *  a 32-bit name length, the name's characters, a 32-bit component count, and a double flux and
+ *  double radius for each component.
  */
 class MultiGaussianRegistry {
 public:
 
     /// @brief Retrieve the MultiGaussian with the given name or throw NotFoundException.
-    static MultiGaussian const & lookup(std::string const & name);
+    static MultiGaussian const & lookup(std::string const & name) { return *getHandle(name); }
+
+    /// @brief Return a handle to the MultiGaussian with the given name or throw NotFoundException.
+    static MultiGaussianHandle getHandle(std::string const & name);
 
-    /// @brief Insert a new MultiGaussian (replaces if name is already present).
+    /**
+     *  @brief Insert a new MultiGaussian (replaces if name is already present).
+     *
+     *  Throws LogicErrorException if the registry has been frozen.
+     */
     static void insert(std::string const & name, MultiGaussian const & multiGaussian);
 
     /// @brief Insert a new MultiGaussian by passing in separate flux and radius arrays.
@@ -56,6 +121,53 @@ public:
         bool normalize=false
     );
 
+    /**
+     *  @brief Insert all the profiles in a file written by saveFile(), replacing any with the same names.
+     *
+     *  Profiles are inserted exactly as saved, without normalization.  Throws IoErrorException if
+     *  the file cannot be read or is not a valid profile file (in which case nothing is inserted),
+     *  and LogicErrorException if the registry has been frozen.
+     */
+    static void loadFile(std::string const & filename);
+
+    /**
+     *  @brief Write the named profiles to a file that can be read by loadFile().
+     *
+     *  Throws NotFoundException if any of the names is not registered, and IoErrorException if
+     *  the file cannot be written.
+     */
+    static void saveFile(std::string const & filename, std::vector<std::string> const & names);
+
+    /**
+     *  @brief Make insert() and loadFile() throw until a matching call to unfreeze().
+     *
+     *  Freezes nest: the registry stays frozen until unfreeze() has been called once for every call
+     *  to freeze().  Neither function may be called concurrently with insert() or with each other.
+     */
+    static void freeze();
+
+    /// @brief Undo one call to freeze(); throws LogicErrorException if the registry is not frozen.
+    static void unfreeze();
+
+    /// @brief Return true if freeze() has been called more times than unfreeze().
+    static bool isFrozen();
+
+    /**
+     *  @brief Freezes the registry for the lifetime of the guard object.
+     *
+     *  @code
+     *  {
+     *      MultiGaussianRegistry::ScopedFreeze freeze;
+     *      results = FitProfileAlgorithm::applyBatch(ctrl, sources, image, nThreads);
+     *  }
+     *  @endcode
+     */
+    class ScopedFreeze : private boost::noncopyable {
+    public:
+        ScopedFreeze() { MultiGaussianRegistry::freeze(); }
+        ~ScopedFreeze() { MultiGaussianRegistry::unfreeze(); }
+    };
+
 };
 
 }}}} // namespace lsst::meas::extensions::multiShapelet
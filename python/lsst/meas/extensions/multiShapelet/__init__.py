@@ -6,6 +6,10 @@ import lsst.meas.algorithms
 
 algorithms = set(["multishapelet.psf", "multishapelet.exp", "multishapelet.dev", "multishapelet.combo"])
 
+# Produces the same fields as 'algorithms', with exp, dev and combo fit in a single pass over the pixels;
+# use one set or the other, not both.
+jointAlgorithms = set(["multishapelet.psf", "multishapelet.expdev"])
+
 for fieldName in ("multishapelet.exp.flux", "multishapelet.dev.flux", "multishapelet.combo.flux"):
     lsst.meas.algorithms.getApCorrRegistry().insert(fieldName)
 del fieldName
@@ -14,35 +18,41 @@ del fieldName
 class HybridOptimizerConfig(lsst.pex.config.Config):
     pass
 
+@lsst.pex.config.wrap(FitPsfControl)
+class FitPsfConfig(lsst.pex.config.Config):
+    def setDefaults(self):
+        # nested config defaults come from HybridOptimizerControl, not the FitPsfControl constructor
+        self.optimizer.tau = 1E-6
+        self.optimizer.gTol = 1E-6
+
 @lsst.pex.config.wrap(FitProfileControl)
 class FitProfileConfig(lsst.pex.config.Config):
-    pass
+    def setDefaults(self):
+        # nested config defaults come from HybridOptimizerControl, not the FitProfileControl constructor
+        self.optimizer.tau = 1E-2
+        self.optimizer.gTol = 1E-4
 
 class FitExponentialConfig(FitProfileConfig):
     def setDefaults(self):
+        FitProfileConfig.setDefaults(self)
         self.profile = "tractor-exponential"
 
 class FitDeVaucouleurConfig(FitProfileConfig):
     def setDefaults(self):
+        FitProfileConfig.setDefaults(self)
         self.profile = "tractor-devaucouleur"
 
-lsst.meas.algorithms.AlgorithmRegistry.register("multishapelet.psf", FitPsfControl)
+@lsst.pex.config.wrap(FitExpDevControl)
+class FitExpDevConfig(lsst.pex.config.Config):
+    def setDefaults(self):
+        self.exp.profile = "tractor-exponential"
+        self.dev.profile = "tractor-devaucouleur"
+
+lsst.meas.algorithms.AlgorithmRegistry.register("multishapelet.psf", FitPsfControl, FitPsfConfig)
 lsst.meas.algorithms.AlgorithmRegistry.register("multishapelet.exp", FitProfileControl, FitExponentialConfig)
 lsst.meas.algorithms.AlgorithmRegistry.register("multishapelet.dev", FitProfileControl, FitDeVaucouleurConfig)
 lsst.meas.algorithms.AlgorithmRegistry.register("multishapelet.combo", FitComboControl)
-
-def loadProfiles():
-    import os
-    import cPickle
-    root = os.environ["MEAS_EXTENSIONS_MULTISHAPELET_DIR"]
-    for filename in ("tractor.p",):
-        with open(os.path.join(root, "data", filename), "r") as f:
-            d = cPickle.load(f)
-            for k, v in d.iteritems():
-                flux, radius = v
-                MultiGaussianRegistry.insert(k, flux, radius, True)
-loadProfiles()
+lsst.meas.algorithms.AlgorithmRegistry.register("multishapelet.expdev", FitExpDevControl, FitExpDevConfig)
 
 # cleanup namespace
-del loadProfiles
 del lsst
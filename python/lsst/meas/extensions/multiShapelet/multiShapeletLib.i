@@ -7,7 +7,10 @@ Measurement algorithms using galaxy models built from multi-scale shapelets.
 
 %feature("autodoc", "1");
 %module(package="lsst.meas.extensions.multiShapelet", 
-        docstring=meas_extensions_multiShapelet_DOCSTRING) multiShapeletLib
+        docstring=meas_extensions_multiShapelet_DOCSTRING, threads="1") multiShapeletLib
+
+// Only the ArrayBatch functions (which never touch Python objects) release the GIL.
+%nothread;
 
 %{
 #include "lsst/afw/geom.h"
@@ -46,17 +49,30 @@ Measurement algorithms using galaxy models built from multi-scale shapelets.
 
 %template(BoolPair) std::pair<bool,bool>;
 
+// Vectors of types without default constructors can't be built or resized from a size alone.
+%define %batchVector(NAME, TYPE...)
+%ignore std::vector< TYPE >::vector(size_type);
+%ignore std::vector< TYPE >::resize;
+%template(NAME) std::vector< TYPE >;
+%enddef
+
 %declareNumPyConverters(ndarray::Array<double const,1>);
 %declareNumPyConverters(ndarray::Array<double const,1,1>);
 %declareNumPyConverters(ndarray::Array<double,1,1>);
 %declareNumPyConverters(ndarray::Array<double,2,-1>);
 %declareNumPyConverters(ndarray::Array<double,2,-2>);
+%declareNumPyConverters(ndarray::Array<double,2,2>);
+%declareNumPyConverters(ndarray::Array<float,1,1>);
+%declareNumPyConverters(ndarray::Array<float,2,-2>);
+%declareNumPyConverters(ndarray::Array<double const,2,2>);
+%declareNumPyConverters(ndarray::Array<int const,2,2>);
 %declareNumPyConverters(Eigen::Matrix<double,3,Eigen::Dynamic>);
 
 %include "lsst/meas/extensions/multiShapelet/ModelInputHandler.h"
 
 %template(ModelInputHandler) lsst::meas::extensions::multiShapelet::ModelInputHandler::ModelInputHandler<float>;
 %template(ModelInputHandler) lsst::meas::extensions::multiShapelet::ModelInputHandler::ModelInputHandler<double>;
+%template(CoordinateSpanList) std::vector<lsst::meas::extensions::multiShapelet::CoordinateSpan>;
 
 %rename(__len__) lsst::meas::extensions::multiShapelet::MultiGaussian::size;
 %rename(__getitem__) lsst::meas::extensions::multiShapelet::MultiGaussian::operator[];
@@ -70,12 +86,37 @@ def __iter__(self):
 }
 
 %include "lsst/meas/extensions/multiShapelet/GaussianModelBuilder.h"
+%template(addTileModelAndDerivative)
+    lsst::meas::extensions::multiShapelet::GaussianModelBuilder::addTileModelAndDerivative<float>;
+%template(addTileModelAndDerivative)
+    lsst::meas::extensions::multiShapelet::GaussianModelBuilder::addTileModelAndDerivative<double>;
 
 %shared_ptr(lsst::meas::extensions::multiShapelet::Objective);
+// scalar output arguments; only HybridOptimizer needs to call these
+%ignore lsst::meas::extensions::multiShapelet::Objective::computeNormalEquations;
+%ignore lsst::meas::extensions::multiShapelet::MultiGaussianObjective::computeNormalEquations;
 %include "lsst/meas/extensions/multiShapelet/HybridOptimizer.h"
 
+%ignore lsst::meas::extensions::multiShapelet::MultiGaussianHandle::operator*;
+%ignore lsst::meas::extensions::multiShapelet::MultiGaussianHandle::operator->;
+%template(ProfileNameList) std::vector<std::string>;
+%ignore lsst::meas::extensions::multiShapelet::MultiGaussianRegistry::ScopedFreeze;
 %include "lsst/meas/extensions/multiShapelet/MultiGaussianRegistry.h"
 
+%pythoncode %{
+class FrozenRegistry(object):
+    """Context manager that freezes MultiGaussianRegistry for the duration of a with block,
+    like MultiGaussianRegistry::ScopedFreeze in C++."""
+
+    def __enter__(self):
+        MultiGaussianRegistry.freeze()
+        return self
+
+    def __exit__(self, *args):
+        MultiGaussianRegistry.unfreeze()
+        return False
+%}
+
 %shared_ptr(lsst::meas::extensions::multiShapelet::MultiGaussianObjective);
 %returnCopy(lsst::meas::extensions::multiShapelet::MultiGaussianObjective::getInputs);
 %include "lsst/meas/extensions/multiShapelet/MultiGaussianObjective.h"
@@ -103,16 +144,39 @@ namespace lsst { namespace meas { namespace extensions { namespace multiShapelet
 
 }}}} // namespace lsst::meas::extensions::multiShapelet
 
+%shared_ptr(lsst::meas::extensions::multiShapelet::FitStatisticsKeys);
+%shared_ptr(lsst::meas::extensions::multiShapelet::FitStatisticsSummary);
+%include "lsst/meas/extensions/multiShapelet/Instrumentation.h"
+
 %shared_ptr(lsst::meas::extensions::multiShapelet::FitPsfControl);
 %shared_ptr(lsst::meas::extensions::multiShapelet::FitPsfAlgorithm);
+namespace lsst { namespace meas { namespace extensions { namespace multiShapelet {
+struct FitPsfModel;
+}}}} // namespace lsst::meas::extensions::multiShapelet
+%template(PointList) std::vector<lsst::afw::geom::Point2D>;
+%batchVector(FitPsfModelList, lsst::meas::extensions::multiShapelet::FitPsfModel)
 %include "lsst/meas/extensions/multiShapelet/FitPsf.h"
 
+%include "lsst/meas/extensions/multiShapelet/ConvolvedProfileTemplate.h"
+
 %shared_ptr(lsst::meas::extensions::multiShapelet::FitProfileControl);
 %shared_ptr(lsst::meas::extensions::multiShapelet::FitProfileAlgorithm);
+namespace lsst { namespace meas { namespace extensions { namespace multiShapelet {
+struct FitProfileModel;
+struct FitProfileBatchInput;
+struct FitProfileForcedBatchInput;
+}}}} // namespace lsst::meas::extensions::multiShapelet
+%batchVector(FitProfileModelList, lsst::meas::extensions::multiShapelet::FitProfileModel)
+%batchVector(FitProfileBatchInputList, lsst::meas::extensions::multiShapelet::FitProfileBatchInput)
+%batchVector(FitProfileForcedBatchInputList, lsst::meas::extensions::multiShapelet::FitProfileForcedBatchInput)
 %include "lsst/meas/extensions/multiShapelet/FitProfile.h"
 
 %template(adjustInputs) lsst::meas::extensions::multiShapelet::FitProfileAlgorithm::adjustInputs<float>;
 %template(adjustInputs) lsst::meas::extensions::multiShapelet::FitProfileAlgorithm::adjustInputs<double>;
+%template(applyBatch) lsst::meas::extensions::multiShapelet::FitProfileAlgorithm::applyBatch<float>;
+%template(applyBatch) lsst::meas::extensions::multiShapelet::FitProfileAlgorithm::applyBatch<double>;
+%template(applyForcedBatch) lsst::meas::extensions::multiShapelet::FitProfileAlgorithm::applyForcedBatch<float>;
+%template(applyForcedBatch) lsst::meas::extensions::multiShapelet::FitProfileAlgorithm::applyForcedBatch<double>;
 
 %shared_ptr(lsst::meas::extensions::multiShapelet::FitComboControl);
 %shared_ptr(lsst::meas::extensions::multiShapelet::FitComboAlgorithm);
@@ -120,3 +184,53 @@ namespace lsst { namespace meas { namespace extensions { namespace multiShapelet
 
 %template(adjustInputs) lsst::meas::extensions::multiShapelet::FitComboAlgorithm::adjustInputs<float>;
 %template(adjustInputs) lsst::meas::extensions::multiShapelet::FitComboAlgorithm::adjustInputs<double>;
+
+%shared_ptr(lsst::meas::extensions::multiShapelet::FitExpDevControl);
+%shared_ptr(lsst::meas::extensions::multiShapelet::FitExpDevAlgorithm);
+%include "lsst/meas/extensions/multiShapelet/FitExpDev.h"
+
+%template(adjustInputs) lsst::meas::extensions::multiShapelet::FitExpDevAlgorithm::adjustInputs<float>;
+%template(adjustInputs) lsst::meas::extensions::multiShapelet::FitExpDevAlgorithm::adjustInputs<double>;
+
+%thread lsst::meas::extensions::multiShapelet::ArrayBatch::fitPsf;
+%thread lsst::meas::extensions::multiShapelet::ArrayBatch::fitProfile;
+%include "lsst/meas/extensions/multiShapelet/ArrayBatch.h"
+
+%template(fitProfile) lsst::meas::extensions::multiShapelet::ArrayBatch::fitProfile<float>;
+%template(fitProfile) lsst::meas::extensions::multiShapelet::ArrayBatch::fitProfile<double>;
+
+%pythoncode %{
+import numpy
+
+def makePsfBatchArray(ctrl, size):
+    """Return a zeroed structured array that can be passed as the output of ArrayBatch.fitPsf."""
+    nInner = (ctrl.innerOrder + 1) * (ctrl.innerOrder + 2) / 2
+    nOuter = (ctrl.outerOrder + 1) * (ctrl.outerOrder + 2) / 2
+    dtype = numpy.dtype([("flag", float), ("ixx", float), ("iyy", float), ("ixy", float),
+                         ("chisq", float), ("inner", float, nInner), ("outer", float, nOuter)])
+    return numpy.zeros(size, dtype=dtype)
+
+def makeProfileBatchArray(size):
+    """Return a zeroed structured array that can be passed as the output of ArrayBatch.fitProfile."""
+    dtype = numpy.dtype([("flag", float), ("flux", float), ("fluxErr", float), ("ixx", float),
+                         ("iyy", float), ("ixy", float), ("chisq", float)])
+    return numpy.zeros(size, dtype=dtype)
+
+def _asColumns(array):
+    """Return a 2-d float view of a (contiguous, all-float) structured array, without copying."""
+    if array.dtype.fields is None:
+        return array
+    if not array.flags.c_contiguous or array.dtype.itemsize % 8 != 0 \
+            or not all(array.dtype.fields[name][0].base == numpy.float64 for name in array.dtype.names):
+        raise TypeError("Batch arrays must be C-contiguous with only float64 fields")
+    return array.view(numpy.float64).reshape(array.shape[0], -1)
+
+def fitPsfArrays(ctrl, psf, centers, output, nThreads=1):
+    """Call ArrayBatch.fitPsf, with output a 2-d array or one from makePsfBatchArray."""
+    ArrayBatch.fitPsf(ctrl, psf, centers, _asColumns(output), nThreads)
+
+def fitProfileArrays(ctrl, psfCtrl, image, centers, shapes, stamps, psfModels, output, nThreads=1):
+    """Call ArrayBatch.fitProfile, with psfModels and output 2-d or structured batch arrays."""
+    ArrayBatch.fitProfile(ctrl, psfCtrl, image, centers, shapes, stamps, _asColumns(psfModels),
+                          _asColumns(output), nThreads)
+%}
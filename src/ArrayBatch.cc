@@ -0,0 +1,182 @@
+// -*- lsst-c++ -*-
+/* 
+ * LSST Data Management System
+ * Copyright 2012 LSST Corporation.
+ * 
+ * This product includes software developed by the
+ * LSST Project (http://www.lsst.org/).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the LSST License Statement and 
+ * the GNU General Public License along with this program.  If not, 
+ * see <http://www.lsstcorp.org/LegalNotices/>.
+ */
+
+#include <limits>
+
+#include "boost/make_shared.hpp"
+
+#include "lsst/utils/ieee.h"
+#include "lsst/meas/extensions/multiShapelet/ArrayBatch.h"
+
+namespace lsst { namespace meas { namespace extensions { namespace multiShapelet {
+
+namespace {
+
+void checkShape(
+    char const * name, ndarray::Array<double const,2,2> const & array, int rows, int columns
+) {
+    if (array.getSize<0>() != rows || array.getSize<1>() != columns) {
+        throw LSST_EXCEPT(
+            pex::exceptions::LengthErrorException,
+            (boost::format("%s array has shape (%d, %d); expected (%d, %d)")
+             % name % array.getSize<0>() % array.getSize<1>() % rows % columns).str()
+        );
+    }
+}
+
+void writePsfModel(FitPsfModel const & model, ndarray::Array<double,1,1> const & row) {
+    if (model.hasFailed() || !(model.ellipse.getArea() > 0.0)) {
+        row.deep() = std::numeric_limits<double>::quiet_NaN();
+        row[ArrayBatch::PSF_FLAG] = 1.0;
+        return;
+    }
+    int const nInner = model.inner.getSize<0>();
+    int const nOuter = model.outer.getSize<0>();
+    row[ArrayBatch::PSF_FLAG] = 0.0;
+    row[ArrayBatch::PSF_IXX] = model.ellipse.getIxx();
+    row[ArrayBatch::PSF_IYY] = model.ellipse.getIyy();
+    row[ArrayBatch::PSF_IXY] = model.ellipse.getIxy();
+    row[ArrayBatch::PSF_CHISQ] = model.chisq;
+    row.asEigen().segment(ArrayBatch::PSF_COEFFICIENTS, nInner) = model.inner.asEigen();
+    row.asEigen().segment(ArrayBatch::PSF_COEFFICIENTS + nInner, nOuter) = model.outer.asEigen();
+}
+
+// Failed PSF fits are returned as placeholders, which FitProfileAlgorithm::applyBatch skips.
+FitPsfModel readPsfModel(FitPsfControl const & ctrl, ndarray::Array<double const,1,1> const & row) {
+    FitPsfModel model(ctrl);
+    if (row[ArrayBatch::PSF_FLAG] != 0.0) {
+        return model;
+    }
+    int const nInner = model.inner.getSize<0>();
+    int const nOuter = model.outer.getSize<0>();
+    model.ellipse = afw::geom::ellipses::Quadrupole(
+        row[ArrayBatch::PSF_IXX], row[ArrayBatch::PSF_IYY], row[ArrayBatch::PSF_IXY]
+    );
+    model.chisq = row[ArrayBatch::PSF_CHISQ];
+    model.inner.asEigen() = row.asEigen().segment(ArrayBatch::PSF_COEFFICIENTS, nInner);
+    model.outer.asEigen() = row.asEigen().segment(ArrayBatch::PSF_COEFFICIENTS + nInner, nOuter);
+    return model;
+}
+
+void writeProfileModel(FitProfileModel const & model, ndarray::Array<double,1,1> const & row) {
+    if (model.fluxFlag && !lsst::utils::isfinite(model.flux)) {
+        row.deep() = std::numeric_limits<double>::quiet_NaN();
+        row[ArrayBatch::PROFILE_FLAG] = 1.0;
+        return;
+    }
+    row[ArrayBatch::PROFILE_FLAG] = model.fluxFlag ? 1.0 : 0.0;
+    row[ArrayBatch::PROFILE_FLUX] = model.flux;
+    row[ArrayBatch::PROFILE_FLUX_ERR] = model.fluxErr;
+    row[ArrayBatch::PROFILE_IXX] = model.ellipse.getIxx();
+    row[ArrayBatch::PROFILE_IYY] = model.ellipse.getIyy();
+    row[ArrayBatch::PROFILE_IXY] = model.ellipse.getIxy();
+    row[ArrayBatch::PROFILE_CHISQ] = model.chisq;
+}
+
+} // anonymous
+
+int ArrayBatch::getPsfColumnCount(FitPsfControl const & ctrl) {
+    return PSF_COEFFICIENTS + shapelet::computeSize(ctrl.innerOrder) + shapelet::computeSize(ctrl.outerOrder);
+}
+
+void ArrayBatch::fitPsf(
+    FitPsfControl const & ctrl,
+    afw::detection::Psf const & psf,
+    ndarray::Array<double const,2,2> const & centers,
+    ndarray::Array<double,2,2> const & output,
+    int nThreads
+) {
+    int const size = centers.getSize<0>();
+    checkShape("Center", centers, size, 2);
+    checkShape("PSF output", output, size, getPsfColumnCount(ctrl));
+    std::vector<afw::geom::Point2D> points;
+    points.reserve(size);
+    for (int i = 0; i < size; ++i) {
+        points.push_back(afw::geom::Point2D(centers[i][0], centers[i][1]));
+    }
+    std::vector<FitPsfModel> models = FitPsfAlgorithm::applyBatch(ctrl, psf, points, nThreads);
+    for (int i = 0; i < size; ++i) {
+        writePsfModel(models[i], output[i]);
+    }
+}
+
+template <typename PixelT>
+void ArrayBatch::fitProfile(
+    FitProfileControl const & ctrl,
+    FitPsfControl const & psfCtrl,
+    afw::image::MaskedImage<PixelT> const & image,
+    ndarray::Array<double const,2,2> const & centers,
+    ndarray::Array<double const,2,2> const & shapes,
+    ndarray::Array<int const,2,2> const & stamps,
+    ndarray::Array<double const,2,2> const & psfModels,
+    ndarray::Array<double,2,2> const & output,
+    int nThreads
+) {
+    int const size = centers.getSize<0>();
+    checkShape("Center", centers, size, 2);
+    checkShape("Shape", shapes, size, 3);
+    checkShape("PSF model", psfModels, size, getPsfColumnCount(psfCtrl));
+    checkShape("Profile output", output, size, PROFILE_COLUMN_COUNT);
+    if (stamps.getSize<0>() != size || stamps.getSize<1>() != 4) {
+        throw LSST_EXCEPT(
+            pex::exceptions::LengthErrorException,
+            (boost::format("Stamp array has shape (%d, %d); expected (%d, 4)")
+             % stamps.getSize<0>() % stamps.getSize<1>() % size).str()
+        );
+    }
+    std::vector<FitProfileBatchInput> sources;
+    sources.reserve(size);
+    for (int i = 0; i < size; ++i) {
+        afw::geom::Box2I box(
+            afw::geom::Point2I(stamps[i][0], stamps[i][1]), afw::geom::Extent2I(stamps[i][2], stamps[i][3])
+        );
+        box.clip(image.getBBox(afw::image::PARENT));
+        sources.push_back(
+            FitProfileBatchInput(
+                box.isEmpty() ? PTR(afw::detection::Footprint)()
+                              : boost::make_shared<afw::detection::Footprint>(box),
+                afw::geom::Point2D(centers[i][0], centers[i][1]),
+                afw::geom::ellipses::Quadrupole(shapes[i][0], shapes[i][1], shapes[i][2]),
+                readPsfModel(psfCtrl, psfModels[i])
+            )
+        );
+    }
+    std::vector<FitProfileModel> models = FitProfileAlgorithm::applyBatch(ctrl, sources, image, nThreads);
+    for (int i = 0; i < size; ++i) {
+        writeProfileModel(models[i], output[i]);
+    }
+}
+
+#define INSTANTIATE_fitProfile(PIXELT) \
+template \
+void ArrayBatch::fitProfile(                                            \
+    FitProfileControl const&, FitPsfControl const&,                     \
+    afw::image::MaskedImage<PIXELT, unsigned short, float> const&,      \
+    ndarray::Array<double const,2,2> const&, ndarray::Array<double const,2,2> const&, \
+    ndarray::Array<int const,2,2> const&, ndarray::Array<double const,2,2> const&, \
+    ndarray::Array<double,2,2> const&, int)
+
+INSTANTIATE_fitProfile(float);
+INSTANTIATE_fitProfile(double);
+
+}}}} // namespace lsst::meas::extensions::multiShapelet
@@ -0,0 +1,74 @@
+// -*- lsst-c++ -*-
+/* 
+ * LSST Data Management System
+ * Copyright 2012 LSST Corporation.
+ * 
+ * This product includes software developed by the
+ * LSST Project (http://www.lsst.org/).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the LSST License Statement and 
+ * the GNU General Public License along with this program.  If not, 
+ * see <http://www.lsstcorp.org/LegalNotices/>.
+ */
+
+#include "boost/make_shared.hpp"
+
+#include "lsst/shapelet/MultiShapeletFunction.h"
+#include "lsst/meas/extensions/multiShapelet/ConvolvedProfileTemplate.h"
+
+namespace lsst { namespace meas { namespace extensions { namespace multiShapelet {
+
+ConvolvedProfileTemplate::ConvolvedProfileTemplate(
+    MultiGaussian const & profile, FitPsfModel const & psfModel
+) {
+    typedef shapelet::MultiShapeletFunction MSF;
+    MSF psf = psfModel.asMultiShapelet();
+    // Convolution multiplies integrals, so the normalization is just the product of the profile
+    // and PSF integrals; the profile's shapelet coefficients are flux / FLUX_FACTOR.
+    double norm = profile.integrate() * psf.evaluate().integrate()
+        * shapelet::ShapeletFunction::FLUX_FACTOR;
+    _components.reserve(profile.size());
+    for (MultiGaussian::const_iterator i = profile.begin(); i != profile.end(); ++i) {
+        Component component;
+        component.radius = i->radius;
+        component.amplitude = i->flux / norm;
+        _components.push_back(component);
+    }
+    _convolutions.reserve(psf.getElements().size());
+    for (MSF::ElementList::const_iterator j = psf.getElements().begin(); j != psf.getElements().end(); ++j) {
+        _convolutions.push_back(boost::make_shared<shapelet::HermiteConvolution>(0, *j));
+    }
+}
+
+void ConvolvedProfileTemplate::addModelVector(
+    afw::geom::ellipses::BaseCore const & ellipse,
+    shapelet::ModelBuilder<double> & builder,
+    ndarray::Array<double,1,1> const & output,
+    double weight
+) const {
+    for (ComponentList::const_iterator i = _components.begin(); i != _components.end(); ++i) {
+        for (ConvolutionList::const_iterator j = _convolutions.begin(); j != _convolutions.end(); ++j) {
+            afw::geom::ellipses::Ellipse convolved(ellipse);
+            convolved.getCore().scale(i->radius);
+            // evaluate() replaces the ellipse with the convolved one, and returns the matrix that
+            // maps the (single) unconvolved coefficient to the convolved coefficients.
+            ndarray::Array<double const,2,2> matrix = (**j).evaluate(convolved);
+            ndarray::Array<double,1,1> coefficients = ndarray::allocate(matrix.getSize<0>());
+            coefficients.asEigen() = matrix.asEigen().col(0) * (weight * i->amplitude);
+            builder.update(convolved.getCore());
+            builder.addModelVector((**j).getRowOrder(), coefficients, output);
+        }
+    }
+}
+
+}}}} // namespace lsst::meas::extensions::multiShapelet
@@ -24,7 +24,6 @@
 #include "lsst/utils/ieee.h"
 #include "lsst/meas/extensions/multiShapelet/FitCombo.h"
 #include "lsst/shapelet/ModelBuilder.h"
-#include "lsst/afw/math/LeastSquares.h"
 #include "lsst/afw/detection/FootprintArray.h"
 #include "lsst/afw/detection/FootprintArray.cc"
 
@@ -39,22 +38,24 @@ PTR(algorithms::AlgorithmControl) FitComboControl::_clone() const {
 
 PTR(algorithms::Algorithm) FitComboControl::_makeAlgorithm(
     afw::table::Schema & schema,
-    PTR(daf::base::PropertyList) const & metxadata,
+    PTR(daf::base::PropertyList) const & metadata,
     algorithms::AlgorithmMap const & others,
     bool isForced
 ) const {
-    return boost::make_shared<FitComboAlgorithm>(*this, boost::ref(schema), others);
+    return boost::make_shared<FitComboAlgorithm>(*this, boost::ref(schema), others, metadata);
 }
 
 //------------ FitComboModel ------------------------------------------------------------------------------
 
 FitComboModel::FitComboModel(FitComboControl const & ctrl) :
     devFrac(0.0),
-    flux(std::numeric_limits<double>::quiet_NaN()), fluxErr(std::numeric_limits<double>::quiet_NaN())
+    flux(std::numeric_limits<double>::quiet_NaN()), fluxErr(std::numeric_limits<double>::quiet_NaN()),
+    fluxFlag(true), stats()
 {}
 
 FitComboModel::FitComboModel(FitComboModel const & other) :
-    devFrac(other.devFrac), flux(other.flux), fluxErr(other.fluxErr)
+    devFrac(other.devFrac), flux(other.flux), fluxErr(other.fluxErr), fluxFlag(other.fluxFlag),
+    stats(other.stats)
 {}
 
 FitComboModel & FitComboModel::operator=(FitComboModel const & other) {
@@ -62,6 +63,8 @@ FitComboModel & FitComboModel::operator=(FitComboModel const & other) {
         devFrac = other.devFrac;
         flux = other.flux;
         fluxErr = other.fluxErr;
+        fluxFlag = other.fluxFlag;
+        stats = other.stats;
     }
     return *this;
 }
@@ -95,7 +98,8 @@ CONST_PTR(Ctrl) getDependency(algorithms::AlgorithmMap const & others, std::stri
 FitComboAlgorithm::FitComboAlgorithm(
     FitComboControl const & ctrl,
     afw::table::Schema & schema,
-    algorithms::AlgorithmMap const & others
+    algorithms::AlgorithmMap const & others,
+    PTR(daf::base::PropertyList) const & metadata
 ) :
     algorithms::Algorithm(ctrl),
     _fluxKeys(
@@ -112,7 +116,12 @@ FitComboAlgorithm::FitComboAlgorithm(
     _expComponentCtrl(getDependency<FitProfileControl>(others, ctrl.expName)),
     _devComponentCtrl(getDependency<FitProfileControl>(others, ctrl.devName)),
     _psfCtrl(getDependency<FitPsfControl>(others, ctrl.psfName))
-{}
+{
+    if (ctrl.instrument) {
+        _statsKeys = boost::make_shared<FitStatisticsKeys>(boost::ref(schema), ctrl.name, false);
+        _statsSummary = boost::make_shared<FitStatisticsSummary>(metadata, ctrl.name);
+    }
+}
 
 template <typename PixelT>
 ModelInputHandler FitComboAlgorithm::adjustInputs(
@@ -144,26 +153,95 @@ ModelInputHandler FitComboAlgorithm::adjustInputs(
 namespace {
 
 // helper function for FitComboAlgorithm::apply
-void buildComponentModel(
-    FitProfileModel const & component,
+void buildComponentModels(
     FitPsfModel const & psfModel,
-    shapelet::ModelBuilder<double> & builder,
+    FitProfileModel const & expComponent,
+    FitProfileModel const & devComponent,
     ModelInputHandler const & inputs,
-    ndarray::Array<double,1,1> const & output,
-    double weight = 1.0
+    bool useApproximateExp,
+    ndarray::Array<double,2,2> const & output
 ) {
-    typedef shapelet::MultiShapeletFunction MSF;
-   MSF msf = component.asMultiShapelet(afw::geom::Point2D())
-       .convolve(psfModel.asMultiShapelet());
-   msf.normalize(weight);
-   for (
-       MSF::ElementList::const_iterator i = msf.getElements().begin();
-       i != msf.getElements().end();
-       ++i
-   ) {
-       builder.update(i->getEllipse().getCore());
-       builder.addModelVector(i->getOrder(), i->getCoefficients(), output);
-   }
+    output.deep() = 0.0;
+    shapelet::ModelBuilder<double> builder(inputs.getX(), inputs.getY(), useApproximateExp);
+    ConvolvedProfileTemplate(expComponent.getMultiGaussian(), psfModel)
+        .addModelVector(expComponent.ellipse, builder, output[0]);
+    ConvolvedProfileTemplate(devComponent.getMultiGaussian(), psfModel)
+        .addModelVector(devComponent.ellipse, builder, output[1]);
+    if (!inputs.getWeights().isEmpty()) {
+        for (int n = 0; n < 2; ++n) {
+            output[n].asEigen<Eigen::ArrayXpr>() *= inputs.getWeights().asEigen<Eigen::ArrayXpr>();
+        }
+    }
+}
+
+void checkComponentModels(
+    ModelInputHandler const & inputs,
+    ndarray::Array<double const,2,2> const & componentModels
+) {
+    if (componentModels.getSize<0>() != 2 || componentModels.getSize<1>() != inputs.getSize()) {
+        throw LSST_EXCEPT(
+            pex::exceptions::LengthErrorException,
+            (boost::format("Component model array has shape (%d, %d); expected (2, %d)")
+             % componentModels.getSize<0>() % componentModels.getSize<1>() % inputs.getSize()).str()
+        );
+    }
+}
+
+// Normal equations for the fluxes of the two components, accumulated in a single pass over the
+// (already weighted) component models and data.
+struct ComboNormalEquations {
+    Eigen::Matrix2d fisher;
+    Eigen::Vector2d rhs;
+
+    ComboNormalEquations(
+        ModelInputHandler const & inputs,
+        ndarray::Array<double const,2,2> const & componentModels
+    ) {
+        double const * expModel = componentModels[0].getData();
+        double const * devModel = componentModels[1].getData();
+        double const * data = inputs.getData().getData();
+        double f00 = 0.0, f01 = 0.0, f11 = 0.0, r0 = 0.0, r1 = 0.0;
+        for (int i = 0, n = inputs.getSize(); i < n; ++i) {
+            f00 += expModel[i] * expModel[i];
+            f01 += expModel[i] * devModel[i];
+            f11 += devModel[i] * devModel[i];
+            r0 += expModel[i] * data[i];
+            r1 += devModel[i] * data[i];
+        }
+        fisher << f00, f01, f01, f11;
+        rhs << r0, r1;
+    }
+};
+
+// Solve the two-parameter non-negative least squares problem exactly, setting the fluxes and
+// uncertainty of the model.  If the unconstrained solution is not non-negative, the minimum lies
+// on one of the boundaries, where the problem is one-dimensional; the error is then that of the
+// one-component fit.
+void solveNonNegative(ComboNormalEquations const & eq, FitComboModel & model) {
+    Eigen::Matrix2d const & f = eq.fisher;
+    double det = f(0,0) * f(1,1) - f(0,1) * f(0,1);
+    if (det > 0.0) {
+        double expFlux = (f(1,1) * eq.rhs[0] - f(0,1) * eq.rhs[1]) / det;
+        double devFlux = (f(0,0) * eq.rhs[1] - f(0,1) * eq.rhs[0]) / det;
+        if (expFlux >= 0.0 && devFlux >= 0.0) {
+            model.flux = expFlux + devFlux;
+            model.devFrac = devFlux / model.flux;
+            // variance of the sum of the fluxes is the sum of the elements of the inverse Fisher matrix
+            model.fluxErr = std::sqrt((f(0,0) + f(1,1) - 2.0 * f(0,1)) / det);
+            return;
+        }
+    }
+    // Compare the chi^2 reductions rhs^2/fisher of the feasible one-component fits.
+    bool expOk = eq.rhs[0] > 0.0 && f(0,0) > 0.0;
+    bool devOk = eq.rhs[1] > 0.0 && f(1,1) > 0.0;
+    if (!expOk && !devOk) {
+        throw LSST_EXCEPT(pex::exceptions::RuntimeErrorException, "measured negative flux");
+    }
+    int k = (devOk && (!expOk || eq.rhs[1] * eq.rhs[1] * f(0,0) > eq.rhs[0] * eq.rhs[0] * f(1,1)))
+        ? 1 : 0;
+    model.devFrac = k;
+    model.flux = eq.rhs[k] / f(k,k);
+    model.fluxErr = std::sqrt(1.0 / f(k,k));
 }
 
 } // anonymous
@@ -175,51 +253,85 @@ FitComboModel FitComboAlgorithm::apply(
     FitProfileModel const & devComponent,
     ModelInputHandler const & inputs
 ) {
+    StageTimer timer;
+    ndarray::Array<double,2,2> componentModels = ndarray::allocate(2, inputs.getSize());
+    buildComponentModels(psfModel, expComponent, devComponent, inputs, ctrl.useApproximateExp,
+                         componentModels);
+    FitComboModel model = apply(ctrl, expComponent, devComponent, inputs, componentModels);
+    model.stats.linearTime = timer.lap();
+    return model;
+}
+
+FitComboModel FitComboAlgorithm::apply(
+    FitComboControl const & ctrl,
+    FitProfileModel const & expComponent,
+    FitProfileModel const & devComponent,
+    ModelInputHandler const & inputs,
+    ndarray::Array<double const,2,2> const & componentModels
+) {
+    StageTimer timer;
+    checkComponentModels(inputs, componentModels);
     FitComboModel model(ctrl);
-    typedef shapelet::MultiShapeletFunction MSF;
-    ndarray::Array<double,2,2> matrixT = ndarray::allocate(2, inputs.getSize());
-    shapelet::ModelBuilder<double> builder(inputs.getX(), inputs.getY(), ctrl.useApproximateExp);
-    ndarray::Array<double,2,-2> matrix(matrixT.transpose());
-    matrixT.deep() = 0.0;
-    buildComponentModel(expComponent, psfModel, builder, inputs, matrixT[0]);
-    if (!inputs.getWeights().isEmpty()) {
-        matrixT[0].asEigen<Eigen::ArrayXpr>() *= inputs.getWeights().asEigen<Eigen::ArrayXpr>();
-    }
-    buildComponentModel(devComponent, psfModel, builder, inputs, matrixT[1]);
-    if (!inputs.getWeights().isEmpty()) {
-        matrixT[1].asEigen<Eigen::ArrayXpr>() *= inputs.getWeights().asEigen<Eigen::ArrayXpr>();
-    }
-    // We should really do constrained linear least squares to get the errors right, but this
-    // produces the same result for the fluxes, and we don't have a constrained solver handy.
-    afw::math::LeastSquares lstsq = afw::math::LeastSquares::fromDesignMatrix(matrix, inputs.getData());
-    if (lstsq.getSolution()[0] < 0.0) {
-        if (lstsq.getSolution()[1] < 0.0) {
-            throw LSST_EXCEPT(pex::exceptions::RuntimeErrorException, "measured negative flux");
-        }
-        model.devFrac = 1.0;
-        model.flux = devComponent.flux;
-        model.fluxErr = devComponent.fluxErr;
-    } else if (lstsq.getSolution()[1] < 0.0) {
-        model.devFrac = 0.0;
-        model.flux = expComponent.flux;
-        model.fluxErr = expComponent.fluxErr;
-    } else {
-        model.flux = lstsq.getSolution().asEigen().sum();
-        model.devFrac = lstsq.getSolution()[1] / model.flux;
-#if 0 // don't know why this doesn't work; numbers are way too big
-        model.fluxErr = std::sqrt(
-            lstsq.getSolution().asEigen().dot(
-                lstsq.getCovariance().asEigen() * lstsq.getSolution().asEigen()
-            )
-        );
-#else // this is incorrect, but a good-enough workaround for now: weighted average in quadrature
-        model.fluxErr = std::sqrt(expComponent.fluxErr * expComponent.fluxErr * (1.0 - model.devFrac)
-                                  + devComponent.fluxErr * devComponent.fluxErr * model.devFrac);
-#endif
-    }
+    solveNonNegative(ComboNormalEquations(inputs, componentModels), model);
+    model.fluxFlag = false;
+    model.stats.linearTime = timer.lap();
+    return model;
+}
+
+FitComboModel FitComboAlgorithm::applyForced(
+    FitComboControl const & ctrl,
+    FitPsfModel const & psfModel,
+    FitProfileModel const & expComponent,
+    FitProfileModel const & devComponent,
+    double devFrac,
+    ModelInputHandler const & inputs
+) {
+    StageTimer timer;
+    ndarray::Array<double,2,2> componentModels = ndarray::allocate(2, inputs.getSize());
+    buildComponentModels(psfModel, expComponent, devComponent, inputs, false, componentModels);
+    FitComboModel model = applyForced(ctrl, expComponent, devComponent, devFrac, inputs, componentModels);
+    model.stats.linearTime = timer.lap();
+    return model;
+}
+
+FitComboModel FitComboAlgorithm::applyForced(
+    FitComboControl const & ctrl,
+    FitProfileModel const & expComponent,
+    FitProfileModel const & devComponent,
+    double devFrac,
+    ModelInputHandler const & inputs,
+    ndarray::Array<double const,2,2> const & componentModels
+) {
+    StageTimer timer;
+    checkComponentModels(inputs, componentModels);
+    FitComboModel model(ctrl);
+    model.devFrac = devFrac;
+    // 1-d linear least squares for the flux of the fixed combination of the components
+    ComboNormalEquations eq(inputs, componentModels);
+    Eigen::Vector2d fractions(1.0 - model.devFrac, model.devFrac);
+    double a = fractions.dot(eq.fisher * fractions);
+    double b = fractions.dot(eq.rhs);
+    model.flux = b / a;
+    model.fluxErr = std::sqrt(1.0 / a);
+    model.fluxFlag = false;
+    model.stats.linearTime = timer.lap();
     return model;
 }
 
+void FitComboAlgorithm::fillRecord(afw::table::SourceRecord & source, FitComboModel const & model) const {
+    source.set(_devFracKey, model.devFrac);
+    source.set(_fluxKeys.meas, model.flux);
+    source.set(_fluxKeys.err, model.fluxErr);
+    source.set(_fluxKeys.flag, model.fluxFlag);
+    if (_statsKeys) {
+        _statsKeys->set(source, model.stats);
+    }
+}
+
+void FitComboAlgorithm::flushStatistics() const {
+    if (_statsSummary) _statsSummary->flush();
+}
+
 template <typename PixelT>
 void FitComboAlgorithm::_apply(
     afw::table::SourceRecord & source,
@@ -241,16 +353,17 @@ void FitComboAlgorithm::_apply(
     }
     assert(lsst::utils::isfinite(expComponent.ellipse.getArea()));
     assert(lsst::utils::isfinite(devComponent.ellipse.getArea()));
+    StageTimer timer;
     ModelInputHandler inputs = adjustInputs(
         getControl(), psfModel, expComponent, devComponent, *source.getFootprint(),
         exposure.getMaskedImage(), center
     );
+    double inputsTime = timer.lap();
     FitComboModel model = apply(getControl(), psfModel, expComponent, devComponent, inputs);
+    model.stats.inputsTime = inputsTime;
 
-    source.set(_devFracKey, model.devFrac);
-    source.set(_fluxKeys.meas, model.flux);
-    source.set(_fluxKeys.err, model.fluxErr);
-    source.set(_fluxKeys.flag, false);
+    fillRecord(source, model);
+    if (_statsSummary) _statsSummary->add(model.stats);
 }
 
 
@@ -278,30 +391,20 @@ void FitComboAlgorithm::_applyForced(
     assert(lsst::utils::isfinite(expComponent.ellipse.getArea()));
     assert(lsst::utils::isfinite(devComponent.ellipse.getArea()));
     afw::table::SubSchema s = reference.getSchema()[getControl().name];
+    StageTimer timer;
     ModelInputHandler inputs = adjustInputs(
         getControl(), psfModel, expComponent, devComponent, *source.getFootprint(),
         exposure.getMaskedImage(), center
     );
-    FitComboModel model(getControl());
-    model.devFrac = reference.get(s.find<float>("devfrac").key);
-    shapelet::ModelBuilder<double> builder(inputs.getX(), inputs.getY());
-    ndarray::Array<double,1,1> matrix = ndarray::allocate(inputs.getSize());
-    matrix.deep() = 0.0;
-    buildComponentModel(expComponent, psfModel, builder, inputs, matrix, 1.0 - model.devFrac);
-    buildComponentModel(devComponent, psfModel, builder, inputs, matrix, model.devFrac);
-    if (!inputs.getWeights().isEmpty()) {
-        matrix.asEigen<Eigen::ArrayXpr>() *= inputs.getWeights().asEigen<Eigen::ArrayXpr>();
-    }
-    // 1-d linear least squares...
-    double a = matrix.asEigen<Eigen::MatrixXpr>().squaredNorm();
-    double b = matrix.asEigen<Eigen::MatrixXpr>().dot(inputs.getData().asEigen<Eigen::MatrixXpr>());
-    model.flux = b / a;
-    model.fluxErr = std::sqrt(1.0 / a);
+    double inputsTime = timer.lap();
+    FitComboModel model = applyForced(
+        getControl(), psfModel, expComponent, devComponent,
+        reference.get(s.find<float>("devfrac").key), inputs
+    );
+    model.stats.inputsTime = inputsTime;
 
-    source.set(_devFracKey, model.devFrac);
-    source.set(_fluxKeys.meas, model.flux);
-    source.set(_fluxKeys.err, model.fluxErr);
-    source.set(_fluxKeys.flag, false);
+    fillRecord(source, model);
+    if (_statsSummary) _statsSummary->add(model.stats);
 }
 
 LSST_MEAS_ALGORITHM_PRIVATE_IMPLEMENTATION(FitComboAlgorithm);
@@ -0,0 +1,347 @@
+// -*- lsst-c++ -*-
+/* 
+ * LSST Data Management System
+ * Copyright 2012 LSST Corporation.
+ * 
+ * This product includes software developed by the
+ * LSST Project (http://www.lsst.org/).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the LSST License Statement and 
+ * the GNU General Public License along with this program.  If not, 
+ * see <http://www.lsstcorp.org/LegalNotices/>.
+ */
+
+#include "lsst/utils/ieee.h"
+#include "lsst/meas/extensions/multiShapelet/FitExpDev.h"
+
+namespace lsst { namespace meas { namespace extensions { namespace multiShapelet {
+
+//------------ FitExpDevControl -----------------------------------------------------------------------------
+
+PTR(algorithms::AlgorithmControl) FitExpDevControl::_clone() const {
+    return boost::make_shared<FitExpDevControl>(*this);
+}
+
+PTR(algorithms::Algorithm) FitExpDevControl::_makeAlgorithm(
+    afw::table::Schema & schema,
+    PTR(daf::base::PropertyList) const & metadata,
+    algorithms::AlgorithmMap const & others,
+    bool isForced
+) const {
+    return boost::make_shared<FitExpDevAlgorithm>(*this, boost::ref(schema), others, isForced, metadata);
+}
+
+//------------ FitExpDevModel -------------------------------------------------------------------------------
+
+namespace {
+
+// Control objects for the component algorithms, named so they read and write the same fields the
+// standalone algorithms would.
+FitProfileControl makeComponentControl(
+    FitExpDevControl const & ctrl, FitProfileControl const & component, std::string const & name
+) {
+    FitProfileControl result(component);
+    result.name = name;
+    result.psfName = ctrl.psfName;
+    result.usePixelWeights = ctrl.usePixelWeights;
+    result.badMaskPlanes = ctrl.badMaskPlanes;
+    result.maxBadPixelFraction = ctrl.maxBadPixelFraction;
+    result.growFootprint = ctrl.growFootprint;
+    result.radiusInputFactor = ctrl.radiusInputFactor;
+    result.instrument = ctrl.instrument;
+    return result;
+}
+
+FitComboControl makeComboControl(FitExpDevControl const & ctrl) {
+    FitComboControl result;
+    result.name = ctrl.comboName;
+    result.expName = ctrl.expName;
+    result.devName = ctrl.devName;
+    result.psfName = ctrl.psfName;
+    result.usePixelWeights = ctrl.usePixelWeights;
+    result.badMaskPlanes = ctrl.badMaskPlanes;
+    result.growFootprint = ctrl.growFootprint;
+    result.radiusInputFactor = ctrl.radiusInputFactor;
+    result.useApproximateExp = ctrl.exp.useApproximateExp && ctrl.dev.useApproximateExp;
+    result.instrument = ctrl.instrument;
+    return result;
+}
+
+} // anonymous
+
+FitExpDevModel::FitExpDevModel(FitExpDevControl const & ctrl) :
+    exp(ctrl.exp), dev(ctrl.dev), combo(makeComboControl(ctrl))
+{}
+
+//------------ FitExpDevAlgorithm ---------------------------------------------------------------------------
+
+FitExpDevAlgorithm::FitExpDevAlgorithm(
+    FitExpDevControl const & ctrl,
+    afw::table::Schema & schema,
+    algorithms::AlgorithmMap const & others,
+    bool isForced,
+    PTR(daf::base::PropertyList) const & metadata
+) :
+    algorithms::Algorithm(ctrl),
+    _expAlgorithm(
+        boost::make_shared<FitProfileAlgorithm>(
+            makeComponentControl(ctrl, ctrl.exp, ctrl.expName), boost::ref(schema), others, isForced
+        )
+    ),
+    _devAlgorithm(
+        boost::make_shared<FitProfileAlgorithm>(
+            makeComponentControl(ctrl, ctrl.dev, ctrl.devName), boost::ref(schema), others, isForced
+        )
+    ),
+    _comboAlgorithm(),
+    _psfCtrl()
+{
+    // The component algorithms save per-source statistics, but get no metadata; the summaries are
+    // kept here, under the same names the standalone algorithms would use.
+    if (ctrl.instrument) {
+        _expStatsSummary = boost::make_shared<FitStatisticsSummary>(metadata, ctrl.expName);
+        _devStatsSummary = boost::make_shared<FitStatisticsSummary>(metadata, ctrl.devName);
+        _comboStatsSummary = boost::make_shared<FitStatisticsSummary>(metadata, ctrl.comboName);
+    }
+    // FitComboAlgorithm looks up its components by name, so give it a map that includes ours.
+    algorithms::AlgorithmMap comboOthers(others);
+    comboOthers[ctrl.expName] = _expAlgorithm;
+    comboOthers[ctrl.devName] = _devAlgorithm;
+    _comboAlgorithm = boost::make_shared<FitComboAlgorithm>(
+        makeComboControl(ctrl), boost::ref(schema), comboOthers
+    );
+    algorithms::AlgorithmMap::const_iterator i = others.find(ctrl.psfName);
+    if (i == others.end()) {
+        throw LSST_EXCEPT(
+            pex::exceptions::LogicErrorException,
+            (boost::format("FitPsf with name '%s' not found; needed by FitExpDev.") % ctrl.psfName).str()
+        );
+    }
+    _psfCtrl = boost::dynamic_pointer_cast<FitPsfControl const>(i->second->getControl().clone());
+    if (!_psfCtrl) {
+        throw LSST_EXCEPT(
+            pex::exceptions::LogicErrorException,
+            (boost::format("Algorithm with name '%s' is not FitPsf.") % ctrl.psfName).str()
+        );
+    }
+}
+
+template <typename PixelT>
+ModelInputHandler FitExpDevAlgorithm::adjustInputs(
+    FitExpDevControl const & ctrl,
+    FitPsfModel const & psfModel,
+    afw::geom::ellipses::Quadrupole & expShape,
+    afw::geom::ellipses::Quadrupole & devShape,
+    afw::detection::Footprint const & footprint,
+    afw::image::MaskedImage<PixelT> const & image,
+    afw::geom::Point2D const & center,
+    bool fixShape
+) {
+    if (!fixShape) {
+        FitProfileAlgorithm::adjustShape(ctrl.exp, psfModel, expShape);
+        FitProfileAlgorithm::adjustShape(ctrl.dev, psfModel, devShape);
+    }
+    afw::image::MaskPixel badPixelMask = afw::image::Mask<>::getPlaneBitMask(ctrl.badMaskPlanes);
+    if (ctrl.radiusInputFactor > 0.0) {
+        std::vector<afw::geom::ellipses::Ellipse> boundsEllipses;
+        boundsEllipses.push_back(afw::geom::ellipses::Ellipse(expShape, center));
+        boundsEllipses.back().getCore().scale(ctrl.radiusInputFactor);
+        boundsEllipses.push_back(afw::geom::ellipses::Ellipse(devShape, center));
+        boundsEllipses.back().getCore().scale(ctrl.radiusInputFactor);
+        return ModelInputHandler(image, center,
+                                 boundsEllipses, footprint, ctrl.growFootprint,
+                                 badPixelMask, ctrl.usePixelWeights, ctrl.maxBadPixelFraction);
+    } else {
+        return ModelInputHandler(image, center, footprint, ctrl.growFootprint,
+                                 badPixelMask, ctrl.usePixelWeights, ctrl.maxBadPixelFraction);
+    }
+}
+
+FitExpDevModel FitExpDevAlgorithm::apply(
+    FitExpDevControl const & ctrl,
+    FitPsfModel const & psfModel,
+    MultiGaussianObjective::EllipseCore const & expEllipse,
+    MultiGaussianObjective::EllipseCore const & devEllipse,
+    ModelInputHandler const & inputs
+) {
+    FitExpDevModel model(ctrl);
+    // The component fits leave their final unit-flux models here, so the combo fit can reuse them.
+    ndarray::Array<double,2,2> componentModels = ndarray::allocate(2, inputs.getSize());
+    try {
+        model.exp = FitProfileAlgorithm::apply(
+            ctrl.exp, psfModel, expEllipse, inputs, 0, componentModels[0]
+        );
+    } catch (pex::exceptions::Exception &) {
+        // leave the placeholder in place
+    }
+    try {
+        model.dev = FitProfileAlgorithm::apply(
+            ctrl.dev, psfModel, devEllipse, inputs, 0, componentModels[1]
+        );
+    } catch (pex::exceptions::Exception &) {
+        // leave the placeholder in place
+    }
+    if (!model.exp.fluxFlag && !model.dev.fluxFlag) {
+        try {
+            model.combo = FitComboAlgorithm::apply(
+                makeComboControl(ctrl), model.exp, model.dev, inputs, componentModels
+            );
+        } catch (pex::exceptions::Exception &) {
+            // leave the placeholder in place
+        }
+    }
+    return model;
+}
+
+void FitExpDevAlgorithm::_fillRecord(afw::table::SourceRecord & source, FitExpDevModel const & model) const {
+    _expAlgorithm->fillRecord(source, model.exp);
+    _devAlgorithm->fillRecord(source, model.dev);
+    _comboAlgorithm->fillRecord(source, model.combo);
+}
+
+void FitExpDevAlgorithm::_addStatistics(FitExpDevModel const & model) const {
+    if (!getControl().instrument) return;
+    _expStatsSummary->add(model.exp.stats);
+    _devStatsSummary->add(model.dev.stats);
+    _comboStatsSummary->add(model.combo.stats);
+}
+
+void FitExpDevAlgorithm::flushStatistics() const {
+    if (!getControl().instrument) return;
+    _expStatsSummary->flush();
+    _devStatsSummary->flush();
+    _comboStatsSummary->flush();
+}
+
+template <typename PixelT>
+void FitExpDevAlgorithm::_apply(
+    afw::table::SourceRecord & source,
+    afw::image::Exposure<PixelT> const & exposure,
+    afw::geom::Point2D const & center
+) const {
+    _fillRecord(source, FitExpDevModel(getControl()));
+    if (!exposure.hasPsf()) {
+        throw LSST_EXCEPT(
+            pex::exceptions::LogicErrorException,
+            "Cannot run FitExpDevAlgorithm without a PSF."
+        );
+    }
+    FitPsfModel psfModel(*_psfCtrl, source);
+    if (psfModel.hasFailed() || !(psfModel.ellipse.getArea() > 0.0)) {
+        throw LSST_EXCEPT(
+            pex::exceptions::RuntimeErrorException,
+            "PSF shapelet fit failed; cannot fit galaxy model."
+        );
+    }
+    afw::geom::ellipses::Quadrupole expShape = source.getShape();
+    if (source.getShapeFlag()) {
+        expShape = psfModel.ellipse;
+    }
+    afw::geom::ellipses::Quadrupole devShape = expShape;
+    StageTimer timer;
+    ModelInputHandler inputs = adjustInputs(
+        getControl(), psfModel, expShape, devShape, *source.getFootprint(),
+        exposure.getMaskedImage(), center
+    );
+    double inputsTime = timer.lap();
+    FitExpDevModel model = apply(getControl(), psfModel, expShape, devShape, inputs);
+    model.exp.stats.inputsTime = inputsTime;
+
+    assert(model.exp.fluxFlag || lsst::utils::isfinite(model.exp.ellipse.getArea()));
+    assert(model.dev.fluxFlag || lsst::utils::isfinite(model.dev.ellipse.getArea()));
+
+    _fillRecord(source, model);
+    _addStatistics(model);
+}
+
+template <typename PixelT>
+void FitExpDevAlgorithm::_applyForced(
+    afw::table::SourceRecord & source,
+    afw::image::Exposure<PixelT> const & exposure,
+    afw::geom::Point2D const & center,
+    afw::table::SourceRecord const & reference,
+    afw::geom::AffineTransform const & refToMeas
+) const {
+    _fillRecord(source, FitExpDevModel(getControl()));
+    if (!exposure.hasPsf()) {
+        throw LSST_EXCEPT(
+            pex::exceptions::LogicErrorException,
+            "Cannot run FitExpDevAlgorithm without a PSF."
+        );
+    }
+    if (source.getPsfFluxFlag()) {
+        // See FitProfileAlgorithm::_applyForced.
+        throw LSST_EXCEPT(
+            pex::exceptions::RuntimeErrorException,
+            "PSF flux failed; suspect galaxy modeling will be problematic."
+        );
+    }
+    FitPsfModel psfModel(*_psfCtrl, source);
+    if (psfModel.hasFailed() || !(psfModel.ellipse.getArea() > 0.0)) {
+        throw LSST_EXCEPT(
+            pex::exceptions::RuntimeErrorException,
+            "PSF shapelet fit failed; cannot fit galaxy model."
+        );
+    }
+    FitExpDevModel model(getControl());
+    FitProfileModel expReference(_expAlgorithm->getControl(), reference);
+    FitProfileModel devReference(_devAlgorithm->getControl(), reference);
+    if (expReference.fluxFlag || devReference.fluxFlag) {
+        throw LSST_EXCEPT(
+            pex::exceptions::RuntimeErrorException,
+            "Reference galaxy model fit failed; cannot run forced modeling."
+        );
+    }
+    expReference.ellipse = expReference.ellipse.transform(refToMeas.getLinear());
+    devReference.ellipse = devReference.ellipse.transform(refToMeas.getLinear());
+    StageTimer timer;
+    ModelInputHandler inputs = adjustInputs(
+        getControl(), psfModel, expReference.ellipse, devReference.ellipse, *source.getFootprint(),
+        exposure.getMaskedImage(), center, true
+    );
+    expReference.stats.inputsTime = timer.lap();
+    ndarray::Array<double,2,2> componentModels = ndarray::allocate(2, inputs.getSize());
+    FitProfileAlgorithm::fitShapeletTerms(
+        getControl().exp, psfModel, inputs, expReference, componentModels[0]
+    );
+    expReference.stats.linearTime = timer.lap();
+    FitProfileAlgorithm::fitShapeletTerms(
+        getControl().dev, psfModel, inputs, devReference, componentModels[1]
+    );
+    devReference.stats.linearTime = timer.lap();
+    model.exp = expReference;
+    model.dev = devReference;
+    afw::table::SubSchema s = reference.getSchema()[getControl().comboName];
+    model.combo = FitComboAlgorithm::applyForced(
+        _comboAlgorithm->getControl(), model.exp, model.dev,
+        reference.get(s.find<float>("devfrac").key), inputs, componentModels
+    );
+
+    _fillRecord(source, model);
+    _addStatistics(model);
+}
+
+LSST_MEAS_ALGORITHM_PRIVATE_IMPLEMENTATION(FitExpDevAlgorithm);
+
+#define INSTANTIATE_adjustInputs(PIXELT) \
+template \
+ModelInputHandler FitExpDevAlgorithm::adjustInputs(                     \
+    FitExpDevControl const &, FitPsfModel const &,                      \
+    afw::geom::ellipses::Quadrupole &, afw::geom::ellipses::Quadrupole &, \
+    afw::detection::Footprint const &, afw::image::MaskedImage<PIXELT> const &, \
+    afw::geom::Point2D const &, bool)
+
+INSTANTIATE_adjustInputs(float);
+INSTANTIATE_adjustInputs(double);
+
+}}}} // namespace lsst::meas::extensions::multiShapelet
@@ -21,6 +21,8 @@
  * see <http://www.lsstcorp.org/LegalNotices/>.
  */
 
+#include <algorithm>
+
 #include "lsst/utils/ieee.h"
 #include "lsst/meas/extensions/multiShapelet/FitProfile.h"
 #include "lsst/meas/extensions/multiShapelet/MultiGaussianObjective.h"
@@ -44,7 +46,7 @@ PTR(algorithms::Algorithm) FitProfileControl::_makeAlgorithm(
     algorithms::AlgorithmMap const & others,
     bool isForced
 ) const {
-    return boost::make_shared<FitProfileAlgorithm>(*this, boost::ref(schema), others, isForced);
+    return boost::make_shared<FitProfileAlgorithm>(*this, boost::ref(schema), others, isForced, metadata);
 }
 
 //------------ FitProfileModel ------------------------------------------------------------------------------
@@ -54,21 +56,21 @@ FitProfileModel::FitProfileModel(
     double amplitude,
     ndarray::Array<double const,1,1> const & parameters
 ) :
-    profile(ctrl.profile), flux(amplitude), fluxErr(0.0),
+    profile(MultiGaussianRegistry::getHandle(ctrl.profile)), flux(amplitude), fluxErr(0.0),
     ellipse(MultiGaussianObjective::EllipseCore(parameters[0], parameters[1], parameters[2])),
     chisq(std::numeric_limits<double>::quiet_NaN()), fluxFlag(false),
     flagMaxIter(false), flagTinyStep(false), flagMinRadius(false), flagMinAxisRatio(false),
-    flagLargeArea(false)
+    flagLargeArea(false), approximationError(0.0), stats()
 {}
 
 FitProfileModel::FitProfileModel(
     FitProfileControl const & ctrl, afw::table::SourceRecord const & source,
     bool loadPsfFactorModel
 ) :
-    profile(ctrl.profile), flux(1.0), fluxErr(0.0), ellipse(),
+    profile(MultiGaussianRegistry::getHandle(ctrl.profile)), flux(1.0), fluxErr(0.0), ellipse(),
     chisq(std::numeric_limits<double>::quiet_NaN()), fluxFlag(false),
     flagMaxIter(false), flagTinyStep(false), flagMinRadius(false), flagMinAxisRatio(false),
-    flagLargeArea(false)
+    flagLargeArea(false), approximationError(0.0), stats()
 {
     afw::table::SubSchema s = source.getSchema()[ctrl.name];
     if (loadPsfFactorModel) {
@@ -88,6 +90,14 @@ FitProfileModel::FitProfileModel(
     assert(fluxFlag || lsst::utils::isfinite(ellipse.getArea()));
 }
 
+FitProfileModel::FitProfileModel(FitProfileControl const & ctrl) :
+    profile(MultiGaussianRegistry::getHandle(ctrl.profile)), flux(std::numeric_limits<double>::quiet_NaN()),
+    fluxErr(std::numeric_limits<double>::quiet_NaN()), ellipse(0.0, 0.0, 0.0),
+    chisq(std::numeric_limits<double>::quiet_NaN()), fluxFlag(true),
+    flagMaxIter(false), flagTinyStep(false), flagMinRadius(false), flagMinAxisRatio(false),
+    flagLargeArea(false), approximationError(0.0), stats()
+{}
+
 FitProfileModel::FitProfileModel(FitProfileModel const & other) :
     profile(other.profile), flux(other.flux), fluxErr(other.fluxErr), ellipse(other.ellipse),
     chisq(other.chisq),
@@ -96,7 +106,9 @@ FitProfileModel::FitProfileModel(FitProfileModel const & other) :
     flagTinyStep(other.flagTinyStep),
     flagMinRadius(other.flagMinRadius),
     flagMinAxisRatio(other.flagMinAxisRatio),
-    flagLargeArea(other.flagLargeArea)
+    flagLargeArea(other.flagLargeArea),
+    approximationError(other.approximationError),
+    stats(other.stats)
 {}
 
 FitProfileModel & FitProfileModel::operator=(FitProfileModel const & other) {
@@ -112,6 +124,8 @@ FitProfileModel & FitProfileModel::operator=(FitProfileModel const & other) {
         flagMinRadius = other.flagMinRadius;
         flagMinAxisRatio = other.flagMinAxisRatio;
         flagLargeArea = other.flagLargeArea;
+        approximationError = other.approximationError;
+        stats = other.stats;
     }
     return *this;
 }
@@ -120,7 +134,7 @@ shapelet::MultiShapeletFunction FitProfileModel::asMultiShapelet(
     afw::geom::Point2D const & center
 ) const {
     shapelet::MultiShapeletFunction::ElementList elements;
-    MultiGaussian const & multiGaussian = MultiGaussianRegistry::lookup(profile);
+    MultiGaussian const & multiGaussian = *profile;
     for (MultiGaussian::const_iterator i = multiGaussian.begin(); i != multiGaussian.end(); ++i) {
         afw::geom::ellipses::Ellipse fullEllipse(ellipse, center);
         elements.push_back(i->makeShapelet(fullEllipse));
@@ -135,7 +149,8 @@ FitProfileAlgorithm::FitProfileAlgorithm(
     FitProfileControl const & ctrl,
     afw::table::Schema & schema,
     algorithms::AlgorithmMap const & others,
-    bool isForced
+    bool isForced,
+    PTR(daf::base::PropertyList) const & metadata
 ) :
     algorithms::Algorithm(ctrl),
     _fluxKeys(
@@ -159,8 +174,13 @@ FitProfileAlgorithm::FitProfileAlgorithm(
             ctrl.name + ".chisq",
             "reduced chi^2"
         )),
-    _psfCtrl()
+    _psfCtrl(),
+    _isForced(isForced)
 {
+    if (ctrl.instrument) {
+        _statsKeys = boost::make_shared<FitStatisticsKeys>(boost::ref(schema), ctrl.name, !isForced);
+        _statsSummary = boost::make_shared<FitStatisticsSummary>(metadata, ctrl.name);
+    }
     if (!isForced) {
         _flagMaxIterKey = schema.addField<afw::table::Flag>(
             ctrl.name + ".flags.maxiter",
@@ -204,65 +224,84 @@ PTR(MultiGaussianObjective) FitProfileAlgorithm::makeObjective(
     FitPsfModel const & psfModel,
     ModelInputHandler const & inputs
 ) {
-    return boost::make_shared<MultiGaussianObjective>(
+    PTR(MultiGaussianObjective) result = boost::make_shared<MultiGaussianObjective>(
         inputs, ctrl.getMultiGaussian(), psfModel.getMultiGaussian(), psfModel.ellipse,
         ctrl.minRadius, ctrl.minAxisRatio, ctrl.useApproximateExp
     );
+    result->setStreaming(ctrl.streamingMinPixels > 0 && inputs.getSize() >= ctrl.streamingMinPixels);
+    result->setSinglePrecision(ctrl.useSinglePrecision);
+    if (ctrl.cullSigma > 0.0 || ctrl.pruneTolerance > 0.0) {
+        result->setCulling(ctrl.cullSigma, ctrl.pruneTolerance);
+    }
+    if (inputs.getSize() >= ctrl.parallelMinPixels) {
+        result->setThreads(ctrl.parallelThreads);
+    }
+    return result;
 }
 
 HybridOptimizer FitProfileAlgorithm::makeOptimizer(
     FitProfileControl const & ctrl,
     FitPsfModel const & psfModel,
     MultiGaussianObjective::EllipseCore const & ellipse,
-    ModelInputHandler const & inputs
+    ModelInputHandler const & inputs,
+    HybridOptimizerWarmStart const & warmStart
 ) {
     PTR(Objective) obj = makeObjective(ctrl, psfModel, inputs);
     ndarray::Array<double,1,1> initial = ndarray::allocate(obj->getParameterSize());
     ellipse.writeParameters(initial.getData());
-    HybridOptimizerControl optCtrl; // TODO: nest this in FitProfileControl
-    optCtrl.tau = 1E-2;
-    optCtrl.useCholesky = true;
-    optCtrl.gTol = 1E-4;
-    return HybridOptimizer(obj, initial, optCtrl);
+    return HybridOptimizer(obj, initial, ctrl.optimizer, warmStart);
 }
 
-template <typename PixelT>
-ModelInputHandler FitProfileAlgorithm::adjustInputs(
+void FitProfileAlgorithm::adjustShape(
     FitProfileControl const & ctrl,
     FitPsfModel const & psfModel,
-    afw::geom::ellipses::Quadrupole & shape,
-    afw::detection::Footprint const & footprint,
-    afw::image::MaskedImage<PixelT> const & image,
-    afw::geom::Point2D const & center,
-    bool fixShape
+    afw::geom::ellipses::Quadrupole & shape
 ) {
     MultiGaussianObjective::EllipseCore ellipse(shape);
     if (!(ellipse.getArea() > 0.0)) {  // phrasing comparison this way also guards against NaN
         ellipse = psfModel.ellipse;
         ellipse.scale(ctrl.minInitialRadius);
-    } else {
-        if (!fixShape && ctrl.deconvolveShape) {
-            try {
+    } else if (ctrl.deconvolveShape) {
+        try {
+            if (ctrl.matchWeightedMoments) {
+                ellipse = ctrl.getMultiGaussian().deconvolveWeighted(
+                    shape, psfModel.ellipse, psfModel.getMultiGaussian()
+                );
+            } else {
                 ellipse = ctrl.getMultiGaussian().deconvolve(
                     shape, psfModel.ellipse, psfModel.getMultiGaussian()
                 );
-            } catch (pex::exceptions::InvalidParameterException &) {
-                ellipse = psfModel.ellipse;
-                ellipse.scale(ctrl.minInitialRadius);
             }
-        }
-    }
-    if (!fixShape) {
-        // We never want to start with an ellipse smaller than the PSF or an ellipticity
-        // on the constraint, because we might never find our way out.
-        std::pair<bool,bool> constrained = MultiGaussianObjective::constrainEllipse(
-            ellipse, psfModel.ellipse.getTraceRadius() * ctrl.minInitialRadius, ctrl.minAxisRatio
-        );
-        if (constrained.first || constrained.second) {
+        } catch (pex::exceptions::InvalidParameterException &) {
             ellipse = psfModel.ellipse;
             ellipse.scale(ctrl.minInitialRadius);
         }
-        shape = ellipse;
+    }
+    // We never want to start with an ellipse smaller than the PSF or an ellipticity
+    // on the constraint, because we might never find our way out.
+    std::pair<bool,bool> constrained = MultiGaussianObjective::constrainEllipse(
+        ellipse, psfModel.ellipse.getTraceRadius() * ctrl.minInitialRadius, ctrl.minAxisRatio
+    );
+    if (constrained.first || constrained.second) {
+        ellipse = psfModel.ellipse;
+        ellipse.scale(ctrl.minInitialRadius);
+    }
+    shape = ellipse;
+}
+
+template <typename PixelT>
+ModelInputHandler FitProfileAlgorithm::adjustInputs(
+    FitProfileControl const & ctrl,
+    FitPsfModel const & psfModel,
+    afw::geom::ellipses::Quadrupole & shape,
+    afw::detection::Footprint const & footprint,
+    afw::image::MaskedImage<PixelT> const & image,
+    afw::geom::Point2D const & center,
+    bool fixShape,
+    ModelInputWorkspace * workspace
+) {
+    if (!fixShape) {
+        adjustShape(ctrl, psfModel, shape);
     }
     afw::image::MaskPixel badPixelMask = afw::image::Mask<>::getPlaneBitMask(ctrl.badMaskPlanes);
     if (ctrl.radiusInputFactor > 0.0) {
@@ -271,10 +310,12 @@ ModelInputHandler FitProfileAlgorithm::adjustInputs(
         boundsEllipses.back().getCore().scale(ctrl.radiusInputFactor);
         return ModelInputHandler(image, center,
                                  boundsEllipses, footprint, ctrl.growFootprint, 
-                                 badPixelMask, ctrl.usePixelWeights, ctrl.maxBadPixelFraction);
+                                 badPixelMask, ctrl.usePixelWeights, ctrl.maxBadPixelFraction,
+                                 workspace);
     } else {
         return ModelInputHandler(image, center, footprint, ctrl.growFootprint, 
-                                 badPixelMask, ctrl.usePixelWeights, ctrl.maxBadPixelFraction);
+                                 badPixelMask, ctrl.usePixelWeights, ctrl.maxBadPixelFraction,
+                                 workspace);
     }
 }
 
@@ -282,43 +323,118 @@ void FitProfileAlgorithm::fitShapeletTerms(
     FitProfileControl const & ctrl,
     FitPsfModel const & psfModel,
     ModelInputHandler const & inputs,
-    FitProfileModel & model
+    FitProfileModel & model,
+    ndarray::Array<double,1,1> const & modelVector
+) {
+    fitShapeletTerms(
+        ctrl, ConvolvedProfileTemplate(model.getMultiGaussian(), psfModel), inputs, model, modelVector
+    );
+}
+
+void FitProfileAlgorithm::fitShapeletTerms(
+    FitProfileControl const & ctrl,
+    ConvolvedProfileTemplate const & convolvedProfile,
+    ModelInputHandler const & inputs,
+    FitProfileModel & model,
+    ndarray::Array<double,1,1> const & modelVector
 ) {
-    typedef shapelet::MultiShapeletFunction MSF; 
-    MSF msf = model.asMultiShapelet().convolve(psfModel.asMultiShapelet());
-    msf.normalize();
-    ndarray::Array<double,1,1> vector = ndarray::allocate(inputs.getSize());
+    ndarray::Array<double,1,1> vector = modelVector;
+    if (vector.isEmpty()) {
+        vector = ndarray::allocate(inputs.getSize());
+    } else if (vector.getSize<0>() != inputs.getSize()) {
+        throw LSST_EXCEPT(
+            pex::exceptions::LengthErrorException,
+            (boost::format("Model vector size (%d) does not match number of pixels (%d)")
+             % vector.getSize<0>() % inputs.getSize()).str()
+        );
+    }
     vector.deep() = 0.0;
     shapelet::ModelBuilder<double> builder(inputs.getX(), inputs.getY(), ctrl.useApproximateExp);
-    for (MSF::ElementList::const_iterator i = msf.getElements().begin(); i != msf.getElements().end(); ++i) {
-        builder.update(i->getEllipse().getCore());
-        builder.addModelVector(i->getOrder(), i->getCoefficients(), vector);
-    }
+    convolvedProfile.addModelVector(model.ellipse, builder, vector);
     if (!inputs.getWeights().isEmpty()) {
         vector.asEigen<Eigen::ArrayXpr>() *= inputs.getWeights().asEigen<Eigen::ArrayXpr>();
     }
-    // the following is just linear least squares with one free parameter
+    // the following is just linear least squares with one free parameter, solved from its
+    // (scalar) normal equation
     double variance = 1.0 / vector.asEigen().squaredNorm();
-    model.flux = vector.asEigen().dot(inputs.getData().asEigen()) * variance;
+    double rhs = vector.asEigen().dot(inputs.getData().asEigen());
+    model.flux = rhs * variance;
     model.fluxErr = std::sqrt(variance);
+    // sum the residual itself (Eigen evaluates this lazily, so no residual vector is formed);
+    // |d|^2 - flux*rhs would subtract nearly equal numbers for a good fit
     model.chisq = (model.flux * vector.asEigen() - inputs.getData().asEigen()).squaredNorm()
         / (inputs.getSize() - 4);
 }
 
+namespace {
+
+// Fit the ellipse to the inputs binned by binSize x binSize pixels, starting from and updating a
+// full-resolution ellipse.  Binned coordinates are in units of bins, so the ellipses and minimum
+// radius are scaled by 1/binSize, and the PSF is broadened by the difference between the bin and
+// pixel responses (added to the PSF ellipse, so this is exact only for its inner component).
+void fitBinnedLevel(
+    FitProfileControl const & ctrl,
+    FitPsfModel const & psfModel,
+    ModelInputHandler const & inputs,
+    int binSize,
+    MultiGaussianObjective::EllipseCore & ellipse,
+    FitStatistics & stats
+) {
+    ModelInputHandler binned(inputs, binSize);
+    if (binned.getSize() < ctrl.pyramidMinPixels) return;
+    double const scale = 1.0 / binSize;
+    double const boxVariance = (1.0 - scale * scale) / 12.0;
+    FitProfileControl binnedCtrl(ctrl);
+    binnedCtrl.minRadius *= scale;
+    FitPsfModel binnedPsf(psfModel);
+    binnedPsf.ellipse = afw::geom::ellipses::Quadrupole(
+        psfModel.ellipse.getIxx() * scale * scale + boxVariance,
+        psfModel.ellipse.getIyy() * scale * scale + boxVariance,
+        psfModel.ellipse.getIxy() * scale * scale
+    );
+    MultiGaussianObjective::EllipseCore start(ellipse);
+    start.scale(scale);
+    HybridOptimizer opt = FitProfileAlgorithm::makeOptimizer(binnedCtrl, binnedPsf, start, binned);
+    opt.run();
+    stats.steps += opt.getStepCount();
+    stats.evaluations += opt.getEvaluationCount();
+    stats.derivatives += opt.getDerivativeCount();
+    stats.methodSwitches += opt.getMethodSwitchCount();
+    MultiGaussianObjective::EllipseCore result = MultiGaussianObjective::readParameters(opt.getParameters());
+    result.scale(binSize);
+    if (lsst::utils::isfinite(result.getArea())) {
+        ellipse = result;
+    }
+}
+
+} // anonymous
+
 FitProfileModel FitProfileAlgorithm::apply(
     FitProfileControl const & ctrl,
     FitPsfModel const & psfModel,
     MultiGaussianObjective::EllipseCore const & inEllipse,
-    ModelInputHandler const & inputs
+    ModelInputHandler const & inputs,
+    HybridOptimizerWarmStart * warmStart,
+    ndarray::Array<double,1,1> const & modelVector
 ) {
-    HybridOptimizer opt = makeOptimizer(ctrl, psfModel, inEllipse, inputs);
-    opt.run();
-    Model model(
-        ctrl, 
-        boost::static_pointer_cast<MultiGaussianObjective const>(opt.getObjective())->getAmplitude(),
-        opt.getParameters()
+    StageTimer timer;
+    MultiGaussianObjective::EllipseCore ellipse(inEllipse);
+    FitStatistics coarseStats;
+    for (int level = ctrl.pyramidLevels; level > 0; --level) {
+        fitBinnedLevel(ctrl, psfModel, inputs, 1 << level, ellipse, coarseStats);
+    }
+    HybridOptimizer opt = makeOptimizer(
+        ctrl, psfModel, ellipse, inputs, warmStart ? *warmStart : HybridOptimizerWarmStart()
     );
-    MultiGaussianObjective::EllipseCore ellipse = MultiGaussianObjective::readParameters(opt.getParameters());
+    opt.run();
+    if (warmStart) {
+        *warmStart = opt.getWarmStart();
+    }
+    PTR(MultiGaussianObjective const) objective
+        = boost::static_pointer_cast<MultiGaussianObjective const>(opt.getObjective());
+    Model model(ctrl, objective->getAmplitude(), opt.getParameters());
+    model.approximationError = objective->getApproximationError();
+    ellipse = MultiGaussianObjective::readParameters(opt.getParameters());
     std::pair<bool,bool> constrained 
         = MultiGaussianObjective::constrainEllipse(ellipse, ctrl.minRadius, ctrl.minAxisRatio);
     model.flagMaxIter = opt.getState() & HybridOptimizer::FAILURE_MAXITER;
@@ -328,10 +444,270 @@ FitProfileModel FitProfileAlgorithm::apply(
     model.flagMinAxisRatio = constrained.second;
     model.flagLargeArea = !(model.ellipse.getArea() < inputs.getSize());
     model.fluxFlag = model.flagLargeArea;
-    fitShapeletTerms(ctrl, psfModel, inputs, model);
+    model.stats.readOptimizer(opt);
+    model.stats.steps += coarseStats.steps;
+    model.stats.evaluations += coarseStats.evaluations;
+    model.stats.derivatives += coarseStats.derivatives;
+    model.stats.methodSwitches += coarseStats.methodSwitches;
+    model.stats.fitTime = timer.lap();
+    fitShapeletTerms(ctrl, psfModel, inputs, model, modelVector);
+    model.stats.linearTime = timer.lap();
     return model;
 }
 
+namespace {
+
+// Number of sources per thread whose inputs are built before the fits in the batch methods are run.
+int const BATCH_CHUNK_SIZE = 64;
+
+// Flatten a batch source's pixels, as adjustInputs() does, adjusting the given shape; returns an
+// empty pointer if the source cannot be fit.
+template <typename PixelT>
+PTR(ModelInputHandler) makeBatchInputs(
+    FitProfileControl const & ctrl,
+    FitProfileBatchInput const & source,
+    afw::image::MaskedImage<PixelT> const & image,
+    ModelInputWorkspace & workspace,
+    afw::geom::ellipses::Quadrupole & shape
+) {
+    shape = source.shape;
+    try {
+        return boost::make_shared<ModelInputHandler>(
+            FitProfileAlgorithm::adjustInputs(
+                ctrl, source.psfModel, shape, *source.footprint, image, source.center, false, &workspace
+            )
+        );
+    } catch (pex::exceptions::Exception &) {
+    } catch (std::exception &) {
+    }
+    return PTR(ModelInputHandler)();
+}
+
+void fitBatchSource(
+    FitProfileControl const & ctrl,
+    FitPsfModel const & psfModel,
+    afw::geom::ellipses::Quadrupole const & shape,
+    ModelInputHandler const & inputs,
+    double inputsTime,
+    FitProfileModel & result
+) {
+    try {
+        result = FitProfileAlgorithm::apply(ctrl, psfModel, shape, inputs);
+        result.stats.inputsTime = inputsTime;
+    } catch (pex::exceptions::Exception &) {
+        // leave the placeholder in place
+    } catch (std::exception &) {
+        // leave the placeholder in place
+    }
+}
+
+} // anonymous
+
+template <typename PixelT>
+std::vector<FitProfileModel> FitProfileAlgorithm::applyBatch(
+    FitProfileControl const & ctrl,
+    std::vector<FitProfileBatchInput> const & sources,
+    afw::image::MaskedImage<PixelT> const & image,
+    int nThreads
+) {
+    int const size = sources.size();
+    std::vector<FitProfileModel> results(size, FitProfileModel(ctrl));
+    // Sources big enough to be worth parallelizing internally are set aside and fit one at a time
+    // at the end, each with all the threads; the rest are distributed over the threads.
+    std::vector<int> large;
+    std::vector<int> small;
+    for (int i = 0; i < size; ++i) {
+        FitProfileBatchInput const & source = sources[i];
+        if (!source.footprint || source.psfModel.hasFailed() || !(source.psfModel.ellipse.getArea() > 0.0)) {
+            continue;
+        }
+        if (nThreads > 1 && source.footprint->getArea() >= ctrl.parallelMinPixels) {
+            large.push_back(i);
+        } else {
+            small.push_back(i);
+        }
+    }
+    int const nSlots = std::max(nThreads, 1);
+    int const chunkSize = BATCH_CHUNK_SIZE * nSlots;
+    std::vector<ModelInputWorkspace> workspaces(nSlots);
+    std::vector<PTR(ModelInputHandler)> inputs(chunkSize);
+    std::vector<afw::geom::ellipses::Quadrupole> shapes(chunkSize);
+    std::vector<double> inputsTimes(chunkSize);
+    FitProfileControl smallCtrl(ctrl);
+    smallCtrl.parallelThreads = 1;
+    int const nSmall = small.size();
+    for (int chunkBegin = 0; chunkBegin < nSmall; chunkBegin += chunkSize) {
+        int const chunkEnd = std::min(chunkBegin + chunkSize, nSmall);
+        int const chunkLength = chunkEnd - chunkBegin;
+        // Flattening the pixels copies the MaskedImage's image and variance arrays, whose reference
+        // counts aren't thread-safe, so the inputs are built serially.  Arrays carved out of the same
+        // workspace share a reference count too, so input k goes in workspace k % nSlots and only
+        // the thread that takes slot k % nSlots below ever touches it.
+        for (int t = 0; t < nSlots; ++t) {
+            workspaces[t].reset();
+        }
+        for (int k = 0; k < chunkLength; ++k) {
+            StageTimer timer;
+            inputs[k] = makeBatchInputs(
+                smallCtrl, sources[small[chunkBegin + k]], image, workspaces[k % nSlots], shapes[k]
+            );
+            inputsTimes[k] = timer.lap();
+        }
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic) num_threads(nSlots)
+#endif
+        for (int t = 0; t < nSlots; ++t) {
+            for (int k = t; k < chunkLength; k += nSlots) {
+                if (!inputs[k]) continue;
+                int const i = small[chunkBegin + k];
+                fitBatchSource(smallCtrl, sources[i].psfModel, shapes[k], *inputs[k], inputsTimes[k],
+                               results[i]);
+                inputs[k].reset();
+            }
+        }
+    }
+    FitProfileControl largeCtrl(ctrl);
+    largeCtrl.parallelThreads = nThreads;
+    for (std::size_t n = 0; n < large.size(); ++n) {
+        int const i = large[n];
+        workspaces.front().reset();
+        StageTimer timer;
+        PTR(ModelInputHandler) largeInputs = makeBatchInputs(
+            largeCtrl, sources[i], image, workspaces.front(), shapes.front()
+        );
+        if (largeInputs) {
+            fitBatchSource(largeCtrl, sources[i].psfModel, shapes.front(), *largeInputs, timer.lap(),
+                           results[i]);
+        }
+    }
+    return results;
+}
+
+namespace {
+
+// Transform a forced batch source's reference model to the image and flatten its pixels, as
+// _applyForced does, allocating the model-vector buffer for fitShapeletTerms from the same
+// workspace; returns an empty pointer if the source cannot be fit.
+template <typename PixelT>
+PTR(ModelInputHandler) makeForcedBatchInputs(
+    FitProfileControl const & ctrl,
+    FitProfileModel const & reference,
+    FitProfileForcedBatchInput const & source,
+    afw::image::MaskedImage<PixelT> const & image,
+    ModelInputWorkspace & workspace,
+    FitProfileModel & model,
+    ndarray::Array<double,1,1> & modelVector
+) {
+    try {
+        model = reference;
+        model.stats = FitStatistics();
+        model.ellipse = model.ellipse.transform(source.refToMeas);
+        PTR(ModelInputHandler) inputs = boost::make_shared<ModelInputHandler>(
+            FitProfileAlgorithm::adjustInputs(
+                ctrl, source.psfModel, model.ellipse, *source.footprint, image, source.center, true,
+                &workspace
+            )
+        );
+        modelVector = workspace.allocate(inputs->getSize());
+        return inputs;
+    } catch (pex::exceptions::Exception &) {
+    } catch (std::exception &) {
+    }
+    return PTR(ModelInputHandler)();
+}
+
+void fitForcedBatchSource(
+    FitProfileControl const & ctrl,
+    FitPsfModel const & psfModel,
+    ModelInputHandler const & inputs,
+    ndarray::Array<double,1,1> const & modelVector,
+    FitProfileModel & model,
+    FitProfileModel & result
+) {
+    try {
+        StageTimer timer;
+        FitProfileAlgorithm::fitShapeletTerms(ctrl, psfModel, inputs, model, modelVector);
+        model.stats.linearTime = timer.lap();
+        result = model;
+    } catch (pex::exceptions::Exception &) {
+        // leave the placeholder in place
+    } catch (std::exception &) {
+        // leave the placeholder in place
+    }
+}
+
+} // anonymous
+
+template <typename PixelT>
+std::vector<FitProfileModel> FitProfileAlgorithm::applyForcedBatch(
+    FitProfileControl const & ctrl,
+    std::vector<FitProfileModel> const & references,
+    std::vector<FitProfileForcedBatchInput> const & sources,
+    afw::image::MaskedImage<PixelT> const & image,
+    int nThreads
+) {
+    int const size = sources.size();
+    for (int i = 0; i < size; ++i) {
+        if (sources[i].reference < 0 || sources[i].reference >= int(references.size())) {
+            throw LSST_EXCEPT(
+                pex::exceptions::InvalidParameterException,
+                (boost::format("Reference index %d for source %d is out of range [0, %d)")
+                 % sources[i].reference % i % references.size()).str()
+            );
+        }
+    }
+    std::vector<FitProfileModel> results(size, FitProfileModel(ctrl));
+    std::vector<int> good;
+    for (int i = 0; i < size; ++i) {
+        FitProfileForcedBatchInput const & source = sources[i];
+        // The same sources _applyForced refuses to fit.
+        if (!source.footprint || source.psfFluxFlag || references[source.reference].fluxFlag
+            || source.psfModel.hasFailed() || !(source.psfModel.ellipse.getArea() > 0.0)) {
+            continue;
+        }
+        good.push_back(i);
+    }
+    int const nSlots = std::max(nThreads, 1);
+    int const chunkSize = BATCH_CHUNK_SIZE * nSlots;
+    std::vector<ModelInputWorkspace> workspaces(nSlots);
+    std::vector<PTR(ModelInputHandler)> inputs(chunkSize);
+    std::vector< ndarray::Array<double,1,1> > modelVectors(chunkSize);
+    std::vector<FitProfileModel> models(chunkSize, FitProfileModel(ctrl));
+    int const nGood = good.size();
+    for (int chunkBegin = 0; chunkBegin < nGood; chunkBegin += chunkSize) {
+        int const chunkEnd = std::min(chunkBegin + chunkSize, nGood);
+        int const chunkLength = chunkEnd - chunkBegin;
+        // As in applyBatch, the inputs are built serially and each workspace is only touched by the
+        // thread that takes its slot.
+        for (int t = 0; t < nSlots; ++t) {
+            workspaces[t].reset();
+        }
+        for (int k = 0; k < chunkLength; ++k) {
+            FitProfileForcedBatchInput const & source = sources[good[chunkBegin + k]];
+            StageTimer timer;
+            inputs[k] = makeForcedBatchInputs(
+                ctrl, references[source.reference], source, image, workspaces[k % nSlots],
+                models[k], modelVectors[k]
+            );
+            models[k].stats.inputsTime = timer.lap();
+        }
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic) num_threads(nSlots)
+#endif
+        for (int t = 0; t < nSlots; ++t) {
+            for (int k = t; k < chunkLength; k += nSlots) {
+                if (!inputs[k]) continue;
+                int const i = good[chunkBegin + k];
+                fitForcedBatchSource(ctrl, sources[i].psfModel, *inputs[k], modelVectors[k], models[k],
+                                     results[i]);
+                inputs[k].reset();
+                modelVectors[k] = ndarray::Array<double,1,1>();
+            }
+        }
+    }
+    return results;
+}
+
 template <typename PixelT>
 void FitProfileAlgorithm::_apply(
     afw::table::SourceRecord & source,
@@ -356,23 +732,36 @@ void FitProfileAlgorithm::_apply(
     if (source.getShapeFlag()) {
         shape = psfModel.ellipse;
     }
+    bool fixShape = false;
+    if (!getControl().warmStartName.empty()) {
+        // Start from another profile's best-fit ellipse if it's already been measured; it's already
+        // deconvolved and constrained, so adjustInputs should use it as-is.
+        try {
+            afw::table::SubSchema s = source.getSchema()[getControl().warmStartName];
+            if (!source.get(s.find<afw::table::Flag>("flux.flags").key)) {
+                afw::geom::ellipses::Quadrupole warmShape
+                    = source.get(s.find< afw::table::Moments<double> >("ellipse").key);
+                if (warmShape.getArea() > 0.0) {
+                    shape = warmShape;
+                    fixShape = true;
+                }
+            }
+        } catch (pex::exceptions::NotFoundException &) {
+            // other algorithm not run (or not yet); fall back to the moments
+        }
+    }
+    StageTimer timer;
     ModelInputHandler inputs = adjustInputs(
-        getControl(), psfModel, shape, *source.getFootprint(), exposure.getMaskedImage(), center
+        getControl(), psfModel, shape, *source.getFootprint(), exposure.getMaskedImage(), center, fixShape
     );
+    double inputsTime = timer.lap();
     FitProfileModel model = apply(getControl(), psfModel, shape, inputs);
+    model.stats.inputsTime = inputsTime;
 
     assert(model.fluxFlag || lsst::utils::isfinite(model.ellipse.getArea()));
 
-    source.set(_fluxKeys.meas, model.flux);
-    source.set(_fluxKeys.err, model.fluxErr);
-    source.set(_fluxKeys.flag, model.fluxFlag);
-    source.set(_ellipseKey, model.ellipse);
-    source.set(_chisqKey, model.chisq);
-    source.set(_flagMaxIterKey, model.flagMaxIter);
-    source.set(_flagTinyStepKey, model.flagTinyStep);
-    source.set(_flagMinRadiusKey, model.flagMinRadius);
-    source.set(_flagMinAxisRatioKey, model.flagMinAxisRatio);
-    source.set(_flagLargeAreaKey, model.flagLargeArea);
+    fillRecord(source, model);
+    if (_statsSummary) _statsSummary->add(model.stats);
 }
 
 template <typename PixelT>
@@ -416,18 +805,40 @@ void FitProfileAlgorithm::_applyForced(
     }
     model.ellipse = model.ellipse.transform(refToMeas.getLinear());
 
+    StageTimer timer;
     ModelInputHandler inputs = adjustInputs(
         getControl(), psfModel, model.ellipse, *source.getFootprint(),
         exposure.getMaskedImage(), center, true
     );
+    model.stats.inputsTime = timer.lap();
 
     fitShapeletTerms(getControl(), psfModel, inputs, model);
+    model.stats.linearTime = timer.lap();
 
+    fillRecord(source, model);
+    if (_statsSummary) _statsSummary->add(model.stats);
+}
+
+void FitProfileAlgorithm::flushStatistics() const {
+    if (_statsSummary) _statsSummary->flush();
+}
+
+void FitProfileAlgorithm::fillRecord(afw::table::SourceRecord & source, FitProfileModel const & model) const {
     source.set(_fluxKeys.meas, model.flux);
     source.set(_fluxKeys.err, model.fluxErr);
     source.set(_fluxKeys.flag, model.fluxFlag);
     source.set(_ellipseKey, model.ellipse);
     source.set(_chisqKey, model.chisq);
+    if (!_isForced) {
+        source.set(_flagMaxIterKey, model.flagMaxIter);
+        source.set(_flagTinyStepKey, model.flagTinyStep);
+        source.set(_flagMinRadiusKey, model.flagMinRadius);
+        source.set(_flagMinAxisRatioKey, model.flagMinAxisRatio);
+        source.set(_flagLargeAreaKey, model.flagLargeArea);
+    }
+    if (_statsKeys) {
+        _statsKeys->set(source, model.stats);
+    }
 }
 
 LSST_MEAS_ALGORITHM_PRIVATE_IMPLEMENTATION(FitProfileAlgorithm);
@@ -438,9 +849,28 @@ ModelInputHandler FitProfileAlgorithm::adjustInputs(                    \
     FitProfileControl const&, FitPsfModel const&,                       \
     afw::geom::ellipses::Quadrupole&, afw::detection::Footprint const&, \
     afw::image::MaskedImage<PIXELT, unsigned short, float> const&,      \
-    afw::geom::Point<double, 2> const&, bool)
+    afw::geom::Point<double, 2> const&, bool, ModelInputWorkspace*)
 
 INSTANTIATE_adjustInputs(float);
 INSTANTIATE_adjustInputs(double);
 
+#define INSTANTIATE_applyBatch(PIXELT) \
+template \
+std::vector<FitProfileModel> FitProfileAlgorithm::applyBatch(           \
+    FitProfileControl const&, std::vector<FitProfileBatchInput> const&, \
+    afw::image::MaskedImage<PIXELT, unsigned short, float> const&, int)
+
+INSTANTIATE_applyBatch(float);
+INSTANTIATE_applyBatch(double);
+
+#define INSTANTIATE_applyForcedBatch(PIXELT) \
+template \
+std::vector<FitProfileModel> FitProfileAlgorithm::applyForcedBatch(     \
+    FitProfileControl const&, std::vector<FitProfileModel> const&,      \
+    std::vector<FitProfileForcedBatchInput> const&,                     \
+    afw::image::MaskedImage<PIXELT, unsigned short, float> const&, int)
+
+INSTANTIATE_applyForcedBatch(float);
+INSTANTIATE_applyForcedBatch(double);
+
 }}}} // namespace lsst::meas::extensions::multiShapelet
@@ -21,6 +21,9 @@
  * see <http://www.lsstcorp.org/LegalNotices/>.
  */
 
+#include <algorithm>
+#include <cmath>
+
 #include "lsst/meas/extensions/multiShapelet/FitPsf.h"
 #include "lsst/meas/extensions/multiShapelet/MultiGaussianObjective.h"
 #include "lsst/shapelet/ModelBuilder.h"
@@ -42,6 +45,69 @@ int computeOrder(int size2d) {
     );
 }
 
+PTR(ModelInputHandler) makePsfInputs(
+    afw::detection::Psf const & psf, afw::geom::Point2D const & center,
+    ModelInputWorkspace * workspace=0
+) {
+    PTR(afw::image::Image<afw::math::Kernel::Pixel>) image = psf.computeImage(center);
+    double s = image->getArray().asEigen().sum();
+    image->getArray().asEigen() /= s;
+    return boost::make_shared<ModelInputHandler>(
+        *image, center, image->getBBox(afw::image::PARENT), workspace
+    );
+}
+
+// Number of pixels whose shapelet design matrix rows are built at once in fitShapeletTerms.
+int const SHAPELET_TILE_SIZE = 256;
+
+// Copy the coordinates of pixels [begin, end) to the start of the tile buffers x and y, zeroing the
+// rest (the rows for those padding pixels are computed but never used).
+void fillTileCoordinates(
+    ModelInputHandler const & inputs, int begin, int end,
+    ndarray::Array<double,1,1> const & x, ndarray::Array<double,1,1> const & y
+) {
+    int const n = end - begin;
+    x.asEigen().head(n) = inputs.getX().asEigen().segment(begin, n);
+    y.asEigen().head(n) = inputs.getY().asEigen().segment(begin, n);
+    x.asEigen().tail(SHAPELET_TILE_SIZE - n).setZero();
+    y.asEigen().tail(SHAPELET_TILE_SIZE - n).setZero();
+}
+
+// Number of sources per thread whose PSF images are computed before the fits in applyBatch are run.
+int const BATCH_CHUNK_SIZE = 64;
+
+// Compute the adaptive moments of the inputs: the W for which the data, weighted by a Gaussian with
+// covariance W centered on the origin, have second moments W/2.  The iteration starts from a circle
+// of the given radius; returns false if it leaves the space of valid ellipses or does not converge.
+bool computeAdaptiveMoments(ModelInputHandler const & inputs, double radius, Eigen::Matrix2d & w) {
+    ndarray::Array<double const,1,1> data = inputs.getData();
+    ndarray::Array<double const,1,1> x = inputs.getX();
+    ndarray::Array<double const,1,1> y = inputs.getY();
+    w = Eigen::Matrix2d::Identity() * radius * radius;
+    for (int iter = 0; iter < 50; ++iter) {
+        Eigen::Matrix2d const wInv = w.inverse();
+        double norm = 0.0;
+        Eigen::Matrix2d sum = Eigen::Matrix2d::Zero();
+        for (int i = 0; i < inputs.getSize(); ++i) {
+            double const g = data[i] * std::exp(
+                -0.5 * (wInv(0, 0) * x[i] * x[i] + 2.0 * wInv(0, 1) * x[i] * y[i] + wInv(1, 1) * y[i] * y[i])
+            );
+            norm += g;
+            sum(0, 0) += g * x[i] * x[i];
+            sum(0, 1) += g * x[i] * y[i];
+            sum(1, 1) += g * y[i] * y[i];
+        }
+        if (!(norm > 0.0)) return false;
+        sum(1, 0) = sum(0, 1);
+        Eigen::Matrix2d const wNew = (2.0 / norm) * sum;
+        if (!(wNew(0, 0) > 0.0 && wNew(1, 1) > 0.0 && wNew.determinant() > 0.0)) return false;
+        double const change = (wNew - w).norm() / w.norm();
+        w = wNew;
+        if (change < 1E-6) return true;
+    }
+    return false;
+}
+
 } // anonymous
 
 MultiGaussian FitPsfControl::getMultiGaussian() const {
@@ -58,7 +124,8 @@ FitPsfModel::FitPsfModel(
 ) :
     ellipse(),
     radiusRatio(ctrl.radiusRatio), chisq(std::numeric_limits<double>::quiet_NaN()),
-    failedMaxIter(false), failedTinyStep(false), failedMinRadius(false), failedMinAxisRatio(false)
+    failedMaxIter(false), failedTinyStep(false), failedMinRadius(false), failedMinAxisRatio(false),
+    stats()
 {
     MultiGaussian multiGaussian = ctrl.getMultiGaussian();
     ellipse = MultiGaussianObjective::EllipseCore(parameters[0], parameters[1], parameters[2]);
@@ -79,7 +146,8 @@ FitPsfModel::FitPsfModel(FitPsfControl const & ctrl, afw::table::BaseRecord cons
     outer(ndarray::allocate(shapelet::computeSize(ctrl.outerOrder))),
     ellipse(),
     radiusRatio(ctrl.radiusRatio), chisq(std::numeric_limits<double>::quiet_NaN()),
-    failedMaxIter(false), failedTinyStep(false), failedMinRadius(false), failedMinAxisRatio(false)
+    failedMaxIter(false), failedTinyStep(false), failedMinRadius(false), failedMinAxisRatio(false),
+    stats()
 {
     afw::table::SubSchema s = source.getSchema()[ctrl.name];
     afw::table::Key< afw::table::Array<float> > innerKey = s.find< afw::table::Array<float> >("inner").key;
@@ -104,6 +172,18 @@ FitPsfModel::FitPsfModel(FitPsfControl const & ctrl, afw::table::BaseRecord cons
     failedMinRadius = source.get(s.find<afw::table::Flag>("flags.constraint.q").key);
 }
 
+FitPsfModel::FitPsfModel(FitPsfControl const & ctrl) :
+    inner(ndarray::allocate(shapelet::computeSize(ctrl.innerOrder))),
+    outer(ndarray::allocate(shapelet::computeSize(ctrl.outerOrder))),
+    ellipse(0.0, 0.0, 0.0),
+    radiusRatio(ctrl.radiusRatio), chisq(std::numeric_limits<double>::quiet_NaN()),
+    failedMaxIter(false), failedTinyStep(false), failedMinRadius(false), failedMinAxisRatio(false),
+    stats()
+{
+    inner.deep() = 0.0;
+    outer.deep() = 0.0;
+}
+
 FitPsfModel::FitPsfModel(FitPsfModel const & other) :
     inner(ndarray::copy(other.inner)),
     outer(ndarray::copy(other.outer)),
@@ -113,7 +193,8 @@ FitPsfModel::FitPsfModel(FitPsfModel const & other) :
     failedMaxIter(other.failedMaxIter),
     failedTinyStep(other.failedTinyStep),
     failedMinRadius(other.failedMinRadius),
-    failedMinAxisRatio(other.failedMinAxisRatio)    
+    failedMinAxisRatio(other.failedMinAxisRatio),
+    stats(other.stats)
 {}
 
 FitPsfModel & FitPsfModel::operator=(FitPsfModel const & other) {
@@ -127,6 +208,7 @@ FitPsfModel & FitPsfModel::operator=(FitPsfModel const & other) {
         failedTinyStep = other.failedTinyStep;
         failedMinRadius = other.failedMinRadius;
         failedMinAxisRatio = other.failedMinAxisRatio;
+        stats = other.stats;
     }
     return *this;
 }
@@ -163,7 +245,11 @@ shapelet::MultiShapeletFunction FitPsfModel::asMultiShapelet(
     return shapelet::MultiShapeletFunction(elements);
 }
 
-FitPsfAlgorithm::FitPsfAlgorithm(FitPsfControl const & ctrl, afw::table::Schema & schema) :
+FitPsfAlgorithm::FitPsfAlgorithm(
+    FitPsfControl const & ctrl,
+    afw::table::Schema & schema,
+    PTR(daf::base::PropertyList) const & metadata
+) :
     algorithms::Algorithm(ctrl),
     _innerKey(
         schema.addField< afw::table::Array<float> >(
@@ -215,8 +301,24 @@ FitPsfAlgorithm::FitPsfAlgorithm(FitPsfControl const & ctrl, afw::table::Schema
         schema.addField<afw::table::Flag>(
             ctrl.name + ".flags.constraint.q",
             "set if the best-fit axis ratio (b/a) was the minimum allowed by the constraint"
+        )),
+    _cacheDistanceKey(
+        schema.addField<float>(
+            ctrl.name + ".cache.distance",
+            "distance (in pixels) to the nearest point at which the PSF model was actually fit",
+            "pixels"
+        )),
+    _flagCachedKey(
+        schema.addField<afw::table::Flag>(
+            ctrl.name + ".flags.cached",
+            "set if the PSF model was taken or interpolated from fits at nearby positions"
         ))
-{}
+{
+    if (ctrl.instrument) {
+        _statsKeys = boost::make_shared<FitStatisticsKeys>(boost::ref(schema), ctrl.name, true);
+        _statsSummary = boost::make_shared<FitStatisticsSummary>(metadata, ctrl.name);
+    }
+}
 
 PTR(MultiGaussianObjective) FitPsfAlgorithm::makeObjective(
     FitPsfControl const & ctrl,
@@ -232,15 +334,23 @@ HybridOptimizer FitPsfAlgorithm::makeOptimizer(
     ModelInputHandler const & inputs
 ) {
     MultiGaussianObjective::EllipseCore ellipse(0.0, 0.0, std::log(ctrl.initialRadius));
+    Eigen::Matrix2d moments;
+    if (ctrl.initialMoments && computeAdaptiveMoments(inputs, ctrl.initialRadius, moments)) {
+        // The PSF model is fit directly to the image, so we deconvolve a delta function.
+        MultiGaussian point;
+        point.add(GaussianComponent(1.0, 0.0));
+        afw::geom::ellipses::Quadrupole q = ctrl.getMultiGaussian().deconvolveWeighted(
+            afw::geom::ellipses::Quadrupole(moments), afw::geom::ellipses::Quadrupole(0.0, 0.0, 0.0), point
+        );
+        if (q.getDeterminant() > 0.0) {
+            ellipse = q;
+        }
+    }
     MultiGaussianObjective::constrainEllipse(ellipse, ctrl.minRadius, ctrl.minAxisRatio);
     PTR(Objective) obj = makeObjective(ctrl, inputs);
-    HybridOptimizerControl optCtrl; // TODO: nest this in FitPsfControl
-    optCtrl.tau = 1E-6;
-    optCtrl.useCholesky = true;
-    optCtrl.gTol = 1E-6;
     ndarray::Array<double,1,1> initial = ndarray::allocate(obj->getParameterSize());
     ellipse.writeParameters(initial.getData());
-    return HybridOptimizer(obj, initial, optCtrl);
+    return HybridOptimizer(obj, initial, ctrl.optimizer);
 }
 
 void FitPsfAlgorithm::fitShapeletTerms(
@@ -248,34 +358,80 @@ void FitPsfAlgorithm::fitShapeletTerms(
     ModelInputHandler const & inputs,
     FitPsfModel & model
 ) {
-    int innerCoeffs = shapelet::computeSize(ctrl.innerOrder);
-    int outerCoeffs = shapelet::computeSize(ctrl.outerOrder);
-    ndarray::Array<double,2,-2> matrix = ndarray::allocate(inputs.getSize(), innerCoeffs + outerCoeffs);
-    matrix.asEigen().setZero();
-    shapelet::ModelBuilder<double> builder(inputs.getX(), inputs.getY(), ctrl.useApproximateExp);
-    builder.update(model.ellipse);
-    builder.addModelMatrix(ctrl.innerOrder, matrix[ndarray::view()(0, innerCoeffs)]);
-    model.ellipse.scale(ctrl.radiusRatio);
-    builder.update(model.ellipse);
-    model.ellipse.scale(1.0 / ctrl.radiusRatio);
-    builder.addModelMatrix(ctrl.outerOrder, matrix[ndarray::view()(innerCoeffs, innerCoeffs + outerCoeffs)]);
-    if (!inputs.getWeights().isEmpty()) {
-        matrix.asEigen<Eigen::ArrayXpr>() 
-            *= (inputs.getWeights().asEigen() * Eigen::RowVectorXd::Ones(matrix.getSize<1>())).array();
+    int const innerCoeffs = shapelet::computeSize(ctrl.innerOrder);
+    int const outerCoeffs = shapelet::computeSize(ctrl.outerOrder);
+    int const nCoeffs = innerCoeffs + outerCoeffs;
+    int const size = inputs.getSize();
+    afw::geom::ellipses::Quadrupole outerEllipse(model.ellipse);
+    outerEllipse.scale(ctrl.radiusRatio);
+    // Accumulate the normal equations one tile of pixels at a time, so the design matrix is never
+    // held in full; only the tile's rows are built and then folded into the much smaller sums.
+    // A single builder serves every tile: it refers to (rather than copies) the coordinate buffers
+    // it is constructed with, and transforms them anew on each update(), so we just refill them.
+    ndarray::Array<double,1,1> xTile = ndarray::allocate(SHAPELET_TILE_SIZE);
+    ndarray::Array<double,1,1> yTile = ndarray::allocate(SHAPELET_TILE_SIZE);
+    shapelet::ModelBuilder<double> builder(xTile, yTile, ctrl.useApproximateExp);
+    Eigen::MatrixXd fisher = Eigen::MatrixXd::Zero(nCoeffs, nCoeffs);
+    Eigen::VectorXd rhs = Eigen::VectorXd::Zero(nCoeffs);
+    ndarray::Array<double,2,-2> matrix = ndarray::allocate(SHAPELET_TILE_SIZE, nCoeffs);
+    for (int begin = 0; begin < size; begin += SHAPELET_TILE_SIZE) {
+        int const end = std::min(begin + SHAPELET_TILE_SIZE, size);
+        int const n = end - begin;
+        fillTileCoordinates(inputs, begin, end, xTile, yTile);
+        matrix.asEigen().setZero();
+        builder.update(model.ellipse);
+        builder.addModelMatrix(ctrl.innerOrder, matrix[ndarray::view()(0, innerCoeffs)]);
+        builder.update(outerEllipse);
+        builder.addModelMatrix(ctrl.outerOrder, matrix[ndarray::view()(innerCoeffs, nCoeffs)]);
+        Eigen::Map< Eigen::MatrixXd, 0, Eigen::OuterStride<> > rows(
+            matrix.getData(), n, nCoeffs, Eigen::OuterStride<>(matrix.getStride<1>())
+        );
+        if (!inputs.getWeights().isEmpty()) {
+            Eigen::Map<Eigen::VectorXd const> w(inputs.getWeights().getData() + begin, n);
+            rows = w.asDiagonal() * rows;
+        }
+        fisher.selfadjointView<Eigen::Lower>().rankUpdate(rows.adjoint());
+        Eigen::Map<Eigen::VectorXd const> d(inputs.getData().getData() + begin, n);
+        rhs.noalias() += rows.adjoint() * d;
+    }
+    fisher.triangularView<Eigen::StrictlyUpper>() = fisher.adjoint();
+    ndarray::Array<double,2,2> fisherArray = ndarray::allocate(nCoeffs, nCoeffs);
+    ndarray::Array<double,1,1> rhsArray = ndarray::allocate(nCoeffs);
+    fisherArray.asEigen() = fisher;
+    rhsArray.asEigen() = rhs;
+    afw::math::LeastSquares lstsq = afw::math::LeastSquares::fromNormalEquations(fisherArray, rhsArray);
+    ndarray::Array<double const,1,1> solution = lstsq.getSolution();
+    model.inner.deep() = solution[ndarray::view(0, innerCoeffs)];
+    model.outer.deep() = solution[ndarray::view(innerCoeffs, nCoeffs)];
+    // The degrees of freedom corresponds to the final shapelet fit with ellipse held fixed.  The
+    // residual is summed explicitly, tile by tile, with the same builder; deriving it from the normal
+    // equations instead would subtract nearly equal numbers for a good fit.
+    double chisq = 0.0;
+    ndarray::Array<double,1,1> tileModel = ndarray::allocate(SHAPELET_TILE_SIZE);
+    for (int begin = 0; begin < size; begin += SHAPELET_TILE_SIZE) {
+        int const end = std::min(begin + SHAPELET_TILE_SIZE, size);
+        int const n = end - begin;
+        fillTileCoordinates(inputs, begin, end, xTile, yTile);
+        tileModel.deep() = 0.0;
+        builder.update(model.ellipse);
+        builder.addModelVector(ctrl.innerOrder, model.inner, tileModel);
+        builder.update(outerEllipse);
+        builder.addModelVector(ctrl.outerOrder, model.outer, tileModel);
+        Eigen::Map<Eigen::VectorXd> m(tileModel.getData(), n);
+        if (!inputs.getWeights().isEmpty()) {
+            m.array() *= Eigen::Map<Eigen::ArrayXd const>(inputs.getWeights().getData() + begin, n);
+        }
+        Eigen::Map<Eigen::VectorXd const> d(inputs.getData().getData() + begin, n);
+        chisq += (m - d).squaredNorm();
     }
-    afw::math::LeastSquares lstsq = afw::math::LeastSquares::fromDesignMatrix(matrix, inputs.getData());
-    model.inner.deep() = lstsq.getSolution()[ndarray::view(0, innerCoeffs)];
-    model.outer.deep() = lstsq.getSolution()[ndarray::view(innerCoeffs, innerCoeffs + outerCoeffs)];
-    // The degrees of freedom corresponds to the final shapelet fit with ellipse held fixed.
-    model.chisq =
-        (matrix.asEigen() * lstsq.getSolution().asEigen() - inputs.getData().asEigen()).squaredNorm()
-        / (matrix.getSize<0>() - matrix.getSize<1>());
+    model.chisq = chisq / (size - nCoeffs);
 }
 
 FitPsfModel FitPsfAlgorithm::apply(
     FitPsfControl const & ctrl,
     ModelInputHandler const & inputs
 ) {
+    StageTimer timer;
     HybridOptimizer opt = makeOptimizer(ctrl, inputs);
     opt.run();
     Model model(
@@ -283,6 +439,7 @@ FitPsfModel FitPsfAlgorithm::apply(
         boost::static_pointer_cast<MultiGaussianObjective const>(opt.getObjective())->getAmplitude(),
         opt.getParameters()
     );
+    model.stats.readOptimizer(opt);
     MultiGaussianObjective::EllipseCore ellipse = MultiGaussianObjective::readParameters(opt.getParameters());
     std::pair<bool,bool> constrained 
         = MultiGaussianObjective::constrainEllipse(ellipse, ctrl.minRadius, ctrl.minAxisRatio);
@@ -291,7 +448,9 @@ FitPsfModel FitPsfAlgorithm::apply(
         || (opt.getState() & HybridOptimizer::FAILURE_MINTRUST);
     model.failedMinRadius = constrained.first;
     model.failedMinAxisRatio = constrained.second;
+    model.stats.fitTime = timer.lap();
     fitShapeletTerms(ctrl, inputs, model);
+    model.stats.linearTime = timer.lap();
     return model;
 }
 
@@ -300,11 +459,62 @@ FitPsfModel FitPsfAlgorithm::apply(
     afw::detection::Psf const & psf,
     afw::geom::Point2D const & center
 ) {
-    PTR(afw::image::Image<afw::math::Kernel::Pixel>) image = psf.computeImage(center);
-    double s = image->getArray().asEigen().sum();
-    image->getArray().asEigen() /= s;
-    ModelInputHandler inputs(*image, center, image->getBBox(afw::image::PARENT));
-    return apply(ctrl, inputs);
+    StageTimer timer;
+    PTR(ModelInputHandler) inputs = makePsfInputs(psf, center);
+    double inputsTime = timer.lap();
+    FitPsfModel model = apply(ctrl, *inputs);
+    model.stats.inputsTime = inputsTime;
+    return model;
+}
+
+std::vector<FitPsfModel> FitPsfAlgorithm::applyBatch(
+    FitPsfControl const & ctrl,
+    afw::detection::Psf const & psf,
+    std::vector<afw::geom::Point2D> const & centers,
+    int nThreads
+) {
+    int const size = centers.size();
+    std::vector<FitPsfModel> results(size, FitPsfModel(ctrl));
+    int const nSlots = std::max(nThreads, 1);
+    int const chunkSize = BATCH_CHUNK_SIZE * nSlots;
+    std::vector<PTR(ModelInputHandler)> inputs(chunkSize);
+    // The inputs for a chunk are carved out of one buffer per thread, which is reused for the next
+    // chunk.  Arrays from the same buffer share a reference count that isn't thread-safe, so input
+    // k goes in buffer k % nSlots and only the thread that takes slot k % nSlots below touches it.
+    std::vector<ModelInputWorkspace> workspaces(nSlots);
+    for (int chunkBegin = 0; chunkBegin < size; chunkBegin += chunkSize) {
+        int const chunkEnd = std::min(chunkBegin + chunkSize, size);
+        for (int t = 0; t < nSlots; ++t) {
+            workspaces[t].reset();
+        }
+        for (int i = chunkBegin; i < chunkEnd; ++i) {
+            try {
+                inputs[i - chunkBegin] = makePsfInputs(
+                    psf, centers[i], &workspaces[(i - chunkBegin) % nSlots]
+                );
+            } catch (pex::exceptions::Exception &) {
+                inputs[i - chunkBegin].reset();
+            }
+        }
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic) num_threads(nSlots)
+#endif
+        for (int t = 0; t < nSlots; ++t) {
+            for (int i = chunkBegin + t; i < chunkEnd; i += nSlots) {
+                PTR(ModelInputHandler) & chunkInputs = inputs[i - chunkBegin];
+                if (!chunkInputs) continue;
+                try {
+                    results[i] = apply(ctrl, *chunkInputs);
+                } catch (pex::exceptions::Exception &) {
+                    // leave the placeholder in place
+                } catch (std::exception &) {
+                    // leave the placeholder in place
+                }
+                chunkInputs.reset();
+            }
+        }
+    }
+    return results;
 }
 
 FitPsfModel FitPsfAlgorithm::fit(
@@ -314,6 +524,104 @@ FitPsfModel FitPsfAlgorithm::fit(
 ) const {
     record.set(_flagKey, true);
     FitPsfModel model = apply(getControl(), psf, center);
+    record.set(_cacheDistanceKey, 0.0);
+    record.set(_flagCachedKey, false);
+    _save(record, model);
+    return model;
+}
+
+FitPsfModel FitPsfAlgorithm::fitCached(
+    afw::table::BaseRecord & record,
+    CONST_PTR(afw::detection::Psf) const & psf,
+    afw::geom::Point2D const & center
+) const {
+    FitPsfControl const & ctrl = getControl();
+    if (!(ctrl.cacheSpacing > 0.0)) {
+        return fit(record, *psf, center);
+    }
+    record.set(_flagKey, true);
+    if (psf != _cachePsf) {
+        _cache.clear();
+        _cachePsf = psf;
+    }
+    double const u = center.getX() / ctrl.cacheSpacing;
+    double const v = center.getY() / ctrl.cacheSpacing;
+    int const iNearest = static_cast<int>(std::floor(u + 0.5));
+    int const jNearest = static_cast<int>(std::floor(v + 0.5));
+    double const distance = ctrl.cacheSpacing * std::sqrt(
+        (u - iNearest) * (u - iNearest) + (v - jNearest) * (v - jNearest)
+    );
+    FitPsfModel model(ctrl);
+    bool ok = true;
+    if (ctrl.cacheInterpolate) {
+        // Bilinear interpolation of the ellipse moments and shapelet coefficients; the coefficients
+        // are defined relative to slightly different ellipses at each node, but for a PSF that varies
+        // slowly enough to be cached at all the difference is negligible.
+        int const i0 = static_cast<int>(std::floor(u));
+        int const j0 = static_cast<int>(std::floor(v));
+        double const du = u - i0;
+        double const dv = v - j0;
+        double ixx = 0.0, iyy = 0.0, ixy = 0.0;
+        model.chisq = 0.0;
+        for (int dj = 0; dj < 2 && ok; ++dj) {
+            for (int di = 0; di < 2 && ok; ++di) {
+                FitPsfModel const * node = _getCachedNode(i0 + di, j0 + dj);
+                if (!node) {
+                    ok = false;
+                    break;
+                }
+                double const w = (di ? du : 1.0 - du) * (dj ? dv : 1.0 - dv);
+                model.inner.asEigen() += w * node->inner.asEigen();
+                model.outer.asEigen() += w * node->outer.asEigen();
+                ixx += w * node->ellipse.getIxx();
+                iyy += w * node->ellipse.getIyy();
+                ixy += w * node->ellipse.getIxy();
+                model.chisq += w * node->chisq;
+            }
+        }
+        model.ellipse = afw::geom::ellipses::Quadrupole(ixx, iyy, ixy);
+    } else {
+        FitPsfModel const * node = _getCachedNode(iNearest, jNearest);
+        if (node) {
+            model = *node;
+        } else {
+            ok = false;
+        }
+    }
+    if (!ok) {
+        return fit(record, *psf, center);
+    }
+    model.stats = FitStatistics();
+    record.set(_cacheDistanceKey, distance);
+    record.set(_flagCachedKey, true);
+    _save(record, model);
+    return model;
+}
+
+FitPsfModel const * FitPsfAlgorithm::_getCachedNode(int i, int j) const {
+    FitPsfControl const & ctrl = getControl();
+    std::pair<int,int> key(i, j);
+    CacheMap::const_iterator iter = _cache.find(key);
+    if (iter == _cache.end()) {
+        FitPsfModel node(ctrl);
+        try {
+            node = apply(ctrl, *_cachePsf, afw::geom::Point2D(i * ctrl.cacheSpacing, j * ctrl.cacheSpacing));
+        } catch (pex::exceptions::Exception &) {
+            // leave the placeholder in place; it will be treated as a failure below
+        }
+        iter = _cache.insert(std::make_pair(key, node)).first;
+    }
+    if (iter->second.hasFailed() || !(iter->second.ellipse.getArea() > 0.0)) {
+        return 0;
+    }
+    return &iter->second;
+}
+
+void FitPsfAlgorithm::flushStatistics() const {
+    if (_statsSummary) _statsSummary->flush();
+}
+
+void FitPsfAlgorithm::_save(afw::table::BaseRecord & record, FitPsfModel const & model) const {
     record[_innerKey] = model.inner;
     record[_outerKey] = model.outer;
     record.set(_ellipseKey, model.ellipse);
@@ -325,7 +633,10 @@ FitPsfModel FitPsfAlgorithm::fit(
     record.set(_flagMinAxisRatioKey, model.failedMinAxisRatio);
     record.set(_flagKey, model.failedMaxIter || model.failedTinyStep
                || model.failedMinAxisRatio || model.failedMinRadius);
-    return model;
+    if (_statsKeys) {
+        _statsKeys->set(record, model.stats);
+        _statsSummary->add(model.stats);
+    }
 }
 
 template <typename PixelT>
@@ -341,7 +652,7 @@ void FitPsfAlgorithm::_apply(
             "Cannot run FitPsfAlgorithm without a PSF."
         );
     }
-    fit(source, *exposure.getPsf(), center);
+    fitCached(source, exposure.getPsf(), center);
 }
 
 PTR(algorithms::AlgorithmControl) FitPsfControl::_clone() const {
@@ -352,7 +663,7 @@ PTR(algorithms::Algorithm) FitPsfControl::_makeAlgorithm(
     afw::table::Schema & schema,
     PTR(daf::base::PropertyList) const & metadata
 ) const {
-    return boost::make_shared<FitPsfAlgorithm>(*this, boost::ref(schema));
+    return boost::make_shared<FitPsfAlgorithm>(*this, boost::ref(schema), metadata);
 }
 
 LSST_MEAS_ALGORITHM_PRIVATE_IMPLEMENTATION(FitPsfAlgorithm);
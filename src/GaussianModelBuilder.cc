@@ -21,20 +21,97 @@
  * see <http://www.lsstcorp.org/LegalNotices/>.
  */
 
-#include "lsst/utils/PowFast.h"
+#include <algorithm>
+#include <cmath>
+
 #include "lsst/meas/extensions/multiShapelet/GaussianModelBuilder.h"
 
 namespace lsst { namespace meas { namespace extensions { namespace multiShapelet {
 
 namespace {
 
-utils::PowFast const & powFast = utils::getPowFast<11>();
+// Number of pixels converted to single precision and exponentiated at once; a fixed-size
+// buffer lets Eigen use aligned packet operations for the float exp.
+int const BLOCK_SIZE = 64;
+
+/*
+ *  Compute z[i] = amplitude * exp(-0.5 * z[i]) for i in [0, n), in place.
+ *
+ *  When useApproximateExp is true, the exponential is evaluated in single precision using
+ *  Eigen's vectorized float exp (SSE/AVX/NEON, matching whatever instruction set the library
+ *  was compiled for).  The relative error is dominated by rounding the argument to float, and
+ *  is ~1E-6 for any argument large enough that the result is not negligible - comfortably inside
+ *  the ~1E-4 documented for the useApproximateExp control fields.
+ */
+void evaluateGaussian(double * z, int n, double amplitude, bool useApproximateExp) {
+    if (useApproximateExp) {
+        Eigen::Array<float,BLOCK_SIZE,1> buffer;
+        for (int i0 = 0; i0 < n; i0 += BLOCK_SIZE) {
+            int const m = std::min(BLOCK_SIZE, n - i0);
+            double * block = z + i0;
+            for (int k = 0; k < m; ++k) {
+                buffer[k] = -0.5f * static_cast<float>(block[k]);
+            }
+            buffer.head(m) = buffer.head(m).exp();
+            for (int k = 0; k < m; ++k) {
+                block[k] = amplitude * buffer[k];
+            }
+        }
+    } else {
+        Eigen::Map<Eigen::ArrayXd> a(z, n);
+        a = amplitude * (-0.5 * a).exp();
+    }
+}
+
+/*
+ *  Compute v[k] = amplitude * exp(-0.5 * z[k]) for n consecutive pixels in a row, where z is
+ *  quadratic in the pixel index with second difference 2*a, and q = exp(-a).  z and v may alias.
+ *
+ *  Only three exponentials are needed per row: the value at the row's peak and the ratios to its
+ *  neighbors on either side; the ratio between subsequent pixels then changes by the constant
+ *  factor q.  We walk outward from the peak so the values only decrease, and hence only underflow
+ *  where the true values would.  Rounding errors grow with the square of the distance from the
+ *  peak, but remain ~1E-13 relative for rows a few hundred pixels long.
+ */
+void evaluateGaussianRow(double const * z, double * v, int n, double amplitude, double q) {
+    int const p = std::min_element(z, z + n) - z;
+    double const zp = z[p];
+    double rRight = (p + 1 < n) ? std::exp(-0.5 * (z[p + 1] - zp)) : 0.0;
+    double rLeft = (p > 0) ? std::exp(-0.5 * (z[p - 1] - zp)) : 0.0;
+    v[p] = amplitude * std::exp(-0.5 * zp);
+    for (int k = p; k + 1 < n; ++k) {
+        v[k + 1] = v[k] * rRight;
+        rRight *= q;
+    }
+    for (int k = p; k > 0; --k) {
+        v[k - 1] = v[k] * rLeft;
+        rLeft *= q;
+    }
+}
+
+// Rows shorter than this are evaluated with one exponential per pixel.
+int const MIN_RECURRENCE_SIZE = 4;
+
+// Single-precision version of evaluateGaussian(); the exponential is always the vectorized float exp.
+void evaluateGaussian(float * z, int n, double amplitude, bool) {
+    Eigen::Map< Eigen::Array<float,Eigen::Dynamic,1> > a(z, n);
+    a = float(amplitude) * (-0.5f * a).exp();
+}
 
-struct PowFastExpFunctor {
-    inline float operator()(float x) const {
-        return powFast.exp(x);
+// Evaluate the Gaussian along a row of n pixels in place, using the recurrence for long rows.
+void evaluateRow(double * z, int n, double amplitude, double q, bool useApproximateExp) {
+    if (n < MIN_RECURRENCE_SIZE) {
+        evaluateGaussian(z, n, amplitude, useApproximateExp);
+    } else {
+        evaluateGaussianRow(z, z, n, amplitude, q);
     }
-};
+}
+
+// In single precision the recurrence's round-off would grow to ~1E-3 along a long row, so we use one
+// (vectorized) exponential per pixel instead.
+void evaluateRow(float * z, int n, double amplitude, double, bool useApproximateExp) {
+    evaluateGaussian(z, n, amplitude, useApproximateExp);
+}
 
 } // anonymous
 
@@ -43,9 +120,9 @@ GaussianModelBuilder::GaussianModelBuilder(
     ndarray::Array<double const,1,1> const & y,
     double flux, double radius, afw::geom::ellipses::Quadrupole const & psfEllipse,
     double psfAmplitude, bool useApproximateExp
-) : _useApproximateExp(useApproximateExp), _flux(flux), _psfAmplitude(psfAmplitude), 
-    _scaling(afw::geom::LinearTransform::makeScaling(radius)), _psfEllipse(psfEllipse), 
-    _x(x), _y(y), _rx(x.size()), _ry(y.size())
+) : _useApproximateExp(useApproximateExp), _size(x.size()), _cullRadius(0.0), _flux(flux),
+    _psfAmplitude(psfAmplitude), _normalization(1.0), _scaling(afw::geom::LinearTransform::makeScaling(radius)),
+    _psfEllipse(psfEllipse), _x(x), _y(y), _rx(x.size()), _ry(y.size())
 {
     if (_x.size() != _y.size()) {
         throw LSST_EXCEPT(
@@ -54,26 +131,45 @@ GaussianModelBuilder::GaussianModelBuilder(
              % _x.size() % _y.size()).str()
         );
     }
+    _updateRanges();
+}
+
+GaussianModelBuilder::GaussianModelBuilder(
+    CoordinateSpanList const & spans,
+    double flux, double radius, afw::geom::ellipses::Quadrupole const & psfEllipse,
+    double psfAmplitude, bool useApproximateExp
+) : _useApproximateExp(useApproximateExp), _size(spans.empty() ? 0 : spans.back().offset + spans.back().size),
+    _cullRadius(0.0), _flux(flux), _psfAmplitude(psfAmplitude), _normalization(1.0),
+    _scaling(afw::geom::LinearTransform::makeScaling(radius)), _psfEllipse(psfEllipse), 
+    _x(ndarray::Array<double const,1,1>()), _y(ndarray::Array<double const,1,1>()), _spans(spans)
+{
+    _updateRanges();
 }
 
 GaussianModelBuilder::GaussianModelBuilder(GaussianModelBuilder const & other) :
-    _useApproximateExp(other._useApproximateExp), _flux(other._flux), _psfAmplitude(other._psfAmplitude),
-    _scaling(other._scaling), _psfEllipse(other._psfEllipse),
-    _esn(other._esn), _esnJacobian(other._esnJacobian), _dNorm(other._dNorm),
-    _x(other._x), _y(other._y), _rx(other._rx), _ry(other._ry)
+    _useApproximateExp(other._useApproximateExp), _size(other._size), _cullRadius(other._cullRadius),
+    _flux(other._flux),
+    _psfAmplitude(other._psfAmplitude), _normalization(other._normalization), _scaling(other._scaling),
+    _psfEllipse(other._psfEllipse), _esn(other._esn), _esnJacobian(other._esnJacobian), _dNorm(other._dNorm),
+    _x(other._x), _y(other._y), _rx(other._rx), _ry(other._ry), _spans(other._spans), _ranges(other._ranges)
 {}
 
 GaussianModelBuilder & GaussianModelBuilder::operator=(GaussianModelBuilder const & other) {
     if (&other != this) {
         _useApproximateExp = other._useApproximateExp;
+        _size = other._size;
+        _cullRadius = other._cullRadius;
         _flux = other._flux;
         _psfAmplitude = other._psfAmplitude;
+        _normalization = other._normalization;
         _scaling = other._scaling;
         _psfEllipse = other._psfEllipse;
         _x.reset(other._x.shallow());
         _y.reset(other._y.shallow());
         _rx = other._rx;
         _ry = other._ry;
+        _spans = other._spans;
+        _ranges = other._ranges;
         _esn = other._esn;
         _esnJacobian = other._esnJacobian;
         _dNorm = other._dNorm;
@@ -82,7 +178,7 @@ GaussianModelBuilder & GaussianModelBuilder::operator=(GaussianModelBuilder cons
     return *this;
 }
 
-void GaussianModelBuilder::update(afw::geom::ellipses::BaseCore const & core) {
+void GaussianModelBuilder::updateEllipse(afw::geom::ellipses::BaseCore const & core) {
     Eigen::Matrix3d scaleJac = core.transform(_scaling).d();
     PTR(afw::geom::ellipses::BaseCore) ellipse = core.transform(_scaling).copy();
     Eigen::Matrix3d convJac = ellipse->convolve(_psfEllipse).d();
@@ -90,25 +186,192 @@ void GaussianModelBuilder::update(afw::geom::ellipses::BaseCore const & core) {
     afw::geom::ellipses::Quadrupole q;
     Eigen::Matrix3d quadJacobian = q.dAssign(*ellipse) * convJac * scaleJac;
     _esnJacobian = _esn.update(q) * quadJacobian; 
-    if (_model.isEmpty()) {
-        _model = ndarray::allocate(_x.size());
-    }
-    ndarray::EigenView<double,1,1> z(_model);
-    _esn(_x, _y, _rx, _ry, z);
     double det = q.getDeterminant();
     Eigen::RowVector3d dNorm_dq;
     dNorm_dq[0] = -0.5 * q.getIyy() / det;
     dNorm_dq[1] = -0.5 * q.getIxx() / det;
     dNorm_dq[2] = q.getIxy() / det;
     _dNorm = dNorm_dq * quadJacobian;
-    if (_useApproximateExp) {
-        z.array() = (-0.5 * z.array()).unaryExpr(PowFastExpFunctor());
+    _normalization = (_flux * _psfAmplitude) / (std::sqrt(det) * afw::geom::PI * 2.0);
+    if (_cullRadius > 0.0) {
+        _updateRanges();
+    }
+}
+
+void GaussianModelBuilder::setCullRadius(double nSigma) {
+    if (nSigma > 0.0 && _spans.empty() && _size > 0) {
+        throw LSST_EXCEPT(
+            pex::exceptions::InvalidParameterException,
+            "Pixel culling requires a builder constructed from spans"
+        );
+    }
+    _cullRadius = std::max(nSigma, 0.0);
+    // Until the next update, the old ranges (or all pixels) remain valid.
+    if (_cullRadius == 0.0) {
+        _updateRanges();
+    }
+}
+
+void GaussianModelBuilder::_updateRanges() {
+    _ranges.clear();
+    if (_cullRadius <= 0.0) {
+        if (_size > 0) {
+            PixelRange all = { 0, _size };
+            _ranges.push_back(all);
+        }
+        return;
+    }
+    double const z = _cullRadius * _cullRadius;
+    for (CoordinateSpanList::const_iterator s = _spans.begin(); s != _spans.end(); ++s) {
+        double xMin, xMax;
+        if (!_esn.getRowInterval(s->y, z, xMin, xMax)) continue;
+        // Clamp before converting, so huge ellipses cannot overflow the integer conversion.
+        int const b = static_cast<int>(std::max(std::ceil(xMin - s->x0), 0.0));
+        int const e = static_cast<int>(std::min(std::floor(xMax - s->x0) + 1.0, double(s->size)));
+        if (b >= e) continue;
+        PixelRange range = { s->offset + b, s->offset + e };
+        if (!_ranges.empty() && _ranges.back().end == range.begin) {
+            _ranges.back().end = range.end;
+        } else {
+            _ranges.push_back(range);
+        }
+    }
+}
+
+GaussianModelBuilder::PixelRangeList::const_iterator GaussianModelBuilder::_findRange(int begin) const {
+    int lo = 0;
+    int hi = _ranges.size();
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (_ranges[mid].end <= begin) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return _ranges.begin() + lo;
+}
+
+void GaussianModelBuilder::update(afw::geom::ellipses::BaseCore const & core) {
+    updateEllipse(core);
+    if (_model.isEmpty()) {
+        _model = ndarray::allocate(_size);
+    }
+    if (_spans.empty()) {
+        ndarray::EigenView<double,1,1> z(_model);
+        _esn(_x, _y, _rx, _ry, z);
+        evaluateGaussian(_model.getData(), _model.getSize<0>(), _normalization, _useApproximateExp);
     } else {
-        z.array() = (-0.5 * z.array()).exp();
+        double x[BLOCK_SIZE];
+        double y[BLOCK_SIZE];
+        double rx[BLOCK_SIZE];
+        double ry[BLOCK_SIZE];
+        if (_cullRadius > 0.0) {
+            _model.asEigen().setZero();
+        }
+        for (PixelRangeList::const_iterator r = _ranges.begin(); r != _ranges.end(); ++r) {
+            for (int i0 = r->begin; i0 < r->end; i0 += BLOCK_SIZE) {
+                _computeBlock(
+                    i0, std::min(BLOCK_SIZE, r->end - i0), x, y, rx, ry, _model.getData() + i0, true
+                );
+            }
+        }
+    }
+}
+
+void GaussianModelBuilder::addModelAndDerivative(
+    int begin, int end,
+    ndarray::Array<double,1,1> const & model,
+    ndarray::Array<double,2,-2> const & derivative
+) const {
+    if (model.getSize<0>() != _size || derivative.getSize<0>() != _size) {
+        throw LSST_EXCEPT(
+            pex::exceptions::InvalidParameterException,
+            (boost::format("Incorrect number of rows for arrays: got %d and %d, expected %d")
+             % model.getSize<0>() % derivative.getSize<0>() % _size).str()
+        );
+    }
+    int const s0 = derivative.getStride<0>();
+    _addModelAndDerivative(
+        begin, end, model.getData() + begin, derivative.getData() + begin * s0, s0, derivative.getStride<1>()
+    );
+}
+
+template <typename T>
+void GaussianModelBuilder::addTileModelAndDerivative(
+    int begin, int end,
+    ndarray::Array<T,1,1> const & model,
+    ndarray::Array<T,2,-2> const & derivative
+) const {
+    if (model.template getSize<0>() < end - begin || derivative.template getSize<0>() < end - begin) {
+        throw LSST_EXCEPT(
+            pex::exceptions::InvalidParameterException,
+            (boost::format("Too few rows for tile arrays: got %d and %d, expected at least %d")
+             % model.template getSize<0>() % derivative.template getSize<0>() % (end - begin)).str()
+        );
     }
-    z.array() *= (_flux * _psfAmplitude) / (std::sqrt(det) * afw::geom::PI * 2.0);
+    _addModelAndDerivative(
+        begin, end, model.getData(), derivative.getData(),
+        derivative.template getStride<0>(), derivative.template getStride<1>()
+    );
 }
 
+template <typename T>
+void GaussianModelBuilder::_addModelAndDerivative(
+    int begin, int end, T * m, T * d, int s0, int s1
+) const {
+    for (PixelRangeList::const_iterator r = _findRange(begin); r != _ranges.end() && r->begin < end; ++r) {
+        int const b = std::max(r->begin, begin);
+        _addRangeModelAndDerivative(b, std::min(r->end, end), m + (b - begin), d + (b - begin) * s0, s0, s1);
+    }
+}
+
+template <typename T>
+void GaussianModelBuilder::_addRangeModelAndDerivative(
+    int begin, int end, T * m, T * d, int s0, int s1
+) const {
+    // This is the same computation as update() followed by computeDerivative(), but done in
+    // small stack-allocated blocks so no full-size intermediate arrays are needed; dEllipse() reduces to
+    //   dz/de = 2 * [rx*x, ry*x, ry*y] * _esnJacobian
+    // and we fold the -0.5 from the exponent and the normalization derivative in directly.
+    T jac[3][3];
+    T dNorm[3];
+    for (int j = 0; j < 3; ++j) {
+        dNorm[j] = _dNorm[j];
+        for (int i = 0; i < 3; ++i) {
+            jac[i][j] = _esnJacobian(i, j);
+        }
+    }
+    T x[BLOCK_SIZE];
+    T y[BLOCK_SIZE];
+    T rx[BLOCK_SIZE];
+    T ry[BLOCK_SIZE];
+    T v[BLOCK_SIZE];
+    for (int i0 = begin; i0 < end; i0 += BLOCK_SIZE) {
+        int const n = std::min(BLOCK_SIZE, end - i0);
+        _computeBlock(i0, n, x, y, rx, ry, v, true);
+        for (int k = 0; k < n; ++k) {
+            int const i = i0 - begin + k;
+            T const vk = v[k];
+            T const a = rx[k] * x[k];
+            T const b = ry[k] * x[k];
+            T const c = ry[k] * y[k];
+            T * di = d + i * s0;
+            m[i] += vk;
+            di[0]      += vk * (dNorm[0] - a * jac[0][0] - b * jac[1][0] - c * jac[2][0]);
+            di[s1]     += vk * (dNorm[1] - a * jac[0][1] - b * jac[1][1] - c * jac[2][1]);
+            di[2 * s1] += vk * (dNorm[2] - a * jac[0][2] - b * jac[1][2] - c * jac[2][2]);
+        }
+    }
+}
+
+template void GaussianModelBuilder::addTileModelAndDerivative(
+    int, int, ndarray::Array<float,1,1> const &, ndarray::Array<float,2,-2> const &
+) const;
+template void GaussianModelBuilder::addTileModelAndDerivative(
+    int, int, ndarray::Array<double,1,1> const &, ndarray::Array<double,2,-2> const &
+) const;
+
 void GaussianModelBuilder::computeDerivative(
     ndarray::Array<double,2,-1> const & output,
     bool add
@@ -119,15 +382,40 @@ void GaussianModelBuilder::computeDerivative(
             "computeDerivative called before computeModel"
         );
     }
-    if (output.getSize<0>() != _x.size()) {
+    if (output.getSize<0>() != _size) {
         throw LSST_EXCEPT(
             pex::exceptions::InvalidParameterException,
             (boost::format("Incorrect number of rows for array: got %d, expected %d")
-             % output.getSize<0>() % _x.size()).str()
+             % output.getSize<0>() % _size).str()
         );
     }
     ndarray::EigenView<double,2,-1> out(output);
     if (!add) out.setZero();
+    if (!_spans.empty()) {
+        // No full-size rx, ry arrays are kept in span mode, so we recompute them block by block.
+        Eigen::Matrix3d const & jac = _esnJacobian;
+        double x[BLOCK_SIZE];
+        double y[BLOCK_SIZE];
+        double rx[BLOCK_SIZE];
+        double ry[BLOCK_SIZE];
+        double z[BLOCK_SIZE];
+        for (PixelRangeList::const_iterator r = _ranges.begin(); r != _ranges.end(); ++r) {
+            for (int i0 = r->begin; i0 < r->end; i0 += BLOCK_SIZE) {
+                int const n = std::min(BLOCK_SIZE, r->end - i0);
+                _computeBlock(i0, n, x, y, rx, ry, z, false);
+                for (int k = 0; k < n; ++k) {
+                    int const i = i0 + k;
+                    double const a = rx[k] * x[k];
+                    double const b = ry[k] * x[k];
+                    double const c = ry[k] * y[k];
+                    for (int j = 0; j < 3; ++j) {
+                        out(i, j) += _model[i] * (_dNorm[j] - a * jac(0, j) - b * jac(1, j) - c * jac(2, j));
+                    }
+                }
+            }
+        }
+        return;
+    }
     Eigen::MatrixXd dz_de = Eigen::MatrixXd::Zero(_x.size(), _esnJacobian.cols());
     _esn.dEllipse(_x, _y, _rx, _ry, _esnJacobian, dz_de);
     for (int n = 0; n < _esnJacobian.cols(); ++n) {
@@ -137,12 +425,50 @@ void GaussianModelBuilder::computeDerivative(
     out += _model.asEigen() * _dNorm;
 }
 
+template <typename T>
+void GaussianModelBuilder::_computeBlock(
+    int begin, int n,
+    T * x, T * y, T * rx, T * ry, T * z,
+    bool evaluate
+) const {
+    if (_spans.empty()) {
+        for (int k = 0; k < n; ++k) {
+            x[k] = _x[begin + k];
+            y[k] = _y[begin + k];
+            _esn(x[k], y[k], rx[k], ry[k], z[k]);
+        }
+        if (evaluate) evaluateGaussian(z, n, _normalization, _useApproximateExp);
+        return;
+    }
+    double const q = std::exp(-_esn.getXXCoefficient());
+    // Find the last span that starts at or before 'begin', then walk forward.
+    int lo = 0;
+    int hi = _spans.size();
+    while (hi - lo > 1) {
+        int mid = (lo + hi) / 2;
+        if (_spans[mid].offset <= begin) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+    for (int k = 0, s = lo; k < n; ++s) {
+        CoordinateSpan const & span = _spans[s];
+        int const j = begin + k - span.offset;
+        int const m = std::min(span.size - j, n - k);
+        _esn.evaluateSpan(span.x0 + j, span.y, m, x + k, rx + k, ry + k, z + k);
+        std::fill(y + k, y + k + m, T(span.y));
+        if (evaluate) evaluateRow(z + k, m, _normalization, q, _useApproximateExp);
+        k += m;
+    }
+}
+
 void GaussianModelBuilder::setOutput(ndarray::Array<double,1,1> const & array) {
-    if (array.getSize<0>() != _x.size()) {
+    if (array.getSize<0>() != _size) {
         throw LSST_EXCEPT(
             pex::exceptions::InvalidParameterException,
             (boost::format("Incorrect size for array: got %d, expected %d")
-             % array.getSize<0>() % _x.size()).str()
+             % array.getSize<0>() % _size).str()
         );
     }
 }
@@ -25,11 +25,35 @@
 #include "Eigen/Eigenvalues"
 #include "Eigen/Cholesky"
 #include "boost/make_shared.hpp"
+#include "boost/format.hpp"
 
+#include "lsst/pex/exceptions.h"
 #include "lsst/meas/extensions/multiShapelet/HybridOptimizer.h"
 
 namespace lsst { namespace meas { namespace extensions { namespace multiShapelet {
 
+void Objective::computeNormalEquations(
+    ndarray::Array<double const,1,1> const & parameters,
+    double & halfChiSq,
+    double & functionInfNorm,
+    ndarray::Array<double,1,1> const & gradient,
+    ndarray::Array<double,2,2> const & normalMatrix
+) {
+    throw LSST_EXCEPT(
+        pex::exceptions::LogicErrorException,
+        "Objective does not compute the normal equations directly"
+    );
+}
+
+namespace {
+
+// Objectives that compute the normal equations directly need no function- or derivative-sized arrays.
+int getStoredFunctionSize(Objective const & objective) {
+    return objective.hasNormalEquations() ? 0 : objective.getFunctionSize();
+}
+
+} // anonymous
+
 // Throughout this file, I have used the variable names from the original implementation
 // and/or the formulae in the document it is based on (see class docs), rather than
 // names that adhere to the LSST naming conventions (which are follwed in the header file).
@@ -37,6 +61,18 @@ namespace lsst { namespace meas { namespace extensions { namespace multiShapelet
 // a mathematical understanding of the algorithm, so I think it's more important to use
 // variable names that can easily be mapped to variables in a more complete description.
 
+// Impl holds everything that doesn't depend on the number of parameters, and is what the
+// HybridOptimizer accessors use; SizedImpl holds the small parameter-space matrices and vectors,
+// which are fixed-size (and hence never touch the heap) for objectives with exactly 3 parameters
+// (all the MultiGaussianObjectives in this package) and dynamic otherwise.
+//
+// The derivative itself is only used right after each evaluation, to compute the gradient and
+// the normal matrix J^T J (SizedImpl::H and HNew); everything else (the LM Hessian, the BFGS
+// update, and the trust region ratio) works from those.  So only the trial derivative JNew is
+// kept, and accepting a step swaps the f and fNew buffers rather than copying them.  For
+// objectives that compute the normal equations directly ('reduced' objectives), f, fNew, and
+// JNew are empty, and H and HNew come straight from the objective.
+
 class HybridOptimizer::Impl {
 public:
     
@@ -46,9 +82,13 @@ public:
         Control const & control
     );
 
-    void step();
+    virtual void step() = 0;
+
+    virtual void getWarmStart(HybridOptimizerWarmStart & warmStart) const = 0;
+
+    virtual void setWarmStart(HybridOptimizerWarmStart const & warmStart) = 0;
 
-    void solve(Eigen::MatrixXd const & m);
+    virtual ~Impl() {}
 
     bool checkStep(double stepNorm, StateFlags bad) {
         if (!(stepNorm > ctrl.minStep * (x.norm() + ctrl.minStep))) {
@@ -60,29 +100,26 @@ public:
 
     PTR(Objective) obj;
     HybridOptimizerControl ctrl;
+    bool reduced;
     MethodEnum method;
     int state;
     int count;
     int rank;
+    int stepCount;
+    int evalCount;
+    int derivCount;
+    int switchCount;
     ndarray::EigenView<double,1,1> x;
     ndarray::EigenView<double,1,1> xNew;
     ndarray::EigenView<double,1,1> f;
     ndarray::EigenView<double,1,1> fNew;
-    ndarray::EigenView<double,2,-2> J;
     ndarray::EigenView<double,2,-2> JNew;
-    Eigen::VectorXd h;
-    Eigen::VectorXd y;
-    Eigen::VectorXd v;
-    Eigen::MatrixXd A; // Hessian for LM method
-    Eigen::MatrixXd B; // Hessian for BFGS method (Jarvis uses 'H')
-    Eigen::VectorXd g;
-    Eigen::VectorXd gNew;
-    Eigen::LDLT<Eigen::MatrixXd,Eigen::Lower> ldlt;
-    Eigen::SelfAdjointEigenSolver<Eigen::MatrixXd> eigh;
     double normInfF;
+    double normInfFNew;
     double normInfG;
     double Q;
     double QNew;
+    double dChiSq; // predicted chi^2 decrease of a Gauss-Newton step from x
     double mu;
     double nu;
     double delta;
@@ -92,41 +129,190 @@ HybridOptimizer::Impl::Impl(
     PTR(Objective) const & objective,
     ndarray::Array<double const,1,1> const & parameters,
     Control const & control
-) : obj(objective), ctrl(control), method(LM), state(0), count(0),
-    rank(objective->getParameterSize()),
+) : obj(objective), ctrl(control), reduced(objective->hasNormalEquations()), method(LM), state(0),
+    count(0), rank(objective->getParameterSize()), stepCount(0), evalCount(0), derivCount(0),
+    switchCount(0),
     x(ndarray::copy(parameters)), xNew(ndarray::copy(parameters)),
-    f(ndarray::allocate(objective->getFunctionSize())),
-    fNew(ndarray::allocate(objective->getFunctionSize())),
-    J(ndarray::allocate(objective->getFunctionSize(), objective->getParameterSize())),
-    JNew(ndarray::allocate(objective->getFunctionSize(), objective->getParameterSize())),
-    h(Eigen::VectorXd::Zero(objective->getParameterSize())),
-    y(Eigen::VectorXd::Zero(objective->getParameterSize())),
-    v(Eigen::VectorXd::Zero(objective->getParameterSize())),
-    A(Eigen::MatrixXd::Zero(objective->getParameterSize(), objective->getParameterSize())),
-    B(Eigen::MatrixXd::Identity(objective->getParameterSize(), objective->getParameterSize())),
-    g(Eigen::VectorXd::Zero(objective->getParameterSize())),
-    gNew(Eigen::VectorXd::Zero(objective->getParameterSize())),
-    ldlt(0), eigh(0), normInfF(0.0), normInfG(0.0), Q(0.0), QNew(0.0), mu(0.0), nu(2.0), delta(ctrl.delta0)
+    f(ndarray::allocate(getStoredFunctionSize(*objective))),
+    fNew(ndarray::allocate(getStoredFunctionSize(*objective))),
+    JNew(ndarray::allocate(getStoredFunctionSize(*objective), objective->getParameterSize())),
+    normInfF(0.0), normInfFNew(0.0), normInfG(0.0), Q(0.0), QNew(0.0),
+    dChiSq(std::numeric_limits<double>::quiet_NaN()), mu(0.0), nu(2.0),
+    delta(ctrl.delta0)
+{}
+
+// N is the number of parameters, or Eigen::Dynamic.  Only 3 and Eigen::Dynamic are instantiated;
+// other fixed sizes that are a multiple of 16 bytes would need EIGEN_MAKE_ALIGNED_OPERATOR_NEW and
+// an aligned allocator in the HybridOptimizer constructor.
+template <int N>
+class HybridOptimizer::SizedImpl : public HybridOptimizer::Impl {
+public:
+
+    typedef Eigen::Matrix<double,N,1> Vector;
+    typedef Eigen::Matrix<double,N,N> Matrix;
+
+    SizedImpl(
+        PTR(Objective) const & objective,
+        ndarray::Array<double const,1,1> const & parameters,
+        Control const & control
+    );
+
+    virtual void step();
+
+    virtual void getWarmStart(HybridOptimizerWarmStart & warmStart) const;
+
+    virtual void setWarmStart(HybridOptimizerWarmStart const & warmStart);
+
+    void solve(Matrix const & m);
+
+    // Evaluate the objective at xNew, setting QNew and normInfFNew, and (if withDerivative is true)
+    // HNew and, if reduced, gNew; reduced objectives always compute the derivative.
+    void evaluate(bool withDerivative);
+
+    // Evaluate the derivative at xNew after a call to evaluate(false), setting HNew.
+    void evaluateDerivative();
+
+    // Make the trial quantities the current ones.
+    void acceptTrial();
+
+    // Set dChiSq from the current gradient and J^T J, and the SUCCESS_CHISQ flag if it is small.
+    void checkChiSq();
+
+    // Set gNew from fNew and JNew; a no-op if reduced, as evaluate() has already done it.
+    void computeTrialGradient();
+
+    // Set the LM Hessian A to J^T J (or JNew^T JNew if trial is true) plus mu on the diagonal.
+    void resetLM(bool trial);
+
+    Vector h;
+    Vector y;
+    Vector v;
+    Matrix A; // Hessian for LM method
+    Matrix B; // Hessian for BFGS method (Jarvis uses 'H')
+    Vector g;
+    Vector gNew;
+    Matrix H;    // J^T J (only the lower triangle is used)
+    Matrix HNew; // JNew^T JNew
+    ndarray::Array<double,1,1> gBuffer;    // computeNormalEquations outputs, if reduced
+    ndarray::Array<double,2,2> HBuffer;
+    Eigen::LDLT<Matrix,Eigen::Lower> ldlt;
+    Eigen::SelfAdjointEigenSolver<Matrix> eigh;
+};
+
+template <int N>
+HybridOptimizer::SizedImpl<N>::SizedImpl(
+    PTR(Objective) const & objective,
+    ndarray::Array<double const,1,1> const & parameters,
+    Control const & control
+) : Impl(objective, parameters, control),
+    h(Vector::Zero(objective->getParameterSize())),
+    y(Vector::Zero(objective->getParameterSize())),
+    v(Vector::Zero(objective->getParameterSize())),
+    A(Matrix::Zero(objective->getParameterSize(), objective->getParameterSize())),
+    B(Matrix::Identity(objective->getParameterSize(), objective->getParameterSize())),
+    g(Vector::Zero(objective->getParameterSize())),
+    gNew(Vector::Zero(objective->getParameterSize())),
+    H(Matrix::Zero(objective->getParameterSize(), objective->getParameterSize())),
+    HNew(Matrix::Zero(objective->getParameterSize(), objective->getParameterSize())),
+    ldlt(), eigh()
 {
+    if (reduced) {
+        gBuffer = ndarray::allocate(objective->getParameterSize());
+        HBuffer = ndarray::allocate(objective->getParameterSize(), objective->getParameterSize());
+    }
+    evaluate(true);
+    computeTrialGradient();
+    acceptTrial();
+    if (!reduced) {
+        fNew = f; // so the trial function is valid before the first step
+    }
+    normInfG = g.template lpNorm<Eigen::Infinity>();
+    if (ctrl.chiSqTol > 0.0) {
+        checkChiSq();
+    }
+    resetLM(false); // mu is still zero here
+    mu = ctrl.tau * A.diagonal().template lpNorm<Eigen::Infinity>();
+    A.diagonal().array() += mu;
+}
+
+template <int N>
+void HybridOptimizer::SizedImpl<N>::evaluate(bool withDerivative) {
+    ++evalCount;
+    if (reduced) {
+        obj->computeNormalEquations(xNew.shallow(), QNew, normInfFNew, gBuffer, HBuffer);
+        ++derivCount;
+        gNew = gBuffer.asEigen();
+        HNew = HBuffer.asEigen();
+        return;
+    }
     fNew.setZero();
-    obj->computeFunction(xNew.shallow(), fNew.shallow());
-    f = fNew;
-    normInfF = f.lpNorm<Eigen::Infinity>();
-    QNew = Q = 0.5 * f.squaredNorm();
-    JNew.setZero(); 
+    if (withDerivative) {
+        JNew.setZero();
+        obj->computeFunctionAndDerivative(xNew.shallow(), fNew.shallow(), JNew.shallow());
+        ++derivCount;
+        HNew.setZero();
+        HNew.template selfadjointView<Eigen::Lower>().rankUpdate(JNew.adjoint());
+    } else {
+        obj->computeFunction(xNew.shallow(), fNew.shallow());
+    }
+    QNew = 0.5 * fNew.squaredNorm();
+    normInfFNew = fNew.lpNorm<Eigen::Infinity>();
+}
+
+template <int N>
+void HybridOptimizer::SizedImpl<N>::evaluateDerivative() {
+    JNew.setZero();
     obj->computeDerivative(xNew.shallow(), fNew.shallow(), JNew.shallow());
-    J = JNew;
-    A.selfadjointView<Eigen::Lower>().rankUpdate(J.adjoint());
-    g = J.adjoint() * f;
-    normInfG = g.lpNorm<Eigen::Infinity>();
-    mu = ctrl.tau * A.diagonal().lpNorm<Eigen::Infinity>();
+    ++derivCount;
+    HNew.setZero();
+    HNew.template selfadjointView<Eigen::Lower>().rankUpdate(JNew.adjoint());
+}
+
+template <int N>
+void HybridOptimizer::SizedImpl<N>::acceptTrial() {
+    x = xNew;
+    if (!reduced) {
+        ndarray::Array<double,1,1> tmp = f.shallow();
+        f.reset(fNew.shallow());
+        fNew.reset(tmp);
+    }
+    H = HNew;
+    g = gNew;
+    Q = QNew;
+    normInfF = normInfFNew;
+}
+
+template <int N>
+void HybridOptimizer::SizedImpl<N>::checkChiSq() {
+    // H is only positive semidefinite, so a failed or singular factorization gives a non-finite
+    // or negative result, which never meets the condition.
+    Eigen::LDLT<Matrix,Eigen::Lower> ldltH(H);
+    dChiSq = g.dot(ldltH.solve(g));
+    int const dof = obj->getFunctionSize() - obj->getParameterSize();
+    if (dof > 0 && dChiSq >= 0.0 && dChiSq < ctrl.chiSqTol * 2.0 * Q / dof) {
+        state |= SUCCESS_CHISQ;
+    }
+}
+
+template <int N>
+void HybridOptimizer::SizedImpl<N>::computeTrialGradient() {
+    if (!reduced) {
+        gNew = JNew.adjoint() * fNew;
+    }
+}
+
+template <int N>
+void HybridOptimizer::SizedImpl<N>::resetLM(bool trial) {
+    A = trial ? HNew : H;
     A.diagonal().array() += mu;
 }
 
-void HybridOptimizer::Impl::step() {
+template <int N>
+void HybridOptimizer::SizedImpl<N>::step() {
     static double const sqrtEps = std::sqrt(std::numeric_limits<double>::epsilon());
     bool isBetter = false;
     bool shouldSwitchMethod = false;
+    ++stepCount;
 
     switch (method) {
     case LM:
@@ -164,25 +350,29 @@ void HybridOptimizer::Impl::step() {
     } else {
         state &= ~(STEP_MODIFIED | STEP_INVALID);
     }
+    // In lazy mode, LM steps only need the derivative if they are accepted.
+    bool hasDerivative = false;
     if (doStep) {
-        fNew.setZero();
-        obj->computeFunction(xNew.shallow(), fNew.shallow());
-        QNew = 0.5 * fNew.squaredNorm();
-        JNew.setZero();
-        obj->computeDerivative(xNew.shallow(), fNew.shallow(), JNew.shallow());
+        bool lazy = ctrl.lazyDerivative && method == LM && !reduced;
+        evaluate(!lazy);
+        hasDerivative = !lazy;
+        if (lazy && QNew < Q) {
+            evaluateDerivative();
+            hasDerivative = true;
+        }
     }
 
     double normInfGNew = 0.0;
     if (doStep && (method == BFGS || QNew < Q)) {
-        gNew = JNew.adjoint() * fNew;
-        normInfGNew = gNew.lpNorm<Eigen::Infinity>();
+        computeTrialGradient();
+        normInfGNew = gNew.template lpNorm<Eigen::Infinity>();
     }
 
     if (method == BFGS) {
         isBetter = (QNew < Q) || (QNew <= (1.0 + sqrtEps) * Q && normInfGNew < normInfG);
         shouldSwitchMethod = (normInfGNew >= normInfG);
         if (QNew < Q) {
-            double rho = (Q - QNew) / -(h.dot(g) - 0.5*(J*h).squaredNorm());
+            double rho = (Q - QNew) / -(h.dot(g) - 0.5*h.dot(H.template selfadjointView<Eigen::Lower>() * h));
             if (rho > 0.75) {
                 delta = std::max(delta, 3.0 * normH);
             } else if (rho < 0.25) {
@@ -205,9 +395,7 @@ void HybridOptimizer::Impl::step() {
                 count = 0;
             }
             if (count != 3) {
-                A.setZero();
-                A.selfadjointView<Eigen::Lower>().rankUpdate(JNew.adjoint());
-                A.diagonal().array() += mu;
+                resetLM(true);
             }
         } else {
             A.diagonal().array() += mu * (nu - 1.0);
@@ -218,22 +406,19 @@ void HybridOptimizer::Impl::step() {
     }
     if (!doStep) return;
 
-    y = JNew.adjoint() * (JNew * h) + (gNew - g);
-    double hy = h.dot(y);
-    if (hy > 0.0) {
-        v = B.selfadjointView<Eigen::Lower>() * h;
-        double hv = h.dot(v);
-        B.selfadjointView<Eigen::Lower>().rankUpdate(v, -1.0 / hv);
-        B.selfadjointView<Eigen::Lower>().rankUpdate(y, 1.0 / hy);
+    if (hasDerivative) {
+        y = HNew.template selfadjointView<Eigen::Lower>() * h + (gNew - g);
+        double hy = h.dot(y);
+        if (hy > 0.0) {
+            v = B.template selfadjointView<Eigen::Lower>() * h;
+            double hv = h.dot(v);
+            B.template selfadjointView<Eigen::Lower>().rankUpdate(v, -1.0 / hv);
+            B.template selfadjointView<Eigen::Lower>().rankUpdate(y, 1.0 / hy);
+        }
     }
 
     if (isBetter) {
-        x = xNew;
-        f = fNew;
-        Q = QNew;
-        J = JNew;
-        g = gNew;
-        normInfF = f.lpNorm<Eigen::Infinity>();
+        acceptTrial();
         normInfG = normInfGNew;
         if (!(normInfF > ctrl.fTol)) {
             state |= SUCCESS_FTOL;
@@ -241,16 +426,18 @@ void HybridOptimizer::Impl::step() {
         if (!(normInfG > ctrl.gTol)) {
             state |= SUCCESS_GTOL;
         }
+        if (ctrl.chiSqTol > 0.0) {
+            checkChiSq();
+        }
     }
 
     if (shouldSwitchMethod) {
+        ++switchCount;
         if (method == BFGS) { // switching from BFGS to LM
-            A.setZero();
-            A.selfadjointView<Eigen::Lower>().rankUpdate(J.adjoint());
-            A.diagonal().array() += mu;
+            resetLM(false);
             method = LM;
         } else { // switching from LM to BFGS
-            delta = std::max(1.5 * ctrl.minStep * (f.squaredNorm() + ctrl.minStep), 0.2 * normH);
+            delta = std::max(1.5 * ctrl.minStep * (2.0 * Q + ctrl.minStep), 0.2 * normH);
             method = BFGS;
         }
     }
@@ -262,7 +449,48 @@ void HybridOptimizer::Impl::step() {
     }
 }
 
-void HybridOptimizer::Impl::solve(Eigen::MatrixXd const & m) {
+template <int N>
+void HybridOptimizer::SizedImpl<N>::getWarmStart(HybridOptimizerWarmStart & warmStart) const {
+    int const n = obj->getParameterSize();
+    warmStart.method = method;
+    warmStart.mu = mu;
+    warmStart.delta = delta;
+    warmStart.hessian = ndarray::allocate(n, n);
+    // only the lower triangle of B is kept up to date
+    for (int i = 0; i < n; ++i) {
+        for (int j = 0; j <= i; ++j) {
+            warmStart.hessian[i][j] = warmStart.hessian[j][i] = B(i, j);
+        }
+    }
+}
+
+template <int N>
+void HybridOptimizer::SizedImpl<N>::setWarmStart(HybridOptimizerWarmStart const & warmStart) {
+    int const n = obj->getParameterSize();
+    if (warmStart.hessian.getSize<0>() != n || warmStart.hessian.getSize<1>() != n) {
+        throw LSST_EXCEPT(
+            pex::exceptions::LengthErrorException,
+            (boost::format("Warm-start Hessian has shape (%d, %d); expected (%d, %d)")
+             % warmStart.hessian.getSize<0>() % warmStart.hessian.getSize<1>() % n % n).str()
+        );
+    }
+    for (int i = 0; i < n; ++i) {
+        for (int j = 0; j < n; ++j) {
+            B(i, j) = warmStart.hessian[i][j];
+        }
+    }
+    if (warmStart.mu > 0.0) {
+        A.diagonal().array() += warmStart.mu - mu;
+        mu = warmStart.mu;
+    }
+    if (warmStart.method == BFGS && warmStart.delta > 0.0) {
+        method = BFGS;
+        delta = warmStart.delta;
+    }
+}
+
+template <int N>
+void HybridOptimizer::SizedImpl<N>::solve(Matrix const & m) {
     if (ctrl.useCholesky) {
         ldlt.compute(m);
         h = ldlt.solve(-g);
@@ -290,6 +518,9 @@ int HybridOptimizer::getState() const {
 
 int HybridOptimizer::run() {
     for (int n = 0; n < _impl->ctrl.maxIter; ++n) {
+        // step() calls evaluate() at most once (there are no line searches or inner LM retries; a
+        // rejected LM step just increases mu for the next one), so checking here is exact.
+        if (_impl->ctrl.maxEvaluations > 0 && _impl->evalCount >= _impl->ctrl.maxEvaluations) break;
         _impl->step();
         if (_impl->state & FINISHED) return _impl->state;
     }
@@ -302,8 +533,19 @@ double HybridOptimizer::getChiSq() const { return 2.0 * _impl->Q; }
 double HybridOptimizer::getTrialChiSq() const { return 2.0 * _impl->QNew; }
 double HybridOptimizer::getFunctionInfNorm() const { return _impl->normInfF; }
 double HybridOptimizer::getGradientInfNorm() const { return _impl->normInfG; }
+double HybridOptimizer::getPredictedChiSqDecrease() const { return _impl->dChiSq; }
 double HybridOptimizer::getMu() const { return _impl->mu; }
 double HybridOptimizer::getDelta() const { return _impl->delta; }
+int HybridOptimizer::getStepCount() const { return _impl->stepCount; }
+int HybridOptimizer::getEvaluationCount() const { return _impl->evalCount; }
+int HybridOptimizer::getDerivativeCount() const { return _impl->derivCount; }
+int HybridOptimizer::getMethodSwitchCount() const { return _impl->switchCount; }
+
+HybridOptimizerWarmStart HybridOptimizer::getWarmStart() const {
+    HybridOptimizerWarmStart result;
+    _impl->getWarmStart(result);
+    return result;
+}
 
 CONST_PTR(Objective) HybridOptimizer::getObjective() const { return _impl->obj; }
 
@@ -317,9 +559,18 @@ HybridOptimizerControl const & HybridOptimizer::getControl() const { return _imp
 HybridOptimizer::HybridOptimizer(
     PTR(Objective) const & objective,
     ndarray::Array<double const,1,1> const & parameters,
-    Control const & ctrl
-) : _impl(boost::make_shared<Impl>(objective, parameters, ctrl))
-{}
+    Control const & ctrl,
+    HybridOptimizerWarmStart const & warmStart
+) {
+    if (objective->getParameterSize() == 3) {
+        _impl = boost::make_shared< SizedImpl<3> >(objective, parameters, ctrl);
+    } else {
+        _impl = boost::make_shared< SizedImpl<Eigen::Dynamic> >(objective, parameters, ctrl);
+    }
+    if (!warmStart.isEmpty()) {
+        _impl->setWarmStart(warmStart);
+    }
+}
 
 HybridOptimizer::~HybridOptimizer() {}
 
@@ -0,0 +1,117 @@
+// -*- lsst-c++ -*-
+/* 
+ * LSST Data Management System
+ * Copyright 2012 LSST Corporation.
+ * 
+ * This product includes software developed by the
+ * LSST Project (http://www.lsst.org/).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the LSST License Statement and 
+ * the GNU General Public License along with this program.  If not, 
+ * see <http://www.lsstcorp.org/LegalNotices/>.
+ */
+
+#include <algorithm>
+
+#include "lsst/meas/extensions/multiShapelet/Instrumentation.h"
+
+namespace lsst { namespace meas { namespace extensions { namespace multiShapelet {
+
+FitStatisticsKeys::FitStatisticsKeys(
+    afw::table::Schema & schema, std::string const & prefix, bool nonlinear
+) : _nonlinear(nonlinear) {
+    if (_nonlinear) {
+        _stepsKey = schema.addField<int>(
+            prefix + ".nsteps", "number of optimizer steps taken"
+        );
+        _evaluationsKey = schema.addField<int>(
+            prefix + ".nevals", "number of model evaluations"
+        );
+        _derivativesKey = schema.addField<int>(
+            prefix + ".nderivs", "number of model derivative evaluations"
+        );
+        _methodSwitchesKey = schema.addField<int>(
+            prefix + ".nswitches", "number of optimizer switches between Levenberg-Marquardt and BFGS"
+        );
+        _fitTimeKey = schema.addField<float>(
+            prefix + ".time.fit", "wall-clock time spent in the nonlinear fit", "seconds"
+        );
+    }
+    _inputsTimeKey = schema.addField<float>(
+        prefix + ".time.inputs", "wall-clock time spent selecting and flattening pixels", "seconds"
+    );
+    _linearTimeKey = schema.addField<float>(
+        prefix + ".time.linear", "wall-clock time spent in the final linear fit", "seconds"
+    );
+}
+
+void FitStatisticsKeys::set(afw::table::BaseRecord & record, FitStatistics const & stats) const {
+    if (_nonlinear) {
+        record.set(_stepsKey, stats.steps);
+        record.set(_evaluationsKey, stats.evaluations);
+        record.set(_derivativesKey, stats.derivatives);
+        record.set(_methodSwitchesKey, stats.methodSwitches);
+        record.set(_fitTimeKey, stats.fitTime);
+    }
+    record.set(_inputsTimeKey, stats.inputsTime);
+    record.set(_linearTimeKey, stats.linearTime);
+}
+
+FitStatisticsSummary::FitStatisticsSummary(
+    PTR(daf::base::PropertyList) const & metadata, std::string const & prefix
+) : _metadata(metadata), _prefix(prefix + ".summary."), _sourceCount(0), _total(), _max() {}
+
+void FitStatisticsSummary::add(FitStatistics const & stats) {
+    ++_sourceCount;
+    _total.steps += stats.steps;
+    _total.evaluations += stats.evaluations;
+    _total.derivatives += stats.derivatives;
+    _total.methodSwitches += stats.methodSwitches;
+    _total.inputsTime += stats.inputsTime;
+    _total.fitTime += stats.fitTime;
+    _total.linearTime += stats.linearTime;
+    _max.steps = std::max(_max.steps, stats.steps);
+    _max.evaluations = std::max(_max.evaluations, stats.evaluations);
+    _max.derivatives = std::max(_max.derivatives, stats.derivatives);
+    _max.methodSwitches = std::max(_max.methodSwitches, stats.methodSwitches);
+    _max.inputsTime = std::max(_max.inputsTime, stats.inputsTime);
+    _max.fitTime = std::max(_max.fitTime, stats.fitTime);
+    _max.linearTime = std::max(_max.linearTime, stats.linearTime);
+}
+
+FitStatisticsSummary::~FitStatisticsSummary() {
+    try {
+        flush();
+    } catch (...) {}
+}
+
+void FitStatisticsSummary::flush() const {
+    if (!_metadata) return;
+    _metadata->set(_prefix + "nsources", _sourceCount);
+    _metadata->set(_prefix + "nsteps.total", _total.steps);
+    _metadata->set(_prefix + "nsteps.max", _max.steps);
+    _metadata->set(_prefix + "nevals.total", _total.evaluations);
+    _metadata->set(_prefix + "nevals.max", _max.evaluations);
+    _metadata->set(_prefix + "nderivs.total", _total.derivatives);
+    _metadata->set(_prefix + "nderivs.max", _max.derivatives);
+    _metadata->set(_prefix + "nswitches.total", _total.methodSwitches);
+    _metadata->set(_prefix + "nswitches.max", _max.methodSwitches);
+    _metadata->set(_prefix + "time.inputs.total", _total.inputsTime);
+    _metadata->set(_prefix + "time.inputs.max", _max.inputsTime);
+    _metadata->set(_prefix + "time.fit.total", _total.fitTime);
+    _metadata->set(_prefix + "time.fit.max", _max.fitTime);
+    _metadata->set(_prefix + "time.linear.total", _total.linearTime);
+    _metadata->set(_prefix + "time.linear.max", _max.linearTime);
+}
+
+}}}} // namespace lsst::meas::extensions::multiShapelet
@@ -21,9 +21,13 @@
  * see <http://www.lsstcorp.org/LegalNotices/>.
  */
 
+#include <cmath>
+#include <algorithm>
+
+#include "boost/format.hpp"
+
 #include "ndarray/eigen.h"
 #include "lsst/meas/extensions/multiShapelet/ModelInputHandler.h"
-#include "lsst/afw/detection/FootprintSet.h"
 #include "lsst/afw/detection/FootprintArray.h"
 #include "lsst/afw/detection/FootprintArray.cc"
 
@@ -31,12 +35,36 @@ namespace lsst { namespace meas { namespace extensions { namespace multiShapelet
 
 namespace {
 
+ndarray::Array<double,1,1> allocateArray(int size, ModelInputWorkspace * workspace) {
+    if (workspace) return workspace->allocate(size);
+    return ndarray::allocate(size);
+}
+
+void initSpans(
+    CoordinateSpanList & spans, afw::detection::Footprint const & region,
+    ndarray::Array<double const,1,1> const & x, ndarray::Array<double const,1,1> const & y
+) {
+    spans.clear();
+    spans.reserve(region.getSpans().size());
+    int n = 0;
+    for (
+        afw::detection::Footprint::SpanList::const_iterator spanIter = region.getSpans().begin();
+        spanIter != region.getSpans().end();
+        ++spanIter
+    ) {
+        CoordinateSpan span = { x[n], y[n], n, (**spanIter).getWidth() };
+        spans.push_back(span);
+        n += span.size;
+    }
+}
+
 void initCoords(
-    ndarray::Array<double,1,1> & x, ndarray::Array<double,1,1> & y,
-    afw::detection::Footprint const & region, afw::geom::Point2D const & center
+    ndarray::Array<double,1,1> & x, ndarray::Array<double,1,1> & y, CoordinateSpanList & spans,
+    afw::detection::Footprint const & region, afw::geom::Point2D const & center,
+    ModelInputWorkspace * workspace
 ) {
-    x = ndarray::allocate(region.getArea());
-    y = ndarray::allocate(region.getArea());
+    x = allocateArray(region.getArea(), workspace);
+    y = allocateArray(region.getArea(), workspace);
     int n = 0;
     for (
         afw::detection::Footprint::SpanList::const_iterator spanIter = region.getSpans().begin();
@@ -50,45 +78,128 @@ void initCoords(
             ++n;
         }
     }
+    initSpans(spans, region, x, y);
+}
+
+// A run of pixels [x0, x1] in row y; footprints are grown and merged as lists of these, without
+// rasterizing them into a Mask.
+struct PixelRun {
+    int y;
+    int x0;
+    int x1;
+
+    bool operator<(PixelRun const & other) const {
+        return y < other.y || (y == other.y && x0 < other.x0);
+    }
+};
+
+typedef std::vector<PixelRun> PixelRunList;
+
+// Append the spans of a footprint, each dilated by a disk of the given radius; this is the same
+// pixel set as the isotropic afw::detection::growFootprint.
+void appendRuns(PixelRunList & runs, afw::detection::Footprint const & footprint, int grow) {
+    runs.reserve(runs.size() + footprint.getSpans().size() * (2 * grow + 1));
+    for (
+        afw::detection::Footprint::SpanList::const_iterator spanIter = footprint.getSpans().begin();
+        spanIter != footprint.getSpans().end();
+        ++spanIter
+    ) {
+        for (int dy = -grow; dy <= grow; ++dy) {
+            int dx = static_cast<int>(std::sqrt(static_cast<double>(grow * grow - dy * dy)));
+            PixelRun run = { (**spanIter).getY() + dy, (**spanIter).getX0() - dx, (**spanIter).getX1() + dx };
+            runs.push_back(run);
+        }
+    }
+}
+
+// Sort the runs and merge those that overlap or touch into the spans of a new footprint.
+PTR(afw::detection::Footprint) makeFootprint(PixelRunList & runs) {
+    std::sort(runs.begin(), runs.end());
+    PTR(afw::detection::Footprint) result = boost::make_shared<afw::detection::Footprint>();
+    PixelRunList::const_iterator i = runs.begin();
+    while (i != runs.end()) {
+        PixelRun current = *i;
+        for (++i; i != runs.end() && i->y == current.y && i->x0 <= current.x1 + 1; ++i) {
+            current.x1 = std::max(current.x1, i->x1);
+        }
+        result->addSpan(current.y, current.x0, current.x1);
+    }
+    result->normalize();
+    return result;
+}
+
+int findRoot(std::vector<int> & parents, int n) {
+    while (parents[n] != n) {
+        parents[n] = parents[parents[n]];
+        n = parents[n];
+    }
+    return n;
+}
+
+// Return true if the spans of a normalized footprint form a single 8-connected region, as
+// a FootprintSet detected on the footprint's pixels would.
+bool isConnected(afw::detection::Footprint const & footprint) {
+    afw::detection::Footprint::SpanList const & spans = footprint.getSpans();
+    int const size = spans.size();
+    std::vector<int> parents(size);
+    int nRegions = size;
+    int rowBegin = 0;     // first span in the current row
+    int prevBegin = 0;    // first span in the previous row
+    int prevEnd = 0;      // one past the last span in the previous row
+    for (int n = 0; n < size; ++n) {
+        parents[n] = n;
+        if (n > 0 && spans[n]->getY() != spans[n - 1]->getY()) {
+            // Spans in the previous row can only touch this one if that row is adjacent.
+            prevBegin = (spans[n]->getY() == spans[n - 1]->getY() + 1) ? rowBegin : n;
+            prevEnd = n;
+            rowBegin = n;
+        }
+        for (int m = prevBegin; m < prevEnd; ++m) {
+            if (spans[m]->getX0() <= spans[n]->getX1() + 1 && spans[n]->getX0() <= spans[m]->getX1() + 1) {
+                int a = findRoot(parents, m);
+                int b = findRoot(parents, n);
+                if (a != b) {
+                    parents[a] = b;
+                    --nRegions;
+                }
+            }
+        }
+    }
+    return nRegions == 1;
+}
+
+PTR(afw::detection::Footprint) growFootprintSpans(afw::detection::Footprint const & footprint, int grow) {
+    PixelRunList runs;
+    appendRuns(runs, footprint, grow);
+    return makeFootprint(runs);
 }
 
 PTR(afw::detection::Footprint) mergeFootprintWithEllipses(
     afw::detection::Footprint const & footprint,
+    int grow,
     std::vector<afw::geom::ellipses::Ellipse> const & ellipses,
     afw::geom::Box2I const & imageBox
 ) {
-    // TODO: we do a lot of turning footprints into masks here and elsewhere; should really only
-    // have to do that once
-    afw::geom::Box2I bbox(footprint.getBBox());
-    std::vector<PTR(afw::detection::Footprint)> ellipseFootprints(ellipses.size());
+    PixelRunList runs;
+    appendRuns(runs, footprint, grow);
     for (std::size_t n = 0; n < ellipses.size(); ++n) {
-        ellipseFootprints[n] = boost::make_shared<afw::detection::Footprint>(ellipses[n]);
-        bbox.include(ellipseFootprints[n]->getBBox());
+        appendRuns(runs, afw::detection::Footprint(ellipses[n]), 0);
     }
-
+    PTR(afw::detection::Footprint) result = makeFootprint(runs);
+    afw::geom::Box2I bbox(result->getBBox());
     if (!(bbox.getArea() > 0) || !(imageBox.contains(bbox))) {
         throw LSST_EXCEPT(
             pex::exceptions::RuntimeErrorException,
             "Invalid bounding box in model fit"
         );
     }
-    afw::image::Mask<> mask(bbox);
-    assert(mask.getBBox(afw::image::PARENT).contains(footprint.getBBox()));
-    afw::detection::setMaskFromFootprint(&mask, footprint, afw::image::MaskPixel(0x1));
-    for (std::size_t n = 0; n < ellipses.size(); ++n) {
-        assert(mask.getBBox(afw::image::PARENT).contains(ellipseFootprints[n]->getBBox()));
-        afw::detection::setMaskFromFootprint(&mask, *ellipseFootprints[n], afw::image::MaskPixel(0x1));
-    }
-    afw::detection::FootprintSet fpSet(
-        mask, afw::detection::Threshold(0x1, afw::detection::Threshold::BITMASK), 1
-    );
-    if (fpSet.getFootprints()->size() != 1u) {
+    if (!isConnected(*result)) {
         throw LSST_EXCEPT(
             pex::exceptions::InvalidParameterException,
             "Ellipse-based footprints do not all overlap detection footprint."
         );
     }
-    return fpSet.getFootprints()->front();
+    return result;
 }
 
 } // anonymous
@@ -96,8 +207,8 @@ PTR(afw::detection::Footprint) mergeFootprintWithEllipses(
 template <typename PixelT>
 ModelInputHandler::ModelInputHandler(
     afw::image::Image<PixelT> const & image, afw::geom::Point2D const & center, 
-    afw::geom::Box2I const & region
-) {
+    afw::geom::Box2I const & region, ModelInputWorkspace * workspace
+) : _binSize(1) {
     _footprint = boost::make_shared<afw::detection::Footprint>(region);
     _footprint->clipTo(image.getBBox(afw::image::PARENT));
     if (_footprint->getArea() <= 0) {
@@ -106,18 +217,18 @@ ModelInputHandler::ModelInputHandler(
             "Model fit contains no usable pixels."
         );
     }
-    _data = ndarray::allocate(_footprint->getArea());
+    _data = allocateArray(_footprint->getArea(), workspace);
     afw::detection::flattenArray(*_footprint, image.getArray(), _data, image.getXY0());
-    initCoords(_x, _y, *_footprint, center);
+    initCoords(_x, _y, _spans, *_footprint, center, workspace);
 }
 
 template <typename PixelT>
 ModelInputHandler::ModelInputHandler(
     afw::image::Image<PixelT> const & image, afw::geom::Point2D const & center, 
-    afw::detection::Footprint const & region, int growFootprint
-) {
+    afw::detection::Footprint const & region, int growFootprint, ModelInputWorkspace * workspace
+) : _binSize(1) {
     if (growFootprint) {
-        _footprint = afw::detection::growFootprint(region, growFootprint);
+        _footprint = growFootprintSpans(region, growFootprint);
     } else {
         _footprint = boost::make_shared<afw::detection::Footprint>(region);
     }
@@ -128,23 +239,18 @@ ModelInputHandler::ModelInputHandler(
             "Model fit contains no usable pixels."
         );
     }
-    _data = ndarray::allocate(_footprint->getArea());
+    _data = allocateArray(_footprint->getArea(), workspace);
     afw::detection::flattenArray(*_footprint, image.getArray(), _data, image.getXY0());
-    initCoords(_x, _y, *_footprint, center);
+    initCoords(_x, _y, _spans, *_footprint, center, workspace);
 }
 
 template <typename PixelT>
 ModelInputHandler::ModelInputHandler(
     afw::image::Image<PixelT> const & image, afw::geom::Point2D const & center,
     std::vector<afw::geom::ellipses::Ellipse> const & ellipses, 
-    afw::detection::Footprint const & region, int growFootprint
-) {
-    if (growFootprint) {
-        _footprint = afw::detection::growFootprint(region, growFootprint);
-    } else {
-        _footprint = boost::make_shared<afw::detection::Footprint>(region);
-    }
-    _footprint = mergeFootprintWithEllipses(*_footprint, ellipses, image.getBBox(afw::image::PARENT));
+    afw::detection::Footprint const & region, int growFootprint, ModelInputWorkspace * workspace
+) : _binSize(1) {
+    _footprint = mergeFootprintWithEllipses(region, growFootprint, ellipses, image.getBBox(afw::image::PARENT));
     _footprint->clipTo(image.getBBox(afw::image::PARENT));
     if (_footprint->getArea() <= 0) {
         throw LSST_EXCEPT(
@@ -152,17 +258,17 @@ ModelInputHandler::ModelInputHandler(
             "Model fit contains no usable pixels."
         );
     }
-    _data = ndarray::allocate(_footprint->getArea());
+    _data = allocateArray(_footprint->getArea(), workspace);
     afw::detection::flattenArray(*_footprint, image.getArray(), _data, image.getXY0());
-    initCoords(_x, _y, *_footprint, center);
+    initCoords(_x, _y, _spans, *_footprint, center, workspace);
 }
 
 template <typename PixelT>
 ModelInputHandler::ModelInputHandler(
     afw::image::MaskedImage<PixelT> const & image, afw::geom::Point2D const & center, 
     afw::geom::Box2I const & region, afw::image::MaskPixel badPixelMask, bool usePixelWeights,
-    double maxBadPixelFraction
-) {
+    double maxBadPixelFraction, ModelInputWorkspace * workspace
+) : _binSize(1) {
     _footprint = boost::make_shared<afw::detection::Footprint>(region);
     double originalArea = _footprint->getArea();
     _footprint->intersectMask(*image.getMask(), badPixelMask);
@@ -178,8 +284,8 @@ ModelInputHandler::ModelInputHandler(
             "Model fit contains no usable pixels."
         );
     }
-    _data = ndarray::allocate(_footprint->getArea());
-    _weights = ndarray::allocate(_footprint->getArea());
+    _data = allocateArray(_footprint->getArea(), workspace);
+    _weights = allocateArray(_footprint->getArea(), workspace);
     afw::detection::flattenArray(*_footprint, image.getImage()->getArray(), _data, image.getXY0());
     afw::detection::flattenArray(*_footprint, image.getVariance()->getArray(), _weights, image.getXY0());
     if (!usePixelWeights) {
@@ -188,7 +294,7 @@ ModelInputHandler::ModelInputHandler(
     // "operator=" needed here to workaround clang bug in resolving inherited assignment operators
     _weights.asEigen<Eigen::ArrayXpr>().operator=(_weights.asEigen<Eigen::ArrayXpr>().sqrt().inverse());
     _data.asEigen<Eigen::ArrayXpr>() *= _weights.asEigen<Eigen::ArrayXpr>();
-    initCoords(_x, _y, *_footprint, center);
+    initCoords(_x, _y, _spans, *_footprint, center, workspace);
 }
 
 template <typename PixelT>
@@ -196,10 +302,10 @@ ModelInputHandler::ModelInputHandler(
     afw::image::MaskedImage<PixelT> const & image, afw::geom::Point2D const & center, 
     afw::detection::Footprint const & region, int growFootprint,
     afw::image::MaskPixel badPixelMask, bool usePixelWeights,
-    double maxBadPixelFraction
-) {
+    double maxBadPixelFraction, ModelInputWorkspace * workspace
+) : _binSize(1) {
     if (growFootprint) {
-        _footprint = afw::detection::growFootprint(region, growFootprint);
+        _footprint = growFootprintSpans(region, growFootprint);
     } else {
         _footprint = boost::make_shared<afw::detection::Footprint>(region);
     }
@@ -217,8 +323,8 @@ ModelInputHandler::ModelInputHandler(
             "Model fit contains no usable pixels."
         );
     }
-    _data = ndarray::allocate(_footprint->getArea());
-    _weights = ndarray::allocate(_footprint->getArea());
+    _data = allocateArray(_footprint->getArea(), workspace);
+    _weights = allocateArray(_footprint->getArea(), workspace);
     afw::detection::flattenArray(*_footprint, image.getImage()->getArray(), _data, image.getXY0());
     afw::detection::flattenArray(*_footprint, image.getVariance()->getArray(), _weights, image.getXY0());
     if (!usePixelWeights) {
@@ -226,7 +332,7 @@ ModelInputHandler::ModelInputHandler(
     }
     _weights.asEigen<Eigen::ArrayXpr>().operator=(_weights.asEigen<Eigen::ArrayXpr>().sqrt().inverse());
     _data.asEigen<Eigen::ArrayXpr>() *= _weights.asEigen<Eigen::ArrayXpr>();
-    initCoords(_x, _y, *_footprint, center);
+    initCoords(_x, _y, _spans, *_footprint, center, workspace);
 }
 
 template <typename PixelT>
@@ -235,14 +341,9 @@ ModelInputHandler::ModelInputHandler(
     std::vector<afw::geom::ellipses::Ellipse> const & ellipses,
     afw::detection::Footprint const & region, int growFootprint,
     afw::image::MaskPixel badPixelMask, bool usePixelWeights,
-    double maxBadPixelFraction
-) {
-    if (growFootprint) {
-        _footprint = afw::detection::growFootprint(region, growFootprint);
-    } else {
-        _footprint = boost::make_shared<afw::detection::Footprint>(region);
-    }
-    _footprint = mergeFootprintWithEllipses(*_footprint, ellipses, image.getBBox(afw::image::PARENT));
+    double maxBadPixelFraction, ModelInputWorkspace * workspace
+) : _binSize(1) {
+    _footprint = mergeFootprintWithEllipses(region, growFootprint, ellipses, image.getBBox(afw::image::PARENT));
     double originalArea = _footprint->getArea();
     _footprint->intersectMask(*image.getMask(), badPixelMask);
     if ((1.0 - _footprint->getArea() / originalArea) > maxBadPixelFraction) {
@@ -257,8 +358,8 @@ ModelInputHandler::ModelInputHandler(
             "Model fit contains no usable pixels."
         );
     }
-    _data = ndarray::allocate(_footprint->getArea());
-    _weights = ndarray::allocate(_footprint->getArea());
+    _data = allocateArray(_footprint->getArea(), workspace);
+    _weights = allocateArray(_footprint->getArea(), workspace);
     afw::detection::flattenArray(*_footprint, image.getImage()->getArray(), _data, image.getXY0());
     afw::detection::flattenArray(*_footprint, image.getVariance()->getArray(), _weights, image.getXY0());
     if (!usePixelWeights) {
@@ -266,33 +367,241 @@ ModelInputHandler::ModelInputHandler(
     }
     _weights.asEigen<Eigen::ArrayXpr>().operator=(_weights.asEigen<Eigen::ArrayXpr>().sqrt().inverse());
     _data.asEigen<Eigen::ArrayXpr>() *= _weights.asEigen<Eigen::ArrayXpr>();
-    initCoords(_x, _y, *_footprint, center);
+    initCoords(_x, _y, _spans, *_footprint, center, workspace);
+}
+
+ModelInputWorkspace::ModelInputWorkspace(int capacity) :
+    _buffer(ndarray::allocate(capacity)), _offset(0)
+{}
+
+ndarray::Array<double,1,1> ModelInputWorkspace::allocate(int size) {
+    if (_offset + size > getCapacity()) {
+        // Arrays already handed out share ownership of the old buffer, so they remain valid;
+        // the new one is large enough to hold everything allocated since the last reset.
+        _buffer = ndarray::allocate(std::max(2 * getCapacity(), _offset + size));
+        _offset = 0;
+    }
+    ndarray::Array<double,1,1> result = _buffer[ndarray::view(_offset, _offset + size)];
+    _offset += size;
+    return result;
+}
+
+namespace {
+
+struct SpanOffset {
+    int y;
+    int x0;
+    int x1;
+    int offset; // index of the span's first pixel in the flattened arrays
+
+    bool operator<(SpanOffset const & other) const {
+        return y < other.y || (y == other.y && x0 < other.x0);
+    }
+};
+
+struct CompareSpanOffsetY {
+    bool operator()(SpanOffset const & a, int y) const { return a.y < y; }
+    bool operator()(int y, SpanOffset const & a) const { return y < a.y; }
+};
+
+typedef std::pair<std::vector<SpanOffset>::const_iterator,std::vector<SpanOffset>::const_iterator> SpanRow;
+
+} // anonymous
+
+ModelInputHandler::ModelInputHandler(
+    ModelInputHandler const & other, afw::detection::Footprint const & region,
+    ModelInputWorkspace * workspace
+) : _binSize(other._binSize) {
+    // Index the parent's spans by row, remembering where each starts in the flattened arrays.
+    std::vector<SpanOffset> index;
+    index.reserve(other._footprint->getSpans().size());
+    int offset = 0;
+    for (
+        afw::detection::Footprint::SpanList::const_iterator spanIter = other._footprint->getSpans().begin();
+        spanIter != other._footprint->getSpans().end();
+        ++spanIter
+    ) {
+        SpanOffset item = { (**spanIter).getY(), (**spanIter).getX0(), (**spanIter).getX1(), offset };
+        index.push_back(item);
+        offset += (**spanIter).getWidth();
+    }
+    std::sort(index.begin(), index.end());
+    _footprint = boost::make_shared<afw::detection::Footprint>();
+    for (
+        afw::detection::Footprint::SpanList::const_iterator spanIter = region.getSpans().begin();
+        spanIter != region.getSpans().end();
+        ++spanIter
+    ) {
+        SpanRow row = std::equal_range(index.begin(), index.end(), (**spanIter).getY(), CompareSpanOffsetY());
+        for (std::vector<SpanOffset>::const_iterator i = row.first; i != row.second; ++i) {
+            int x0 = std::max(i->x0, (**spanIter).getX0());
+            int x1 = std::min(i->x1, (**spanIter).getX1());
+            if (x0 <= x1) _footprint->addSpan((**spanIter).getY(), x0, x1);
+        }
+    }
+    _footprint->normalize();
+    if (_footprint->getArea() <= 0) {
+        throw LSST_EXCEPT(
+            pex::exceptions::RuntimeErrorException,
+            "Model fit contains no usable pixels."
+        );
+    }
+    _x = allocateArray(_footprint->getArea(), workspace);
+    _y = allocateArray(_footprint->getArea(), workspace);
+    _data = allocateArray(_footprint->getArea(), workspace);
+    if (!other._weights.isEmpty()) {
+        _weights = allocateArray(_footprint->getArea(), workspace);
+    }
+    int n = 0;
+    for (
+        afw::detection::Footprint::SpanList::const_iterator spanIter = _footprint->getSpans().begin();
+        spanIter != _footprint->getSpans().end();
+        ++spanIter
+    ) {
+        SpanRow row = std::equal_range(index.begin(), index.end(), (**spanIter).getY(), CompareSpanOffsetY());
+        for (std::vector<SpanOffset>::const_iterator i = row.first; i != row.second; ++i) {
+            int x0 = std::max(i->x0, (**spanIter).getX0());
+            int x1 = std::min(i->x1, (**spanIter).getX1());
+            for (int j = i->offset + x0 - i->x0; x0 <= x1; ++x0, ++j, ++n) {
+                _x[n] = other._x[j];
+                _y[n] = other._y[j];
+                _data[n] = other._data[j];
+                if (!_weights.isEmpty()) _weights[n] = other._weights[j];
+            }
+        }
+    }
+    assert(n == _footprint->getArea());
+    initSpans(_spans, *_footprint, _x, _y);
+}
+
+namespace {
+
+// Accumulated unweighted sum and variance of the pixels in one bin.
+struct BinSum {
+    int y;
+    int x;
+    int count;
+    double sum;
+    double variance;
+
+    bool operator<(BinSum const & other) const {
+        return y < other.y || (y == other.y && x < other.x);
+    }
+};
+
+// Integer division that rounds toward negative infinity, so bins are aligned across zero.
+inline int floorDivide(int a, int b) {
+    return (a >= 0) ? a / b : -((-a + b - 1) / b);
+}
+
+} // anonymous
+
+ModelInputHandler::ModelInputHandler(
+    ModelInputHandler const & other, int binSize, ModelInputWorkspace * workspace
+) : _binSize(binSize) {
+    if (binSize < 1) {
+        throw LSST_EXCEPT(
+            pex::exceptions::InvalidParameterException,
+            (boost::format("Bin size must be positive; got %d") % binSize).str()
+        );
+    }
+    if (other._binSize != 1) {
+        throw LSST_EXCEPT(
+            pex::exceptions::InvalidParameterException,
+            "Cannot bin inputs that have already been binned."
+        );
+    }
+    afw::detection::Footprint::SpanList const & spans = other._footprint->getSpans();
+    // Each span contributes its pixels to consecutive bins of a single row; bins shared by
+    // several spans (from different rows, or the same row) are merged after sorting.
+    std::vector<BinSum> bins;
+    bins.reserve(other._footprint->getArea() / binSize + 2 * spans.size());
+    int n = 0;
+    for (
+        afw::detection::Footprint::SpanList::const_iterator spanIter = spans.begin();
+        spanIter != spans.end();
+        ++spanIter
+    ) {
+        int by = floorDivide((**spanIter).getY(), binSize);
+        for (int ix = (**spanIter).getX0(); ix <= (**spanIter).getX1(); ++ix, ++n) {
+            int bx = floorDivide(ix, binSize);
+            if (ix == (**spanIter).getX0() || bins.back().x != bx) {
+                BinSum bin = { by, bx, 0, 0.0, 0.0 };
+                bins.push_back(bin);
+            }
+            double w = other._weights.isEmpty() ? 1.0 : other._weights[n];
+            bins.back().sum += other._data[n] / w;
+            bins.back().variance += 1.0 / (w * w);
+            ++bins.back().count;
+        }
+    }
+    std::sort(bins.begin(), bins.end());
+    std::vector<BinSum>::iterator last = bins.begin();
+    for (std::vector<BinSum>::const_iterator i = bins.begin() + 1; i < bins.end(); ++i) {
+        if (i->y == last->y && i->x == last->x) {
+            last->count += i->count;
+            last->sum += i->sum;
+            last->variance += i->variance;
+        } else {
+            *(++last) = *i;
+        }
+    }
+    bins.erase(last + 1, bins.end());
+    _footprint = boost::make_shared<afw::detection::Footprint>();
+    std::vector<BinSum>::const_iterator i = bins.begin();
+    while (i != bins.end()) {
+        std::vector<BinSum>::const_iterator j = i + 1;
+        while (j != bins.end() && j->y == i->y && j->x == (j - 1)->x + 1) ++j;
+        _footprint->addSpan(i->y, i->x, (j - 1)->x);
+        i = j;
+    }
+    _footprint->normalize();
+    _data = allocateArray(bins.size(), workspace);
+    _weights = allocateArray(bins.size(), workspace);
+    double const binArea = binSize * binSize;
+    for (std::size_t k = 0; k < bins.size(); ++k) {
+        double sigma = std::sqrt(bins[k].variance);
+        _data[k] = bins[k].sum / sigma;
+        _weights[k] = bins[k].count / (binArea * sigma);
+    }
+    // The center in bin-index coordinates: bin b covers pixels [b*binSize, (b+1)*binSize - 1].
+    double const offset = 0.5 * (binSize - 1);
+    afw::geom::Point2D center(
+        ((**spans.begin()).getX0() - other._x[0] - offset) / binSize,
+        ((**spans.begin()).getY() - other._y[0] - offset) / binSize
+    );
+    initCoords(_x, _y, _spans, *_footprint, center, workspace);
 }
 
 #define INSTANTIATE(T)                          \
     template ModelInputHandler::ModelInputHandler(                      \
         afw::image::Image<T> const & image, afw::geom::Point2D const & center, \
-        afw::geom::Box2I const & region);                               \
+        afw::geom::Box2I const & region, ModelInputWorkspace * workspace); \
     template ModelInputHandler::ModelInputHandler(                      \
         afw::image::Image<T> const & image, afw::geom::Point2D const & center, \
-        afw::detection::Footprint const & region, int growFootprint);   \
+        afw::detection::Footprint const & region, int growFootprint,    \
+        ModelInputWorkspace * workspace);                               \
     template ModelInputHandler::ModelInputHandler(                      \
         afw::image::Image<T> const & image, afw::geom::Point2D const & center, \
         std::vector<afw::geom::ellipses::Ellipse> const & ellipses,     \
-        afw::detection::Footprint const & region, int growFootprint);   \
+        afw::detection::Footprint const & region, int growFootprint,    \
+        ModelInputWorkspace * workspace);                               \
     template ModelInputHandler::ModelInputHandler(                      \
         afw::image::MaskedImage<T> const & image, afw::geom::Point2D const & center, \
         afw::geom::Box2I const & region, afw::image::MaskPixel badPixelMask, \
-        bool usePixelWeights, double maxBadPixelFraction);              \
+        bool usePixelWeights, double maxBadPixelFraction,               \
+        ModelInputWorkspace * workspace);                               \
     template ModelInputHandler::ModelInputHandler(                      \
         afw::image::MaskedImage<T> const & image, afw::geom::Point2D const & center, \
         afw::detection::Footprint const & region, int growFootprint,    \
-        afw::image::MaskPixel badPixelMask, bool usePixelWeights, double maxBadPixelFraction); \
+        afw::image::MaskPixel badPixelMask, bool usePixelWeights, double maxBadPixelFraction, \
+        ModelInputWorkspace * workspace);                               \
     template ModelInputHandler::ModelInputHandler(                      \
         afw::image::MaskedImage<T> const & image, afw::geom::Point2D const & center, \
         std::vector<afw::geom::ellipses::Ellipse> const & ellipses,     \
         afw::detection::Footprint const & region, int growFootprint,    \
-        afw::image::MaskPixel badPixelMask, bool usePixelWeights, double maxBadPixelFraction)
+        afw::image::MaskPixel badPixelMask, bool usePixelWeights, double maxBadPixelFraction, \
+        ModelInputWorkspace * workspace)
 
 INSTANTIATE(float);
 INSTANTIATE(double);
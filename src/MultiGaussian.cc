@@ -1,7 +1,131 @@
+#include <cmath>
+
+#include "Eigen/LU"
+
+#include "lsst/utils/ieee.h"
 #include "lsst/meas/extensions/multiShapelet/MultiGaussian.h"
 
 namespace lsst { namespace meas { namespace extensions { namespace multiShapelet {
 
+namespace {
+
+// Component of a convolved profile for the weighted moments solve: a Gaussian with covariance
+// radius2 * Q + psfRadius2 * P and the given flux.
+struct ConvolvedComponent {
+    double flux;
+    double radius2;
+    double psfRadius2;
+};
+
+typedef std::vector<ConvolvedComponent> ConvolvedComponentList;
+
+// Convert between a symmetric 2x2 matrix and its (xx, yy, xy) elements.
+Eigen::Vector3d flattenMoments(Eigen::Matrix2d const & m) {
+    return Eigen::Vector3d(m(0, 0), m(1, 1), m(0, 1));
+}
+
+Eigen::Matrix2d unflattenMoments(Eigen::Vector3d const & v) {
+    Eigen::Matrix2d m;
+    m << v[0], v[2], v[2], v[1];
+    return m;
+}
+
+bool isPositiveDefinite(Eigen::Matrix2d const & m) {
+    return m(0, 0) > 0.0 && m(1, 1) > 0.0 && m.determinant() > 0.0;
+}
+
+// Compute the second moments of the profile with ellipse Q and PSF ellipse P, weighted by exp(-x^T W^{-1} x / 2) and
+// normalized by the weighted flux, and their derivative wrt the (xx, yy, xy) elements of Q.
+//
+// The product of a Gaussian with covariance C and the weight is a Gaussian with covariance
+// S = C (C + W)^{-1} W = W - W (C + W)^{-1} W, and its integral is proportional to
+// |C + W|^{-1/2}, which gives everything in closed form.
+bool computeWeightedMoments(
+    ConvolvedComponentList const & components,
+    Eigen::Matrix2d const & psf,
+    Eigen::Matrix2d const & weight,
+    Eigen::Matrix2d const & q,
+    Eigen::Vector3d & moments,
+    Eigen::Matrix3d & jacobian
+) {
+    Eigen::Matrix2d basis[3];
+    basis[0] << 1.0, 0.0, 0.0, 0.0;
+    basis[1] << 0.0, 0.0, 0.0, 1.0;
+    basis[2] << 0.0, 1.0, 1.0, 0.0;
+    double norm = 0.0;
+    Eigen::Matrix2d sum = Eigen::Matrix2d::Zero();
+    Eigen::Vector3d dNorm = Eigen::Vector3d::Zero();
+    Eigen::Matrix2d dSum[3] = { Eigen::Matrix2d::Zero(), Eigen::Matrix2d::Zero(), Eigen::Matrix2d::Zero() };
+    for (ConvolvedComponentList::const_iterator i = components.begin(); i != components.end(); ++i) {
+        Eigen::Matrix2d const a = i->radius2 * q + i->psfRadius2 * psf + weight;
+        double const det = a.determinant();
+        if (!(det > 0.0)) return false;
+        Eigen::Matrix2d const aInv = a.inverse();
+        Eigen::Matrix2d const b = weight * aInv;
+        Eigen::Matrix2d const s = weight - b * weight;
+        double const w = i->flux / std::sqrt(det);
+        norm += w;
+        sum += w * s;
+        for (int k = 0; k < 3; ++k) {
+            Eigen::Matrix2d const dc = i->radius2 * basis[k];
+            double const dw = -0.5 * w * (aInv * dc).trace();
+            dNorm[k] += dw;
+            dSum[k] += dw * s + w * b * dc * b.transpose();
+        }
+    }
+    if (!(norm > 0.0)) return false;
+    Eigen::Matrix2d const m = sum / norm;
+    moments = flattenMoments(m);
+    for (int k = 0; k < 3; ++k) {
+        jacobian.col(k) = flattenMoments((dSum[k] - dNorm[k] * m) / norm);
+    }
+    return true;
+}
+
+// Newton solve for the Q whose weighted moments equal target, starting from q; returns false
+// (leaving q unspecified) if it does not converge.
+bool solveWeightedMoments(
+    ConvolvedComponentList const & components,
+    Eigen::Matrix2d const & psf,
+    Eigen::Matrix2d const & weight,
+    Eigen::Vector3d const & target,
+    Eigen::Matrix2d & q,
+    int maxIter, double tolerance
+) {
+    Eigen::Vector3d moments;
+    Eigen::Matrix3d jacobian;
+    if (!isPositiveDefinite(q) || !computeWeightedMoments(components, psf, weight, q, moments, jacobian)) {
+        return false;
+    }
+    double const threshold = tolerance * target.norm();
+    double residual = (moments - target).norm();
+    for (int iter = 0; iter < maxIter; ++iter) {
+        if (residual <= threshold) return true;
+        Eigen::Vector3d const step = jacobian.partialPivLu().solve(target - moments);
+        if (!lsst::utils::isfinite(step.sum())) return false;
+        // Backtrack until the step keeps Q positive definite and reduces the residual.
+        bool accepted = false;
+        for (double scale = 1.0; scale > 1E-3 && !accepted; scale *= 0.5) {
+            Eigen::Matrix2d const qNew = q + unflattenMoments(scale * step);
+            Eigen::Vector3d movedMoments;
+            Eigen::Matrix3d movedJacobian;
+            if (isPositiveDefinite(qNew)
+                && computeWeightedMoments(components, psf, weight, qNew, movedMoments, movedJacobian)
+                && (movedMoments - target).norm() < residual) {
+                q = qNew;
+                moments = movedMoments;
+                jacobian = movedJacobian;
+                residual = (moments - target).norm();
+                accepted = true;
+            }
+        }
+        if (!accepted) return false;
+    }
+    return residual <= threshold;
+}
+
+} // anonymous
+
 shapelet::ShapeletFunction GaussianComponent::makeShapelet(
     afw::geom::ellipses::Ellipse const & ellipse, int order
 ) const {
@@ -37,11 +161,9 @@ afw::geom::ellipses::Quadrupole MultiGaussian::deconvolve(
     // of the profile convolved with the PSF.  This is analogous to just
     // subtracting Gaussian moments, but with some weighted sums involved.
     //
-    // We might be able to do even better by matching the profile's moments
-    // as weighted by a Gaussian with the decorrected measured moments, but
-    // that's a nonlinear problem that would require a numerical root finder.
-    // But it may still be worth considering if it saves us fitting
-    // iterations later.
+    // deconvolveWeighted() does better for adaptive moments by matching the
+    // profile's moments as weighted by a Gaussian with the measured moments,
+    // which is a nonlinear problem; it starts from this solution.
     //
     double lhs = 0.0;
     Eigen::Matrix2d rhs = Eigen::Matrix2d::Zero();
@@ -62,5 +184,42 @@ afw::geom::ellipses::Quadrupole MultiGaussian::deconvolve(
     return afw::geom::ellipses::Quadrupole(q);
 }
 
+afw::geom::ellipses::Quadrupole MultiGaussian::deconvolveWeighted(
+    afw::geom::ellipses::Quadrupole const & fullMoments,
+    afw::geom::ellipses::Quadrupole const & psfMoments,
+    MultiGaussian const & psfMultiGaussian,
+    int maxIter,
+    double tolerance
+) const {
+    afw::geom::ellipses::Quadrupole closedForm = deconvolve(fullMoments, psfMoments, psfMultiGaussian);
+    ConvolvedComponentList components;
+    components.reserve(size() * psfMultiGaussian.size());
+    double flux = 0.0;
+    double fluxRadius2 = 0.0;
+    for (List::const_iterator i = psfMultiGaussian.begin(); i != psfMultiGaussian.end(); ++i) {
+        for (List::const_iterator j = this->begin(); j != this->end(); ++j) {
+            ConvolvedComponent component;
+            component.flux = i->flux * j->flux;
+            component.radius2 = j->radius * j->radius;
+            component.psfRadius2 = i->radius * i->radius;
+            components.push_back(component);
+            flux += component.flux;
+            fluxRadius2 += component.flux * component.radius2;
+        }
+    }
+    Eigen::Matrix2d p = psfMoments.getMatrix();
+    Eigen::Matrix2d w = fullMoments.getMatrix();
+    Eigen::Matrix2d q = closedForm.getMatrix();
+    if (!isPositiveDefinite(q)) {
+        // The unweighted solution can fail for sources barely larger than the PSF (whose weighted
+        // moments may still be matched), so start from a small ellipse with the shape of W instead.
+        q = (0.01 * flux / fluxRadius2) * w;
+    }
+    if (!solveWeightedMoments(components, p, w, flattenMoments(0.5 * w), q, maxIter, tolerance)) {
+        return closedForm;
+    }
+    return afw::geom::ellipses::Quadrupole(q);
+}
+
 
 }}}} // namespace lsst::meas::extensions::multiShapelet
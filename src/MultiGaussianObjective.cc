@@ -21,19 +21,62 @@
  * see <http://www.lsstcorp.org/LegalNotices/>.
  */
 
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
 #include "lsst/utils/ieee.h"
 #include "lsst/meas/extensions/multiShapelet/MultiGaussianObjective.h"
 
 namespace lsst { namespace meas { namespace extensions { namespace multiShapelet {
 
+namespace {
+
+// Number of pixels processed by all builders before moving on to the next block; small enough
+// that the coordinates, model, and derivative rows for a tile stay in L1 cache.
+int const TILE_SIZE = 256;
+
+// Contributions of a single tile to the sums in computeNormalEquations.
+struct TileSums {
+    double mm;
+    double r0r0;
+    double mr0;
+    double maxM;
+    double maxR0;
+    Eigen::Vector3d Dm;
+    Eigen::Vector3d Dr0;
+    Eigen::Matrix3d DD;
+};
+
+// Zero the tile arrays and add the model and derivative of every builder for pixels
+// [begin, begin + n) to them, in scalar type T.
+template <typename T>
+void evaluateTile(
+    std::vector<GaussianModelBuilder> const & builders, int begin, int n,
+    ndarray::Array<T,1,1> const & model, ndarray::Array<T,2,-2> const & derivative
+) {
+    model.asEigen().setZero();
+    derivative.asEigen().setZero();
+    for (std::size_t k = 0; k < builders.size(); ++k) {
+        builders[k].addTileModelAndDerivative(begin, begin + n, model, derivative);
+    }
+}
+
+} // anonymous
+
 MultiGaussianObjective::MultiGaussianObjective(
     ModelInputHandler const & inputs,
     MultiGaussian const & multiGaussian,
     double minRadius, double minAxisRatio,
     bool useApproximateExp
-) : Objective(inputs.getSize(), 3), _minRadius(minRadius), _minAxisRatio(minAxisRatio), 
+) : Objective(inputs.getSize(), 3), _streaming(false), _singlePrecision(false), _nThreads(1),
+    _threadsUsed(1), _approximationError(0.0), _minRadius(minRadius), _minAxisRatio(minAxisRatio),
     _amplitude(1.0), _modelSquaredNorm(1.0),
-    _ellipse(), _inputs(inputs), _model(ndarray::allocate(inputs.getSize()))
+    _ellipse(), _inputs(inputs)
 {
     if (_minRadius <= 0.0) {
         throw LSST_EXCEPT(
@@ -51,7 +94,7 @@ MultiGaussianObjective::MultiGaussianObjective(
     for (MultiGaussian::const_iterator i = multiGaussian.begin(); i != multiGaussian.end(); ++i) {
         _builders.push_back(
             GaussianModelBuilder(
-                _inputs.getX(), _inputs.getY(), i->flux, i->radius,
+                _inputs.getSpans(), i->flux, i->radius,
                 afw::geom::ellipses::Quadrupole(0.0, 0.0, 0.0), 1.0,
                 useApproximateExp
             )
@@ -66,9 +109,10 @@ MultiGaussianObjective::MultiGaussianObjective(
     afw::geom::ellipses::Quadrupole const & psfEllipse,
     double minRadius, double minAxisRatio,
     bool useApproximateExp
-) : Objective(inputs.getSize(), 3), _minRadius(minRadius), _minAxisRatio(minAxisRatio),
+) : Objective(inputs.getSize(), 3), _streaming(false), _singlePrecision(false), _nThreads(1),
+    _threadsUsed(1), _approximationError(0.0), _minRadius(minRadius), _minAxisRatio(minAxisRatio),
     _amplitude(1.0), _modelSquaredNorm(1.0),
-    _ellipse(), _inputs(inputs), _model(ndarray::allocate(inputs.getSize()))
+    _ellipse(), _inputs(inputs)
 {
     if (_minRadius <= 0.0) {
         throw LSST_EXCEPT(
@@ -89,7 +133,7 @@ MultiGaussianObjective::MultiGaussianObjective(
         for (MultiGaussian::const_iterator i = multiGaussian.begin(); i != multiGaussian.end(); ++i) {
             _builders.push_back(
                 GaussianModelBuilder(
-                    _inputs.getX(), _inputs.getY(), i->flux, i->radius,
+                    _inputs.getSpans(), i->flux, i->radius,
                     psfComponentEllipse, j->flux,
                     useApproximateExp
                 )
@@ -98,6 +142,37 @@ MultiGaussianObjective::MultiGaussianObjective(
     }
 }
 
+void MultiGaussianObjective::setCulling(double nSigma, double pruneTolerance) {
+    double total = 0.0;
+    double largest = 0.0;
+    for (BuilderList::const_iterator i = _builders.begin(); i != _builders.end(); ++i) {
+        total += std::abs(i->getAmplitude());
+        largest = std::max(largest, std::abs(i->getAmplitude()));
+    }
+    double pruned = 0.0;
+    double kept = 0.0;
+    BuilderList builders;
+    builders.reserve(_builders.size());
+    for (BuilderList::const_iterator i = _builders.begin(); i != _builders.end(); ++i) {
+        double const amplitude = std::abs(i->getAmplitude());
+        // The largest component is always kept, so there is still a model to fit.
+        if (amplitude < pruneTolerance * total && amplitude < largest) {
+            pruned += amplitude;
+        } else {
+            builders.push_back(*i);
+            builders.back().setCullRadius(nSigma);
+            kept += amplitude;
+        }
+    }
+    _builders.swap(builders);
+    if (nSigma > 0.0) {
+        kept *= std::exp(-0.5 * nSigma * nSigma);
+    } else {
+        kept = 0.0;
+    }
+    _approximationError = (total > 0.0) ? (pruned + kept) / total : 0.0;
+}
+
 Objective::StepResult MultiGaussianObjective::tryStep(
     ndarray::Array<double const,1,1> const & oldParameters, 
     ndarray::Array<double,1,1> const & newParameters
@@ -122,18 +197,16 @@ void MultiGaussianObjective::computeFunction(
     ndarray::Array<double,1,1> const & function
 ) {
     _ellipse.readParameters(parameters.getData());
+    if (_model.isEmpty()) {
+        _model = ndarray::allocate(_inputs.getSize());
+    }
     ndarray::EigenView<double,1,1> model(_model);
     model.setZero();
     for (std::size_t n = 0; n < _builders.size(); ++n) {
         _builders[n].update(_ellipse);
         model += _builders[n].getModel().asEigen();
     }
-    if (!_inputs.getWeights().isEmpty()) {
-        model.array() *= _inputs.getWeights().asEigen<Eigen::ArrayXpr>();
-    }
-    _modelSquaredNorm = model.squaredNorm();
-    _amplitude = model.dot(_inputs.getData().asEigen()) / _modelSquaredNorm;
-    function.asEigen() = _amplitude * model - _inputs.getData().asEigen();
+    _finishFunction(function);
 }
 
 void MultiGaussianObjective::computeDerivative(
@@ -145,9 +218,173 @@ void MultiGaussianObjective::computeDerivative(
     for (std::size_t n = 0; n < _builders.size(); ++n) {
         _builders[n].computeDerivative(derivative, true);
     }
+    _finishDerivative(derivative);
+}
+
+void MultiGaussianObjective::computeFunctionAndDerivative(
+    ndarray::Array<double const,1,1> const & parameters, 
+    ndarray::Array<double,1,1> const & function,
+    ndarray::Array<double,2,-2> const & derivative
+) {
+    _ellipse.readParameters(parameters.getData());
+    if (_model.isEmpty()) {
+        _model = ndarray::allocate(_inputs.getSize());
+    }
+    _model.asEigen().setZero();
+    derivative.asEigen().setZero();
+    for (std::size_t n = 0; n < _builders.size(); ++n) {
+        _builders[n].updateEllipse(_ellipse);
+    }
+    int const size = _inputs.getSize();
+    int const nTiles = (size + TILE_SIZE - 1) / TILE_SIZE;
+    // Each pixel is only touched by the thread that owns its tile, and the builders are always
+    // added in the same order, so the result does not depend on the number of threads.
+    _threadsUsed = 1;
+#ifdef _OPENMP
+#pragma omp parallel num_threads(_nThreads) if(_nThreads > 1)
+#endif
+    {
+#ifdef _OPENMP
+#pragma omp master
+        _threadsUsed = omp_get_num_threads();
+#pragma omp for schedule(static)
+#endif
+        for (int t = 0; t < nTiles; ++t) {
+            int const begin = t * TILE_SIZE;
+            int const end = std::min(begin + TILE_SIZE, size);
+            for (std::size_t n = 0; n < _builders.size(); ++n) {
+                _builders[n].addModelAndDerivative(begin, end, _model, derivative);
+            }
+        }
+    }
+    _finishFunction(function);
+    _finishDerivative(derivative);
+}
+
+void MultiGaussianObjective::computeNormalEquations(
+    ndarray::Array<double const,1,1> const & parameters,
+    double & halfChiSq,
+    double & functionInfNorm,
+    ndarray::Array<double,1,1> const & gradient,
+    ndarray::Array<double,2,2> const & normalMatrix
+) {
+    // With m the (weighted) unit-amplitude model, D its derivative, and d the data, the function is
+    // f = a*m - d with a = m.d/m.m, and its derivative is J = a*D + m*da^T with
+    // da = D^T (d - 2*a*m) / m.m (see _finishDerivative).  Everything the optimizer needs can be
+    // written in terms of the sums below, where r0 = a0*m - d is the residual for the previous
+    // amplitude a0; the true residual is then r0 + (a - a0)*m, with a - a0 = -m.r0/m.m.
+    _ellipse.readParameters(parameters.getData());
+    for (std::size_t n = 0; n < _builders.size(); ++n) {
+        _builders[n].updateEllipse(_ellipse);
+    }
+    double const a0 = _amplitude;
+    int const size = _inputs.getSize();
+    int const nTiles = (size + TILE_SIZE - 1) / TILE_SIZE;
+    std::vector<TileSums> tiles(nTiles);
+    _threadsUsed = 1;
+#ifdef _OPENMP
+#pragma omp parallel num_threads(_nThreads) if(_nThreads > 1)
+#endif
+    {
+#ifdef _OPENMP
+#pragma omp master
+        _threadsUsed = omp_get_num_threads();
+#endif
+        ndarray::Array<double,1,1> tileModel = ndarray::allocate(TILE_SIZE);
+        ndarray::Array<double,2,-2> tileDerivative = ndarray::allocate(TILE_SIZE, 3);
+        ndarray::Array<float,1,1> floatModel;
+        ndarray::Array<float,2,-2> floatDerivative;
+        if (_singlePrecision) {
+            floatModel = ndarray::allocate(TILE_SIZE);
+            floatDerivative = ndarray::allocate(TILE_SIZE, 3);
+        }
+        Eigen::VectorXd r0(TILE_SIZE);
+#ifdef _OPENMP
+#pragma omp for schedule(static)
+#endif
+        for (int t = 0; t < nTiles; ++t) {
+            int const begin = t * TILE_SIZE;
+            int const n = std::min(TILE_SIZE, size - begin);
+            if (_singlePrecision) {
+                // The tile is evaluated in float; widening it here, in cache, means the weighting,
+                // residual, and every sum below are accumulated in double.
+                evaluateTile(_builders, begin, n, floatModel, floatDerivative);
+                tileModel.asEigen() = floatModel.asEigen().cast<double>();
+                tileDerivative.asEigen() = floatDerivative.asEigen().cast<double>();
+            } else {
+                evaluateTile(_builders, begin, n, tileModel, tileDerivative);
+            }
+            Eigen::Map<Eigen::VectorXd> m(tileModel.getData(), n);
+            Eigen::Map< Eigen::MatrixXd, 0, Eigen::OuterStride<> > D(
+                tileDerivative.getData(), n, 3, Eigen::OuterStride<>(tileDerivative.getStride<1>())
+            );
+            if (!_inputs.getWeights().isEmpty()) {
+                Eigen::Map<Eigen::VectorXd const> w(_inputs.getWeights().getData() + begin, n);
+                m.array() *= w.array();
+                for (int j = 0; j < 3; ++j) {
+                    D.col(j).array() *= w.array();
+                }
+            }
+            r0.head(n) = a0 * m - Eigen::Map<Eigen::VectorXd const>(_inputs.getData().getData() + begin, n);
+            TileSums & sums = tiles[t];
+            sums.mm = m.squaredNorm();
+            sums.r0r0 = r0.head(n).squaredNorm();
+            sums.mr0 = m.dot(r0.head(n));
+            sums.maxM = m.lpNorm<Eigen::Infinity>();
+            sums.maxR0 = r0.head(n).lpNorm<Eigen::Infinity>();
+            sums.Dm = D.adjoint() * m;
+            sums.Dr0 = D.adjoint() * r0.head(n);
+            sums.DD.setZero();
+            sums.DD.selfadjointView<Eigen::Lower>().rankUpdate(D.adjoint());
+        }
+    }
+    // Combine the tiles serially, in order, so the result does not depend on the number of threads.
+    double mm = 0.0;         // m.m
+    double r0r0 = 0.0;       // r0.r0
+    double mr0 = 0.0;        // m.r0
+    double maxM = 0.0;       // max |m|
+    double maxR0 = 0.0;      // max |r0|
+    Eigen::Vector3d Dm = Eigen::Vector3d::Zero();     // D^T m
+    Eigen::Vector3d Dr0 = Eigen::Vector3d::Zero();    // D^T r0
+    Eigen::Matrix3d DD = Eigen::Matrix3d::Zero();     // D^T D (lower triangle)
+    for (int t = 0; t < nTiles; ++t) {
+        mm += tiles[t].mm;
+        r0r0 += tiles[t].r0r0;
+        mr0 += tiles[t].mr0;
+        maxM = std::max(maxM, tiles[t].maxM);
+        maxR0 = std::max(maxR0, tiles[t].maxR0);
+        Dm += tiles[t].Dm;
+        Dr0 += tiles[t].Dr0;
+        DD += tiles[t].DD;
+    }
+    double const delta = -mr0 / mm;
+    _modelSquaredNorm = mm;
+    _amplitude = a0 + delta;
+    halfChiSq = 0.5 * std::max(r0r0 + delta * mr0, 0.0);
+    functionInfNorm = std::min(maxR0 + std::abs(delta) * maxM, std::sqrt(2.0 * halfChiSq));
+    Eigen::Vector3d const Dr = Dr0 + delta * Dm;   // D^T f
+    Eigen::Vector3d const dAmplitude = -(Dr + _amplitude * Dm) / mm;
+    gradient.asEigen() = _amplitude * Dr;
+    Eigen::Matrix3d const cross = Dm * dAmplitude.transpose();
+    Eigen::Matrix3d DDFull = DD.selfadjointView<Eigen::Lower>();
+    normalMatrix.asEigen() = _amplitude * _amplitude * DDFull
+        + _amplitude * (cross + cross.transpose()) + mm * dAmplitude * dAmplitude.transpose();
+}
+
+void MultiGaussianObjective::_finishFunction(ndarray::Array<double,1,1> const & function) {
+    ndarray::EigenView<double,1,1> model(_model);
+    if (!_inputs.getWeights().isEmpty()) {
+        model.array() *= _inputs.getWeights().asEigen<Eigen::ArrayXpr>();
+    }
+    _modelSquaredNorm = model.squaredNorm();
+    _amplitude = model.dot(_inputs.getData().asEigen()) / _modelSquaredNorm;
+    function.asEigen() = _amplitude * model - _inputs.getData().asEigen();
+}
+
+void MultiGaussianObjective::_finishDerivative(ndarray::Array<double,2,-2> const & derivative) {
     if (!_inputs.getWeights().isEmpty()) {
         derivative.asEigen<Eigen::ArrayXpr>() 
-            *= (_inputs.getWeights().asEigen() * Eigen::RowVectorXd::Ones(parameters.getSize<0>())).array();
+            *= (_inputs.getWeights().asEigen() * Eigen::RowVectorXd::Ones(derivative.getSize<1>())).array();
     }
     // Right now, 'derivative' is the partial derivative w.r.t. the objective parameters
     // with flux held fixed at 1.  However, the parameters also affect the flux, so we need
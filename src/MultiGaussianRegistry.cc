@@ -21,10 +21,12 @@
  * see <http://www.lsstcorp.org/LegalNotices/>.
  */
 
-#include <list>
-#include <algorithm>
+#include <cstring>
+#include <fstream>
 
 #include "boost/format.hpp"
+#include "boost/cstdint.hpp"
+#include "boost/unordered_map.hpp"
 
 #include "lsst/pex/exceptions.h"
 #include "lsst/meas/extensions/multiShapelet/MultiGaussianRegistry.h"
@@ -33,49 +35,201 @@ namespace lsst { namespace meas { namespace extensions { namespace multiShapelet
 
 namespace {
 
-typedef std::pair<std::string,MultiGaussian> RegistryItem;
-typedef std::list<RegistryItem> RegistryList;
+// Elements of an unordered_map are never moved by later insertions (only iterators are
+// invalidated by rehashing), so handles can point directly at them.
+typedef boost::unordered_map<std::string,MultiGaussian> RegistryMap;
 
-RegistryList & getRegistryList() {
-    static RegistryList it;
+// Built-in profiles: the multi-Gaussian approximations to the exponential and de Vaucouleur
+// profiles from Hogg & Lang (the Tractor), as generated by examples/sersicApprox.py.  The
+// radii are the square roots of the published variances.
+struct BuiltinProfile {
+    char const * name;
+    int size;
+    double const * fluxes;
+    double const * radii;
+};
+
+double const TRACTOR_EXP_FLUXES[] = {
+    3.31636565e-05, 0.00106478564, 0.0133260624, 0.106217866,
+    0.609924868, 2.43600369, 5.3455325, 3.41379672
+};
+double const TRACTOR_EXP_RADII[] = {
+    0.0070107716337076617, 0.02812975337609628, 0.071197602066361762, 0.1516635087949636,
+    0.29163741718099206, 0.52287559227793368, 0.89088446781835862, 1.4733146405299853
+};
+double const TRACTOR_DEV_FLUXES[] = {
+    0.0136305372, 0.108889599, 0.368235229, 0.926647361,
+    2.00002437, 3.77384257, 6.01053703, 7.22968202
+};
+double const TRACTOR_DEV_RADII[] = {
+    0.011604070148012721, 0.022452811561138618, 0.043418724301849315, 0.084878722539868612,
+    0.16969373176402244, 0.35372150627294352, 0.79889616722074719, 2.1827455486153213
+};
+
+BuiltinProfile const BUILTIN_PROFILES[] = {
+    { "tractor-exponential", 8, TRACTOR_EXP_FLUXES, TRACTOR_EXP_RADII },
+    { "tractor-devaucouleur", 8, TRACTOR_DEV_FLUXES, TRACTOR_DEV_RADII }
+};
+int const N_BUILTIN_PROFILES = sizeof(BUILTIN_PROFILES) / sizeof(BuiltinProfile);
+
+MultiGaussian makeMultiGaussian(int size, double const * fluxes, double const * radii, bool normalize) {
+    MultiGaussian multiGaussian;
+    double totalFlux = 0.0;
+    for (int n = 0; n < size; ++n) {
+        multiGaussian.add(GaussianComponent(fluxes[n], radii[n]));
+        totalFlux += fluxes[n];
+    }
+    if (normalize) {
+        for (int n = 0; n < size; ++n) {
+            multiGaussian[n].flux /= totalFlux;
+        }
+    }
+    return multiGaussian;
+}
+
+struct Registry {
+    RegistryMap map;
+    int frozen; // number of freeze() calls not yet matched by unfreeze()
+
+    Registry() : map(), frozen(0) {
+        for (int i = 0; i < N_BUILTIN_PROFILES; ++i) {
+            BuiltinProfile const & p = BUILTIN_PROFILES[i];
+            map[p.name] = makeMultiGaussian(p.size, p.fluxes, p.radii, true);
+        }
+    }
+};
+
+Registry & getRegistry() {
+    static Registry it;
     return it;
 }
 
-struct CompareRegistryItem {
+// Profile files are little-endian regardless of the host, so they can be shared between machines;
+// all integers are unsigned 32-bit and all floating-point values are IEEE doubles.
+char const FILE_MAGIC[8] = { 'M', 'G', 'P', 'R', 'O', 'F', 'I', 'L' };
+boost::uint32_t const FILE_VERSION = 1;
 
-    bool operator()(RegistryItem const & item) const { return item.first == name; }
+void writeUInt32(std::ostream & os, boost::uint32_t value) {
+    char buffer[4];
+    for (int k = 0; k < 4; ++k) {
+        buffer[k] = static_cast<char>((value >> (8 * k)) & 0xFF);
+    }
+    os.write(buffer, 4);
+}
+
+void writeDouble(std::ostream & os, double value) {
+    boost::uint64_t bits;
+    std::memcpy(&bits, &value, 8);
+    char buffer[8];
+    for (int k = 0; k < 8; ++k) {
+        buffer[k] = static_cast<char>((bits >> (8 * k)) & 0xFF);
+    }
+    os.write(buffer, 8);
+}
 
-    explicit CompareRegistryItem(std::string const & name_) : name(name_) {}
+// Sequential reader over the complete contents of a profile file, which are read with a single
+// call so loading does no per-value I/O.
+class FileReader {
+public:
 
-    std::string const & name;
+    FileReader(std::string const & filename) : _filename(filename), _data(), _pos(0) {
+        std::ifstream is(filename.c_str(), std::ios::in | std::ios::binary);
+        if (!is) {
+            fail("could not open file");
+        }
+        is.seekg(0, std::ios::end);
+        std::streamoff size = is.tellg();
+        is.seekg(0, std::ios::beg);
+        _data.resize(size);
+        if (size > 0 && !is.read(&_data[0], size)) {
+            fail("could not read file");
+        }
+    }
+
+    char const * readBytes(std::size_t n) {
+        if (_data.size() - _pos < n) {
+            fail("unexpected end of file");
+        }
+        char const * result = &_data[_pos];
+        _pos += n;
+        return result;
+    }
+
+    boost::uint32_t readUInt32() {
+        unsigned char const * buffer = reinterpret_cast<unsigned char const *>(readBytes(4));
+        boost::uint32_t value = 0;
+        for (int k = 0; k < 4; ++k) {
+            value |= boost::uint32_t(buffer[k]) << (8 * k);
+        }
+        return value;
+    }
+
+    double readDouble() {
+        unsigned char const * buffer = reinterpret_cast<unsigned char const *>(readBytes(8));
+        boost::uint64_t bits = 0;
+        for (int k = 0; k < 8; ++k) {
+            bits |= boost::uint64_t(buffer[k]) << (8 * k);
+        }
+        double value;
+        std::memcpy(&value, &bits, 8);
+        return value;
+    }
+
+    void fail(std::string const & message) const {
+        throw LSST_EXCEPT(
+            pex::exceptions::IoErrorException,
+            (boost::format("Error loading profile file '%s': %s.") % _filename % message).str()
+        );
+    }
+
+private:
+    std::string _filename;
+    std::vector<char> _data;
+    std::size_t _pos;
 };
 
 } // anonymous
 
-MultiGaussian const & MultiGaussianRegistry::lookup(std::string const & name) {
-    RegistryList & l = getRegistryList();
-    RegistryList::iterator i = std::find_if(l.begin(), l.end(), CompareRegistryItem(name));
-    if (i == l.end()) {
+MultiGaussianHandle MultiGaussianRegistry::getHandle(std::string const & name) {
+    RegistryMap const & m = getRegistry().map;
+    RegistryMap::const_iterator i = m.find(name);
+    if (i == m.end()) {
         throw LSST_EXCEPT(
             pex::exceptions::NotFoundException,
             (boost::format("MultiGaussian with name '%s' not found in registry.") % name).str()
         );
     }
-    MultiGaussian const & result = i->second;
-    if (i != l.begin()) {
-        l.splice(l.begin(), l, i);
-    }
-    return result;
+    return MultiGaussianHandle(&(*i));
 }
 
 void MultiGaussianRegistry::insert(std::string const & name, MultiGaussian const & multiGaussian) {
-    RegistryList & l = getRegistryList();
-    RegistryList::iterator i = std::find_if(l.begin(), l.end(), CompareRegistryItem(name));
-    if (i != l.end()) {
-        i->second = multiGaussian;
-    } else {
-        l.push_back(std::make_pair(name, multiGaussian));
+    Registry & r = getRegistry();
+    if (r.frozen) {
+        throw LSST_EXCEPT(
+            pex::exceptions::LogicErrorException,
+            (boost::format("Cannot insert MultiGaussian '%s'; registry is frozen.") % name).str()
+        );
     }
+    r.map[name] = multiGaussian;
+}
+
+void MultiGaussianRegistry::freeze() {
+    ++getRegistry().frozen;
+}
+
+void MultiGaussianRegistry::unfreeze() {
+    Registry & r = getRegistry();
+    if (r.frozen <= 0) {
+        throw LSST_EXCEPT(
+            pex::exceptions::LogicErrorException,
+            "Cannot unfreeze MultiGaussianRegistry; it is not frozen."
+        );
+    }
+    --r.frozen;
+}
+
+bool MultiGaussianRegistry::isFrozen() {
+    return getRegistry().frozen > 0;
 }
 
 void MultiGaussianRegistry::insert(
@@ -105,4 +259,67 @@ void MultiGaussianRegistry::insert(
     insert(name, multiGaussian);
 }
 
+void MultiGaussianRegistry::loadFile(std::string const & filename) {
+    FileReader reader(filename);
+    if (std::memcmp(reader.readBytes(sizeof(FILE_MAGIC)), FILE_MAGIC, sizeof(FILE_MAGIC)) != 0) {
+        reader.fail("not a multi-Gaussian profile file");
+    }
+    boost::uint32_t version = reader.readUInt32();
+    if (version != FILE_VERSION) {
+        reader.fail((boost::format("unsupported format version %d") % version).str());
+    }
+    // Parse everything before inserting anything, so a corrupt file leaves the registry unchanged.
+    boost::uint32_t nProfiles = reader.readUInt32();
+    std::vector< std::pair<std::string,MultiGaussian> > profiles;
+    for (boost::uint32_t i = 0; i < nProfiles; ++i) {
+        boost::uint32_t nameSize = reader.readUInt32();
+        std::string name(reader.readBytes(nameSize), nameSize);
+        boost::uint32_t nComponents = reader.readUInt32();
+        MultiGaussian multiGaussian;
+        for (boost::uint32_t n = 0; n < nComponents; ++n) {
+            double flux = reader.readDouble();
+            double radius = reader.readDouble();
+            multiGaussian.add(GaussianComponent(flux, radius));
+        }
+        profiles.push_back(std::make_pair(name, multiGaussian));
+    }
+    for (std::size_t i = 0; i < profiles.size(); ++i) {
+        insert(profiles[i].first, profiles[i].second);
+    }
+}
+
+void MultiGaussianRegistry::saveFile(std::string const & filename, std::vector<std::string> const & names) {
+    std::vector<MultiGaussianHandle> handles;
+    for (std::vector<std::string>::const_iterator i = names.begin(); i != names.end(); ++i) {
+        handles.push_back(getHandle(*i));
+    }
+    std::ofstream os(filename.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!os) {
+        throw LSST_EXCEPT(
+            pex::exceptions::IoErrorException,
+            (boost::format("Could not open profile file '%s' for writing.") % filename).str()
+        );
+    }
+    os.write(FILE_MAGIC, sizeof(FILE_MAGIC));
+    writeUInt32(os, FILE_VERSION);
+    writeUInt32(os, handles.size());
+    for (std::vector<MultiGaussianHandle>::const_iterator i = handles.begin(); i != handles.end(); ++i) {
+        std::string name = i->getName();
+        writeUInt32(os, name.size());
+        os.write(name.data(), name.size());
+        writeUInt32(os, (*i)->size());
+        for (MultiGaussian::const_iterator j = (*i)->begin(); j != (*i)->end(); ++j) {
+            writeDouble(os, j->flux);
+            writeDouble(os, j->radius);
+        }
+    }
+    os.close();
+    if (!os) {
+        throw LSST_EXCEPT(
+            pex::exceptions::IoErrorException,
+            (boost::format("Error writing profile file '%s'.") % filename).str()
+        );
+    }
+}
+
 }}}} // namespace lsst::meas::extensions::multiShapelet
@@ -133,6 +133,32 @@ BOOST_AUTO_TEST_CASE(Vectorization) {
     }
 }
 
+BOOST_AUTO_TEST_CASE(Span) {
+    // Test that evaluating along a span matches evaluating at each pixel.
+    ms::EllipseSquaredNorm esn;
+    EllipseVector const ellipses = makeTestEllipses();
+    int const n = 50;
+    double const x0 = -24.3;
+    double const y = 3.7;
+    Eigen::VectorXd x = Eigen::VectorXd::Zero(n);
+    Eigen::VectorXd rx = Eigen::VectorXd::Zero(n);
+    Eigen::VectorXd ry = Eigen::VectorXd::Zero(n);
+    Eigen::VectorXd z = Eigen::VectorXd::Zero(n);
+    for (EllipseIter i = ellipses.begin(); i != ellipses.end(); ++i) {
+        esn.update(**i, false);
+        esn.evaluateSpan(x0, y, n, x.data(), rx.data(), ry.data(), z.data());
+        for (int j = 0; j < n; ++j) {
+            double rxj=0., ryj=0., zj=0.;
+            esn(x0 + j, y, rxj, ryj, zj);
+            BOOST_CHECK_CLOSE(x0 + j, x[j], 1E-15);
+            // the recurrence accumulates rounding error, so compare absolutely
+            BOOST_CHECK_SMALL(rxj - rx[j], 1E-10);
+            BOOST_CHECK_SMALL(ryj - ry[j], 1E-10);
+            BOOST_CHECK_SMALL(zj - z[j], 1E-8);
+        }
+    }
+}
+
 BOOST_AUTO_TEST_CASE(Functor) {
     ms::EllipseSquaredNorm esn;
     EllipseVector const ellipses = makeTestEllipses();
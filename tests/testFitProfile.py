@@ -32,6 +32,8 @@ or
    >>> import testFitProfile; testFitProfile.run()
 """
 
+import os
+import tempfile
 import unittest
 import numpy
 
@@ -41,6 +43,8 @@ import lsst.afw.geom as geom
 import lsst.afw.geom.ellipses
 import lsst.afw.image
 import lsst.afw.detection
+import lsst.afw.table
+import lsst.meas.algorithms
 import lsst.meas.extensions.multiShapelet as ms
 
 numpy.random.seed(5)
@@ -105,6 +109,271 @@ class FitProfileTestMixin(object):
             self.assert_(numpy.isfinite(z0).all())
             self.assert_(numpy.isfinite(z1).all())
 
+    def testDeconvolveWeighted(self):
+        multiGaussian = ms.MultiGaussianRegistry.lookup(self.ctrl.profile)
+        psfMultiGaussian = ms.FitPsfControl().getMultiGaussian()
+        psfMoments = geom.ellipses.Quadrupole(2.0, 1.8, 0.2)
+        fullMoments = geom.ellipses.Quadrupole(9.0, 6.0, 1.5)
+        q = multiGaussian.deconvolveWeighted(fullMoments, psfMoments, psfMultiGaussian)
+        self.assert_(q.getDeterminant() > 0.0)
+        # the convolved profile, weighted by a Gaussian with the full moments, must have weighted
+        # moments equal to half the full moments
+        x, y = numpy.meshgrid(numpy.arange(-40.0, 40.0, 0.1), numpy.arange(-40.0, 40.0, 0.1))
+        image = numpy.zeros(x.shape, dtype=float)
+        for p in psfMultiGaussian:
+            for c in multiGaussian:
+                m = q.getMatrix() * c.radius**2 + psfMoments.getMatrix() * p.radius**2
+                mInv = numpy.linalg.inv(m)
+                image += (p.flux * c.flux / numpy.linalg.det(m)**0.5
+                          * numpy.exp(-0.5 * (mInv[0,0]*x**2 + 2.0*mInv[0,1]*x*y + mInv[1,1]*y**2)))
+        wInv = numpy.linalg.inv(fullMoments.getMatrix())
+        image *= numpy.exp(-0.5 * (wInv[0,0]*x**2 + 2.0*wInv[0,1]*x*y + wInv[1,1]*y**2))
+        norm = image.sum()
+        moments = [(image * x**2).sum() / norm, (image * y**2).sum() / norm, (image * x * y).sum() / norm]
+        self.assertClose(moments, [4.5, 3.0, 0.75], rtol=1E-6, atol=1E-6)
+        # for a single component profile and PSF, this is the same as matching unweighted moments
+        gaussian = ms.MultiGaussian()
+        gaussian.add(ms.GaussianComponent(1.0, 1.0))
+        self.assertClose(gaussian.deconvolveWeighted(fullMoments, psfMoments, gaussian).getParameterVector(),
+                         gaussian.deconvolve(fullMoments, psfMoments, gaussian).getParameterVector())
+
+    def testConfigDefaults(self):
+        # Nested pex_config defaults come from the nested control's own constructor, so the
+        # setDefaults overrides must keep the Python optimizer settings in step with the C++ ones.
+        cases = [(ms.FitPsfConfig().makeControl(), ms.FitPsfControl()),
+                 (ms.FitProfileConfig().makeControl(), ms.FitProfileControl()),
+                 (ms.FitExponentialConfig().makeControl(), ms.FitProfileControl())]
+        expDev = ms.FitExpDevConfig().makeControl()
+        cases += [(expDev.exp, ms.FitProfileControl()), (expDev.dev, ms.FitProfileControl())]
+        for ctrl, expected in cases:
+            for name in ms.HybridOptimizerConfig().toDict():
+                self.assertEqual(getattr(ctrl.optimizer, name), getattr(expected.optimizer, name), name)
+
+    def testRegistryHandle(self):
+        handle = ms.MultiGaussianRegistry.getHandle(self.ctrl.profile)
+        self.assertFalse(handle.isNull())
+        self.assertEqual(handle.getName(), self.ctrl.profile)
+        self.assertClose(handle.get().integrate(), 1.0)
+        model = ms.FitProfileModel(self.ctrl, 1.0, numpy.array([0.0, 0.0, 1.0]))
+        self.assertEqual(model.profile, handle)
+        self.assertEqual(model.profile.getName(), self.ctrl.profile)
+        self.assertTrue(ms.MultiGaussianHandle().isNull())
+        self.assertRaises(lsst.pex.exceptions.LsstCppException,
+                          ms.MultiGaussianRegistry.getHandle, "not-a-profile")
+
+    def testRegistryFreeze(self):
+        original = ms.MultiGaussianRegistry.lookup(self.ctrl.profile)
+        self.assertFalse(ms.MultiGaussianRegistry.isFrozen())
+        with ms.FrozenRegistry():
+            with ms.FrozenRegistry():
+                self.assert_(ms.MultiGaussianRegistry.isFrozen())
+            # freezes nest, so the outer one is still in effect
+            self.assert_(ms.MultiGaussianRegistry.isFrozen())
+            self.assertRaises(lsst.pex.exceptions.LsstCppException,
+                              ms.MultiGaussianRegistry.insert, "test-frozen", original)
+            self.assertEqual(len(ms.MultiGaussianRegistry.lookup(self.ctrl.profile)), len(original))
+        self.assertFalse(ms.MultiGaussianRegistry.isFrozen())
+        self.assertRaises(lsst.pex.exceptions.LsstCppException, ms.MultiGaussianRegistry.unfreeze)
+        ms.MultiGaussianRegistry.insert("test-frozen", original)
+        self.assertEqual(len(ms.MultiGaussianRegistry.lookup("test-frozen")), len(original))
+        # batch fits leave freezing to the caller
+        psfModel = ms.FitPsfModel(ms.FitPsfControl(), 1.0, numpy.array([0.1, -0.05, 1.0]))
+        source = ms.FitProfileBatchInput(self.footprint, self.center,
+                                         geom.ellipses.Quadrupole(self.ellipse.getCore()), psfModel)
+        ms.FitProfileAlgorithm.applyBatch(self.ctrl, [source], self.mi, 2)
+        self.assertFalse(ms.MultiGaussianRegistry.isFrozen())
+
+    def testProfileFile(self):
+        for name in ("tractor-exponential", "tractor-devaucouleur"):
+            builtin = ms.MultiGaussianRegistry.lookup(name)
+            self.assertEqual(len(builtin), 8)
+            self.assertClose(builtin.integrate(), 1.0)
+        original = ms.MultiGaussianRegistry.lookup(self.ctrl.profile)
+        ms.MultiGaussianRegistry.insert("test-unnormalized",
+                                        numpy.array([3.0 * c.flux for c in original]),
+                                        numpy.array([c.radius for c in original]))
+        fd, filename = tempfile.mkstemp()
+        os.close(fd)
+        try:
+            ms.MultiGaussianRegistry.saveFile(filename, [self.ctrl.profile, "test-unnormalized"])
+            ms.MultiGaussianRegistry.insert("test-unnormalized", ms.MultiGaussian())
+            ms.MultiGaussianRegistry.loadFile(filename)
+            loaded = ms.MultiGaussianRegistry.lookup("test-unnormalized")
+            self.assertEqual(len(loaded), len(original))
+            for a, b in zip(loaded, original):
+                self.assertEqual(a.flux, 3.0 * b.flux)
+                self.assertEqual(a.radius, b.radius)
+            with open(filename, "r+b") as f:
+                f.truncate(os.path.getsize(filename) - 1)
+            self.assertRaises(lsst.pex.exceptions.LsstCppException,
+                              ms.MultiGaussianRegistry.loadFile, filename)
+        finally:
+            os.remove(filename)
+        self.assertRaises(lsst.pex.exceptions.LsstCppException,
+                          ms.MultiGaussianRegistry.loadFile, filename)
+
+    def testArrayBatch(self):
+        psfCtrl = ms.FitPsfControl()
+        psfModel = ms.FitPsfModel(psfCtrl, 1.0, numpy.array([0.1, -0.05, 1.0]))
+        psfModels = ms.makePsfBatchArray(psfCtrl, 1)
+        psfModels["ixx"] = psfModel.ellipse.getIxx()
+        psfModels["iyy"] = psfModel.ellipse.getIyy()
+        psfModels["ixy"] = psfModel.ellipse.getIxy()
+        psfModels["inner"] = psfModel.inner
+        psfModels["outer"] = psfModel.outer
+        shape = geom.ellipses.Quadrupole(geom.ellipses.Axes(10.0, 8.0, 0.2))
+        centers = numpy.array([[self.center.getX(), self.center.getY()]])
+        shapes = numpy.array([[shape.getIxx(), shape.getIyy(), shape.getIxy()]])
+        stamps = numpy.array([[self.bbox.getMinX(), self.bbox.getMinY(),
+                               self.bbox.getWidth(), self.bbox.getHeight()]], dtype=numpy.int32)
+        output = ms.makeProfileBatchArray(1)
+        ms.fitProfileArrays(self.ctrl, psfCtrl, self.mi, centers, shapes, stamps, psfModels, output)
+        inputs = ms.FitProfileAlgorithm.adjustInputs(self.ctrl, psfModel, shape,
+                                                     lsst.afw.detection.Footprint(self.bbox),
+                                                     self.mi, self.center)
+        model = ms.FitProfileAlgorithm.apply(self.ctrl, psfModel, shape, inputs)
+        self.assertEqual(output["flag"][0], float(model.fluxFlag))
+        self.assertClose(output["flux"][0], model.flux)
+        self.assertClose(output["fluxErr"][0], model.fluxErr)
+        self.assertClose([output["ixx"][0], output["iyy"][0], output["ixy"][0]],
+                         [model.ellipse.getIxx(), model.ellipse.getIyy(), model.ellipse.getIxy()])
+        # failed PSF models produce flagged, NaN results
+        psfModels["flag"] = 1.0
+        ms.fitProfileArrays(self.ctrl, psfCtrl, self.mi, centers, shapes, stamps, psfModels, output)
+        self.assertEqual(output["flag"][0], 1.0)
+        self.assert_(numpy.isnan(output["flux"][0]))
+
+    def testBatch(self):
+        psfModel = ms.FitPsfModel(ms.FitPsfControl(), 1.0, numpy.array([0.1, -0.05, 1.0]))
+        inner = lsst.afw.detection.Footprint(
+            geom.ellipses.Ellipse(geom.ellipses.Axes(10.0, 8.0, 0.3), self.center)
+            )
+        sources = [
+            ms.FitProfileBatchInput(footprint, self.center + geom.Extent2D(dx, dy),
+                                    geom.ellipses.Quadrupole(geom.ellipses.Axes(a, b, theta)), psfModel)
+            for footprint, dx, dy, a, b, theta in [(self.footprint, 0.0, 0.0, 10.0, 8.0, 0.2),
+                                                   (inner, 0.5, -0.3, 6.0, 5.0, -0.4),
+                                                   (inner, -1.2, 0.8, 12.0, 6.0, 1.0),
+                                                   (inner, 0.0, 0.0, 4.0, 4.0, 0.0)]
+            ]
+        # a failed PSF model should produce a flagged placeholder
+        sources.append(ms.FitProfileBatchInput(inner, self.center, geom.ellipses.Quadrupole(),
+                                               ms.FitPsfModel(ms.FitPsfControl())))
+        # the first source is big enough to be fit last, with all the threads
+        self.ctrl.parallelMinPixels = self.footprint.getArea()
+        expected = []
+        for source in sources[:-1]:
+            shape = geom.ellipses.Quadrupole(source.shape)
+            inputs = ms.FitProfileAlgorithm.adjustInputs(self.ctrl, source.psfModel, shape, source.footprint,
+                                                         self.mi, source.center)
+            expected.append(ms.FitProfileAlgorithm.apply(self.ctrl, source.psfModel, shape, inputs))
+        for nThreads in (1, 4):
+            models = ms.FitProfileAlgorithm.applyBatch(self.ctrl, sources, self.mi, nThreads)
+            self.assertEqual(len(models), len(sources))
+            for model, direct in zip(models[:-1], expected):
+                self.assertEqual(model.fluxFlag, direct.fluxFlag)
+                self.assertClose(model.flux, direct.flux, rtol=1E-12, atol=0.0)
+                self.assertClose(model.fluxErr, direct.fluxErr, rtol=1E-12, atol=0.0)
+                self.assertClose(model.ellipse.getParameterVector(), direct.ellipse.getParameterVector(),
+                                 rtol=1E-12, atol=1E-14)
+                self.assertClose(model.chisq, direct.chisq, rtol=1E-12, atol=0.0)
+            self.assert_(models[-1].fluxFlag)
+            self.assert_(numpy.isnan(models[-1].flux))
+
+    def testForcedBatch(self):
+        psf = lsst.afw.detection.createPsf("DoubleGaussian", 19, 19, 1.5, 3.0, 0.1)
+        exposure = lsst.afw.image.ExposureF(self.mi)
+        exposure.setPsf(psf)
+        psfCtrl = ms.FitPsfControl()
+        # reference catalog, with the models saved by a regular (non-forced) fit
+        refSchema = lsst.afw.table.SourceTable.makeMinimalSchema()
+        refOthers = lsst.meas.algorithms.AlgorithmMap()
+        refOthers[psfCtrl.name] = psfCtrl.makeAlgorithm(refSchema)
+        refAlg = self.ctrl.makeAlgorithm(refSchema, None, refOthers, False)
+        refTable = lsst.afw.table.SourceTable.make(refSchema)
+        refRecords = []
+        for model in [ms.FitProfileModel(self.ctrl, 30.0, numpy.array([0.2, -0.1, 2.0])),
+                      ms.FitProfileModel(self.ctrl, 12.0, numpy.array([0.0, 0.3, 1.5])),
+                      ms.FitProfileModel(self.ctrl)]:
+            refRecords.append(refTable.makeRecord())
+            refAlg.fillRecord(refRecords[-1], model)
+        references = [ms.FitProfileModel(self.ctrl, record) for record in refRecords]
+        # measurement catalog on this image
+        schema = lsst.afw.table.SourceTable.makeMinimalSchema()
+        schema.addField("flux.psf", type="F8", doc="PSF flux")
+        schema.addField("flux.psf.err", type="F8", doc="PSF flux uncertainty")
+        psfFluxFlagKey = schema.addField("flux.psf.flags", type="Flag", doc="PSF flux failure flag")
+        others = lsst.meas.algorithms.AlgorithmMap()
+        psfAlg = psfCtrl.makeAlgorithm(schema)
+        others[psfCtrl.name] = psfAlg
+        alg = self.ctrl.makeAlgorithm(schema, None, others, True)
+        table = lsst.afw.table.SourceTable.make(schema)
+        table.definePsfFlux("flux.psf")
+        inner = lsst.afw.detection.Footprint(
+            geom.ellipses.Ellipse(geom.ellipses.Axes(10.0, 8.0, 0.3), self.center)
+            )
+        records = []
+        sources = []
+        for reference, footprint, dx, dy, refToMeas, psfFluxFlag in [
+            (0, self.footprint, 0.0, 0.0, geom.LinearTransform.makeScaling(0.9), False),
+            (1, inner, 0.5, -0.3, geom.LinearTransform.makeRotation(0.3 * geom.radians), False),
+            (0, inner, -1.0, 0.4, geom.LinearTransform(), False),
+            (1, inner, 0.0, 0.0, geom.LinearTransform(), True),   # PSF flux failed on this image
+            (2, inner, 0.0, 0.0, geom.LinearTransform(), False),  # reference fit failed
+            ]:
+            center = self.center + geom.Extent2D(dx, dy)
+            record = table.makeRecord()
+            record.setFootprint(footprint)
+            record.set(psfFluxFlagKey, psfFluxFlag)
+            psfAlg.fit(record, psf, center)
+            records.append((record, center, refRecords[reference], geom.AffineTransform(refToMeas)))
+            sources.append(ms.FitProfileForcedBatchInput(reference, footprint, center, refToMeas,
+                                                         ms.FitPsfModel(psfCtrl, record), psfFluxFlag))
+        # the single-source forced path; it throws for sources it can't fit, leaving the flag set
+        for record, center, refRecord, refToMeas in records:
+            try:
+                lsst.meas.algorithms.Algorithm.applyForced(alg, record, exposure, center,
+                                                           refRecord, refToMeas)
+            except lsst.pex.exceptions.LsstCppException:
+                pass
+        for nThreads in (1, 3):
+            models = ms.FitProfileAlgorithm.applyForcedBatch(self.ctrl, references, sources, self.mi,
+                                                             nThreads)
+            self.assertEqual(len(models), len(sources))
+            for model, (record, center, refRecord, refToMeas) in zip(models, records):
+                self.assertEqual(model.fluxFlag, record.get(self.ctrl.name + ".flux.flags"))
+                if model.fluxFlag:
+                    self.assert_(numpy.isnan(model.flux))
+                    continue
+                self.assertClose(model.flux, record.get(self.ctrl.name + ".flux"), rtol=1E-12, atol=0.0)
+                self.assertClose(model.fluxErr, record.get(self.ctrl.name + ".flux.err"),
+                                 rtol=1E-12, atol=0.0)
+                self.assertClose(model.ellipse.getParameterVector(),
+                                 record.get(self.ctrl.name + ".ellipse").getParameterVector(),
+                                 rtol=1E-12, atol=1E-14)
+            self.assertEqual([model.fluxFlag for model in models], [False, False, False, True, True])
+        # enough sources to fill more than one chunk of inputs per thread; threading must not
+        # change any of the results
+        manySources = sources * 80
+        serial = ms.FitProfileAlgorithm.applyForcedBatch(self.ctrl, references, manySources, self.mi, 1)
+        for nThreads in (3, 4):
+            models = ms.FitProfileAlgorithm.applyForcedBatch(self.ctrl, references, manySources,
+                                                             self.mi, nThreads)
+            self.assertEqual(len(models), len(manySources))
+            for model, expected in zip(models, serial):
+                self.assertEqual(model.fluxFlag, expected.fluxFlag)
+                if model.fluxFlag:
+                    continue
+                self.assertEqual(model.flux, expected.flux)
+                self.assertEqual(model.fluxErr, expected.fluxErr)
+                self.assertEqual(list(model.ellipse.getParameterVector()),
+                                 list(expected.ellipse.getParameterVector()))
+        # out-of-range reference indices are rejected before any fitting
+        sources.append(ms.FitProfileForcedBatchInput(len(references), inner, self.center,
+                                                     geom.LinearTransform(), sources[0].psfModel))
+        self.assertRaises(lsst.pex.exceptions.LsstCppException, ms.FitProfileAlgorithm.applyForcedBatch,
+                          self.ctrl, references, sources, self.mi)
+
     def testConvolvedModel(self):
         psfModel = ms.FitPsfModel(ms.FitPsfControl(), 1.0, numpy.array([0.1, -0.05, 1.0]))
         psfMultiGaussian = psfModel.getMultiGaussian()
@@ -163,6 +432,207 @@ class FitProfileTestMixin(object):
             self.assertClose(d0, d1, atol=1E-4, rtol=1E-10)
             print d0
             
+    def testConvolvedProfileTemplate(self):
+        psfModel = ms.FitPsfModel(ms.FitPsfControl(), 1.0, numpy.array([0.1, -0.05, 1.0]))
+        model = ms.FitProfileModel(self.ctrl, 1.0, numpy.array([0.2, -0.8, 2.3]))
+        modelVector = numpy.zeros(self.inputs.getSize(), dtype=float)
+        ms.FitProfileAlgorithm.fitShapeletTerms(self.ctrl, psfModel, self.inputs, model, modelVector)
+        # compare to the direct convolution of the shapelet expansions
+        msf = model.asMultiShapelet(self.center).convolve(psfModel.asMultiShapelet())
+        msf.normalize()
+        sImage = lsst.afw.image.ImageD(self.bbox)
+        msf.evaluate().addToImage(sImage)
+        i = numpy.round(self.inputs.getY() + self.center.getY()).astype(int) - self.bbox.getBeginY()
+        j = numpy.round(self.inputs.getX() + self.center.getX()).astype(int) - self.bbox.getBeginX()
+        expected = sImage.getArray()[i, j]
+        if self.inputs.getWeights().size:
+            expected *= self.inputs.getWeights()
+        self.assertClose(modelVector, expected)
+        # the combo fit should give the same answer from the component models
+        devCtrl = ms.FitDeVaucouleurConfig().makeControl()
+        dev = ms.FitProfileModel(devCtrl, 1.0, numpy.array([0.2, -0.8, 2.0]))
+        componentModels = numpy.zeros((2, self.inputs.getSize()), dtype=float)
+        ms.FitProfileAlgorithm.fitShapeletTerms(self.ctrl, psfModel, self.inputs, model, componentModels[0])
+        ms.FitProfileAlgorithm.fitShapeletTerms(devCtrl, psfModel, self.inputs, dev, componentModels[1])
+        comboCtrl = ms.FitComboControl()
+        combo1 = ms.FitComboAlgorithm.apply(comboCtrl, psfModel, model, dev, self.inputs)
+        combo2 = ms.FitComboAlgorithm.apply(comboCtrl, model, dev, self.inputs, componentModels)
+        self.assertClose(combo1.flux, combo2.flux)
+        self.assertClose(combo1.devFrac, combo2.devFrac)
+        # ...which is the unconstrained linear fit whenever that is non-negative
+        fisher = numpy.dot(componentModels, componentModels.transpose())
+        covariance = numpy.linalg.inv(fisher)
+        solution = numpy.dot(covariance, numpy.dot(componentModels, self.inputs.getData()))
+        if (solution >= 0.0).all():
+            self.assertClose(combo2.flux, solution.sum())
+            self.assertClose(combo2.devFrac, solution[1] / solution.sum())
+            self.assertClose(combo2.fluxErr, covariance.sum()**0.5)
+        else:
+            self.assert_(combo2.devFrac in (0.0, 1.0))
+
+    def testInputSubset(self):
+        bad = lsst.afw.image.MaskU.getPlaneBitMask("BAD")
+        inner = lsst.afw.detection.Footprint(
+            geom.ellipses.Ellipse(geom.ellipses.Axes(12.0, 8.0, -0.4), self.center)
+            )
+        direct = ms.ModelInputHandler(self.mi, self.center, inner, 0, bad, True)
+        workspace = ms.ModelInputWorkspace()
+        subset = ms.ModelInputHandler(self.inputs, inner, workspace)
+        self.assertEqual(direct.getSize(), subset.getSize())
+        self.assertEqual(workspace.getUsed(), 4 * subset.getSize())
+        self.assertClose(direct.getX(), subset.getX())
+        self.assertClose(direct.getY(), subset.getY())
+        self.assertClose(direct.getData(), subset.getData())
+        self.assertClose(direct.getWeights(), subset.getWeights())
+
+    def testBinnedInputs(self):
+        binSize = 4
+        binned = ms.ModelInputHandler(self.inputs, binSize)
+        self.assertEqual(binned.getBinSize(), binSize)
+        # recover the unweighted pixels and variances, and sum them by bin
+        x = self.inputs.getX() + self.center.getX()
+        y = self.inputs.getY() + self.center.getY()
+        w = self.inputs.getWeights()
+        keys = zip(numpy.floor(y / binSize).astype(int), numpy.floor(x / binSize).astype(int))
+        sums = {}
+        for key, d, wi in zip(keys, self.inputs.getData() / w, w):
+            s = sums.setdefault(key, [0.0, 0.0, 0])
+            s[0] += d
+            s[1] += wi**-2
+            s[2] += 1
+        self.assertEqual(binned.getSize(), len(sums))
+        bx = numpy.round(binned.getX() + (self.center.getX() - 0.5 * (binSize - 1)) / binSize).astype(int)
+        by = numpy.round(binned.getY() + (self.center.getY() - 0.5 * (binSize - 1)) / binSize).astype(int)
+        self.assertClose(binned.getX(), bx - (self.center.getX() - 0.5 * (binSize - 1)) / binSize)
+        expected = numpy.array([sums[key] for key in zip(by, bx)])
+        self.assertClose(binned.getData(), expected[:,0] / expected[:,1]**0.5)
+        self.assertClose(binned.getWeights(), expected[:,2] / (binSize**2 * expected[:,1]**0.5))
+        self.assertRaises(lsst.pex.exceptions.LsstCppException, ms.ModelInputHandler, binned, 2)
+
+    def testPyramid(self):
+        psfModel = ms.FitPsfModel(ms.FitPsfControl(), 1.0, numpy.array([0.1, -0.05, 1.0]))
+        truth = ms.FitProfileModel(self.ctrl, 1.0, numpy.array([0.2, -0.1, 2.0]))
+        msf = truth.asMultiShapelet(self.center).convolve(psfModel.asMultiShapelet())
+        image = lsst.afw.image.MaskedImageD(self.bbox)
+        msf.evaluate().addToImage(image.getImage())
+        image.getImage().getArray()[:,:] *= 5000.0
+        image.getImage().getArray()[:,:] += numpy.random.randn(self.bbox.getHeight(), self.bbox.getWidth())
+        image.getVariance().getArray()[:,:] = 1.0
+        inputs = ms.ModelInputHandler(image, self.center, self.bbox)
+        shape = geom.ellipses.Quadrupole(geom.ellipses.Axes(4.0, 4.0, 0.0))
+        direct = ms.FitProfileAlgorithm.apply(self.ctrl, psfModel, shape, inputs)
+        ctrl = self.config.makeControl()
+        ctrl.pyramidLevels = 2
+        ctrl.pyramidMinPixels = 100
+        pyramid = ms.FitProfileAlgorithm.apply(ctrl, psfModel, shape, inputs)
+        self.assertFalse(pyramid.fluxFlag)
+        self.assertClose(pyramid.flux, direct.flux, rtol=1E-3)
+        self.assertClose(pyramid.ellipse.getParameterVector(), direct.ellipse.getParameterVector(),
+                         rtol=1E-3, atol=1E-3)
+        self.assertClose(pyramid.chisq, direct.chisq, rtol=1E-4)
+
+    def testMergeEllipses(self):
+        def rasterize(footprint, grow=0):
+            mask = numpy.zeros((self.bbox.getHeight(), self.bbox.getWidth()), dtype=bool)
+            for span in footprint.getSpans():
+                y = span.getY() - self.bbox.getBeginY()
+                mask[y, span.getX0() - self.bbox.getBeginX():span.getX1() - self.bbox.getBeginX() + 1] = True
+            if grow:
+                # dilate by a disk, as the isotropic afw growFootprint does
+                grown = mask.copy()
+                for dy in range(-grow, grow + 1):
+                    for dx in range(-grow, grow + 1):
+                        if dx*dx + dy*dy <= grow*grow:
+                            grown[max(dy,0):mask.shape[0]+min(dy,0), max(dx,0):mask.shape[1]+min(dx,0)] |= \
+                                mask[max(-dy,0):mask.shape[0]-max(dy,0), max(-dx,0):mask.shape[1]-max(dx,0)]
+                mask = grown
+            return mask
+        inner = lsst.afw.detection.Footprint(
+            geom.ellipses.Ellipse(geom.ellipses.Axes(6.0, 4.0, 0.3), self.center)
+            )
+        ellipse = geom.ellipses.Ellipse(geom.ellipses.Axes(12.0, 3.0, -0.4), self.center)
+        image = self.mi.getImage()
+        for grow in (0, 3):
+            expected = rasterize(inner, grow) | rasterize(lsst.afw.detection.Footprint(ellipse))
+            inputs = ms.ModelInputHandler(image, self.center, [ellipse], inner, grow)
+            self.assertEqual(inputs.getSize(), expected.sum())
+            self.assertTrue((rasterize(inputs.getFootprint()) == expected).all())
+        distant = geom.ellipses.Ellipse(geom.ellipses.Axes(3.0, 3.0, 0.0),
+                                        self.center + geom.Extent2D(25.0, 0.0))
+        self.assertRaises(lsst.pex.exceptions.LsstCppException, ms.ModelInputHandler,
+                          image, self.center, [distant], inner, 0)
+
+    def testExpDev(self):
+        psf = lsst.afw.detection.createPsf("DoubleGaussian", 19, 19, 1.5, 3.0, 0.1)
+        exposure = lsst.afw.image.ExposureF(self.mi)
+        exposure.setPsf(psf)
+        psfCtrl = ms.FitPsfControl()
+        # With no footprint growth or radius-based expansion, the joint fit's union of regions is just
+        # the footprint, so it should reproduce fits done separately on the same pixels.
+        badMaskPlanes = ["EDGE", "SAT", "BAD"]
+        config = ms.FitExpDevConfig()
+        config.badMaskPlanes = badMaskPlanes
+        config.growFootprint = 0
+        config.radiusInputFactor = 0.0
+        ctrl = config.makeControl()
+        self.assertEqual(ctrl.exp.profile, "tractor-exponential")
+        self.assertEqual(ctrl.dev.profile, "tractor-devaucouleur")
+        separateCtrls = []
+        for componentConfig, name in [(ms.FitExponentialConfig(), ctrl.expName),
+                                      (ms.FitDeVaucouleurConfig(), ctrl.devName)]:
+            componentConfig.name = name
+            componentConfig.badMaskPlanes = badMaskPlanes
+            componentConfig.growFootprint = 0
+            componentConfig.radiusInputFactor = 0.0
+            separateCtrls.append(componentConfig.makeControl())
+        comboCtrl = ms.FitComboControl()
+        comboCtrl.name = ctrl.comboName
+        comboCtrl.badMaskPlanes = badMaskPlanes
+        comboCtrl.growFootprint = 0
+        comboCtrl.radiusInputFactor = 0.0
+        # one record measured with multishapelet.expdev, one with exp, dev, and combo run separately
+        records = []
+        for joint in (True, False):
+            schema = lsst.afw.table.SourceTable.makeMinimalSchema()
+            shapeKey = schema.addField("shape", type="MomentsD", doc="initial shape")
+            schema.addField("shape.flags", type="Flag", doc="initial shape failure flag")
+            others = lsst.meas.algorithms.AlgorithmMap()
+            psfAlg = psfCtrl.makeAlgorithm(schema)
+            others[psfCtrl.name] = psfAlg
+            if joint:
+                algorithms = [ctrl.makeAlgorithm(schema, None, others, False)]
+            else:
+                algorithms = []
+                for componentCtrl in separateCtrls:
+                    algorithms.append(componentCtrl.makeAlgorithm(schema, None, others, False))
+                    others[componentCtrl.name] = algorithms[-1]
+                algorithms.append(comboCtrl.makeAlgorithm(schema, None, others))
+            table = lsst.afw.table.SourceTable.make(schema)
+            table.defineShape("shape")
+            record = table.makeRecord()
+            record.setFootprint(self.footprint)
+            record.set(shapeKey, geom.ellipses.Quadrupole(self.ellipse.getCore()))
+            psfAlg.fit(record, psf, self.center)
+            for alg in algorithms:
+                lsst.meas.algorithms.Algorithm.apply(alg, record, exposure, self.center)
+            records.append(record)
+        jointRecord, separateRecord = records
+        for name in (ctrl.expName, ctrl.devName):
+            self.assertEqual(jointRecord.get(name + ".flux.flags"), separateRecord.get(name + ".flux.flags"))
+            self.assertClose(jointRecord.get(name + ".flux"), separateRecord.get(name + ".flux"),
+                             rtol=1E-10, atol=0.0)
+            self.assertClose(jointRecord.get(name + ".flux.err"), separateRecord.get(name + ".flux.err"),
+                             rtol=1E-10, atol=0.0)
+            self.assertClose(jointRecord.get(name + ".ellipse").getParameterVector(),
+                             separateRecord.get(name + ".ellipse").getParameterVector(),
+                             rtol=1E-10, atol=1E-12)
+        name = ctrl.comboName
+        self.assertEqual(jointRecord.get(name + ".flux.flags"), separateRecord.get(name + ".flux.flags"))
+        if not jointRecord.get(name + ".flux.flags"):
+            self.assertClose(jointRecord.get(name + ".flux"), separateRecord.get(name + ".flux"),
+                             rtol=1E-10, atol=0.0)
+            self.assertClose(jointRecord.get(name + ".devfrac"), separateRecord.get(name + ".devfrac"),
+                             rtol=1E-6, atol=1E-7)
 
     def tearDown(self):
         del self.ellipse
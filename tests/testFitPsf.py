@@ -37,10 +37,13 @@ import numpy
 
 import lsst.utils.tests as utilsTests
 import lsst.pex.exceptions
+import lsst.daf.base
 import lsst.afw.geom as geom
 import lsst.afw.geom.ellipses as ellipses
 import lsst.afw.image
+import lsst.afw.math
 import lsst.afw.detection
+import lsst.afw.table
 import lsst.meas.extensions.multiShapelet as ms
 
 numpy.random.seed(5)
@@ -103,6 +106,144 @@ class FitPsfTestCase(unittest.TestCase):
                 parameters[i,j] += eps
             self.assertClose(d0, d1, rtol=1E-10, atol=1E-8)
 
+    def testChiSq(self):
+        # chisq should be the explicitly-summed residual of the final model, per degree of freedom
+        psf = lsst.afw.detection.createPsf("DoubleGaussian", 19, 19, 1.5, 3.0, 0.1)
+        ctrl = ms.FitPsfControl()
+        array = psf.computeImage(geom.Point2D(130.0, 275.0)).getArray()
+        image = lsst.afw.image.ImageD(array.shape[1], array.shape[0])
+        image.getArray()[:,:] = array / array.sum()
+        center = geom.Point2D(array.shape[1] // 2, array.shape[0] // 2)
+        inputs = ms.ModelInputHandler(image, center, image.getBBox(lsst.afw.image.PARENT))
+        model = ms.FitPsfAlgorithm.apply(ctrl, inputs)
+        image2 = lsst.afw.image.ImageD(array.shape[1], array.shape[0])
+        model.asMultiShapelet(center).evaluate().addToImage(image2)
+        residual = image2.getArray() - image.getArray()
+        nCoeffs = len(model.inner) + len(model.outer)
+        self.assertClose(model.chisq * (inputs.getSize() - nCoeffs), (residual**2).sum(), rtol=1E-8, atol=0.0)
+
+    def testArrayBatch(self):
+        psf = lsst.afw.detection.createPsf("DoubleGaussian", 19, 19, 1.5, 3.0, 0.1)
+        ctrl = ms.FitPsfControl()
+        centers = numpy.array([[130.0, 275.0], [20.5, 30.25], [300.0, 10.0]])
+        output = ms.makePsfBatchArray(ctrl, len(centers))
+        self.assertEqual(output.itemsize, 8 * ms.ArrayBatch.getPsfColumnCount(ctrl))
+        ms.fitPsfArrays(ctrl, psf, centers, output, 2)
+        for row, (x, y) in zip(output, centers):
+            model = ms.FitPsfAlgorithm.apply(ctrl, psf, geom.Point2D(x, y))
+            self.assertEqual(row["flag"], 0.0)
+            self.assertClose([row["ixx"], row["iyy"], row["ixy"]],
+                             [model.ellipse.getIxx(), model.ellipse.getIyy(), model.ellipse.getIxy()])
+            self.assertClose(row["inner"], model.inner)
+            self.assertClose(row["outer"], model.outer)
+            self.assertClose(row["chisq"], model.chisq)
+        self.assertRaises(lsst.pex.exceptions.LsstCppException,
+                          ms.ArrayBatch.fitPsf, ctrl, psf, centers, numpy.zeros((3, 2), dtype=float))
+        # a structured array with 8-byte records that are not all float64 must not be reinterpreted
+        names = output.dtype.names
+        mixed = numpy.zeros(len(centers), dtype=[(names[0], numpy.int64)]
+                            + [(name, output.dtype.fields[name][0]) for name in names[1:]])
+        self.assertEqual(mixed.dtype.itemsize, output.dtype.itemsize)
+        self.assertRaises(TypeError, ms.fitPsfArrays, ctrl, psf, centers, mixed)
+
+    def testBatch(self):
+        psf = lsst.afw.detection.createPsf("DoubleGaussian", 19, 19, 1.5, 3.0, 0.1)
+        ctrl = ms.FitPsfControl()
+        centers = [geom.Point2D(x, y) for x, y in numpy.random.rand(20, 2) * 400.0]
+        expected = [ms.FitPsfAlgorithm.apply(ctrl, psf, center) for center in centers]
+        for nThreads in (1, 4):
+            models = ms.FitPsfAlgorithm.applyBatch(ctrl, psf, centers, nThreads)
+            self.assertEqual(len(models), len(centers))
+            # the fits are independent, so the thread count must not affect the outcome at all
+            for model, direct in zip(models, expected):
+                self.assertFalse(model.hasFailed())
+                self.assertClose(model.ellipse.getParameterVector(), direct.ellipse.getParameterVector(),
+                                 rtol=0.0, atol=0.0)
+                self.assertClose(model.inner, direct.inner, rtol=0.0, atol=0.0)
+                self.assertClose(model.outer, direct.outer, rtol=0.0, atol=0.0)
+                self.assertEqual(model.chisq, direct.chisq)
+
+    def testCache(self):
+        # A Gaussian PSF whose width grows by 0.1 pixels per 100 in x and y, so the cached models at the
+        # grid points differ from each other and from fits at the source positions by a few percent.
+        kernel = lsst.afw.math.AnalyticKernel(19, 19, lsst.afw.math.GaussianFunction2D(1.0, 1.0, 0.0),
+                                              lsst.afw.math.PolynomialFunction2D(1))
+        kernel.setSpatialParameters([[1.5, 1E-3, 1E-3], [1.5, 1E-3, 1E-3], [0.0, 0.0, 0.0]])
+        psf = lsst.afw.detection.KernelPsf(kernel)
+        ctrl = ms.FitPsfControl()
+        ctrl.cacheSpacing = 100.0
+        # each is 50-80 pixels in x+y from its nearest grid point
+        centers = [geom.Point2D(130.0, 220.0), geom.Point2D(240.0, 140.0), geom.Point2D(330.0, 330.0)]
+        for interpolate in (False, True):
+            ctrl.cacheInterpolate = interpolate
+            schema = lsst.afw.table.SourceTable.makeMinimalSchema()
+            alg = ctrl.makeAlgorithm(schema)
+            table = lsst.afw.table.SourceTable.make(schema)
+            for center in centers:
+                direct = table.makeRecord()
+                m0 = alg.fit(direct, psf, center)
+                self.assertFalse(direct.get("multishapelet.psf.flags.cached"))
+                record = table.makeRecord()
+                m1 = alg.fitCached(record, psf, center)
+                self.assertTrue(record.get("multishapelet.psf.flags.cached"))
+                i = int(numpy.floor(center.getX() / ctrl.cacheSpacing + 0.5))
+                j = int(numpy.floor(center.getY() / ctrl.cacheSpacing + 0.5))
+                node = geom.Point2D(i * ctrl.cacheSpacing, j * ctrl.cacheSpacing)
+                self.assertClose(record.get("multishapelet.psf.cache.distance"),
+                                 ((center.getX() - node.getX())**2 + (center.getY() - node.getY())**2)**0.5)
+                moments0 = m0.ellipse.getParameterVector()
+                moments1 = m1.ellipse.getParameterVector()
+                if interpolate:
+                    # Bilinear interpolation of moments that vary quadratically across a 100-pixel cell
+                    # is good to ~0.1%; we require 0.5%, while the nearest node is off by several percent.
+                    self.assertClose(moments1, moments0, rtol=5E-3, atol=1E-4)
+                    self.assertClose(m1.inner[0], m0.inner[0], rtol=5E-3)
+                else:
+                    self.assert_(abs(m1.ellipse.getIxx() / m0.ellipse.getIxx() - 1.0) > 2E-2)
+                    nodeModel = alg.fit(table.makeRecord(), psf, node)
+                    self.assertClose(m1.inner, nodeModel.inner, rtol=0.0, atol=0.0)
+                    self.assertClose(moments1, nodeModel.ellipse.getParameterVector(), rtol=0.0, atol=0.0)
+
+    def testInitialMoments(self):
+        # A PSF much larger than the default initial circle; starting from its deconvolved adaptive
+        # moments should reach the same fit in no more steps.
+        psf = lsst.afw.detection.createPsf("DoubleGaussian", 41, 41, 4.0, 8.0, 0.1)
+        center = geom.Point2D(130.0, 275.0)
+        ctrl = ms.FitPsfControl()
+        m0 = ms.FitPsfAlgorithm.apply(ctrl, psf, center)
+        ctrl.initialMoments = True
+        m1 = ms.FitPsfAlgorithm.apply(ctrl, psf, center)
+        self.assertClose(m0.ellipse.getParameterVector(), m1.ellipse.getParameterVector(), rtol=1E-4)
+        self.assertClose(m0.inner, m1.inner, rtol=1E-4, atol=1E-6)
+        self.assert_(m1.stats.steps <= m0.stats.steps)
+
+    def testInstrumentation(self):
+        psf = lsst.afw.detection.createPsf("DoubleGaussian", 19, 19, 1.5, 3.0, 0.1)
+        ctrl = ms.FitPsfControl()
+        ctrl.instrument = True
+        schema = lsst.afw.table.SourceTable.makeMinimalSchema()
+        metadata = lsst.daf.base.PropertyList()
+        alg = ctrl.makeAlgorithm(schema, metadata)
+        table = lsst.afw.table.SourceTable.make(schema)
+        steps = 0
+        for center in (geom.Point2D(130.0, 275.0), geom.Point2D(20.0, 30.0)):
+            record = table.makeRecord()
+            model = alg.fit(record, psf, center)
+            self.assert_(model.stats.steps > 0)
+            self.assert_(model.stats.evaluations > 0)
+            self.assertEqual(record.get("multishapelet.psf.nsteps"), model.stats.steps)
+            self.assert_(record.get("multishapelet.psf.time.fit") >= 0.0)
+            steps += model.stats.steps
+        # the summary is only written to the metadata on request (or when the algorithm is destroyed)
+        self.assertFalse(metadata.exists("multishapelet.psf.summary.nsources"))
+        alg.flushStatistics()
+        self.assertEqual(metadata.get("multishapelet.psf.summary.nsources"), 2)
+        self.assertEqual(metadata.get("multishapelet.psf.summary.nsteps.total"), steps)
+        record = table.makeRecord()
+        alg.fit(record, psf, geom.Point2D(50.0, 60.0))
+        del alg
+        self.assertEqual(metadata.get("multishapelet.psf.summary.nsources"), 3)
+
 #-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
 
 def suite():
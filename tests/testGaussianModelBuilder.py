@@ -176,6 +176,100 @@ class GaussianModelBuilderTestCase(unittest.TestCase):
         # no hard requirement for tolerances here, but I've dialed them to the max to avoid regressions
         self.assertClose(a, n, rtol=1E-15, atol=1E-9)
 
+    def testApproximateExp(self):
+        amplitude = 3.2
+        radius = 2.7
+        psfEllipse = ellipses.Quadrupole(2.3, 1.8, 0.6)
+        psfAmplitude = 5.3
+        exact = ms.GaussianModelBuilder(self.x, self.y, amplitude, radius, psfEllipse, psfAmplitude, False)
+        approx = ms.GaussianModelBuilder(self.x, self.y, amplitude, radius, psfEllipse, psfAmplitude, True)
+        exact.update(self.ellipse)
+        approx.update(self.ellipse)
+        # the documented guarantee is ~1E-4; the single-precision kernel should do much better
+        self.assertClose(exact.getModel(), approx.getModel(), rtol=1E-5, atol=1E-12)
+        a0 = numpy.zeros((3, exact.getSize()), dtype=float).transpose()
+        a1 = numpy.zeros((3, approx.getSize()), dtype=float).transpose()
+        exact.computeDerivative(a0)
+        approx.computeDerivative(a1)
+        self.assertClose(a0, a1, rtol=1E-5, atol=1E-12)
+
+    def testSpans(self):
+        amplitude = 3.2
+        radius = 2.7
+        psfEllipse = ellipses.Quadrupole(2.3, 1.8, 0.6)
+        psfAmplitude = 5.3
+        center = geom.Point2D(2.3, -1.6)
+        footprint = lsst.afw.detection.Footprint(ellipses.Ellipse(ellipses.Axes(30, 18, 0.4), center))
+        image = lsst.afw.image.ImageD(footprint.getBBox())
+        inputs = ms.ModelInputHandler(image, center, footprint)
+        b0 = ms.GaussianModelBuilder(inputs.getX(), inputs.getY(), amplitude, radius, psfEllipse, psfAmplitude)
+        b1 = ms.GaussianModelBuilder(inputs.getSpans(), amplitude, radius, psfEllipse, psfAmplitude)
+        self.assertEqual(b0.getSize(), b1.getSize())
+        b0.update(self.ellipse)
+        b1.update(self.ellipse)
+        self.assertClose(b0.getModel(), b1.getModel(), rtol=1E-12, atol=1E-14)
+        a0 = numpy.zeros((3, b0.getSize()), dtype=float).transpose()
+        a1 = numpy.zeros((3, b1.getSize()), dtype=float).transpose()
+        b0.computeDerivative(a0)
+        b1.computeDerivative(a1)
+        self.assertClose(a0, a1, rtol=1E-12, atol=1E-14)
+
+    def testSinglePrecisionTile(self):
+        psfEllipse = ellipses.Quadrupole(2.3, 1.8, 0.6)
+        center = geom.Point2D(2.3, -1.6)
+        footprint = lsst.afw.detection.Footprint(ellipses.Ellipse(ellipses.Axes(30, 18, 0.4), center))
+        image = lsst.afw.image.ImageD(footprint.getBBox())
+        inputs = ms.ModelInputHandler(image, center, footprint)
+        builder = ms.GaussianModelBuilder(inputs.getSpans(), 3.2, 2.7, psfEllipse, 5.3)
+        builder.updateEllipse(self.ellipse)
+        begin = 100
+        end = builder.getSize() - 100
+        for dtype in (numpy.float32, numpy.float64):
+            m = numpy.zeros(end - begin, dtype=dtype)
+            d = numpy.zeros((3, end - begin), dtype=dtype).transpose()
+            builder.addTileModelAndDerivative(begin, end, m, d)
+            if dtype == numpy.float64:
+                self.assertClose(m, m32, rtol=1E-5, atol=1E-7 * m.max())
+                self.assertClose(d, d32, rtol=1E-5, atol=1E-7 * numpy.abs(d).max())
+            else:
+                m32, d32 = m, d
+        # the double tile should match the full-size model
+        builder.update(self.ellipse)
+        self.assertClose(builder.getModel()[begin:end], m, rtol=1E-12, atol=1E-14)
+
+    def testCulling(self):
+        nSigma = 3.0
+        psfEllipse = ellipses.Quadrupole(2.3, 1.8, 0.6)
+        center = geom.Point2D(2.3, -1.6)
+        footprint = lsst.afw.detection.Footprint(ellipses.Ellipse(ellipses.Axes(30, 18, 0.4), center))
+        image = lsst.afw.image.ImageD(footprint.getBBox())
+        inputs = ms.ModelInputHandler(image, center, footprint)
+        b0 = ms.GaussianModelBuilder(inputs.getSpans(), 3.2, 0.5, psfEllipse, 5.3)
+        b1 = ms.GaussianModelBuilder(inputs.getSpans(), 3.2, 0.5, psfEllipse, 5.3)
+        b1.setCullRadius(nSigma)
+        self.assertEqual(b1.getCullRadius(), nSigma)
+        b0.update(self.ellipse)
+        b1.update(self.ellipse)
+        m0 = b0.getModel()
+        m1 = b1.getModel()
+        culled = (m1 == 0.0)
+        self.assert_(culled.sum() > 0)
+        self.assertClose(m0[~culled], m1[~culled], rtol=1E-12, atol=1E-14)
+        # culled pixels are all outside the n-sigma ellipse, where the Gaussian is below its peak
+        # times exp(-n^2/2) (the brightest pixel is slightly off-center)
+        self.assert_((m0[culled] <= m0.max() * numpy.exp(-0.5 * nSigma**2) * 1.01).all())
+        a0 = numpy.zeros((3, b0.getSize()), dtype=float).transpose()
+        a1 = numpy.zeros((3, b1.getSize()), dtype=float).transpose()
+        b0.computeDerivative(a0)
+        b1.computeDerivative(a1)
+        self.assertClose(a0[~culled], a1[~culled], rtol=1E-12, atol=1E-14)
+        self.assert_((a1[culled] == 0.0).all())
+        b1.setCullRadius(0.0)
+        b1.update(self.ellipse)
+        self.assertClose(b0.getModel(), b1.getModel(), rtol=1E-12, atol=1E-14)
+        b2 = ms.GaussianModelBuilder(inputs.getX(), inputs.getY(), 3.2, 0.5, psfEllipse, 5.3)
+        self.assertRaises(lsst.pex.exceptions.LsstCppException, b2.setCullRadius, nSigma)
+
 
 #-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
 
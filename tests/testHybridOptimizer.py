@@ -70,6 +70,9 @@ class HybridOptimizerTestCase(unittest.TestCase):
                 if state & ms.HybridOptimizer.FINISHED:
                     break
             final = opt.getParameters()
+            self.assertEqual(opt.getStepCount(), k + 1)
+            self.assert_(opt.getEvaluationCount() <= opt.getStepCount() + 1)
+            self.assert_(opt.getMethodSwitchCount() <= opt.getStepCount())
             dx = ((final - numpy.array([1.0, 1.0], dtype=float))**2).sum()**0.5
             if lambda_ <= 1.0:
                 self.assert_(state & ms.HybridOptimizer.SUCCESS)
@@ -77,6 +80,111 @@ class HybridOptimizerTestCase(unittest.TestCase):
                 self.assert_(numpy.abs(numpy.max(opt.getFunction())) <= ctrl.fTol)
             self.assert_(dx <= 1E-4)
 
+    def testExtendedRosenbrock(self):
+        ctrl = ms.HybridOptimizerControl()
+        ctrl.fTol = 1E-10
+        ctrl.gTol = 1E-10
+        ctrl.minStep = 1E-14
+        ctrl.maxIter = 200
+        ctrl.tau = 1E-3
+        initial = numpy.array([-1.2, 1.0, 3.0], dtype=float)
+        for lambda_ in (0.0, 1E-5, 1.0):
+            obj = testLib.ExtendedRosenbrockObjective(lambda_)
+            opt = ms.HybridOptimizer(obj, initial, ctrl)
+            state = opt.run()
+            self.assert_(state & ms.HybridOptimizer.SUCCESS)
+            final = opt.getParameters()
+            dx = ((final - numpy.array([1.0, 1.0, 1.0], dtype=float))**2).sum()**0.5
+            self.assert_(dx <= 1E-4)
+            # accepted steps swap buffers; make sure the current function still matches the parameters
+            f = numpy.zeros(obj.getFunctionSize(), dtype=float)
+            obj.computeFunction(final, f)
+            self.assertClose(opt.getFunction(), f, rtol=0.0, atol=1E-14)
+            self.assertClose(opt.getChiSq(), (f**2).sum(), rtol=1E-14, atol=1E-28)
+
+    def testLazyDerivative(self):
+        ctrl = ms.HybridOptimizerControl()
+        ctrl.fTol = 1E-10
+        ctrl.gTol = 1E-10
+        ctrl.minStep = 1E-14
+        ctrl.maxIter = 200
+        initial = numpy.array([-1.2, 1.0, 3.0], dtype=float)
+        for lambda_ in (0.0, 1.0):
+            opt = ms.HybridOptimizer(testLib.ExtendedRosenbrockObjective(lambda_), initial, ctrl)
+            opt.run()
+            self.assertEqual(opt.getDerivativeCount(), opt.getEvaluationCount())
+            ctrl.lazyDerivative = True
+            lazy = ms.HybridOptimizer(testLib.ExtendedRosenbrockObjective(lambda_), initial, ctrl)
+            state = lazy.run()
+            ctrl.lazyDerivative = False
+            self.assert_(state & ms.HybridOptimizer.SUCCESS)
+            self.assert_(lazy.getDerivativeCount() < lazy.getEvaluationCount())
+            self.assertClose(lazy.getParameters(), opt.getParameters(), rtol=0.0, atol=1E-6)
+
+    def testWarmStart(self):
+        ctrl = ms.HybridOptimizerControl()
+        ctrl.fTol = 1E-10
+        ctrl.gTol = 1E-10
+        ctrl.minStep = 1E-14
+        ctrl.maxIter = 200
+        obj = testLib.ExtendedRosenbrockObjective(1.0)
+        opt = ms.HybridOptimizer(obj, numpy.array([-1.2, 1.0, 3.0], dtype=float), ctrl)
+        opt.run()
+        warmStart = opt.getWarmStart()
+        self.assertEqual(warmStart.hessian.shape, (3, 3))
+        self.assert_((warmStart.hessian == warmStart.hessian.transpose()).all())
+        self.assertEqual(warmStart.mu, opt.getMu())
+        initial = opt.getParameters() + numpy.array([0.01, -0.02, 0.05])
+        warm = ms.HybridOptimizer(testLib.ExtendedRosenbrockObjective(1.0), initial, ctrl, warmStart)
+        self.assertEqual(warm.getMu(), warmStart.mu)
+        self.assertEqual(warm.getMethod(), warmStart.method)
+        state = warm.run()
+        self.assert_(state & ms.HybridOptimizer.SUCCESS)
+        dx = ((warm.getParameters() - numpy.array([1.0, 1.0, 1.0], dtype=float))**2).sum()**0.5
+        self.assert_(dx <= 1E-4)
+        # a Hessian of the wrong size should be rejected
+        other = testLib.RosenbrockObjective(1.0)
+        self.assertRaises(lsst.pex.exceptions.LsstCppException, ms.HybridOptimizer, other,
+                          numpy.array([-1.2, 1.0], dtype=float), ctrl, warmStart)
+
+    def testNoiseStopping(self):
+        ctrl = ms.HybridOptimizerControl()
+        ctrl.fTol = 1E-10
+        ctrl.gTol = 1E-10
+        ctrl.minStep = 1E-14
+        ctrl.maxIter = 200
+        initial = numpy.array([-1.2, 1.0, 3.0], dtype=float)
+        # lambda=1 leaves a residual chi^2 of 1 with a single degree of freedom
+        full = ms.HybridOptimizer(testLib.ExtendedRosenbrockObjective(1.0), initial, ctrl)
+        full.run()
+        ctrl.chiSqTol = 1E-3
+        opt = ms.HybridOptimizer(testLib.ExtendedRosenbrockObjective(1.0), initial, ctrl)
+        state = opt.run()
+        self.assert_(state & ms.HybridOptimizer.SUCCESS_CHISQ)
+        self.assert_(state & ms.HybridOptimizer.SUCCESS)
+        self.assert_(opt.getEvaluationCount() < full.getEvaluationCount())
+        # the same bound the optimizer tests: chiSqTol times the reduced chi^2 (3 parameters)
+        dof = testLib.ExtendedRosenbrockObjective(1.0).getFunctionSize() - 3
+        self.assert_(opt.getPredictedChiSqDecrease() < ctrl.chiSqTol * opt.getChiSq() / dof)
+        self.assertClose(opt.getParameters(), full.getParameters(), rtol=0.0, atol=0.05)
+        ctrl.chiSqTol = 0.0
+        ctrl.maxEvaluations = 10
+        limited = ms.HybridOptimizer(testLib.ExtendedRosenbrockObjective(1.0), initial, ctrl)
+        state = limited.run()
+        self.assert_(state & ms.HybridOptimizer.FAILURE_MAXITER)
+        self.assertEqual(limited.getEvaluationCount(), ctrl.maxEvaluations)
+        # the cap is never exceeded, whatever mix of accepted and rejected steps (and lazy derivatives)
+        # the optimizer takes before reaching it
+        for lazy in (False, True):
+            ctrl.lazyDerivative = lazy
+            for maxEvaluations in range(1, full.getEvaluationCount()):
+                ctrl.maxEvaluations = maxEvaluations
+                limited = ms.HybridOptimizer(testLib.RosenbrockObjective(1E2), initial[:2], ctrl)
+                state = limited.run()
+                self.assert_(limited.getEvaluationCount() <= maxEvaluations)
+                if state & ms.HybridOptimizer.FAILURE_MAXITER:
+                    self.assertEqual(limited.getEvaluationCount(), maxEvaluations)
+
 #-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
 
 def suite():
@@ -68,6 +68,7 @@ Various swigged-up C++ classes for testing
 %declareNumPyConverters(ndarray::Array<double,2,-2>);
 
 %shared_ptr(RosenbrockObjective);
+%shared_ptr(ExtendedRosenbrockObjective);
 
 %inline %{
 
@@ -103,4 +104,40 @@ Various swigged-up C++ classes for testing
         double _lambda;
     };
 
+    // Rosenbrock with an additional, decoupled linear parameter, to exercise the fixed-size
+    // 3-parameter code path in HybridOptimizer.
+    class ExtendedRosenbrockObjective : public lsst::meas::extensions::multiShapelet::Objective {
+    public:
+
+        explicit ExtendedRosenbrockObjective(double lambda_) : 
+            lsst::meas::extensions::multiShapelet::Objective(4, 3),
+            _lambda(lambda_)
+        {}
+
+        virtual void computeFunction(
+            ndarray::Array<double const,1,1> const & parameters, 
+            ndarray::Array<double,1,1> const & function
+        ) {
+            function[0] = 10.0 * (parameters[1] - parameters[0] * parameters[0]);
+            function[1] = 1.0 - parameters[0];
+            function[2] = _lambda;
+            function[3] = parameters[2] - 1.0;
+        }
+
+        virtual void computeDerivative(
+            ndarray::Array<double const,1,1> const & parameters, 
+            ndarray::Array<double const,1,1> const & function,
+            ndarray::Array<double,2,-2> const & derivative
+        ) {
+            derivative.deep() = 0.0;
+            derivative[0][0] = -20.0 * parameters[0];
+            derivative[0][1] = 10.0;
+            derivative[1][0] = -1.0;
+            derivative[3][2] = 1.0;
+        }
+
+    private:
+        double _lambda;
+    };
+
 %}
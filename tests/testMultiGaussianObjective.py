@@ -118,6 +118,11 @@ class MultiGaussianObjectiveTestCase(unittest.TestCase):
                 d1[:,j] = (f1a - f1b) / (2.0 * eps)
                 parameters[i,j] += eps
             self.assertClose(d0, d1, rtol=1E-10, atol=1E-8)
+            f2 = numpy.zeros(self.inputs.getSize(), dtype=float)
+            d2 = numpy.zeros((parameters.shape[1], self.inputs.getSize()), dtype=float).transpose()
+            obj.computeFunctionAndDerivative(parameters[i,:], f2, d2)
+            self.assertClose(f0, f2, rtol=1E-12, atol=1E-14)
+            self.assertClose(d0, d2, rtol=1E-12, atol=1E-14)
 
     def testUnconvolved(self):
         multiGaussian = ms.MultiGaussian()
@@ -125,7 +130,88 @@ class MultiGaussianObjectiveTestCase(unittest.TestCase):
         multiGaussian.add(ms.GaussianComponent(1.23, 1.32))
         multiGaussian.add(ms.GaussianComponent(0.67, 0.9))
         self.doTest(multiGaussian)
-        
+
+    def testStreaming(self):
+        # a footprint several tiles long, so the normal equations are accumulated over many tiles
+        bbox = geom.Box2I(geom.Point2I(-20, -15), geom.Extent2I(41, 33))
+        image = lsst.afw.image.ImageF(bbox)
+        x, y = numpy.meshgrid(
+            numpy.arange(bbox.getBeginX(), bbox.getEndX()),
+            numpy.arange(bbox.getBeginY(), bbox.getEndY())
+            )
+        image.getArray()[:,:] = numpy.exp(-((x / 1.5)**2 + y**2)**0.5 / 3.0)
+        inputs = ms.ModelInputHandler(image, geom.Point2D(0.0, 0.0), bbox)
+        multiGaussian = ms.MultiGaussian()
+        multiGaussian.add(ms.GaussianComponent(1.0, 1.0))
+        multiGaussian.add(ms.GaussianComponent(0.4, 2.5))
+        initial = numpy.array([0.1, -0.1, 1.0])
+        ctrl = ms.HybridOptimizerControl()
+        results = []
+        for streaming in (False, True):
+            obj = ms.MultiGaussianObjective(inputs, multiGaussian)
+            obj.setStreaming(streaming)
+            self.assertEqual(obj.hasNormalEquations(), streaming)
+            opt = ms.HybridOptimizer(obj, initial, ctrl)
+            self.assert_(opt.run() & ms.HybridOptimizer.SUCCESS)
+            self.assertEqual(opt.getFunction().size, 0 if streaming else inputs.getSize())
+            self.assertEqual(obj.getThreadsUsed(), 1)
+            results.append((opt.getParameters().copy(), opt.getChiSq(), obj.getAmplitude()))
+        self.assertClose(results[0][0], results[1][0], rtol=1E-5, atol=1E-6)
+        self.assertClose(results[0][1], results[1][1], rtol=1E-8)
+        self.assertClose(results[0][2], results[1][2], rtol=1E-6)
+        # intra-source threading must not change the results at all
+        for streaming in (False, True):
+            obj = ms.MultiGaussianObjective(inputs, multiGaussian)
+            obj.setStreaming(streaming)
+            obj.setThreads(3)
+            self.assertEqual(obj.getThreads(), 3)
+            opt = ms.HybridOptimizer(obj, initial, ctrl)
+            opt.run()
+            # make sure the evaluations really were split across threads
+            self.assertEqual(obj.getThreadsUsed(), 3)
+            self.assert_((opt.getParameters() == results[streaming][0]).all())
+            self.assertEqual(opt.getChiSq(), results[streaming][1])
+        # single-precision model evaluation should only perturb the fit at the float round-off level
+        obj = ms.MultiGaussianObjective(inputs, multiGaussian)
+        obj.setStreaming(True)
+        obj.setSinglePrecision(True)
+        self.assert_(obj.getSinglePrecision())
+        opt = ms.HybridOptimizer(obj, initial, ctrl)
+        self.assert_(opt.run() & ms.HybridOptimizer.SUCCESS)
+        self.assertClose(opt.getParameters(), results[1][0], rtol=1E-4, atol=1E-5)
+        self.assertClose(opt.getChiSq(), results[1][1], rtol=1E-5)
+        self.assertClose(obj.getAmplitude(), results[1][2], rtol=1E-5)
+
+    def testCulling(self):
+        bbox = geom.Box2I(geom.Point2I(-20, -15), geom.Extent2I(41, 33))
+        image = lsst.afw.image.ImageF(bbox)
+        x, y = numpy.meshgrid(
+            numpy.arange(bbox.getBeginX(), bbox.getEndX()),
+            numpy.arange(bbox.getBeginY(), bbox.getEndY())
+            )
+        image.getArray()[:,:] = numpy.exp(-((x / 1.5)**2 + y**2)**0.5 / 3.0)
+        inputs = ms.ModelInputHandler(image, geom.Point2D(0.0, 0.0), bbox)
+        multiGaussian = ms.MultiGaussian()
+        multiGaussian.add(ms.GaussianComponent(1.0, 1.0))
+        multiGaussian.add(ms.GaussianComponent(0.4, 2.5))
+        multiGaussian.add(ms.GaussianComponent(1E-5, 0.1))
+        initial = numpy.array([0.1, -0.1, 1.0])
+        ctrl = ms.HybridOptimizerControl()
+        results = []
+        for culling in (False, True):
+            obj = ms.MultiGaussianObjective(inputs, multiGaussian)
+            if culling:
+                obj.setCulling(5.0, 1E-4)
+                self.assertClose(obj.getApproximationError(),
+                                 (1E-5 + 1.4 * numpy.exp(-12.5)) / (1.4 + 1E-5), rtol=1E-10)
+            else:
+                self.assertEqual(obj.getApproximationError(), 0.0)
+            opt = ms.HybridOptimizer(obj, initial, ctrl)
+            self.assert_(opt.run() & ms.HybridOptimizer.SUCCESS)
+            results.append((opt.getParameters().copy(), opt.getChiSq()))
+        self.assertClose(results[0][0], results[1][0], rtol=1E-3, atol=1E-4)
+        self.assertClose(results[0][1], results[1][1], rtol=1E-3)
+
 
 #-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
 